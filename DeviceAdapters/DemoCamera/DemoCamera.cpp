@@ -255,6 +255,8 @@ CDemoCamera::CDemoCamera() :
    InitializeDefaultErrorMessages();
    readoutStartTime_ = GetCurrentMMTime();
    thd_ = new MySequenceThread(this);
+   for (int i = 0; i < SequenceImageCount; ++i)
+      freeSeqImages_.push_back(&seqImages_[i]);
 
    // parent ID display
    CreateHubIDProperty();
@@ -1085,48 +1087,99 @@ int CDemoCamera::StartSequenceAcquisition(long numImages, double interval_ms, bo
 }
 
 /*
- * Inserts Image and MetaData into MMCore circular Buffer
+ * Queues Image and MetaData for insertion into MMCore circular Buffer.
+ * img must not change until the Core releases it (see ReleaseSequenceImage).
  */
-int CDemoCamera::InsertImage()
+int CDemoCamera::InsertImage(const ImgBuffer& img)
 {
    MM::MMTime timeStamp = this->GetCurrentMMTime();
    char label[MM::MaxStrLength];
    this->GetLabel(label);
  
    // Important:  metadata about the image are generated here:
-   Metadata md;
-   md.put("Camera", label);
-   md.put(MM::g_Keyword_Elapsed_Time_ms, CDeviceUtils::ConvertToString((timeStamp - sequenceStartTime_).getMsec()));
-   md.put(MM::g_Keyword_Metadata_ROI_X, CDeviceUtils::ConvertToString( (long) roiX_)); 
-   md.put(MM::g_Keyword_Metadata_ROI_Y, CDeviceUtils::ConvertToString( (long) roiY_)); 
+   BinaryMetadata md;
+   md.PutImageTag("Camera", label);
+   md.PutImageTag(MM::g_Keyword_Elapsed_Time_ms, (timeStamp - sequenceStartTime_).getMsec());
+   md.PutImageTag(MM::g_Keyword_Metadata_ROI_X, (long) roiX_);
+   md.PutImageTag(MM::g_Keyword_Metadata_ROI_Y, (long) roiY_);
 
    imageCounter_++;
 
    char buf[MM::MaxStrLength];
    GetProperty(MM::g_Keyword_Binning, buf);
-   md.put(MM::g_Keyword_Binning, buf);
+   md.PutImageTag(MM::g_Keyword_Binning, buf);
 
-   MMThreadGuard g(imgPixelsLock_);
-
-   const unsigned char* pI;
-   pI = GetImageBuffer();
+   const unsigned char* pI = img.GetPixels();
+   unsigned int w = img.Width();
+   unsigned int h = img.Height();
+   unsigned int b = img.Depth();
 
-   unsigned int w = GetImageWidth();
-   unsigned int h = GetImageHeight();
-   unsigned int b = GetImageBytesPerPixel();
-
-   int ret = GetCoreCallback()->InsertImage(this, pI, w, h, b, nComponents_, md.Serialize().c_str());
+   const unsigned char* mdRecords = md.GetRecords();
+   unsigned mdSize = (unsigned) md.GetRecordsSize();
+   int ret = GetCoreCallback()->InsertImageAsync(this, pI, w, h, b, nComponents_,
+         mdRecords, mdSize, &CDemoCamera::ReleaseSequenceImage, this);
    if (!stopOnOverflow_ && ret == DEVICE_BUFFER_OVERFLOW)
    {
-      // do not stop on overflow - just reset the buffer
+      // do not stop on overflow - just reset the buffer and insert again
       GetCoreCallback()->ClearImageBuffer(this);
-      // don't process this same image again...
-      return GetCoreCallback()->InsertImage(this, pI, w, h, b, nComponents_, md.Serialize().c_str(), false);
+      if (GetCoreCallback()->IsImageInsertQueueEnabled())
+      {
+         // the overflow was reported for an earlier image; this one was
+         // not taken
+         ret = GetCoreCallback()->InsertImageAsync(this, pI, w, h, b, nComponents_,
+               mdRecords, mdSize, &CDemoCamera::ReleaseSequenceImage, this);
+      }
+      else
+      {
+         // this image has already been processed
+         ret = GetCoreCallback()->InsertImage(this, pI, w, h, b, nComponents_,
+               mdRecords, mdSize, false);
+         if (ret == DEVICE_OK)
+         {
+            ReleaseSequenceImage(this, pI);
+            return DEVICE_OK;
+         }
+      }
    }
-   else
+   // Not taken, so the Core will not release it
+   if (ret != DEVICE_OK)
+      ReleaseSequenceImage(this, pI);
+   return ret;
+}
+
+/*
+ * Waits for a free sequence image and sizes it like img_
+ */
+ImgBuffer* CDemoCamera::AcquireSequenceImage()
+{
+   ImgBuffer* img;
    {
-      return ret;
+      std::unique_lock<std::mutex> lock(seqImagesMutex_);
+      seqImagesCV_.wait(lock, [this] { return !freeSeqImages_.empty(); });
+      img = freeSeqImages_.back();
+      freeSeqImages_.pop_back();
+   }
+   img->Resize(img_.Width(), img_.Height(), img_.Depth());
+   return img;
+}
+
+/*
+ * Called by the Core (on any thread) once it has inserted a queued image
+ */
+void CDemoCamera::ReleaseSequenceImage(void* context, const unsigned char* pixels)
+{
+   CDemoCamera* camera = static_cast<CDemoCamera*>(context);
+   std::lock_guard<std::mutex> lock(camera->seqImagesMutex_);
+   for (int i = 0; i < SequenceImageCount; ++i)
+   {
+      if (camera->seqImages_[i].GetPixels() == pixels)
+      {
+         camera->freeSeqImages_.push_back(&camera->seqImages_[i]);
+         camera->seqImagesCV_.notify_one();
+         return;
+      }
    }
+   // Otherwise img_, queued as is in fast image mode
 }
 
 /*
@@ -1149,9 +1202,12 @@ int CDemoCamera::RunSequenceOnThread()
 
    double exposure = GetSequenceExposure();
 
+   // In fast image mode, img_ is not regenerated and can be queued as is
+   ImgBuffer* img = &img_;
    if (!fastImage_)
    {
-      GenerateSyntheticImage(img_, exposure);
+      img = AcquireSequenceImage();
+      GenerateSyntheticImage(*img, exposure);
    }
 
    // Simulate exposure duration
@@ -1160,7 +1216,7 @@ int CDemoCamera::RunSequenceOnThread()
       CDeviceUtils::SleepMs(1);
    }
 
-   ret = InsertImage();
+   ret = InsertImage(*img);
 
    if (ret != DEVICE_OK)
    {
@@ -4926,7 +4982,27 @@ int MedianFilter::Initialize()
 {
     CPropertyAction* pAct = new CPropertyAction (this, &MedianFilter::OnPerformanceTiming);
     (void)CreateFloatProperty("PeformanceTiming (microseconds)", 0, true, pAct);
-    (void)CreateStringProperty("BEWARE", "THIS FILTER MODIFIES DATA, EACH PIXEL IS REPLACED BY 3X3 NEIGHBORHOOD MEDIAN", true);
+    (void)CreateStringProperty("BEWARE", "THIS FILTER MODIFIES DATA, EACH PIXEL IS REPLACED BY A RANK (DEFAULT: MEDIAN) OF ITS NEIGHBORHOOD", true);
+
+    pAct = new CPropertyAction (this, &MedianFilter::OnWindowSize);
+    int nRet = CreateIntegerProperty("Window Size", filter_.GetWindowSize(), false, pAct);
+    if (nRet != DEVICE_OK)
+       return nRet;
+    for (int size = 3; size <= RankFilter::MaxWindowSize; size += 2)
+       AddAllowedValue("Window Size", CDeviceUtils::ConvertToString(size));
+
+    // 0 is a minimum (erosion) filter, 50 the median, 100 a maximum (dilation)
+    pAct = new CPropertyAction (this, &MedianFilter::OnRank);
+    nRet = CreateIntegerProperty("Rank (percent)", filter_.GetRankPercent(), false, pAct);
+    if (nRet != DEVICE_OK)
+       return nRet;
+    SetPropertyLimits("Rank (percent)", 0, 100);
+
+    pAct = new CPropertyAction (this, &MedianFilter::OnThreads);
+    nRet = CreateIntegerProperty("Threads", filter_.GetThreadCount(), false, pAct);
+    if (nRet != DEVICE_OK)
+       return nRet;
+    SetPropertyLimits("Threads", 1, 64);
    return DEVICE_OK;
 }
 
@@ -4947,6 +5023,57 @@ int MedianFilter::OnPerformanceTiming(MM::PropertyBase* pProp, MM::ActionType eA
    return DEVICE_OK;
 }
 
+int MedianFilter::OnWindowSize(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set((long)filter_.GetWindowSize());
+   }
+   else if (eAct == MM::AfterSet)
+   {
+      if (busy_)
+         return DEVICE_CAMERA_BUSY_ACQUIRING;
+      long size;
+      pProp->Get(size);
+      filter_.SetWindowSize((int)size);
+   }
+   return DEVICE_OK;
+}
+
+int MedianFilter::OnRank(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set((long)filter_.GetRankPercent());
+   }
+   else if (eAct == MM::AfterSet)
+   {
+      if (busy_)
+         return DEVICE_CAMERA_BUSY_ACQUIRING;
+      long percent;
+      pProp->Get(percent);
+      filter_.SetRankPercent((int)percent);
+   }
+   return DEVICE_OK;
+}
+
+int MedianFilter::OnThreads(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set((long)filter_.GetThreadCount());
+   }
+   else if (eAct == MM::AfterSet)
+   {
+      if (busy_)
+         return DEVICE_CAMERA_BUSY_ACQUIRING;
+      long threads;
+      pProp->Get(threads);
+      filter_.SetThreadCount((unsigned)threads);
+   }
+   return DEVICE_OK;
+}
+
 
 int MedianFilter::Process(unsigned char *pBuffer, unsigned int width, unsigned int height, unsigned int byteDepth)
 {
@@ -4960,21 +5087,21 @@ int MedianFilter::Process(unsigned char *pBuffer, unsigned int width, unsigned i
    MM::MMTime  s0 = GetCurrentMMTime();
 
 
-   if( sizeof(unsigned char) == byteDepth)
+   if( sizeof(uint8_t) == byteDepth)
    {
-      ret = Filter( (unsigned char*)pBuffer, width, height);
+      filter_.Apply( (uint8_t*)pBuffer, width, height);
    }
-   else if( sizeof(unsigned short) == byteDepth)
+   else if( sizeof(uint16_t) == byteDepth)
    {
-      ret = Filter( (unsigned short*)pBuffer, width, height);
+      filter_.Apply( (uint16_t*)pBuffer, width, height);
    }
-   else if( sizeof(unsigned long) == byteDepth)
+   else if( sizeof(uint32_t) == byteDepth)
    {
-      ret = Filter( (unsigned long*)pBuffer, width, height);
+      filter_.Apply( (uint32_t*)pBuffer, width, height);
    }
-   else if( sizeof(unsigned long long) == byteDepth)
+   else if( sizeof(uint64_t) == byteDepth)
    {
-      ret =  Filter( (unsigned long long*)pBuffer, width, height);
+      filter_.Apply( (uint64_t*)pBuffer, width, height);
    }
    else
    {
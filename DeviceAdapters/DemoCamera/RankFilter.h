@@ -0,0 +1,571 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          RankFilter.h
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     DeviceAdapters
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Median and other rank filters over square windows, used by
+//                the MedianFilter image processor.
+//
+// COPYRIGHT:     University of California, San Francisco, 2006-2015
+//
+// LICENSE:       This file is distributed under the BSD license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#ifndef _RANKFILTER_H_
+#define _RANKFILTER_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <stdint.h>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RANKFILTER_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define RANKFILTER_NEON
+#include <arm_neon.h>
+#endif
+
+
+//////////////////////////////////////////////////////////////////////////////
+// RankFilter class
+// Replaces each pixel by the value of a given rank (e.g. the median) among
+// the pixels of the window centered on it. Pixels beyond the image edges are
+// copies of the nearest edge pixel.
+//
+// 3x3 and 5x5 windows use a sorting network evaluated on many pixels at once
+// (SIMD for 8, 16 and 32 bits). Larger windows use a sliding histogram:
+// constant time per pixel for 8 bits (Perreault and Hebert, 2007),
+// proportional to the window width for 16 bits (Huang, 1979).
+// Larger windows on wider pixels use the 16-bit histograms when the image's
+// values span 16 bits or less, and otherwise select from the window contents.
+//
+// Rows are divided among threads. Not safe for concurrent use.
+//////////////////////////////////////////////////////////////////////////////
+class RankFilter
+{
+public:
+   RankFilter() :
+      size_(3),
+      percent_(50),
+      threads_(std::max(1u, std::thread::hardware_concurrency()))
+   {}
+
+   // Window width and height; odd, from 1 to MaxWindowSize
+   enum { MaxWindowSize = 31 };
+   void SetWindowSize(int size) { size_ = std::max(1, std::min(static_cast<int>(MaxWindowSize), size | 1)); }
+   int GetWindowSize() const { return size_; }
+
+   // Rank as a percentage of the window: 0 is the minimum, 50 the median,
+   // 100 the maximum
+   void SetRankPercent(int percent) { percent_ = std::max(0, std::min(100, percent)); }
+   int GetRankPercent() const { return percent_; }
+
+   void SetThreadCount(unsigned count) { threads_ = std::max(1u, count); }
+   unsigned GetThreadCount() const { return threads_; }
+
+   // Filters the image in place
+   template <typename PixelType>
+   void Apply(PixelType* pixels, unsigned width, unsigned height)
+   {
+      if (width == 0 || height == 0 || size_ == 1)
+         return;
+
+      // Wider pixels whose values span no more than 16 bits (such as 16-bit
+      // data in 32-bit frames) can use the 16-bit histograms
+      const size_t count = (size_t)width * height;
+      if (sizeof(PixelType) > 2 && size_ / 2 > MaxNetworkRadius)
+      {
+         const std::pair<PixelType*, PixelType*> range = std::minmax_element(pixels, pixels + count);
+         const PixelType lowest = *range.first;
+         if (*range.second - lowest <= 0xFFFF)
+         {
+            narrowed_.resize(count);
+            for (size_t i = 0; i < count; ++i)
+               narrowed_[i] = static_cast<uint16_t>(pixels[i] - lowest);
+            Filter(&narrowed_[0], width, height);
+            for (size_t i = 0; i < count; ++i)
+               pixels[i] = static_cast<PixelType>(lowest + narrowed_[i]);
+            return;
+         }
+      }
+      Filter(pixels, width, height);
+   }
+
+private:
+   typedef std::vector< std::pair<int, int> > Network;
+   enum { MaxNetworkRadius = 2 };
+
+   template <typename PixelType>
+   void Filter(PixelType* pixels, unsigned width, unsigned height)
+   {
+      const size_t bytes = sizeof(PixelType) * width * height;
+      if (result_.size() < bytes)
+         result_.resize(bytes);
+      PixelType* result = reinterpret_cast<PixelType*>(&result_[0]);
+
+      const int radius = size_ / 2;
+      const int rank = (percent_ * (size_ * size_ - 1) + 50) / 100;
+      Network network;
+      if (radius <= MaxNetworkRadius)
+         network = SelectionNetwork(size_ * size_, rank);
+
+      // Threads only pay off for bands of some size
+      const unsigned minBandPixels = 64 * 1024;
+      unsigned bands = std::min(threads_, std::max(1u, width * height / minBandPixels));
+      bands = std::min(bands, height);
+
+      std::vector<std::thread> workers;
+      for (unsigned i = 0; i < bands; ++i)
+      {
+         const unsigned y0 = static_cast<unsigned>((unsigned long long)height * i / bands);
+         const unsigned y1 = static_cast<unsigned>((unsigned long long)height * (i + 1) / bands);
+         if (i + 1 < bands)
+            workers.push_back(std::thread(&RankFilter::FilterRows<PixelType>, pixels, result,
+                     width, height, radius, rank, std::cref(network), y0, y1));
+         else
+            FilterRows<PixelType>(pixels, result, width, height, radius, rank, network, y0, y1);
+      }
+      for (size_t i = 0; i < workers.size(); ++i)
+         workers[i].join();
+
+      memcpy(pixels, result, bytes);
+   }
+
+   // Vector operations for the sorting network: the general case is one
+   // pixel at a time
+   template <typename T>
+   struct Lanes
+   {
+      typedef T V;
+      enum { N = 1 };
+      static V Load(const T* p) { return *p; }
+      static void Store(T* p, V v) { *p = v; }
+      static V Min(V a, V b) { return b < a ? b : a; }
+      static V Max(V a, V b) { return a < b ? b : a; }
+   };
+
+   // Comparators of Batcher's odd-even merge sort of n elements, keeping only
+   // those that affect which element ends up at position k
+   static Network SelectionNetwork(int n, int k)
+   {
+      int n2 = 1;
+      while (n2 < n)
+         n2 *= 2;
+      Network sort;
+      for (int p = 1; p < n2; p *= 2)
+         for (int d = p; d >= 1; d /= 2)
+            for (int j = d % p; j + d < n2; j += 2 * d)
+               for (int i = 0; i < std::min(d, n2 - j - d); ++i)
+                  if ((i + j) / (2 * p) == (i + j + d) / (2 * p) && i + j + d < n)
+                     sort.push_back(std::make_pair(i + j, i + j + d));
+      // Positions >= n would only ever hold +infinity, so comparators
+      // touching them are dropped above
+
+      std::vector<bool> needed(n, false);
+      needed[k] = true;
+      Network select;
+      for (Network::reverse_iterator it = sort.rbegin(); it != sort.rend(); ++it)
+      {
+         if (needed[it->first] || needed[it->second])
+         {
+            needed[it->first] = needed[it->second] = true;
+            select.push_back(*it);
+         }
+      }
+      std::reverse(select.begin(), select.end());
+      return select;
+   }
+
+   template <typename PixelType>
+   static void FilterRows(const PixelType* src, PixelType* dst, unsigned width,
+         unsigned height, int radius, int rank, const Network& network,
+         unsigned y0, unsigned y1)
+   {
+      if (radius <= MaxNetworkRadius)
+         NetworkRows(src, dst, width, height, radius, rank, network, y0, y1);
+      else
+         HistogramRows(src, dst, width, height, radius, rank, y0, y1);
+   }
+
+   static int Clamp(int v, int n) { return v < 0 ? 0 : (v >= n ? n - 1 : v); }
+
+   template <typename PixelType>
+   static void NetworkRows(const PixelType* src, PixelType* dst, unsigned width,
+         unsigned height, int radius, int rank, const Network& network,
+         unsigned y0, unsigned y1)
+   {
+      typedef Lanes<PixelType> L;
+      const int size = 2 * radius + 1;
+      const size_t stride = width + 2 * radius + L::N;
+
+      // Rows padded with copies of the edge pixels, by row index mod size,
+      // and one output row with room for a whole last vector
+      std::vector<PixelType> lines(stride * size + width + L::N);
+      std::vector<int> lineRow(size, -1);
+      PixelType* out = &lines[stride * size];
+      const PixelType* rows[2 * MaxNetworkRadius + 1];
+      typename L::V v[(2 * MaxNetworkRadius + 1) * (2 * MaxNetworkRadius + 1)];
+
+      for (unsigned y = y0; y < y1; ++y)
+      {
+         for (int dy = 0; dy < size; ++dy)
+         {
+            const int row = Clamp(static_cast<int>(y) + dy - radius, height);
+            const int slot = (static_cast<int>(y) + dy) % size;
+            PixelType* line = &lines[stride * slot];
+            if (lineRow[slot] != row)
+            {
+               lineRow[slot] = row;
+               const PixelType* s = src + (size_t)row * width;
+               memcpy(line + radius, s, width * sizeof(PixelType));
+               for (int i = 0; i < radius; ++i)
+               {
+                  line[i] = s[0];
+                  line[radius + width + i] = s[width - 1];
+               }
+            }
+            rows[dy] = line;
+         }
+
+         for (unsigned x = 0; x < width; x += L::N)
+         {
+            int n = 0;
+            for (int dy = 0; dy < size; ++dy)
+               for (int dx = 0; dx < size; ++dx)
+                  v[n++] = L::Load(rows[dy] + x + dx);
+            for (Network::const_iterator c = network.begin(); c != network.end(); ++c)
+            {
+               typename L::V a = v[c->first];
+               typename L::V b = v[c->second];
+               v[c->first] = L::Min(a, b);
+               v[c->second] = L::Max(a, b);
+            }
+            L::Store(out + x, v[rank]);
+         }
+         memcpy(dst + (size_t)y * width, out, width * sizeof(PixelType));
+      }
+   }
+
+   template <typename PixelType>
+   static void HistogramRows(const PixelType* src, PixelType* dst, unsigned width,
+         unsigned height, int radius, int rank, unsigned y0, unsigned y1)
+   {
+      SelectRows(src, dst, width, height, radius, rank, y0, y1);
+   }
+
+   static void HistogramRows(const uint8_t* src, uint8_t* dst, unsigned width,
+         unsigned height, int radius, int rank, unsigned y0, unsigned y1)
+   {
+      ConstantTimeRows(src, dst, width, height, radius, rank, y0, y1);
+   }
+
+   static void HistogramRows(const uint16_t* src, uint16_t* dst, unsigned width,
+         unsigned height, int radius, int rank, unsigned y0, unsigned y1)
+   {
+      SlidingHistogramRows(src, dst, width, height, radius, rank, y0, y1);
+   }
+
+   // Perreault and Hebert: a histogram per column over the window's rows,
+   // moved down one row at a time, and a window histogram that adds the
+   // column entering on the right and removes the one leaving on the left.
+   // Histograms have 16 coarse bins (high nibble) and 256 fine bins.
+   static void ConstantTimeRows(const uint8_t* src, uint8_t* dst, unsigned width,
+         unsigned height, int radius, int rank, unsigned y0, unsigned y1)
+   {
+      const int w = static_cast<int>(width);
+      const int h = static_cast<int>(height);
+      const int binsPerColumn = 16 + 256;
+      std::vector<uint16_t> columns((size_t)w * binsPerColumn, 0);
+      uint16_t window[16 + 256];
+
+      for (int dy = -radius; dy <= radius; ++dy)
+      {
+         const uint8_t* s = src + (size_t)Clamp(static_cast<int>(y0) + dy, h) * w;
+         for (int x = 0; x < w; ++x)
+         {
+            uint16_t* c = &columns[(size_t)x * binsPerColumn];
+            ++c[s[x] >> 4];
+            ++c[16 + s[x]];
+         }
+      }
+
+      for (int y = static_cast<int>(y0); y < static_cast<int>(y1); ++y)
+      {
+         if (y > static_cast<int>(y0))
+         {
+            const uint8_t* leaving = src + (size_t)Clamp(y - radius - 1, h) * w;
+            const uint8_t* entering = src + (size_t)Clamp(y + radius, h) * w;
+            for (int x = 0; x < w; ++x)
+            {
+               uint16_t* c = &columns[(size_t)x * binsPerColumn];
+               --c[leaving[x] >> 4];
+               --c[16 + leaving[x]];
+               ++c[entering[x] >> 4];
+               ++c[16 + entering[x]];
+            }
+         }
+
+         memset(window, 0, sizeof(window));
+         for (int dx = -radius; dx <= radius; ++dx)
+         {
+            const uint16_t* c = &columns[(size_t)Clamp(dx, w) * binsPerColumn];
+            for (int b = 0; b < binsPerColumn; ++b)
+               window[b] += c[b];
+         }
+
+         uint8_t* out = dst + (size_t)y * w;
+         for (int x = 0; x < w; ++x)
+         {
+            int coarse = 0;
+            int below = 0;
+            while (below + window[coarse] <= rank)
+               below += window[coarse++];
+            int fine = 16 + coarse * 16;
+            while (below + window[fine] <= rank)
+               below += window[fine++];
+            out[x] = static_cast<uint8_t>(fine - 16);
+
+            if (x + 1 < w)
+               Slide(window, &columns[(size_t)Clamp(x + radius + 1, w) * binsPerColumn],
+                     &columns[(size_t)Clamp(x - radius, w) * binsPerColumn], binsPerColumn);
+         }
+      }
+   }
+
+   // window += add - sub, for n a multiple of 8
+   static void Slide(uint16_t* window, const uint16_t* add, const uint16_t* sub, int n)
+   {
+#if defined(RANKFILTER_SSE2)
+      for (int b = 0; b < n; b += 8)
+      {
+         __m128i* w = reinterpret_cast<__m128i*>(window + b);
+         __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(add + b));
+         __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(sub + b));
+         _mm_storeu_si128(w, _mm_sub_epi16(_mm_add_epi16(_mm_loadu_si128(w), a), s));
+      }
+#elif defined(RANKFILTER_NEON)
+      for (int b = 0; b < n; b += 8)
+         vst1q_u16(window + b, vsubq_u16(vaddq_u16(vld1q_u16(window + b), vld1q_u16(add + b)),
+                  vld1q_u16(sub + b)));
+#else
+      for (int b = 0; b < n; ++b)
+         window[b] = static_cast<uint16_t>(window[b] + add[b] - sub[b]);
+#endif
+   }
+
+   // Huang: one window histogram per row, updated with the column of pixels
+   // entering and the column leaving at each step. 4096 coarse bins (all but
+   // the low 4 bits) locate the fine bin; the coarse bin holding the rank and
+   // the count below it are carried from pixel to pixel, since neighboring
+   // ranks are usually close.
+   struct SlidingHistogram
+   {
+      SlidingHistogram() : coarse(4096, 0), fine(65536, 0), bin(0), below(0) {}
+
+      void Add(uint16_t v)
+      {
+         ++coarse[v >> 4];
+         ++fine[v];
+         below += (v >> 4) < bin;
+      }
+
+      void Remove(uint16_t v)
+      {
+         --coarse[v >> 4];
+         --fine[v];
+         below -= (v >> 4) < bin;
+      }
+
+      uint16_t Find(int rank)
+      {
+         while (below > rank)
+            below -= coarse[--bin];
+         while (below + coarse[bin] <= rank)
+            below += coarse[bin++];
+         int value = bin << 4;
+         int count = below;
+         while (count + fine[value] <= rank)
+            count += fine[value++];
+         return static_cast<uint16_t>(value);
+      }
+
+      std::vector<uint16_t> coarse;
+      std::vector<uint16_t> fine;
+      int bin;
+      int below;
+   };
+
+   static void SlidingHistogramRows(const uint16_t* src, uint16_t* dst,
+         unsigned width, unsigned height, int radius, int rank,
+         unsigned y0, unsigned y1)
+   {
+      const int w = static_cast<int>(width);
+      const int h = static_cast<int>(height);
+      SlidingHistogram hist;
+      std::vector<const uint16_t*> rows(2 * radius + 1);
+
+      for (int y = static_cast<int>(y0); y < static_cast<int>(y1); ++y)
+      {
+         for (int dy = -radius; dy <= radius; ++dy)
+            rows[dy + radius] = src + (size_t)Clamp(y + dy, h) * w;
+
+         for (int dx = -radius; dx <= radius; ++dx)
+         {
+            const int x = Clamp(dx, w);
+            for (size_t r = 0; r < rows.size(); ++r)
+               hist.Add(rows[r][x]);
+         }
+
+         uint16_t* out = dst + (size_t)y * w;
+         for (int x = 0; x < w; ++x)
+         {
+            out[x] = hist.Find(rank);
+
+            const int sub = Clamp(x - radius, w);
+            const int add = Clamp(x + radius + 1, w);
+            for (size_t r = 0; r < rows.size(); ++r)
+            {
+               hist.Remove(rows[r][sub]);
+               hist.Add(rows[r][add]);
+            }
+         }
+
+         // Empty the histogram by removing the last window
+         for (int dx = w - radius; dx <= w + radius; ++dx)
+         {
+            const int x = Clamp(dx, w);
+            for (size_t r = 0; r < rows.size(); ++r)
+               hist.Remove(rows[r][x]);
+         }
+      }
+   }
+
+   // Partial sort of each window, for pixel types too wide for histograms
+   template <typename PixelType>
+   static void SelectRows(const PixelType* src, PixelType* dst, unsigned width,
+         unsigned height, int radius, int rank, unsigned y0, unsigned y1)
+   {
+      const int w = static_cast<int>(width);
+      const int h = static_cast<int>(height);
+      std::vector<PixelType> window((2 * radius + 1) * (2 * radius + 1));
+      for (int y = static_cast<int>(y0); y < static_cast<int>(y1); ++y)
+      {
+         for (int x = 0; x < w; ++x)
+         {
+            size_t n = 0;
+            for (int dy = -radius; dy <= radius; ++dy)
+            {
+               const PixelType* s = src + (size_t)Clamp(y + dy, h) * w;
+               for (int dx = -radius; dx <= radius; ++dx)
+                  window[n++] = s[Clamp(x + dx, w)];
+            }
+            std::nth_element(window.begin(), window.begin() + rank, window.end());
+            dst[(size_t)y * w + x] = window[rank];
+         }
+      }
+   }
+
+   int size_;
+   int percent_;
+   unsigned threads_;
+   std::vector<unsigned char> result_;
+   std::vector<uint16_t> narrowed_;
+};
+
+#if defined(RANKFILTER_SSE2)
+template <>
+struct RankFilter::Lanes<uint8_t>
+{
+   typedef __m128i V;
+   enum { N = 16 };
+   static V Load(const uint8_t* p) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); }
+   static void Store(uint8_t* p, V v) { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), v); }
+   static V Min(V a, V b) { return _mm_min_epu8(a, b); }
+   static V Max(V a, V b) { return _mm_max_epu8(a, b); }
+};
+
+// SSE2 has no unsigned 16-bit min/max; use saturating subtraction
+template <>
+struct RankFilter::Lanes<uint16_t>
+{
+   typedef __m128i V;
+   enum { N = 8 };
+   static V Load(const uint16_t* p) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); }
+   static void Store(uint16_t* p, V v) { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), v); }
+   static V Min(V a, V b) { return _mm_sub_epi16(a, _mm_subs_epu16(a, b)); }
+   static V Max(V a, V b) { return _mm_add_epi16(b, _mm_subs_epu16(a, b)); }
+};
+
+// Nor 32-bit; compare with the sign bits flipped and blend
+template <>
+struct RankFilter::Lanes<uint32_t>
+{
+   typedef __m128i V;
+   enum { N = 4 };
+   static V Load(const uint32_t* p) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); }
+   static void Store(uint32_t* p, V v) { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), v); }
+   static V Greater(V a, V b)
+   {
+      const __m128i sign = _mm_set1_epi32(static_cast<int>(0x80000000u));
+      return _mm_cmpgt_epi32(_mm_xor_si128(a, sign), _mm_xor_si128(b, sign));
+   }
+   static V Min(V a, V b)
+   {
+      const __m128i aGreater = Greater(a, b);
+      return _mm_or_si128(_mm_and_si128(aGreater, b), _mm_andnot_si128(aGreater, a));
+   }
+   static V Max(V a, V b)
+   {
+      const __m128i aGreater = Greater(a, b);
+      return _mm_or_si128(_mm_and_si128(aGreater, a), _mm_andnot_si128(aGreater, b));
+   }
+};
+#elif defined(RANKFILTER_NEON)
+template <>
+struct RankFilter::Lanes<uint8_t>
+{
+   typedef uint8x16_t V;
+   enum { N = 16 };
+   static V Load(const uint8_t* p) { return vld1q_u8(p); }
+   static void Store(uint8_t* p, V v) { vst1q_u8(p, v); }
+   static V Min(V a, V b) { return vminq_u8(a, b); }
+   static V Max(V a, V b) { return vmaxq_u8(a, b); }
+};
+
+template <>
+struct RankFilter::Lanes<uint16_t>
+{
+   typedef uint16x8_t V;
+   enum { N = 8 };
+   static V Load(const uint16_t* p) { return vld1q_u16(p); }
+   static void Store(uint16_t* p, V v) { vst1q_u16(p, v); }
+   static V Min(V a, V b) { return vminq_u16(a, b); }
+   static V Max(V a, V b) { return vmaxq_u16(a, b); }
+};
+
+template <>
+struct RankFilter::Lanes<uint32_t>
+{
+   typedef uint32x4_t V;
+   enum { N = 4 };
+   static V Load(const uint32_t* p) { return vld1q_u32(p); }
+   static void Store(uint32_t* p, V v) { vst1q_u32(p, v); }
+   static V Min(V a, V b) { return vminq_u32(a, b); }
+   static V Max(V a, V b) { return vmaxq_u32(a, b); }
+};
+#endif
+
+#endif //_RANKFILTER_H_
@@ -2067,11 +2067,11 @@ MMIIDCCamera::ProcessedSequenceCallback(const void* pixels,
       size_t width, size_t height, size_t bytesPerPixel,
       uint32_t timestampUs )
 {
-   Metadata md;
+   BinaryMetadata md;
 
    char label[MM::MaxStrLength];
    GetLabel(label);
-   md.put("Camera", label);
+   md.PutImageTag("Camera", label);
 
 #ifndef _WIN32
    // The Windows CMU backend does not provide a valid timestamp (the field
@@ -2080,11 +2080,10 @@ MMIIDCCamera::ProcessedSequenceCallback(const void* pixels,
    // pretty accurate.
    double timestampMs = ComputeRelativeTimestampMs(timestampUs);
 
-   md.put(MM::g_Keyword_Elapsed_Time_ms,
-         CDeviceUtils::ConvertToString(timestampMs));
+   md.PutImageTag(MM::g_Keyword_Elapsed_Time_ms, timestampMs);
 #endif
 
-   std::string serializedMD(md.Serialize());
+   unsigned mdSize = static_cast<unsigned>(md.GetRecordsSize());
 
    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(pixels);
 
@@ -2095,14 +2094,14 @@ MMIIDCCamera::ProcessedSequenceCallback(const void* pixels,
 
    int err;
    err = GetCoreCallback()->InsertImage(this, bytes, uWidth, uHeight, uBytesPerPixel,
-         serializedMD.c_str());
+         1, md.GetRecords(), mdSize);
    if (err == DEVICE_BUFFER_OVERFLOW)
    {
       if (!stopOnOverflow_)
       {
          GetCoreCallback()->ClearImageBuffer(this);
          err = GetCoreCallback()->InsertImage(this, bytes, uWidth, uHeight, uBytesPerPixel,
-               serializedMD.c_str(), false);
+               1, md.GetRecords(), mdSize, false);
       }
       else
       {
@@ -28,6 +28,30 @@
 #include "ModuleInterface.h"
 #include <sstream>
 #include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace {
+
+// Read-only property by which a processor declares that it can be run in
+// tiles
+const char* const g_Pointwise = "Pointwise";
+const char* const g_Yes = "Yes";
+
+// Statistics properties; the action data is slot * StatCount + kind
+enum { StatFrames, StatLatency, StatThroughput, StatCount };
+
+unsigned long long ElapsedNs(std::chrono::steady_clock::time_point since,
+      std::chrono::steady_clock::time_point until)
+{
+   return static_cast<unsigned long long>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(until - since).count());
+}
+
+} // namespace
 
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -61,6 +85,172 @@ MODULE_API void DeleteDevice(MM::Device* pDevice)
 }
 
 
+
+///////////////////////////////////////////////////////////////////////////////
+// Stage internals
+///////////////////////////////////////////////////////////////////////////////
+
+// Helper threads that run the tiles of one frame together with the calling
+// thread
+class ImageProcessorChain::TileWorkers
+{
+public:
+   explicit TileWorkers(int count) :
+      count_(count), generation_(0), pending_(0), stop_(false), task_(NULL)
+   {
+      for (int i = 1; i < count_; ++i)
+         threads_.push_back(std::thread(&TileWorkers::ThreadFunc, this, i));
+   }
+
+   ~TileWorkers()
+   {
+      {
+         std::lock_guard<std::mutex> lock(mutex_);
+         stop_ = true;
+      }
+      startCV_.notify_all();
+      for (size_t i = 0; i < threads_.size(); ++i)
+         threads_[i].join();
+   }
+
+   int Count() const { return count_; }
+
+   // Calls f(i) for each i in [0, Count()) in parallel and returns when all
+   // have returned
+   void Run(const std::function<void (int)>& f)
+   {
+      // Concurrent callers share the workers
+      std::lock_guard<std::mutex> runLock(runMutex_);
+      {
+         std::lock_guard<std::mutex> lock(mutex_);
+         task_ = &f;
+         pending_ = count_ - 1;
+         ++generation_;
+      }
+      startCV_.notify_all();
+      f(0);
+      std::unique_lock<std::mutex> lock(mutex_);
+      doneCV_.wait(lock, [this] { return pending_ == 0; });
+      task_ = NULL;
+   }
+
+private:
+   void ThreadFunc(int index)
+   {
+      unsigned long seen = 0;
+      std::unique_lock<std::mutex> lock(mutex_);
+      for (;;)
+      {
+         startCV_.wait(lock, [&] { return stop_ || generation_ != seen; });
+         if (stop_)
+            return;
+         seen = generation_;
+         const std::function<void (int)>* task = task_;
+         lock.unlock();
+         (*task)(index);
+         lock.lock();
+         if (--pending_ == 0)
+            doneCV_.notify_one();
+      }
+   }
+
+   const int count_;
+   std::mutex runMutex_;
+   std::mutex mutex_;
+   std::condition_variable startCV_;
+   std::condition_variable doneCV_;
+   unsigned long generation_;
+   int pending_;
+   bool stop_;
+   const std::function<void (int)>* task_;
+   std::vector<std::thread> threads_;
+};
+
+// Runs the processor of one occupied slot, in tiles if it is pointwise
+class ImageProcessorChain::Stage
+{
+public:
+   Stage(ImageProcessorChain* chain, Slot* slot) :
+      chain_(chain),
+      slot_(slot),
+      tiles_(slot->pointwise ? static_cast<int>(slot->tiles) : 1)
+   {
+   }
+
+   void Run(unsigned char* buffer, unsigned width, unsigned height, unsigned byteDepth)
+   {
+      const std::chrono::steady_clock::time_point entered =
+         std::chrono::steady_clock::now();
+      const unsigned tiles = static_cast<unsigned>(tiles_.Count());
+      std::chrono::steady_clock::time_point start = entered;
+      if (tiles <= 1 || height < tiles)
+         ProcessRows(buffer, width, 0, height, byteDepth);
+      else
+      {
+         tiles_.Run([&](int i) {
+            if (i == 0) // The workers were free
+               start = std::chrono::steady_clock::now();
+            ProcessRows(buffer, width, height * i / tiles,
+                  height * (i + 1) / tiles, byteDepth);
+         });
+      }
+      const std::chrono::steady_clock::time_point end =
+         std::chrono::steady_clock::now();
+      slot_->busyNs += ElapsedNs(start, end);
+      slot_->latencyNs += ElapsedNs(entered, end);
+      ++slot_->frames;
+   }
+
+private:
+   void ProcessRows(unsigned char* buffer, unsigned width, unsigned y0,
+         unsigned y1, unsigned byteDepth)
+   {
+      MM::ImageProcessor* pP = slot_->processor;
+      try
+      {
+         pP->Process(buffer + (size_t)y0 * width * byteDepth,
+               width, y1 - y0, byteDepth);
+      }
+      catch(...)
+      {
+         std::ostringstream m;
+         char name[MM::MaxStrLength];
+         pP->GetName(name);
+         m << "Error in processor " << name;
+         chain_->LogMessage(m.str().c_str(), false);
+      }
+   }
+
+   ImageProcessorChain* const chain_;
+   Slot* const slot_;
+   TileWorkers tiles_;
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+// ImageProcessorChain
+///////////////////////////////////////////////////////////////////////////////
+
+ImageProcessorChain::ImageProcessorChain() :
+   nSlots_(10),
+   busyCount_(0)
+{
+   for (int i = 0; i < nSlots_; ++i)
+      slots_.push_back(std::unique_ptr<Slot>(new Slot()));
+}
+
+ImageProcessorChain::~ImageProcessorChain()
+{
+   Shutdown();
+}
+
+int ImageProcessorChain::Shutdown()
+{
+   std::unique_lock<std::shared_timed_mutex> lock(stagesMutex_);
+   stages_.clear();
+   return DEVICE_OK;
+}
+
 int ImageProcessorChain::Initialize()
 {
 
@@ -95,6 +285,19 @@ int ImageProcessorChain::Initialize()
       for (std::vector<std::string>::iterator iap = availableProcessors.begin();  iap != availableProcessors.end(); ++iap)
          AddAllowedValue(processorSlotName.str().c_str(), iap->c_str());
 
+      // Only used if the processor is pointwise
+      const std::string tilesName = processorSlotName.str() + " Tiles";
+      pAct = new CPropertyActionEx (this, &ImageProcessorChain::OnTiles, ip);
+      (void)CreateProperty(tilesName.c_str(), "1", MM::Integer, false, pAct);
+      SetPropertyLimits(tilesName.c_str(), 1, 64);
+
+      const char* statNames[StatCount] = { " Frames", " Latency (ms)", " Throughput (fps)" };
+      const MM::PropertyType statTypes[StatCount] = { MM::Integer, MM::Float, MM::Float };
+      for (int stat = 0; stat < StatCount; ++stat)
+      {
+         pAct = new CPropertyActionEx (this, &ImageProcessorChain::OnStatistic, ip * StatCount + stat);
+         (void)CreateProperty((processorSlotName.str() + statNames[stat]).c_str(), "0", statTypes[stat], true, pAct);
+      }
    }
 
    return DEVICE_OK;
@@ -106,67 +309,114 @@ int ImageProcessorChain::OnProcessor(MM::PropertyBase* pProp, MM::ActionType eAc
 {
    if (eAct == MM::BeforeGet)
    {
-      std::string name;
-      if (processorNames_.end() != processorNames_.find((int)indexx))
-         name = processorNames_[(int)indexx];
-      pProp->Set(name.c_str());
+      pProp->Set(slots_[indexx]->name.c_str());
    }
    else if (eAct == MM::AfterSet)
    {
       std::string name;
       pProp->Get(name);
-      processorNames_[indexx] = name;
+
+      std::unique_lock<std::shared_timed_mutex> lock(stagesMutex_);
+      stages_.clear();
+      if (name != slots_[indexx]->name)
+         slots_[indexx]->ResetStatistics();
+      slots_[indexx]->name = name;
 
       for( int islot = 0; islot < this->nSlots_; ++islot)
       {
-         processors_[islot] = NULL;
-         if( processorNames_.end() != processorNames_.find(islot))
-            if ( 0 < processorNames_[islot].length())
-            {
-               MM::Device* pDevice = GetDevice(processorNames_[islot].c_str());
-               if( NULL != pDevice)
-                  if( MM::ImageProcessorDevice == pDevice->GetType())
-                     processors_[islot] = (MM::ImageProcessor*) pDevice;
-            }
+         Slot& slot = *slots_[islot];
+         slot.processor = NULL;
+         slot.pointwise = false;
+         if ( 0 < slot.name.length())
+         {
+            MM::Device* pDevice = GetDevice(slot.name.c_str());
+            if( NULL != pDevice)
+               if( MM::ImageProcessorDevice == pDevice->GetType())
+               {
+                  slot.processor = (MM::ImageProcessor*) pDevice;
+                  char value[MM::MaxStrLength];
+                  slot.pointwise = pDevice->HasProperty(g_Pointwise) &&
+                     pDevice->GetProperty(g_Pointwise, value) == DEVICE_OK &&
+                     strcmp(value, g_Yes) == 0;
+               }
+         }
       }
-      
+      RebuildStages();
    }
 
    return DEVICE_OK;
 }
 
-
-int ImageProcessorChain::Process(unsigned char *pBuffer, unsigned int width, unsigned int height, unsigned int byteDepth)
+int ImageProcessorChain::OnTiles(MM::PropertyBase* pProp, MM::ActionType eAct, long indexx)
 {
-   int ret = DEVICE_OK;
-   busy_ = true;
-
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set(slots_[indexx]->tiles);
+   }
+   else if (eAct == MM::AfterSet)
+   {
+      long tiles;
+      pProp->Get(tiles);
+      std::unique_lock<std::shared_timed_mutex> lock(stagesMutex_);
+      stages_.clear();
+      slots_[indexx]->tiles = tiles;
+      slots_[indexx]->ResetStatistics();
+      RebuildStages();
+   }
+   return DEVICE_OK;
+}
 
-   for( int islot = 0; islot < this->nSlots_; ++islot)
+int ImageProcessorChain::OnStatistic(MM::PropertyBase* pProp, MM::ActionType eAct, long code)
+{
+   if (eAct == MM::BeforeGet)
    {
-      if( processors_.end() != processors_.find(islot))
+      const Slot& slot = *slots_[code / StatCount];
+      const unsigned long long frames = slot.frames.load();
+      switch (code % StatCount)
       {
-
-         MM::ImageProcessor* pP = processors_[islot];
-         if( NULL != pP)
+         case StatFrames:
+            pProp->Set(static_cast<long>(frames));
+            break;
+         case StatLatency: // Mean time in the slot, including waiting for tile workers
+            pProp->Set(frames ? slot.latencyNs.load() / 1e6 / frames : 0.0);
+            break;
+         case StatThroughput: // Frames per second of processing time
          {
-            try
-            {
-               pP->Process(pBuffer, width, height,byteDepth);
-            }
-            catch(...)
-            {
-               std::ostringstream m;
-               char name[MM::MaxStrLength];
-               pP->GetName(name);
-               m << "Error in processor " << name;
-               LogMessage(m.str().c_str(), false);
-            }
+            const unsigned long long busyNs = slot.busyNs.load();
+            pProp->Set(busyNs ? frames * 1e9 / busyNs : 0.0);
+            break;
          }
       }
    }
+   return DEVICE_OK;
+}
+
+void ImageProcessorChain::RebuildStages()
+{
+   stages_.clear();
+   for (int islot = 0; islot < nSlots_; ++islot)
+   {
+      Slot* slot = slots_[islot].get();
+      if (slot->processor == NULL)
+         continue;
+      if (slot->tiles > 1 && !slot->pointwise)
+      {
+         std::ostringstream m;
+         m << "Processor " << slot->name << " is not pointwise; ignoring tiles";
+         LogMessage(m.str().c_str(), true);
+      }
+      stages_.push_back(std::unique_ptr<Stage>(new Stage(this, slot)));
+   }
+}
+
 
-   busy_ = false;
+int ImageProcessorChain::Process(unsigned char *pBuffer, unsigned int width, unsigned int height, unsigned int byteDepth)
+{
+   std::shared_lock<std::shared_timed_mutex> lock(stagesMutex_);
+   ++busyCount_;
+   for (size_t i = 0; i < stages_.size(); ++i)
+      stages_[i]->Run(pBuffer, width, height, byteDepth);
+   --busyCount_;
 
-   return ret;
+   return DEVICE_OK;
 }
@@ -29,39 +29,76 @@
 #include "DeviceBase.h"
 #include "ImgBuffer.h"
 #include "DeviceThreads.h"
+#include <atomic>
+#include <memory>
+#include <shared_mutex>
 #include <string>
-#include <map>
+#include <vector>
 
 
 
 //////////////////////////////////////////////////////////////////////////////
 // ImageProcessorChain class
 // run chain of image processors
+//
+// Process() runs the processor of each occupied slot in turn, in place, on
+// the calling thread. A slot whose processor declares itself pointwise (a
+// read-only "Pointwise" property set to "Yes": each output pixel depends
+// only on the same input pixel, and Process() may be called concurrently)
+// can split each frame into horizontal tiles processed in parallel
+// ("ProcessorSlotN Tiles"); for other processors, such as neighbourhood
+// filters, tiles would give wrong results at the seams and the setting is
+// ignored. Per-slot statistics are exposed as read-only properties.
 //////////////////////////////////////////////////////////////////////////////
 class ImageProcessorChain : public CImageProcessorBase<ImageProcessorChain>
 {
 public:
-   ImageProcessorChain () : nSlots_(10), busy_(false) {}
-   ~ImageProcessorChain () { }
+   ImageProcessorChain ();
+   ~ImageProcessorChain ();
 
-   int Shutdown() {return DEVICE_OK;}
+   int Shutdown();
    void GetName(char* name) const {strcpy(name,"ImageProcessorChain");}
 
    int Initialize();
 
-   bool Busy(void) { return busy_;};
+   bool Busy(void) { return busyCount_.load() > 0;};
 
    int Process(unsigned char* buffer, unsigned width, unsigned height, unsigned byteDepth);
 
    // action interface
    // ----------------
    int OnProcessor(MM::PropertyBase* pProp, MM::ActionType eAct, long indexx);
+   int OnTiles(MM::PropertyBase* pProp, MM::ActionType eAct, long indexx);
+   int OnStatistic(MM::PropertyBase* pProp, MM::ActionType eAct, long code);
 
 private:
+   class TileWorkers;
+   class Stage;
+
+   struct Slot
+   {
+      Slot() : processor(NULL), pointwise(false), tiles(1), frames(0), latencyNs(0), busyNs(0) {}
+      void ResetStatistics() { frames = 0; latencyNs = 0; busyNs = 0; }
+
+      std::string name;
+      MM::ImageProcessor* processor;
+      bool pointwise;
+      long tiles;
+      std::atomic<unsigned long long> frames;
+      std::atomic<unsigned long long> latencyNs; // Entering the slot to done, summed
+      std::atomic<unsigned long long> busyNs; // Processing only, summed
+   };
+
+   // Caller must hold stagesMutex_ exclusively
+   void RebuildStages();
+
    const int nSlots_;
-   bool busy_;
-   std::map< int, std::string> processorNames_;
-   std::map< int, MM::ImageProcessor*> processors_;
+   std::atomic<int> busyCount_;
+   std::vector< std::unique_ptr<Slot> > slots_;
+
+   // Held shared by Process() and exclusively while changing the stages
+   std::shared_timed_mutex stagesMutex_;
+   std::vector< std::unique_ptr<Stage> > stages_;
 
    ImageProcessorChain& operator=( const ImageProcessorChain& ){ 
       return *this;
@@ -808,18 +808,18 @@ int COpenCVgrabber::InsertImage()
    this->GetLabel(label);
  
    // Important:  metadata about the image are generated here:
-   Metadata md;
-   md.put("Camera", label);
-   md.put(MM::g_Keyword_Elapsed_Time_ms, CDeviceUtils::ConvertToString((timeStamp - sequenceStartTime_).getMsec()));
-   md.put(MM::g_Keyword_Metadata_ImageNumber, CDeviceUtils::ConvertToString(imageCounter_));
-   md.put(MM::g_Keyword_Metadata_ROI_X, CDeviceUtils::ConvertToString( (long) roiX_)); 
-   md.put(MM::g_Keyword_Metadata_ROI_Y, CDeviceUtils::ConvertToString( (long) roiY_)); 
+   BinaryMetadata md;
+   md.PutImageTag("Camera", label);
+   md.PutImageTag(MM::g_Keyword_Elapsed_Time_ms, (timeStamp - sequenceStartTime_).getMsec());
+   md.PutImageTag(MM::g_Keyword_Metadata_ImageNumber, imageCounter_);
+   md.PutImageTag(MM::g_Keyword_Metadata_ROI_X, (long) roiX_);
+   md.PutImageTag(MM::g_Keyword_Metadata_ROI_Y, (long) roiY_);
    
    imageCounter_++;
    
    char buf[MM::MaxStrLength];
    GetProperty(MM::g_Keyword_Binning, buf);
-   md.put(MM::g_Keyword_Binning, buf);
+   md.PutImageTag(MM::g_Keyword_Binning, buf);
    
    MMThreadGuard g(imgPixelsLock_);
 
@@ -829,13 +829,15 @@ int COpenCVgrabber::InsertImage()
    unsigned int h = GetImageHeight();
    unsigned int b = GetImageBytesPerPixel();
 
-   int ret = GetCoreCallback()->InsertImage(this, pI, w, h, b, md.Serialize().c_str());
+   const unsigned char* mdRecords = md.GetRecords();
+   unsigned mdSize = (unsigned) md.GetRecordsSize();
+   int ret = GetCoreCallback()->InsertImage(this, pI, w, h, b, 1, mdRecords, mdSize);
    if (!stopOnOverFlow_ && ret == DEVICE_BUFFER_OVERFLOW)
    {
       // do not stop on overflow - just reset the buffer
       GetCoreCallback()->ClearImageBuffer(this);
       // don't process this same image again...
-	  return GetCoreCallback()->InsertImage(this, pI, w, h, b, md.Serialize().c_str(), false);
+	  return GetCoreCallback()->InsertImage(this, pI, w, h, b, 1, mdRecords, mdSize, false);
 	  //return GetCoreCallback()->InsertImage(this, pI, w, h, b);
    } else
       return ret;
@@ -530,9 +530,9 @@ TesterCamera::SendSequence(bool finite, long count, bool stopOnOverflow)
 
    char label[MM::MaxStrLength];
    GetLabel(label);
-   Metadata md;
-   md.put("Camera", label);
-   std::string serializedMD(md.Serialize());
+   BinaryMetadata md;
+   md.PutImageTag("Camera", label);
+   unsigned mdSize = static_cast<unsigned>(md.GetRecordsSize());
 
    const unsigned char* bytes = 0;
 
@@ -560,13 +560,13 @@ TesterCamera::SendSequence(bool finite, long count, bool stopOnOverflow)
       {
          int err;
          err = core->InsertImage(this, bytes, width, height,
-               bytesPerPixel, serializedMD.c_str());
+               bytesPerPixel, 1, md.GetRecords(), mdSize);
 
          if (!stopOnOverflow && err == DEVICE_BUFFER_OVERFLOW)
          {
             core->ClearImageBuffer(this);
             err = core->InsertImage(this, bytes, width, height,
-                  bytesPerPixel, serializedMD.c_str(), false);
+                  bytesPerPixel, 1, md.GetRecords(), mdSize, false);
          }
 
          if (err != DEVICE_OK)
@@ -30,8 +30,12 @@
 #include <boost/bind.hpp>
 #include <boost/lexical_cast.hpp>
 
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
 #include <deque>
 #include <exception>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -60,6 +64,7 @@ public:
       active_(true),
       io_service_(ioService),
       serialPortImplementation_(ioService, nativeHandle),
+      receivedOffset_(0),
       pSerialPortAdapter_(pPort),
       device_(deviceName),
       shutDownInProgress_(false)
@@ -79,6 +84,7 @@ public:
       active_(true),
       io_service_(ioService),
       serialPortImplementation_(ioService, deviceName),
+      receivedOffset_(0),
       pSerialPortAdapter_(pPort),
       device_(deviceName),
       shutDownInProgress_(false)
@@ -304,8 +310,9 @@ public:
    {
       // clear read buffer;
       {
-         MMThreadGuard g(readBufferLock_);
-         data_read_.clear();
+         std::lock_guard<std::mutex> g(receivedMutex_);
+         received_.clear();
+         receivedOffset_ = 0;
       }
 
       // clear write buffer
@@ -316,18 +323,62 @@ public:
    }
 
 
-   // read one character, ret. is false if no characters are available.
-   bool ReadOneCharacter(char& msg)
+   // Read the characters received so far, up to maxLength; returns the
+   // number read, which is 0 if none are available.
+   size_t ReadAvailable(char* buf, size_t maxLength)
    {
-      bool retval = false;
-      MMThreadGuard g(readBufferLock_);
-      if (0 < data_read_.size())
+      std::lock_guard<std::mutex> g(receivedMutex_);
+      const size_t n = (std::min)(maxLength, received_.size() - receivedOffset_);
+      if (n > 0)
       {
-         retval = true;
-         msg = data_read_.front();
-         data_read_.pop_front();
+         memcpy(buf, &received_[receivedOffset_], n);
+         receivedOffset_ += n;
+         CompactReceived();
+      }
+      return n;
+   }
+
+   // Move received characters to the end of answer until it ends with term,
+   // waiting for more as they arrive until the deadline. Characters after
+   // term stay in the buffer. Also stops once answer holds maxLength
+   // characters. Returns true if term was found. With an empty term, reads
+   // until the deadline.
+   bool ReadUntil(std::string& answer, size_t maxLength, const std::string& term,
+         std::chrono::steady_clock::time_point deadline)
+   {
+      std::unique_lock<std::mutex> lock(receivedMutex_);
+      for (;;)
+      {
+         const size_t available = received_.size() - receivedOffset_;
+         if (available > 0 && answer.size() < maxLength)
+         {
+            const size_t oldSize = answer.size();
+            const size_t n = (std::min)(available, maxLength - oldSize);
+            answer.append(&received_[receivedOffset_], n);
+            receivedOffset_ += n;
+
+            // Search only where the new characters could complete term
+            if (!term.empty())
+            {
+               const size_t from = oldSize >= term.size() ? oldSize - term.size() + 1 : 0;
+               const size_t pos = answer.find(term, from);
+               if (pos != std::string::npos)
+               {
+                  const size_t end = pos + term.size();
+                  receivedOffset_ -= answer.size() - end;
+                  answer.resize(end);
+                  CompactReceived();
+                  return true;
+               }
+            }
+            CompactReceived();
+         }
+         if (answer.size() >= maxLength)
+            return false;
+         if (receivedCondition_.wait_until(lock, deadline) == std::cv_status::timeout &&
+               received_.size() == receivedOffset_)
+            return false;
       }
-      return retval;
    }
 
    void ShutDownInProgress(const bool v){ shutDownInProgress_ = v;};
@@ -340,6 +391,21 @@ private:
    void LogMessage(const char* msg, bool debug) const
    { pSerialPortAdapter_->LogMessage(msg, debug); }
 
+   // Must be called with receivedMutex_ held
+   void CompactReceived()
+   {
+      if (receivedOffset_ == received_.size())
+      {
+         received_.clear();
+         receivedOffset_ = 0;
+      }
+      else if (receivedOffset_ > 4096 && receivedOffset_ > received_.size() / 2)
+      {
+         received_.erase(received_.begin(), received_.begin() + receivedOffset_);
+         receivedOffset_ = 0;
+      }
+   }
+
    static const int max_read_length = 512; // maximum amount of data to read in one operation
    void ReadStart()
    { // Start an asynchronous read and call ReadComplete when it completes or fails
@@ -363,13 +429,11 @@ private:
       if (!error)
       { // read completed, so process the data
          {
-            MMThreadGuard g(readBufferLock_);
-            for(unsigned int ib = 0; ib < bytes_transferred; ++ib)
-            {
-               data_read_.push_back(read_msg_[ib]);
-            }
+            std::lock_guard<std::mutex> g(receivedMutex_);
+            received_.insert(received_.end(), read_msg_, read_msg_ + bytes_transferred);
          }
-         CDeviceUtils::SleepMs(1);
+         // wake up GetAnswer() as soon as anything arrives
+         receivedCondition_.notify_all();
          ReadStart(); // start waiting for another asynchronous read again
       }
       else
@@ -462,11 +526,13 @@ private:
    boost::asio::serial_port serialPortImplementation_; // the serial port this instance is connected to
    char read_msg_[max_read_length]; // data read from the socket
    std::deque< std::vector<char> > write_msgs_; // buffered write data
-   std::deque<char> data_read_;
+   std::vector<char> received_; // data read, not yet consumed from receivedOffset_
+   size_t receivedOffset_;
+   std::mutex receivedMutex_;
+   std::condition_variable receivedCondition_;
    SerialPort* pSerialPortAdapter_;
    std::string device_;
 
-   MMThreadLock readBufferLock_;
    MMThreadLock writeBufferLock_;
    MMThreadLock implementationLock_;
    bool shutDownInProgress_;
@@ -0,0 +1,164 @@
+// Serial port round-trip latency benchmark (POSIX only).
+//
+// Opens a pseudo-terminal pair, connects a SerialPort to the slave side and
+// answers each command received on the master side immediately. Measures
+// SetCommand() followed by GetAnswer(), and the same exchange with a copy of
+// the loop that GetAnswer() used before (one character at a time, sleeping
+// 1 ms whenever nothing has arrived, and searching the whole answer for the
+// terminator after every character). Reports the median and 99th percentile
+// round trip in microseconds.
+//
+// Usage: SerialManager-Bench [iterations]
+
+#include "SerialManager.h"
+
+#include "DeviceUtils.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+
+namespace {
+
+// The terminator search of GetAnswer() before it became event-driven
+int LegacyGetAnswer(SerialPort& port, char* answer, unsigned bufLen, const char* term)
+{
+   memset(answer, 0, bufLen);
+   unsigned long answerOffset = 0;
+   auto start = std::chrono::steady_clock::now();
+   while (std::chrono::steady_clock::now() - start < std::chrono::milliseconds(500))
+   {
+      unsigned char theData;
+      unsigned long read = 0;
+      port.Read(&theData, 1, read);
+      if (read > 0)
+      {
+         if (bufLen <= answerOffset)
+            return ERR_BUFFER_OVERRUN;
+         answer[answerOffset++] = static_cast<char>(theData);
+      }
+      else
+      {
+         CDeviceUtils::SleepMs(1);
+      }
+      char* termPos = strstr(answer, term);
+      if (termPos != 0)
+      {
+         *termPos = '\0';
+         return DEVICE_OK;
+      }
+   }
+   return ERR_TERM_TIMEOUT;
+}
+
+// Plays the device: answers every line received with "OK"
+void Respond(int master, std::atomic<bool>& stop)
+{
+   char buf[256];
+   while (!stop)
+   {
+      pollfd pfd = { master, POLLIN, 0 };
+      if (poll(&pfd, 1, 50) <= 0)
+         continue;
+      ssize_t n = read(master, buf, sizeof(buf));
+      for (ssize_t i = 0; i < n; ++i)
+      {
+         if (buf[i] == '\r')
+         {
+            if (write(master, "OK\r", 3) != 3)
+               return;
+         }
+      }
+   }
+}
+
+void Report(const char* label, std::vector<double>& us)
+{
+   std::sort(us.begin(), us.end());
+   std::printf("  %-32s median %9.1f us   p99 %9.1f us\n", label,
+         us[us.size() / 2], us[us.size() * 99 / 100]);
+}
+
+std::vector<double> Measure(int iterations, const std::function<int()>& roundTrip)
+{
+   std::vector<double> us;
+   for (int i = 0; i < iterations; ++i)
+   {
+      auto start = std::chrono::steady_clock::now();
+      if (roundTrip() != DEVICE_OK)
+      {
+         std::fprintf(stderr, "Round trip failed\n");
+         std::exit(1);
+      }
+      auto end = std::chrono::steady_clock::now();
+      us.push_back(std::chrono::duration<double, std::micro>(end - start).count());
+   }
+   return us;
+}
+
+} // anonymous namespace
+
+
+int main(int argc, char** argv)
+{
+   const int iterations = argc > 1 ? std::atoi(argv[1]) : 1000;
+   if (iterations < 1)
+   {
+      std::fprintf(stderr, "Usage: SerialManager-Bench [iterations]\n");
+      return 1;
+   }
+
+   int master = posix_openpt(O_RDWR | O_NOCTTY);
+   if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0)
+   {
+      std::perror("posix_openpt");
+      return 1;
+   }
+   const std::string slave = ptsname(master);
+
+   // Without a Core, the port logs to stderr; keep that out of the timing
+   std::cerr.rdbuf(0);
+
+   SerialPort port(slave.c_str());
+   if (port.Initialize() != DEVICE_OK)
+   {
+      std::fprintf(stderr, "Cannot open %s\n", slave.c_str());
+      return 1;
+   }
+
+   std::atomic<bool> stop(false);
+   std::thread responder(Respond, master, std::ref(stop));
+
+   char answer[64];
+   std::printf("%d round trips over %s:\n", iterations, slave.c_str());
+   std::vector<double> current = Measure(iterations, [&] {
+      int ret = port.SetCommand("PING", "\r");
+      return ret != DEVICE_OK ? ret : port.GetAnswer(answer, sizeof(answer), "\r");
+   });
+   std::vector<double> legacy = Measure(std::min(iterations, 200), [&] {
+      int ret = port.SetCommand("PING", "\r");
+      return ret != DEVICE_OK ? ret : LegacyGetAnswer(port, answer, sizeof(answer), "\r");
+   });
+   Report("GetAnswer (polling, original)", legacy);
+   Report("GetAnswer", current);
+
+   stop = true;
+   responder.join();
+   port.Shutdown();
+   close(master);
+   return 0;
+}
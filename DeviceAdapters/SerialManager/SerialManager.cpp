@@ -44,6 +44,7 @@
 #include <boost/lexical_cast.hpp>
 #include <boost/thread.hpp>
 
+#include <chrono>
 #include <iostream>
 #include <sstream>
 
@@ -784,68 +785,55 @@ int SerialPort::GetAnswer(char* answer, unsigned bufLen, const char* term)
       LogMessage("BUFFER_OVERRUN error occured!");
       return ERR_BUFFER_OVERRUN;
    }
-   std::ostringstream logMsg;
-   unsigned long answerOffset = 0;
    memset(answer,0,bufLen);
-   char theData = 0;
 
-   MM::MMTime startTime = GetCurrentMMTime();
-   MM::MMTime answerTimeout(answerTimeoutMs_ * 1000.0);
-   MM::MMTime nonTerminatedAnswerTimeout(5.0 * 1000.0); // For bug-compatibility
-   while ((GetCurrentMMTime() - startTime)  < answerTimeout)
-   {
-      bool anyRead =  pPort_->ReadOneCharacter(theData);
-      if (anyRead)
-      {
-         if (bufLen <= answerOffset)
-         {
-            answer[answerOffset] = '\0';
-            LogMessage("BUFFER_OVERRUN error occured!");
-            return ERR_BUFFER_OVERRUN;
-         }
-         answer[answerOffset++] = theData;
-      }
-      else
-      {
-         //Yield to other threads:
-         CDeviceUtils::SleepMs(1);
-      }
-
-      // look for the terminator, if any
-      if (term && term[0])
-      {
-         // check for terminating sequence
-         char* termPos = strstr(answer, term);
-         if (termPos != 0) // found the terminator
-         {
-            LogAsciiCommunication("GetAnswer", true, answer);
-
-            // erase the terminator from the answer:
-            *termPos = '\0';
+   const std::string terminator(term ? term : "");
+   const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+   const std::chrono::microseconds answerTimeout(static_cast<long long>(answerTimeoutMs_ * 1000.0));
+   // For bug-compatibility
+   const std::chrono::microseconds nonTerminatedAnswerTimeout(5 * 1000 * 1000);
+
+   // XXX Shouldn't it be an error to not have a terminator?
+   // TODO Make it a precondition check (immediate error) once we've made
+   // sure that no device adapter calls us without a terminator. For now,
+   // keep the behavior for the sake of bug-compatibility: collect whatever
+   // arrives for 5 s.
+   const bool nonTerminated = terminator.empty() && nonTerminatedAnswerTimeout < answerTimeout;
+   const std::chrono::steady_clock::time_point deadline = startTime +
+      (nonTerminated ? nonTerminatedAnswerTimeout : answerTimeout);
+
+   // Returns as soon as the terminator is received
+   std::string received;
+   bool found = pPort_->ReadUntil(received, bufLen, terminator, deadline);
+   if (found)
+   {
+      LogAsciiCommunication("GetAnswer", true, received);
+
+      // erase the terminator from the answer:
+      memcpy(answer, received.data(), received.size() - terminator.size());
+      return DEVICE_OK;
+   }
 
-            return DEVICE_OK;
-         }
-      }
-      else
-      {
-         // XXX Shouldn't it be an error to not have a terminator?
-         // TODO Make it a precondition check (immediate error) once we've made
-         // sure that no device adapter calls us without a terminator. For now,
-         // keep the behavior for the sake of bug-compatibility.
+   if (received.size() >= bufLen)
+   {
+      memcpy(answer, received.data(), bufLen - 1);
+      LogMessage("BUFFER_OVERRUN error occured!");
+      return ERR_BUFFER_OVERRUN;
+   }
 
-         MM::MMTime elapsed = GetCurrentMMTime() - startTime;
-         if (elapsed > nonTerminatedAnswerTimeout)
-         {
-            LogAsciiCommunication("GetAnswer", true, answer);
-            long millisecs = static_cast<long>(elapsed.getMsec());
-            LogMessage(("GetAnswer without terminator returning after " +
-                     boost::lexical_cast<std::string>(millisecs) +
-                     "msec").c_str(), true);
-            return DEVICE_OK;
-         }
-      }
+   if (nonTerminated)
+   {
+      memcpy(answer, received.data(), received.size());
+      LogAsciiCommunication("GetAnswer", true, received);
+      long millisecs = static_cast<long>(std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::steady_clock::now() - startTime).count());
+      LogMessage(("GetAnswer without terminator returning after " +
+               boost::lexical_cast<std::string>(millisecs) +
+               "msec").c_str(), true);
+      return DEVICE_OK;
    }
 
+   memcpy(answer, received.data(), received.size());
    LogMessage("TERM_TIMEOUT error occured!");
    return ERR_TERM_TIMEOUT;
 }
@@ -893,26 +881,8 @@ int SerialPort::Read(unsigned char* buf, unsigned long bufLen, unsigned long& ch
       memset(buf, 0, bufLen);
       charsRead = 0;
 
-      bool anyRead = false;
-      char theData = 0;
-      for (;;)
-      {
-         anyRead = pPort_->ReadOneCharacter(theData);
-         if (anyRead)
-         {
-            buf[charsRead] = (unsigned char)theData;
-            if (bufLen <= ++charsRead)
-            {
-               // buffer is full
-               break;
-            }
-         }
-         else
-         {
-            // no data was available
-            break;
-         }
-      }
+      charsRead = static_cast<unsigned long>(
+            pPort_->ReadAvailable(reinterpret_cast<char*>(buf), bufLen));
       if (0 < charsRead)
       {
          if (verbose_)
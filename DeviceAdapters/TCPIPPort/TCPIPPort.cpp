@@ -30,6 +30,13 @@
 
 #include "Util.h"
 
+#include <algorithm>
+#include <chrono>
+
+#ifndef _WIN32
+#include <poll.h>
+#endif
+
 using boost::asio::ip::tcp;
 
 const char* deviceName = "TCP/IP serial port adapter";
@@ -91,6 +98,8 @@ ERRH_START
 	if (ec || !sock_.is_open())
 		return ERR_TERM_TIMEOUT;
 
+	// Nothing left over from an earlier connection
+	received_.clear();
 	initialized_ = true;
 
 	if (index_ == GetCount())
@@ -106,6 +115,7 @@ ERRH_START
 
 	sock_.shutdown(tcp::socket::shutdown_both);
 	sock_.close();
+	received_.clear();
 
 	initialized_ = false;
 ERRH_END
@@ -143,6 +153,22 @@ int TCPIPPort::SetCommand(const char* command, const char* term)
 	ERRH_END
 }
 
+// Wait until the socket has data to read, or the timeout passes
+bool TCPIPPort::WaitReadable(std::chrono::microseconds timeout)
+{
+	pollfd pfd;
+	pfd.fd = sock_.native_handle();
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	// Rounded up, so as not to spin for the last fraction of a millisecond
+	const int timeoutMs = static_cast<int>((timeout.count() + 999) / 1000);
+#ifdef _WIN32
+	return WSAPoll(&pfd, 1, timeoutMs) > 0;
+#else
+	return poll(&pfd, 1, timeoutMs) > 0;
+#endif
+}
+
 //mostly copied from SerialManager.cpp (Serialport::GetAnswer)
 int TCPIPPort::GetAnswer(char* txt, unsigned maxChars, const char* term)
 {
@@ -155,73 +181,80 @@ ERRH_START
 		LogMessage("BUFFER_OVERRUN error occured!");
 		return ERR_BUFFER_OVERRUN;
 	}
-	std::ostringstream logMsg;
-	unsigned long answerOffset = 0;
 	memset(txt, 0, maxChars);
-	char theData = 0;
 
-	MM::MMTime startTime = GetCurrentMMTime();
-	MM::MMTime answerTimeout(answerTimeoutMs_ * 1000.0);
-	MM::MMTime nonTerminatedAnswerTimeout(5.0 * 1000.0); // For bug-compatibility
-	while ((GetCurrentMMTime() - startTime) < answerTimeout)
+	const std::string terminator(term ? term : "");
+	const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+	const std::chrono::microseconds answerTimeout(answerTimeoutMs_ * 1000LL);
+	// For bug-compatibility
+	const std::chrono::microseconds nonTerminatedAnswerTimeout(5 * 1000 * 1000);
+
+	// XXX Shouldn't it be an error to not have a terminator?
+	// TODO Make it a precondition check (immediate error) once we've made
+	// sure that no device adapter calls us without a terminator. For now,
+	// keep the behavior for the sake of bug-compatibility.
+	const bool nonTerminated = terminator.empty() && nonTerminatedAnswerTimeout < answerTimeout;
+	const std::chrono::steady_clock::time_point deadline = startTime +
+		(nonTerminated ? nonTerminatedAnswerTimeout : answerTimeout);
+
+	size_t searchFrom = 0;
+	for (;;)
 	{
-		boost::asio::socket_base::bytes_readable command(true);
-		sock_.io_control(command);
-		size_t bytes_readable = command.get();
-
-		if (bytes_readable > 0)
+		// look for the terminator where the new characters could complete it
+		if (!terminator.empty())
 		{
-			sock_.read_some(boost::asio::buffer(&theData, 1));
-
-			if (maxChars <= answerOffset)
+			const size_t pos = received_.find(terminator, searchFrom);
+			if (pos != std::string::npos && pos + terminator.size() <= maxChars)
 			{
-				txt[answerOffset] = '\0';
-				LogMessage("BUFFER_OVERRUN error occured!");
-				return ERR_BUFFER_OVERRUN;
-			}
-			txt[answerOffset++] = theData;
-		}
-		else
-		{
-			//Yield to other threads:
-			CDeviceUtils::SleepMs(1);
-		}
-
-		// look for the terminator, if any
-		if (term && term[0])
-		{
-			// check for terminating sequence
-			char* termPos = strstr(txt, term);
-			if (termPos != 0) // found the terminator
-			{
-				LogAsciiCommunication("GetAnswer", true, txt);
+				LogAsciiCommunication("GetAnswer", true, received_.substr(0, pos + terminator.size()));
 
 				// erase the terminator from the answer:
-				*termPos = '\0';
-
+				memcpy(txt, received_.data(), pos);
+				received_.erase(0, pos + terminator.size());
 				return DEVICE_OK;
 			}
+			if (received_.size() >= terminator.size())
+				searchFrom = received_.size() - terminator.size() + 1;
 		}
-		else
+
+		if (received_.size() >= maxChars)
 		{
-			// XXX Shouldn't it be an error to not have a terminator?
-			// TODO Make it a precondition check (immediate error) once we've made
-			// sure that no device adapter calls us without a terminator. For now,
-			// keep the behavior for the sake of bug-compatibility.
+			memcpy(txt, received_.data(), maxChars - 1);
+			received_.erase(0, maxChars);
+			LogMessage("BUFFER_OVERRUN error occured!");
+			return ERR_BUFFER_OVERRUN;
+		}
 
-			MM::MMTime elapsed = GetCurrentMMTime() - startTime;
-			if (elapsed > nonTerminatedAnswerTimeout)
-			{
-				LogAsciiCommunication("GetAnswer", true, txt);
-				long millisecs = static_cast<long>(elapsed.getMsec());
-				LogMessage(("GetAnswer without terminator returning after " +
-					boost::lexical_cast<std::string>(millisecs) +
-					"msec").c_str(), true);
-				return DEVICE_OK;
-			}
+		const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		if (now >= deadline)
+			break;
+
+		// Returns as soon as anything arrives; read all of it at once
+		if (WaitReadable(std::chrono::duration_cast<std::chrono::microseconds>(deadline - now)))
+		{
+			char chunk[1024];
+			size_t n = sock_.read_some(boost::asio::buffer(chunk,
+						(std::max)(static_cast<size_t>(1), (std::min)(sock_.available(), sizeof(chunk)))));
+			received_.append(chunk, n);
 		}
 	}
 
+	// Hand over what was received, as the character-by-character loop did
+	const size_t n = (std::min)(received_.size(), static_cast<size_t>(maxChars - 1));
+	memcpy(txt, received_.data(), n);
+	received_.erase(0, n);
+
+	if (nonTerminated)
+	{
+		LogAsciiCommunication("GetAnswer", true, txt);
+		long millisecs = static_cast<long>(std::chrono::duration_cast<std::chrono::milliseconds>(
+					std::chrono::steady_clock::now() - startTime).count());
+		LogMessage(("GetAnswer without terminator returning after " +
+			boost::lexical_cast<std::string>(millisecs) +
+			"msec").c_str(), true);
+		return DEVICE_OK;
+	}
+
 	LogMessage("TERM_TIMEOUT error occured!");
 	return ERR_TERM_TIMEOUT;
 	ERRH_END
@@ -250,7 +283,13 @@ int TCPIPPort::Read(unsigned char* buf, unsigned long bufLen, unsigned long& cha
 
 	memset(buf, 0, bufLen);
 
-	charsRead = (unsigned long)boost::asio::read(sock_, boost::asio::buffer(buf, bufLen));
+	// Characters GetAnswer() received after a terminator come first
+	charsRead = (unsigned long)(std::min)(received_.size(), static_cast<size_t>(bufLen));
+	memcpy(buf, received_.data(), charsRead);
+	received_.erase(0, charsRead);
+
+	if (charsRead < bufLen)
+		charsRead += (unsigned long)boost::asio::read(sock_, boost::asio::buffer(buf + charsRead, bufLen - charsRead));
 
 	if (charsRead > 0)
 		LogBinaryCommunication("Read", true, buf, charsRead);
@@ -259,7 +298,17 @@ int TCPIPPort::Read(unsigned char* buf, unsigned long bufLen, unsigned long& cha
 
 int TCPIPPort::Purge()
 {
-	return DEVICE_OK;
+ERRH_START
+	received_.clear();
+	if (!initialized_)
+		return DEVICE_OK;
+
+	// Discard whatever has arrived but was not read
+	char chunk[1024];
+	boost::system::error_code ec;
+	while (sock_.available(ec) > 0 && !ec)
+		sock_.read_some(boost::asio::buffer(chunk, (std::min)(sock_.available(), sizeof(chunk))), ec);
+ERRH_END
 }
 
 int TCPIPPort::OnHost(MM::PropertyBase* pProp, MM::ActionType eAct)
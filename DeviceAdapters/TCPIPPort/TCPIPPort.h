@@ -25,7 +25,9 @@
 
 #include "boost/asio.hpp"
 
+#include <chrono>
 #include <istream>
+#include <string>
 
 #include "MMDevice.h"
 #include "DeviceBase.h"
@@ -84,6 +86,10 @@ private:
 	std::string host_;
 	unsigned short port_;
 	unsigned int answerTimeoutMs_;
+	// Received but not yet returned by GetAnswer() or Read()
+	std::string received_;
+
+	bool WaitReadable(std::chrono::microseconds timeout);
 
 	void LogAsciiCommunication(const char * prefix, bool isInput, const std::string & data);
 	void LogBinaryCommunication(const char* prefix, bool isInput, const unsigned char* content, std::size_t length);
@@ -34,13 +34,104 @@
 
 #include <boost/lexical_cast.hpp>
 #include <algorithm>
+#include <climits>
 
 extern const char* g_DeviceNameMultiCamera;
 extern const char* g_Undefined;
 
+const char* g_SequenceModeIndependent = "Independent";
+const char* g_SequenceModeCombined = "Combined";
+
+
+CameraSnapWorkers::CameraSnapWorkers() :
+   generation_(0),
+   arrived_(0),
+   finished_(0),
+   result_(DEVICE_OK),
+   stop_(false)
+{
+}
+
+CameraSnapWorkers::~CameraSnapWorkers()
+{
+   Stop();
+}
+
+int CameraSnapWorkers::SnapAll(const std::vector<MM::Camera*>& cameras)
+{
+   // A single camera is snapped on the calling thread
+   if (cameras.empty())
+      return DEVICE_OK;
+   if (cameras.size() == 1)
+      return cameras[0]->SnapImage();
+
+   if (threads_.size() != cameras.size())
+   {
+      Stop();
+      for (size_t i = 0; i < cameras.size(); i++)
+         threads_.push_back(std::thread(&CameraSnapWorkers::Run, this, i, generation_));
+   }
+
+   std::unique_lock<std::mutex> lock(mutex_);
+   cameras_ = cameras;
+   arrived_ = 0;
+   finished_ = 0;
+   result_ = DEVICE_OK;
+   ++generation_;
+   startCondition_.notify_all();
+   doneCondition_.wait(lock, [this] { return finished_ == cameras_.size(); });
+   cameras_.clear();
+   return result_;
+}
+
+void CameraSnapWorkers::Stop()
+{
+   {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+   }
+   startCondition_.notify_all();
+   for (size_t i = 0; i < threads_.size(); i++)
+      threads_[i].join();
+   threads_.clear();
+   stop_ = false;
+}
+
+void CameraSnapWorkers::Run(size_t index, unsigned long long generation)
+{
+   std::unique_lock<std::mutex> lock(mutex_);
+   for (;;)
+   {
+      startCondition_.wait(lock, [&] { return stop_ || generation_ != generation; });
+      if (stop_)
+         return;
+      generation = generation_;
+
+      // Wait until every worker is awake, so that the exposures start
+      // together rather than as each thread gets scheduled
+      if (++arrived_ == cameras_.size())
+         startCondition_.notify_all();
+      else
+         startCondition_.wait(lock, [this] { return arrived_ == cameras_.size(); });
+
+      MM::Camera* camera = cameras_[index];
+      lock.unlock();
+      int ret = camera->SnapImage();
+      lock.lock();
+
+      if (ret != DEVICE_OK && result_ == DEVICE_OK)
+         result_ = ret;
+      if (++finished_ == cameras_.size())
+         doneCondition_.notify_one();
+   }
+}
+
 
 MultiCamera::MultiCamera() :
-   imageBuffer_(0),
+   width_(0),
+   height_(0),
+   bytesPerPixel_(0),
+   combinedSequence_(false),
    nrCamerasInUse_(0),
    initialized_(false)
 {
@@ -69,7 +160,9 @@ MultiCamera::~MultiCamera()
 
 int MultiCamera::Shutdown()
 {
-   delete imageBuffer_;
+   // Stop a combined sequence; physical cameras are left alone
+   CCameraBase<MultiCamera>::StopSequenceAcquisition();
+   snapWorkers_.Stop();
    // Rely on the cameras to shut themselves down
    return DEVICE_OK;
 }
@@ -118,6 +211,15 @@ int MultiCamera::Initialize()
    CPropertyAction* pAct = new CPropertyAction(this, &MultiCamera::OnBinning);
    CreateProperty(MM::g_Keyword_Binning, "1", MM::Integer, false, pAct, false);
 
+   // Independent: each physical camera runs its own sequence and inserts its
+   // images into the Core's buffer. Combined: the physical cameras are
+   // snapped together for each frame, and their images are inserted as the
+   // channels of one multi-channel image.
+   pAct = new CPropertyAction(this, &MultiCamera::OnSequenceMode);
+   CreateProperty("Sequence Mode", g_SequenceModeIndependent, MM::String, false, pAct, false);
+   AddAllowedValue("Sequence Mode", g_SequenceModeIndependent);
+   AddAllowedValue("Sequence Mode", g_SequenceModeCombined);
+
    initialized_ = true;
 
    return DEVICE_OK;
@@ -130,26 +232,16 @@ void MultiCamera::GetName(char* name) const
 
 int MultiCamera::SnapImage()
 {
-   if (nrCamerasInUse_ < 1)
-      return ERR_NO_PHYSICAL_CAMERA;
+   std::vector<MM::Camera*> cameras;
+   int ret = GetChannelCameras(cameras);
+   if (ret != DEVICE_OK)
+      return ret;
 
+   UpdateGeometry(cameras);
    if (!ImageSizesAreEqual())
       return ERR_NO_EQUAL_SIZE;
 
-   CameraSnapThread t[MAX_NUMBER_PHYSICAL_CAMERAS];
-   for (unsigned int i = 0; i < usedCameras_.size(); i++)
-   {
-      MM::Camera* camera = (MM::Camera*)GetDevice(usedCameras_[i].c_str());
-      if (camera != 0)
-      {
-         t[i].SetCamera(camera);
-         t[i].Start();
-      }
-   }
-   // I think that the CameraSnapThread destructor waits until the SnapImage function is done
-   // So, we are likely to be waiting here until all cameras are done snapping
-
-   return DEVICE_OK;
+   return snapWorkers_.SnapAll(cameras);
 }
 
 /**
@@ -165,53 +257,52 @@ const unsigned char* MultiCamera::GetImageBuffer()
 
 const unsigned char* MultiCamera::GetImageBuffer(unsigned channelNr)
 {
-   // We have a vector of physicalCameras, and a vector of Strings listing the cameras
-   // we actually use.  
-   int j = -1;
-   unsigned height = GetImageHeight();
-   unsigned width = GetImageWidth();
-   unsigned pixDepth = GetImageBytesPerPixel();
-   for (unsigned int i = 0; i < usedCameras_.size(); i++)
+   int physical = Logical2Physical(channelNr);
+   MM::Camera* camera = physical >= 0 ? GetPhysicalCamera(physical) : 0;
+   if (camera == 0)
+      return 0;
+
+   // Sizes are read at each snap; before the first one, there is nothing to pad
+   if (channelNr >= cameraWidths_.size())
+      return camera->GetImageBuffer();
+   const unsigned thisWidth = cameraWidths_[channelNr];
+   const unsigned thisHeight = cameraHeights_[channelNr];
+   if (thisWidth == width_ && thisHeight == height_)
+      return camera->GetImageBuffer();
+
+   // Smaller images are padded to the largest size, once per snap
+   if (!paddedValid_[channelNr])
    {
-      MM::Camera* camera = (MM::Camera*)GetDevice(usedCameras_[i].c_str());
-      if (usedCameras_[i] != g_Undefined)
-         j++;
-      if (j == (int)channelNr)
+      ImgBuffer& img = paddedImages_[channelNr];
+      img.Resize(width_, height_, bytesPerPixel_);
+      img.ResetPixels();
+      const unsigned char* pixels = camera->GetImageBuffer();
+      if (pixels == 0)
+         return 0;
+      const unsigned rowBytes = thisWidth * bytesPerPixel_;
+      if (thisWidth == width_)
       {
-         unsigned thisHeight = camera->GetImageHeight();
-         unsigned thisWidth = camera->GetImageWidth();
-         if (height == thisHeight && width == thisWidth)
-            return camera->GetImageBuffer();
-         else
-         {
-            img_.Resize(width, height, pixDepth);
-            img_.ResetPixels();
-            if (width == thisWidth)
-            {
-               memcpy(img_.GetPixelsRW(), camera->GetImageBuffer(), thisHeight * thisWidth * pixDepth);
-            }
-            else
-            {
-               // we need to copy line by line
-               const unsigned char* pixels = camera->GetImageBuffer();
-               for (unsigned k = 0; k < thisHeight; k++)
-               {
-                  memcpy(img_.GetPixelsRW() + k * width, pixels + k * thisWidth, thisWidth);
-               }
-            }
-            return img_.GetPixels();
-         }
+         memcpy(img.GetPixelsRW(), pixels, thisHeight * rowBytes);
+      }
+      else
+      {
+         for (unsigned k = 0; k < thisHeight; k++)
+            memcpy(img.GetPixelsRW() + k * width_ * bytesPerPixel_, pixels + k * rowBytes, rowBytes);
       }
+      paddedValid_[channelNr] = true;
    }
-   return 0;
+   return paddedImages_[channelNr].GetPixels();
 }
 
 bool MultiCamera::IsCapturing()
 {
-   std::vector<std::string>::iterator iter;
-   for (iter = usedCameras_.begin(); iter != usedCameras_.end(); iter++) {
-      MM::Camera* camera = (MM::Camera*)GetDevice((*iter).c_str());
-      if ((camera != 0) && camera->IsCapturing())
+   if (CCameraBase<MultiCamera>::IsCapturing())
+      return true;
+
+   std::vector<MM::Camera*> cameras;
+   GetChannelCameras(cameras);
+   for (unsigned int i = 0; i < cameras.size(); i++) {
+      if (cameras[i]->IsCapturing())
          return true;
    }
 
@@ -223,21 +314,13 @@ bool MultiCamera::IsCapturing()
  */
 unsigned MultiCamera::GetImageWidth() const
 {
-   // TODO: should we use cached width?
-   // If so, when do we cache?
-   // Since this function is const, we can not cache the width found
+   // Physical cameras can change size through their own properties without
+   // MultiCamera knowing, so ask them rather than use the cached sizes
+   std::vector<MM::Camera*> cameras;
+   GetChannelCameras(cameras);
    unsigned width = 0;
-   unsigned int j = 0;
-   while (j < usedCameras_.size())
-   {
-      MM::Camera* camera = (MM::Camera*)GetDevice(usedCameras_[j].c_str());
-      if (camera != 0) {
-         unsigned tmp = camera->GetImageWidth();
-         if (tmp > width)
-            width = tmp;
-      }
-      j++;
-   }
+   for (unsigned int i = 0; i < cameras.size(); i++)
+      width = (std::max)(width, cameras[i]->GetImageWidth());
 
    return width;
 }
@@ -247,19 +330,11 @@ unsigned MultiCamera::GetImageWidth() const
  */
 unsigned MultiCamera::GetImageHeight() const
 {
+   std::vector<MM::Camera*> cameras;
+   GetChannelCameras(cameras);
    unsigned height = 0;
-   unsigned int j = 0;
-   while (j < usedCameras_.size())
-   {
-      MM::Camera* camera = (MM::Camera*)GetDevice(usedCameras_[j].c_str());
-      if (camera != 0)
-      {
-         unsigned tmp = camera->GetImageHeight();
-         if (tmp > height)
-            height = tmp;
-      }
-      j++;
-   }
+   for (unsigned int i = 0; i < cameras.size(); i++)
+      height = (std::max)(height, cameras[i]->GetImageHeight());
 
    return height;
 }
@@ -269,147 +344,167 @@ unsigned MultiCamera::GetImageHeight() const
  * Returns true if image sizes of all available cameras are identical
  * false otherwise
  * edge case: if we have no or one camera, their sizes are equal
+ * Uses the sizes read by the last UpdateGeometry()
  */
 bool MultiCamera::ImageSizesAreEqual() {
-   unsigned height = 0;
-   unsigned width = 0;
-   for (unsigned int i = 0; i < usedCameras_.size(); i++) {
-      MM::Camera* camera = (MM::Camera*)GetDevice(usedCameras_[i].c_str());
-      if (camera != 0)
-      {
-         height = camera->GetImageHeight();
-         width = camera->GetImageWidth();
-      }
+   for (unsigned int i = 1; i < cameraWidths_.size(); i++) {
+      if (cameraWidths_[i] != cameraWidths_[0] || cameraHeights_[i] != cameraHeights_[0])
+         return false;
    }
+   return true;
+}
 
-   for (unsigned int i = 0; i < usedCameras_.size(); i++) {
-      MM::Camera* camera = (MM::Camera*)GetDevice(usedCameras_[i].c_str());
+/**
+ * Reads the image size of each camera in use, and resets the padded copies
+ * of the previous snap
+ */
+void MultiCamera::UpdateGeometry(const std::vector<MM::Camera*>& cameras)
+{
+   const size_t n = cameras.size();
+   cameraWidths_.resize(n);
+   cameraHeights_.resize(n);
+   width_ = 0;
+   height_ = 0;
+   for (size_t i = 0; i < n; i++)
+   {
+      cameraWidths_[i] = cameras[i]->GetImageWidth();
+      cameraHeights_[i] = cameras[i]->GetImageHeight();
+      width_ = (std::max)(width_, cameraWidths_[i]);
+      height_ = (std::max)(height_, cameraHeights_[i]);
+   }
+   bytesPerPixel_ = GetImageBytesPerPixel();
+   paddedImages_.resize(n);
+   paddedValid_.assign(n, false);
+}
+
+/**
+ * Looks up the camera named by Physical Camera property i (0 if undefined
+ * or no longer loaded). Cameras can be unloaded at any time, so the
+ * pointer is only used for the operation at hand.
+ */
+MM::Camera* MultiCamera::GetPhysicalCamera(unsigned i) const
+{
+   if (i >= usedCameras_.size() || usedCameras_[i] == g_Undefined)
+      return 0;
+   MM::Device* device = GetDevice(usedCameras_[i].c_str());
+   if (device == 0 || device->GetType() != MM::CameraDevice)
+      return 0;
+   return static_cast<MM::Camera*>(device);
+}
+
+/**
+ * Looks up the cameras in use, in channel order. Returns an error if there
+ * are none, or if one of them is no longer loaded (cameras holds the
+ * others).
+ */
+int MultiCamera::GetChannelCameras(std::vector<MM::Camera*>& cameras) const
+{
+   cameras.clear();
+   bool missing = false;
+   for (unsigned int i = 0; i < usedCameras_.size(); i++)
+   {
+      if (usedCameras_[i] == g_Undefined)
+         continue;
+      MM::Camera* camera = GetPhysicalCamera(i);
       if (camera != 0)
-      {
-         if (height != camera->GetImageHeight())
-            return false;
-         if (width != camera->GetImageWidth())
-            return false;
-      }
+         cameras.push_back(camera);
+      else
+         missing = true;
    }
-   return true;
+   if (missing)
+      return ERR_INVALID_DEVICE_NAME;
+   if (cameras.empty())
+      return ERR_NO_PHYSICAL_CAMERA;
+   return DEVICE_OK;
 }
 
 unsigned MultiCamera::GetImageBytesPerPixel() const
 {
-   MM::Camera* camera0 = (MM::Camera*)GetDevice(usedCameras_[0].c_str());
-   if (camera0 != 0)
+   std::vector<MM::Camera*> cameras;
+   GetChannelCameras(cameras);
+   if (cameras.empty())
+      return 0;
+   unsigned bytes = cameras[0]->GetImageBytesPerPixel();
+   for (unsigned int i = 1; i < cameras.size(); i++)
    {
-      unsigned bytes = camera0->GetImageBytesPerPixel();
-      for (unsigned int i = 1; i < usedCameras_.size(); i++)
-      {
-         MM::Camera* camera = (MM::Camera*)GetDevice(usedCameras_[i].c_str());
-         if (camera != 0)
-            if (bytes != camera->GetImageBytesPerPixel())
-               return 0;
-      }
-      return bytes;
+      if (bytes != cameras[i]->GetImageBytesPerPixel())
+         return 0;
    }
-   return 0;
+   return bytes;
 }
 
 unsigned MultiCamera::GetBitDepth() const
 {
+   std::vector<MM::Camera*> cameras;
+   GetChannelCameras(cameras);
    // Return the maximum bit depth found in all channels.
-   MM::Camera* camera0 = (MM::Camera*)GetDevice(usedCameras_[0].c_str());
-   if (camera0 != 0)
-   {
-      unsigned bitDepth = 0;
-      for (unsigned int i = 0; i < usedCameras_.size(); i++)
-      {
-         MM::Camera* camera = (MM::Camera*)GetDevice(usedCameras_[i].c_str());
-         if (camera != 0)
-         {
-            unsigned nextBitDepth = camera->GetBitDepth();
-            if (nextBitDepth > bitDepth)
-            {
-               bitDepth = nextBitDepth;
-            }
-         }
-      }
-      return bitDepth;
-   }
-   return 0;
+   unsigned bitDepth = 0;
+   for (unsigned int i = 0; i < cameras.size(); i++)
+      bitDepth = (std::max)(bitDepth, cameras[i]->GetBitDepth());
+   return bitDepth;
 }
 
 long MultiCamera::GetImageBufferSize() const
 {
+   std::vector<MM::Camera*> cameras;
+   GetChannelCameras(cameras);
    long maxSize = 0;
-   int unsigned counter = 0;
-   for (unsigned int i = 0; i < usedCameras_.size(); i++)
-   {
-      MM::Camera* camera = (MM::Camera*)GetDevice(usedCameras_[i].c_str());
-      if (camera != 0)
-      {
-         counter++;
-         long tmp = camera->GetImageBufferSize();
-         if (tmp > maxSize)
-            maxSize = tmp;
-      }
-   }
+   for (unsigned int i = 0; i < cameras.size(); i++)
+      maxSize = (std::max)(maxSize, cameras[i]->GetImageBufferSize());
 
-   return counter * maxSize;
+   return static_cast<long>(cameras.size()) * maxSize;
 }
 
 double MultiCamera::GetExposure() const
 {
-   MM::Camera* camera0 = (MM::Camera*)GetDevice(usedCameras_[0].c_str());
-   if (camera0 != 0)
+   std::vector<MM::Camera*> cameras;
+   GetChannelCameras(cameras);
+   if (cameras.empty())
+      return 0.0;
+   double exposure = cameras[0]->GetExposure();
+   for (unsigned int i = 1; i < cameras.size(); i++)
    {
-      double exposure = camera0->GetExposure();
-      for (unsigned int i = 1; i < usedCameras_.size(); i++)
-      {
-         MM::Camera* camera = (MM::Camera*)GetDevice(usedCameras_[i].c_str());
-         if (camera != 0)
-            if (exposure != camera->GetExposure())
-               return 0;
-      }
-      return exposure;
+      if (exposure != cameras[i]->GetExposure())
+         return 0;
    }
-   return 0.0;
+   return exposure;
 }
 
 void MultiCamera::SetExposure(double exp)
 {
+   std::vector<MM::Camera*> cameras;
+   GetChannelCameras(cameras);
    if (exp > 0.0)
    {
-      for (unsigned int i = 0; i < usedCameras_.size(); i++)
-      {
-         MM::Camera* camera = (MM::Camera*)GetDevice(usedCameras_[i].c_str());
-         if (camera != 0)
-            camera->SetExposure(exp);
-      }
+      for (unsigned int i = 0; i < cameras.size(); i++)
+         cameras[i]->SetExposure(exp);
    }
 }
 
 int MultiCamera::SetROI(unsigned x, unsigned y, unsigned xSize, unsigned ySize)
 {
-   for (unsigned int i = 0; i < usedCameras_.size(); i++)
+   std::vector<MM::Camera*> cameras;
+   int lookup = GetChannelCameras(cameras);
+   if (lookup != DEVICE_OK)
+      return lookup;
+   for (unsigned int i = 0; i < cameras.size(); i++)
    {
-      MM::Camera* camera = (MM::Camera*)GetDevice(usedCameras_[i].c_str());
       // TODO: deal with case when CCD size are not identical
-      if (camera != 0)
-      {
-         int ret = camera->SetROI(x, y, xSize, ySize);
-         if (ret != DEVICE_OK)
-            return ret;
-      }
+      int ret = cameras[i]->SetROI(x, y, xSize, ySize);
+      if (ret != DEVICE_OK)
+         return ret;
    }
    return DEVICE_OK;
 }
 
 int MultiCamera::GetROI(unsigned& x, unsigned& y, unsigned& xSize, unsigned& ySize)
 {
-   MM::Camera* camera0 = (MM::Camera*)GetDevice(usedCameras_[0].c_str());
+   std::vector<MM::Camera*> cameras;
+   GetChannelCameras(cameras);
    // TODO: check if ROI is same on all cameras
-   if (camera0 != 0)
+   if (!cameras.empty())
    {
-      int ret = camera0->GetROI(x, y, xSize, ySize);
+      int ret = cameras[0]->GetROI(x, y, xSize, ySize);
       if (ret != DEVICE_OK)
          return ret;
    }
@@ -419,15 +514,15 @@ int MultiCamera::GetROI(unsigned& x, unsigned& y, unsigned& xSize, unsigned& ySi
 
 int MultiCamera::ClearROI()
 {
-   for (unsigned int i = 0; i < usedCameras_.size(); i++)
+   std::vector<MM::Camera*> cameras;
+   int lookup = GetChannelCameras(cameras);
+   if (lookup != DEVICE_OK)
+      return lookup;
+   for (unsigned int i = 0; i < cameras.size(); i++)
    {
-      MM::Camera* camera = (MM::Camera*)GetDevice(usedCameras_[i].c_str());
-      if (camera != 0)
-      {
-         int ret = camera->ClearROI();
-         if (ret != DEVICE_OK)
-            return ret;
-      }
+      int ret = cameras[i]->ClearROI();
+      if (ret != DEVICE_OK)
+         return ret;
    }
 
    return DEVICE_OK;
@@ -435,18 +530,20 @@ int MultiCamera::ClearROI()
 
 int MultiCamera::PrepareSequenceAcqusition()
 {
-   if (nrCamerasInUse_ < 1)
-      return ERR_NO_PHYSICAL_CAMERA;
+   std::vector<MM::Camera*> cameras;
+   int lookup = GetChannelCameras(cameras);
+   if (lookup != DEVICE_OK)
+      return lookup;
 
-   for (unsigned int i = 0; i < usedCameras_.size(); i++)
+   // In combined mode the physical cameras only snap
+   if (combinedSequence_)
+      return DEVICE_OK;
+
+   for (unsigned int i = 0; i < cameras.size(); i++)
    {
-      MM::Camera* camera = (MM::Camera*)GetDevice(usedCameras_[i].c_str());
-      if (camera != 0)
-      {
-         int ret = camera->PrepareSequenceAcqusition();
-         if (ret != DEVICE_OK)
-            return ret;
-      }
+      int ret = cameras[i]->PrepareSequenceAcqusition();
+      if (ret != DEVICE_OK)
+         return ret;
    }
 
    return DEVICE_OK;
@@ -454,15 +551,20 @@ int MultiCamera::PrepareSequenceAcqusition()
 
 int MultiCamera::StartSequenceAcquisition(double interval)
 {
-   if (nrCamerasInUse_ < 1)
-      return ERR_NO_PHYSICAL_CAMERA;
+   if (combinedSequence_)
+      return StartSequenceAcquisition(LONG_MAX, interval, false);
 
+   std::vector<MM::Camera*> cameras;
+   int lookup = GetChannelCameras(cameras);
+   if (lookup != DEVICE_OK)
+      return lookup;
+   UpdateGeometry(cameras);
    if (!ImageSizesAreEqual())
       return ERR_NO_EQUAL_SIZE;
 
    for (unsigned int i = 0; i < usedCameras_.size(); i++)
    {
-      MM::Camera* camera = (MM::Camera*)GetDevice(usedCameras_[i].c_str());
+      MM::Camera* camera = GetPhysicalCamera(i);
       if (camera != 0)
       {
          std::ostringstream os;
@@ -482,27 +584,37 @@ int MultiCamera::StartSequenceAcquisition(double interval)
 
 int MultiCamera::StartSequenceAcquisition(long numImages, double interval_ms, bool stopOnOverflow)
 {
-   if (nrCamerasInUse_ < 1)
-      return ERR_NO_PHYSICAL_CAMERA;
+   std::vector<MM::Camera*> cameras;
+   int lookup = GetChannelCameras(cameras);
+   if (lookup != DEVICE_OK)
+      return lookup;
 
-   for (unsigned int i = 0; i < usedCameras_.size(); i++)
+   if (combinedSequence_)
    {
-      MM::Camera* camera = (MM::Camera*)GetDevice(usedCameras_[i].c_str());
-      if (camera != 0)
-      {
-         int ret = camera->StartSequenceAcquisition(numImages, interval_ms, stopOnOverflow);
-         if (ret != DEVICE_OK)
-            return ret;
-      }
+      UpdateGeometry(cameras);
+      if (!ImageSizesAreEqual())
+         return ERR_NO_EQUAL_SIZE;
+      // The sequence thread calls SnapImage() and InsertImage() per frame
+      return CCameraBase<MultiCamera>::StartSequenceAcquisition(numImages, interval_ms, stopOnOverflow);
+   }
+
+   for (unsigned int i = 0; i < cameras.size(); i++)
+   {
+      int ret = cameras[i]->StartSequenceAcquisition(numImages, interval_ms, stopOnOverflow);
+      if (ret != DEVICE_OK)
+         return ret;
    }
    return DEVICE_OK;
 }
 
 int MultiCamera::StopSequenceAcquisition()
 {
+   if (CCameraBase<MultiCamera>::IsCapturing())
+      return CCameraBase<MultiCamera>::StopSequenceAcquisition();
+
    for (unsigned int i = 0; i < usedCameras_.size(); i++)
    {
-      MM::Camera* camera = (MM::Camera*)GetDevice(usedCameras_[i].c_str());
+      MM::Camera* camera = GetPhysicalCamera(i);
       if (camera != 0)
       {
          int ret = camera->StopSequenceAcquisition();
@@ -521,35 +633,69 @@ int MultiCamera::StopSequenceAcquisition()
    return DEVICE_OK;
 }
 
+/**
+ * Combined sequence mode: inserts the images of the snap just taken as the
+ * channels of one image
+ */
+int MultiCamera::InsertImage()
+{
+   std::vector<MM::Camera*> cameras;
+   int lookup = GetChannelCameras(cameras);
+   if (lookup != DEVICE_OK)
+      return lookup;
+
+   const size_t channelSize = (size_t)width_ * height_ * bytesPerPixel_;
+   combinedImage_.resize(channelSize * cameras.size());
+   for (unsigned int i = 0; i < cameras.size(); i++)
+   {
+      const unsigned char* pixels = cameras[i]->GetImageBuffer();
+      if (pixels == 0)
+         return DEVICE_ERR;
+      memcpy(&combinedImage_[i * channelSize], pixels, channelSize);
+   }
+
+   char label[MM::MaxStrLength];
+   GetLabel(label);
+   Metadata md;
+   md.PutImageTag("Camera", label);
+   int ret = GetCoreCallback()->InsertMultiChannel(this, &combinedImage_[0],
+         nrCamerasInUse_, width_, height_, bytesPerPixel_, &md);
+   if (!isStopOnOverflow() && ret == DEVICE_BUFFER_OVERFLOW)
+   {
+      // do not stop on overflow - just reset the buffer
+      GetCoreCallback()->ClearImageBuffer(this);
+      ret = GetCoreCallback()->InsertMultiChannel(this, &combinedImage_[0],
+            nrCamerasInUse_, width_, height_, bytesPerPixel_, &md);
+   }
+   return ret;
+}
+
 int MultiCamera::GetBinning() const
 {
-   MM::Camera* camera0 = (MM::Camera*)GetDevice(usedCameras_[0].c_str());
-   int binning = 0;
-   if (camera0 != 0)
-      binning = camera0->GetBinning();
-   for (unsigned int i = 0; i < usedCameras_.size(); i++)
+   std::vector<MM::Camera*> cameras;
+   GetChannelCameras(cameras);
+   if (cameras.empty())
+      return 0;
+   int binning = cameras[0]->GetBinning();
+   for (unsigned int i = 1; i < cameras.size(); i++)
    {
-      MM::Camera* camera = (MM::Camera*)GetDevice(usedCameras_[i].c_str());
-      if (camera != 0)
-      {
-         if (binning != camera->GetBinning())
-            return 0;
-      }
+      if (binning != cameras[i]->GetBinning())
+         return 0;
    }
    return binning;
 }
 
 int MultiCamera::SetBinning(int bS)
 {
-   for (unsigned int i = 0; i < usedCameras_.size(); i++)
+   std::vector<MM::Camera*> cameras;
+   int lookup = GetChannelCameras(cameras);
+   if (lookup != DEVICE_OK)
+      return lookup;
+   for (unsigned int i = 0; i < cameras.size(); i++)
    {
-      MM::Camera* camera = (MM::Camera*)GetDevice(usedCameras_[i].c_str());
-      if (camera != 0)
-      {
-         int ret = camera->SetBinning(bS);
-         if (ret != DEVICE_OK)
-            return ret;
-      }
+      int ret = cameras[i]->SetBinning(bS);
+      if (ret != DEVICE_OK)
+         return ret;
    }
    return DEVICE_OK;
 }
@@ -605,7 +751,10 @@ int MultiCamera::OnPhysicalCamera(MM::PropertyBase* pProp, MM::ActionType eAct,
 
    else if (eAct == MM::AfterSet)
    {
-      MM::Camera* camera = (MM::Camera*)GetDevice(usedCameras_[i].c_str());
+      if (IsCapturing())
+         return DEVICE_CAMERA_BUSY_ACQUIRING;
+
+      MM::Camera* camera = GetPhysicalCamera(i);
       if (camera != 0)
       {
          camera->RemoveTag(MM::g_Keyword_CameraChannelName);
@@ -619,7 +768,9 @@ int MultiCamera::OnPhysicalCamera(MM::PropertyBase* pProp, MM::ActionType eAct,
          usedCameras_[i] = g_Undefined;
       }
       else {
-         camera = (MM::Camera*)GetDevice(cameraName.c_str());
+         MM::Device* device = GetDevice(cameraName.c_str());
+         camera = (device != 0 && device->GetType() == MM::CameraDevice) ?
+            static_cast<MM::Camera*>(device) : 0;
          if (camera != 0) {
             usedCameras_[i] = cameraName;
             std::ostringstream os;
@@ -633,14 +784,16 @@ int MultiCamera::OnPhysicalCamera(MM::PropertyBase* pProp, MM::ActionType eAct,
             return ERR_INVALID_DEVICE_NAME;
       }
       nrCamerasInUse_ = 0;
-      for (unsigned int usedCameraCounter = 0; usedCameraCounter < usedCameras_.size(); usedCameraCounter++)
+      for (unsigned int j = 0; j < usedCameras_.size(); j++)
       {
-         if (usedCameras_[usedCameraCounter] != g_Undefined)
+         if (usedCameras_[j] != g_Undefined)
             nrCamerasInUse_++;
       }
+      cameraWidths_.clear();
+      cameraHeights_.clear();
 
       // TODO: Set allowed binning values correctly
-      MM::Camera* camera0 = (MM::Camera*)GetDevice(usedCameras_[0].c_str());
+      MM::Camera* camera0 = GetPhysicalCamera(0);
       if (camera0 != 0)
       {
          ClearAllowedValues(MM::g_Keyword_Binning);
@@ -674,4 +827,20 @@ int MultiCamera::OnBinning(MM::PropertyBase* pProp, MM::ActionType eAct)
    return DEVICE_OK;
 }
 
+int MultiCamera::OnSequenceMode(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set(combinedSequence_ ? g_SequenceModeCombined : g_SequenceModeIndependent);
+   }
+   else if (eAct == MM::AfterSet)
+   {
+      if (IsCapturing())
+         return DEVICE_CAMERA_BUSY_ACQUIRING;
+      std::string mode;
+      pProp->Get(mode);
+      combinedSequence_ = (mode == g_SequenceModeCombined);
+   }
+   return DEVICE_OK;
+}
 
@@ -29,6 +29,9 @@
 #include "ImgBuffer.h"
 #include <string>
 #include <map>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 
 //////////////////////////////////////////////////////////////////////////////
 // Error codes
@@ -111,27 +114,36 @@ private:
 };
 
 /**
- * CameraSnapThread: helper thread for MultiCamera
+ * CameraSnapWorkers: one persistent thread per physical camera of a
+ * MultiCamera. The threads of a snap wait for each other before calling
+ * SnapImage, so that the exposures start together.
  */
-class CameraSnapThread : public MMDeviceThreadBase
+class CameraSnapWorkers
 {
-   public:
-      CameraSnapThread() :
-         camera_(0),
-         started_(false)
-      {}
-
-      ~CameraSnapThread() { if (started_) wait(); }
-
-      void SetCamera(MM::Camera* camera) { camera_ = camera; }
-
-      int svc() { camera_->SnapImage(); return 0; }
+public:
+   CameraSnapWorkers();
+   ~CameraSnapWorkers();
 
-      void Start() { activate(); started_ = true; }
+   // Snaps the cameras together and waits for them; returns the first
+   // error. The cameras are only used during the call. Threads are kept for
+   // the next call with the same number of cameras.
+   int SnapAll(const std::vector<MM::Camera*>& cameras);
+   // Ends the threads
+   void Stop();
 
-   private:
-      MM::Camera* camera_;
-      bool started_;
+private:
+   void Run(size_t index, unsigned long long generation);
+
+   std::vector<MM::Camera*> cameras_;
+   std::vector<std::thread> threads_;
+   std::mutex mutex_;
+   std::condition_variable startCondition_;
+   std::condition_variable doneCondition_;
+   unsigned long long generation_;
+   size_t arrived_;
+   size_t finished_;
+   int result_;
+   bool stop_;
 };
 
 /*
@@ -177,19 +189,35 @@ public:
    // ---------------
    int OnPhysicalCamera(MM::PropertyBase* pProp, MM::ActionType eAct, long nr);
    int OnBinning(MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnSequenceMode(MM::PropertyBase* pProp, MM::ActionType eAct);
+
+protected:
+   int InsertImage();
 
 private:
    int Logical2Physical(int logical);
    bool ImageSizesAreEqual();
-   unsigned char* imageBuffer_;
+   MM::Camera* GetPhysicalCamera(unsigned i) const;
+   int GetChannelCameras(std::vector<MM::Camera*>& cameras) const;
+   void UpdateGeometry(const std::vector<MM::Camera*>& cameras);
 
    std::vector<std::string> availableCameras_;
    std::vector<std::string> usedCameras_;
-   std::vector<int> cameraWidths_;
-   std::vector<int> cameraHeights_;
+   CameraSnapWorkers snapWorkers_;
+   // Image sizes of the channels, read at each snap and sequence start
+   std::vector<unsigned> cameraWidths_;
+   std::vector<unsigned> cameraHeights_;
+   unsigned width_;
+   unsigned height_;
+   unsigned bytesPerPixel_;
+   // Channels of the last snap padded to width_ x height_, made on demand
+   std::vector<ImgBuffer> paddedImages_;
+   std::vector<bool> paddedValid_;
+   // Channels interleaved for the Core in combined sequence mode
+   std::vector<unsigned char> combinedImage_;
+   bool combinedSequence_;
    unsigned int nrCamerasInUse_;
    bool initialized_;
-   ImgBuffer img_;
 };
 
 
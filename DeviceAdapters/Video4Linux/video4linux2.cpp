@@ -308,6 +308,41 @@ public:
     return DEVICE_OK;
   }
 
+  // called for each frame of a sequence acquisition; converts the frame
+  // straight into the core's sequence buffer instead of going through
+  // imageBuffer
+  int ThreadRun()
+  {
+    char label[MM::MaxStrLength];
+    GetLabel(label);
+    BinaryMetadata md;
+    md.PutImageTag("Camera", label);
+
+    unsigned char* data = VideoTakeBuffer();
+
+    unsigned char* pixels = 0;
+    int ret = GetCoreCallback()->AcquireImageWriteSlot(this, GetImageWidth(),
+        GetImageHeight(), GetImageBytesPerPixel(), &pixels);
+    if (!isStopOnOverflow() && ret == DEVICE_BUFFER_OVERFLOW)
+    {
+      // do not stop on overflow - just reset the buffer
+      GetCoreCallback()->ClearImageBuffer(this);
+      ret = GetCoreCallback()->AcquireImageWriteSlot(this, GetImageWidth(),
+          GetImageHeight(), GetImageBytesPerPixel(), &pixels);
+    }
+    if (ret != DEVICE_OK) {
+      VideoReturnBuffer();
+      return ret;
+    }
+
+    pixelType->convertV4l2ToOutput(state, data, pixels);
+    VideoReturnBuffer();
+
+    return GetCoreCallback()->CommitImageWriteSlot(this, pixels,
+        GetNumberOfComponents(), md.GetRecords(),
+        static_cast<unsigned>(md.GetRecordsSize()));
+  }
+
   // waits for camera readout
   const unsigned char* GetImageBuffer()
   {
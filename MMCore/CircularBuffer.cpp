@@ -25,14 +25,15 @@
 // 
 #include "CircularBuffer.h"
 #include "CoreUtils.h"
+#include "FrameSlab.h"
+#include "SpillFile.h"
 
 #include "TaskSet_CopyMemory.h"
 
 #include "../MMDevice/DeviceUtils.h"
 
+#include <algorithm>
 #include <chrono>
-#include <cstdio>
-#include <ctime>
 #include <memory>
 #include <string>
 
@@ -45,22 +46,83 @@ const long adjustThreshold = LONG_MAX / 2;
 // division by zero can be added.
 const unsigned long maxCBSize = 10000000;
 
-CircularBuffer::CircularBuffer(unsigned int memorySizeMB) :
+const unsigned long slotsPerChunk = 1024;
+
+CircularBuffer::CircularBuffer(unsigned int memorySizeMB, std::shared_ptr<ThreadPool> pool, bool hugePages, bool prefault,
+      const std::string& spillDirectory, unsigned spillSizeMB) :
    width_(0), 
    height_(0), 
    pixDepth_(0), 
    imageCounter_(0), 
    insertIndex_(0), 
    saveIndex_(0), 
+   spillIndex_(0),
    memorySizeMB_(memorySizeMB), 
    overflow_(false),
-   threadPool_(std::make_shared<ThreadPool>()),
+   slab_(new FrameSlab(static_cast<std::size_t>(memorySizeMB * bytesInMB), hugePages)),
+   capacity_(0),
+   frameBytes_(0),
+   generation_(0),
+   slotChunks_((maxCBSize + slotsPerChunk - 1) / slotsPerChunk),
+   spillCapacity_(0),
+   totalSpilled_(0),
+   spilledBytes_(0),
+   spillSeconds_(0.0),
+   writeSlot_(0),
+   writeSlotWidth_(0),
+   writeSlotHeight_(0),
+   writeSlotDepth_(0),
+   threadPool_(pool ? pool : std::make_shared<ThreadPool>()),
    tasksMemCopy_(std::make_shared<TaskSet_CopyMemory>(threadPool_))
 {
+   if (spillSizeMB > 0)
+   {
+      spillFile_.reset(new SpillFile(spillDirectory,
+            static_cast<std::size_t>(spillSizeMB * bytesInMB)));
+      spillChunks_.resize(slotChunks_.size());
+   }
+   if (prefault)
+      slab_->StartPrefault();
 }
 
 CircularBuffer::~CircularBuffer() {}
 
+unsigned long long CircularBuffer::GetResidentBytes() const
+{
+   return slab_->GetResidentBytes();
+}
+
+bool CircularBuffer::UsesHugePages() const
+{
+   return slab_->UsesHugePages();
+}
+
+unsigned long CircularBuffer::GetSpillCapacity() const
+{
+   MMThreadGuard guard(g_bufferLock);
+   return spillCapacity_;
+}
+
+unsigned long CircularBuffer::GetSpilledImageCount() const
+{
+   MMThreadGuard guard(g_bufferLock);
+   return spillIndex_ > saveIndex_ ? (unsigned long)(spillIndex_ - saveIndex_) : 0;
+}
+
+unsigned long long CircularBuffer::GetTotalSpilledImageCount() const
+{
+   MMThreadGuard guard(g_bufferLock);
+   return totalSpilled_;
+}
+
+double CircularBuffer::GetSpillBandwidthMBps() const
+{
+   MMThreadGuard guard(g_bufferLock);
+   if (spillSeconds_ <= 0.0)
+      return 0.0;
+   return spilledBytes_ / spillSeconds_ / bytesInMB;
+}
+
 bool CircularBuffer::Initialize(unsigned channels, unsigned int w, unsigned int h, unsigned int pixDepth)
 {
    MMThreadGuard guard(g_bufferLock);
@@ -74,7 +136,7 @@ bool CircularBuffer::Initialize(unsigned channels, unsigned int w, unsigned int
          return false; // does not make sense
 
       if (w == width_ && height_ == h && pixDepth_ == pixDepth && channels == numChannels_)
-         if (frameArray_.size() > 0)
+         if (capacity_ > 0)
             return true; // nothing to change
 
       width_ = w;
@@ -84,17 +146,23 @@ bool CircularBuffer::Initialize(unsigned channels, unsigned int w, unsigned int
 
       insertIndex_ = 0;
       saveIndex_ = 0;
+      spillIndex_ = 0;
       overflow_ = false;
+      totalSpilled_ = 0;
+      spilledBytes_ = 0;
+      spillSeconds_ = 0.0;
 
-      // calculate the size of the entire buffer array once all images get allocated
-      // the actual size at the time of the creation is going to be less, because
-      // images are not allocated until pixels become available
-      unsigned long frameSizeBytes = width_ * height_ * pixDepth_ * numChannels_;
-      unsigned long cbSize = (unsigned long) ((memorySizeMB_ * bytesInMB) / frameSizeBytes);
+      frameBytes_ = static_cast<std::size_t>(width_) * height_ * pixDepth_ * numChannels_;
+      // Count the slots' images, not just their pixels, against the
+      // footprint; for small images they are a large part of it
+      const std::size_t slotBytes = frameBytes_ +
+         numChannels_ * mm::ImgBuffer::GetOverheadBytes();
+      unsigned long cbSize = (unsigned long) ((memorySizeMB_ * bytesInMB) / slotBytes);
 
       if (cbSize == 0) 
       {
-         frameArray_.resize(0);
+         capacity_ = 0;
+         spillCapacity_ = 0;
          return false; // memory footprint too small
       }
 
@@ -102,34 +170,135 @@ bool CircularBuffer::Initialize(unsigned channels, unsigned int w, unsigned int
       if (cbSize > maxCBSize)
          cbSize = maxCBSize; 
 
-      // TODO: verify if we have enough RAM to satisfy this request
-
-      for (unsigned long i=0; i<frameArray_.size(); i++)
-         frameArray_[i].Clear();
+      spillCapacity_ = 0;
+      if (spillFile_)
+         spillCapacity_ = (unsigned long)std::min<std::size_t>(
+               spillFile_->GetSize() / frameBytes_, maxCBSize);
 
-      // allocate buffers  - could conceivably throw an out-of-memory exception
-      frameArray_.resize(cbSize);
-      for (unsigned long i=0; i<frameArray_.size(); i++)
-      {
-         frameArray_[i].Resize(w, h, pixDepth);
-         frameArray_[i].Preallocate(numChannels_);
-      }
+      // The slab and spill file already hold the pixels; slots are set up
+      // for the new geometry as they are written
+      capacity_ = cbSize;
+      ++generation_;
    }
 
    catch( ... /* std::bad_alloc& ex */)
    {
-      frameArray_.resize(0);
+      capacity_ = 0;
+      spillCapacity_ = 0;
       ret = false;
    }
    return ret;
 }
 
+mm::ImgBuffer* CircularBuffer::PrepareSlotImage(SlotChunks& chunks, unsigned char* storage, long index, unsigned channel)
+{
+   std::unique_ptr<Slot[]>& chunk = chunks[index / slotsPerChunk];
+   try
+   {
+      if (!chunk)
+         chunk.reset(new Slot[slotsPerChunk]);
+
+      Slot& slot = chunk[index % slotsPerChunk];
+      if (slot.generation != generation_)
+      {
+         slot.frame.Attach(storage + index * frameBytes_,
+               numChannels_, width_, height_, pixDepth_);
+         slot.generation = generation_;
+      }
+      return slot.frame.FindImage(channel);
+   }
+   catch (const std::bad_alloc&)
+   {
+      return 0;
+   }
+}
+
+const mm::ImgBuffer* CircularBuffer::FindSlotImage(const SlotChunks& chunks, long index, unsigned channel) const
+{
+   const std::unique_ptr<Slot[]>& chunk = chunks[index / slotsPerChunk];
+   if (!chunk)
+      return 0;
+   const Slot& slot = chunk[index % slotsPerChunk];
+   if (slot.generation != generation_)
+      return 0;
+   return slot.frame.FindImage(channel);
+}
+
+// frame is an absolute (not wrapped) index; g_bufferLock must be held
+const mm::ImgBuffer* CircularBuffer::FindFrameImage(long frame, unsigned channel) const
+{
+   if (frame < spillIndex_)
+      return FindSlotImage(spillChunks_, frame % spillCapacity_, channel);
+   return FindSlotImage(slotChunks_, frame % capacity_, channel);
+}
+
+/**
+* Ensures that the slab has a free slot for the frame at insertIndex_,
+* moving the oldest unread frame to the spill file if needed. Returns false
+* (and sets the overflow flag) if there is no room. Called with g_insertLock
+* held, so that no other thread moves frames to the spill file or writes to
+* the slab.
+*/
+bool CircularBuffer::MakeRoomForInsert()
+{
+   long frame;
+   std::vector<mm::ImgBuffer*> dest;
+   {
+      MMThreadGuard guard(g_bufferLock);
+      const long slabBegin = std::max(spillIndex_, saveIndex_);
+      if (insertIndex_ - slabBegin < static_cast<long>(capacity_))
+         return true;
+      if (slabBegin - saveIndex_ >= static_cast<long>(spillCapacity_))
+      {
+         overflow_ = true;
+         return false;
+      }
+
+      // The position in the file last held a frame that has been read
+      frame = slabBegin;
+      for (unsigned i = 0; i < numChannels_; ++i)
+      {
+         mm::ImgBuffer* pImg = PrepareSlotImage(spillChunks_,
+               spillFile_->GetData(), frame % spillCapacity_, i);
+         if (!pImg)
+            return false;
+         dest.push_back(pImg);
+      }
+   }
+
+   // The frame stays readable from the slab while it is copied
+   const std::size_t spillOffset = (frame % spillCapacity_) * frameBytes_;
+   auto start = std::chrono::steady_clock::now();
+   tasksMemCopy_->MemCopy(spillFile_->GetData() + spillOffset,
+         slab_->GetData() + (frame % capacity_) * frameBytes_, frameBytes_);
+   for (unsigned i = 0; i < numChannels_; ++i)
+   {
+      const mm::ImgBuffer* src = FindSlotImage(slotChunks_, frame % capacity_, i);
+      if (src)
+         dest[i]->SetMetadata(src->GetBinaryMetadata());
+   }
+   spillFile_->StartWriteback(spillOffset, frameBytes_);
+   const double seconds = std::chrono::duration<double>(
+         std::chrono::steady_clock::now() - start).count();
+
+   MMThreadGuard guard(g_bufferLock);
+   spillIndex_ = frame + 1;
+   ++totalSpilled_;
+   spilledBytes_ += frameBytes_;
+   spillSeconds_ += seconds;
+   return true;
+}
+
 void CircularBuffer::Clear() 
 {
    MMThreadGuard guard(g_bufferLock); 
    insertIndex_=0; 
    saveIndex_=0; 
+   spillIndex_ = 0;
    overflow_ = false;
+   totalSpilled_ = 0;
+   spilledBytes_ = 0;
+   spillSeconds_ = 0.0;
    startTime_ = std::chrono::steady_clock::now();
    imageNumbers_.clear();
 }
@@ -137,13 +306,13 @@ void CircularBuffer::Clear()
 unsigned long CircularBuffer::GetSize() const
 {
    MMThreadGuard guard(g_bufferLock);
-   return (unsigned long)frameArray_.size();
+   return capacity_ + spillCapacity_;
 }
 
 unsigned long CircularBuffer::GetFreeSize() const
 {
    MMThreadGuard guard(g_bufferLock);
-   long freeSize = (long)frameArray_.size() - (insertIndex_ - saveIndex_);
+   long freeSize = (long)(capacity_ + spillCapacity_) - (insertIndex_ - saveIndex_);
    if (freeSize < 0)
       return 0;
    else
@@ -156,61 +325,10 @@ unsigned long CircularBuffer::GetRemainingImageCount() const
    return (unsigned long)(insertIndex_ - saveIndex_);
 }
 
-static std::string FormatLocalTime(std::chrono::time_point<std::chrono::system_clock> tp) {
-   using namespace std::chrono;
-   auto us = duration_cast<microseconds>(tp.time_since_epoch());
-   auto secs = duration_cast<seconds>(us);
-   auto whole = duration_cast<microseconds>(secs);
-   auto frac = static_cast<int>((us - whole).count());
-
-   // As of C++14/17, it is simpler (and probably faster) to use C functions for
-   // date-time formatting
-
-   std::time_t t(secs.count()); // time_t is seconds on platforms we support
-   std::tm *ptm;
-#ifdef _WIN32 // Windows localtime() is documented thread-safe
-   ptm = std::localtime(&t);
-#else // POSIX has localtime_r()
-   std::tm tmstruct;
-   ptm = localtime_r(&t, &tmstruct);
-#endif
-
-   // Format as "yyyy-mm-dd hh:mm:ss.uuuuuu" (26 chars)
-   const char *timeFmt = "%Y-%m-%d %H:%M:%S";
-   char buf[32];
-   std::size_t len = std::strftime(buf, sizeof(buf), timeFmt, ptm);
-   std::snprintf(buf + len, sizeof(buf) - len, ".%06d", frac);
-   return buf;
-}
-
-/**
-* Inserts a single image in the buffer.
-*/
-bool CircularBuffer::InsertImage(const unsigned char* pixArray, unsigned int width, unsigned int height, unsigned int byteDepth, const Metadata* pMd) throw (CMMError)
-{
-   return InsertMultiChannel(pixArray, 1, width, height, byteDepth, pMd);
-}
-
-/**
-* Inserts a single image, possibly with multiple channels, but with 1 component, in the buffer.
-*/
-bool CircularBuffer::InsertMultiChannel(const unsigned char* pixArray, unsigned int numChannels, unsigned int width, unsigned int height, unsigned int byteDepth, const Metadata* pMd) throw (CMMError)
-{
-   return InsertMultiChannel(pixArray, numChannels, width, height, byteDepth, 1, pMd);
-}
-
-/**
-* Inserts a single image, possibly with multiple components, in the buffer.
-*/
-bool CircularBuffer::InsertImage(const unsigned char* pixArray, unsigned int width, unsigned int height, unsigned int byteDepth, unsigned int nComponents, const Metadata* pMd) throw (CMMError)
-{
-    return InsertMultiChannel(pixArray, 1, width, height, byteDepth, nComponents, pMd);
-}
- 
 /**
 * Inserts a multi-channel frame in the buffer.
 */
-bool CircularBuffer::InsertMultiChannel(const unsigned char* pixArray, unsigned int numChannels, unsigned int width, unsigned int height, unsigned int byteDepth, unsigned int nComponents, const Metadata* pMd) throw (CMMError)
+bool CircularBuffer::InsertMultiChannel(const unsigned char* pixArray, unsigned int numChannels, unsigned int width, unsigned int height, unsigned int byteDepth, unsigned int nComponents, const BinaryMetadata& md) throw (CMMError)
 {
     MMThreadGuard insertGuard(g_insertLock);
  
@@ -223,118 +341,141 @@ bool CircularBuffer::InsertMultiChannel(const unsigned char* pixArray, unsigned
        // check image dimensions
        if (width != width_ || height != height_ || byteDepth != pixDepth_)
           throw CMMError("Incompatible image dimensions in the circular buffer", MMERR_CircularBufferIncompatibleImage);
- 
-       bool overflowed = (insertIndex_ - saveIndex_) >= static_cast<long>(frameArray_.size());
-       if (overflowed) {
-          overflow_ = true;
-          return false;
-       }
     }
+
+    if (!MakeRoomForInsert())
+       return false;
  
     for (unsigned i=0; i<numChannels; i++)
     {
-       Metadata md;
        {
           MMThreadGuard guard(g_bufferLock);
-          // we assume that all buffers are pre-allocated
-          pImg = frameArray_[insertIndex_ % frameArray_.size()].FindImage(i);
+          pImg = PrepareSlotImage(slotChunks_, slab_->GetData(), insertIndex_ % capacity_, i);
           if (!pImg)
              return false;
- 
-          if (pMd)
-          {
-             // TODO: the same metadata is inserted for each channel ???
-             // Perhaps we need to add specific tags to each channel
-             md = *pMd;
-          }
-
-         std::string cameraName = md.GetSingleTag("Camera").GetValue();
-         if (imageNumbers_.end() == imageNumbers_.find(cameraName))
-         {
-            imageNumbers_[cameraName] = 0;
-         }
-
-         // insert image number. 
-         md.put(MM::g_Keyword_Metadata_ImageNumber, CDeviceUtils::ConvertToString(imageNumbers_[cameraName]));
-         ++imageNumbers_[cameraName];
-      }
-
-      if (!md.HasTag(MM::g_Keyword_Elapsed_Time_ms))
-      {
-         // if time tag was not supplied by the camera insert current timestamp
-         using namespace std::chrono;
-         auto elapsed = steady_clock::now() - startTime_;
-         md.PutImageTag(MM::g_Keyword_Elapsed_Time_ms,
-            std::to_string(duration_cast<milliseconds>(elapsed).count()));
-      }
+       }
 
-      // Note: It is not ideal to use local time. I think this tag is rarely
-      // used. Consider replacing with UTC (micro)seconds-since-epoch (with
-      // different tag key) after addressing current usage.
-      auto now = std::chrono::system_clock::now();
-      md.PutImageTag(MM::g_Keyword_Metadata_TimeInCore, FormatLocalTime(now));
-
-      md.PutImageTag("Width",width);
-      md.PutImageTag("Height",height);
-      if (byteDepth == 1)
-         md.PutImageTag("PixelType","GRAY8");
-      else if (byteDepth == 2)
-         md.PutImageTag("PixelType","GRAY16");
-      else if (byteDepth == 4)
-      {
-         if (nComponents == 1)
-            md.PutImageTag("PixelType","GRAY32");
-         else
-            md.PutImageTag("PixelType","RGB32");
-      }
-      else if (byteDepth == 8)
-         md.PutImageTag("PixelType","RGB64");
-      else
-         md.PutImageTag("PixelType","Unknown"); 
+      // TODO: the same metadata is inserted for each channel ???
+      // Perhaps we need to add specific tags to each channel
+      StoreImageMetadata(pImg, md, width, height, byteDepth, nComponents);
 
-      pImg->SetMetadata(md);
       //pImg->SetPixels(pixArray + i * singleChannelSize);
-      // TODO: In MMCore the ImgBuffer::GetPixels() returns const pointer.
-      //       It would be better to have something like ImgBuffer::GetPixelsRW() in MMDevice.
-      //       Or even better - pass tasksMemCopy_ to ImgBuffer constructor
+      // TODO: Or even better - pass tasksMemCopy_ to ImgBuffer constructor
       //       and utilize parallel copy also in single snap acquisitions.
-      tasksMemCopy_->MemCopy((void*)pImg->GetPixels(),
+      tasksMemCopy_->MemCopy(pImg->GetPixelsRW(),
             pixArray + i * singleChannelSize, singleChannelSize);
    }
 
+   AdvanceInsertIndex();
+   NotifyImageInserted();
+   return true;
+}
+ 
+
+unsigned char* CircularBuffer::AcquireWriteSlot(unsigned int width, unsigned int height, unsigned int byteDepth) throw (CMMError)
+{
+   // Held until CommitWriteSlot() or AbandonWriteSlot()
+   g_insertLock.Lock();
+
    {
       MMThreadGuard guard(g_bufferLock);
-
-      imageCounter_++;
-      insertIndex_++;
-      if ((insertIndex_ - (long)frameArray_.size()) > adjustThreshold && (saveIndex_- (long)frameArray_.size()) > adjustThreshold)
+      if (width != width_ || height != height_ || byteDepth != pixDepth_)
+      {
+         g_insertLock.Unlock();
+         throw CMMError("Incompatible image dimensions in the circular buffer", MMERR_CircularBufferIncompatibleImage);
+      }
+      // The slot holds one image; the other channels would be left stale
+      if (numChannels_ != 1)
       {
-         // adjust buffer indices to avoid overflowing integer size
-         insertIndex_ -= adjustThreshold;
-         saveIndex_ -= adjustThreshold;
+         g_insertLock.Unlock();
+         throw CMMError("Write slots require a single-channel circular buffer", MMERR_CircularBufferIncompatibleImage);
       }
    }
 
+   if (!MakeRoomForInsert())
+   {
+      g_insertLock.Unlock();
+      return 0;
+   }
+
+   MMThreadGuard guard(g_bufferLock);
+   mm::ImgBuffer* pImg = PrepareSlotImage(slotChunks_, slab_->GetData(), insertIndex_ % capacity_, 0);
+   if (!pImg)
+   {
+      g_insertLock.Unlock();
+      return 0;
+   }
+
+   writeSlot_ = pImg;
+   writeSlotWidth_ = width;
+   writeSlotHeight_ = height;
+   writeSlotDepth_ = byteDepth;
+   return pImg->GetPixelsRW();
+}
+
+bool CircularBuffer::CommitWriteSlot(unsigned int nComponents, const BinaryMetadata& md)
+{
+   if (!writeSlot_)
+      return false;
+
+   StoreImageMetadata(writeSlot_, md, writeSlotWidth_, writeSlotHeight_,
+         writeSlotDepth_, nComponents);
+   AdvanceInsertIndex();
+   NotifyImageInserted();
+
+   writeSlot_ = 0;
+   g_insertLock.Unlock();
    return true;
 }
- 
 
-const unsigned char* CircularBuffer::GetTopImage() const
+bool CircularBuffer::AbandonWriteSlot()
 {
-   const mm::ImgBuffer* img = GetNthFromTopImageBuffer(0, 0);
-   if (!img)
-      return 0;
-   return img->GetPixels();
+   if (!writeSlot_)
+      return false;
+
+   writeSlot_ = 0;
+   g_insertLock.Unlock();
+   return true;
 }
 
-const mm::ImgBuffer* CircularBuffer::GetTopImageBuffer(unsigned channel) const
+void CircularBuffer::StoreImageMetadata(mm::ImgBuffer* pImg, const BinaryMetadata& md, unsigned int width, unsigned int height, unsigned int byteDepth, unsigned int nComponents)
 {
-   return GetNthFromTopImageBuffer(0, channel);
+   // Build the metadata in place; this reuses the slot's storage
+   BinaryMetadata& imgMd = pImg->GetBinaryMetadataRW();
+   imgMd = md;
+
+   {
+      MMThreadGuard guard(g_bufferLock);
+
+      const char* cameraName = imgMd.FindString("Camera");
+      if (!cameraName)
+         cameraName = "";
+      auto it = imageNumbers_.find(cameraName);
+      if (it == imageNumbers_.end())
+         it = imageNumbers_.emplace(cameraName, 0).first;
+
+      // insert image number. 
+      imgMd.PutImageTag(MM::g_Keyword_Metadata_ImageNumber, it->second);
+      ++it->second;
+   }
+
+   AddCoreImageTags(imgMd, width, height, byteDepth, nComponents, startTime_);
 }
 
-const mm::ImgBuffer* CircularBuffer::GetNthFromTopImageBuffer(unsigned long n) const
+void CircularBuffer::AdvanceInsertIndex()
 {
-   return GetNthFromTopImageBuffer(static_cast<long>(n), 0);
+   MMThreadGuard guard(g_bufferLock);
+
+   imageCounter_++;
+   insertIndex_++;
+   if ((insertIndex_ - (long)capacity_) > adjustThreshold && (saveIndex_- (long)capacity_) > adjustThreshold)
+   {
+      // adjust buffer indices to avoid overflowing integer size
+      spillIndex_ = std::max(spillIndex_, saveIndex_);
+      insertIndex_ -= adjustThreshold;
+      saveIndex_ -= adjustThreshold;
+      spillIndex_ -= adjustThreshold;
+   }
 }
 
 const mm::ImgBuffer* CircularBuffer::GetNthFromTopImageBuffer(long n,
@@ -346,31 +487,39 @@ const mm::ImgBuffer* CircularBuffer::GetNthFromTopImageBuffer(long n,
    if (n + 1 > availableImages)
       return 0;
 
-   long targetIndex = insertIndex_ - n - 1L;
-   while (targetIndex < 0)
-      targetIndex += (long) frameArray_.size();
-   targetIndex %= frameArray_.size();
-
-   return frameArray_[targetIndex].FindImage(channel);
+   return FindFrameImage(insertIndex_ - n - 1L, channel);
 }
 
-const unsigned char* CircularBuffer::GetNextImage()
+const mm::ImgBuffer* CircularBuffer::GetNextImageBuffer(unsigned channel)
 {
-   const mm::ImgBuffer* img = GetNextImageBuffer(0);
-   if (!img)
+   MMThreadGuard guard(g_bufferLock);
+
+   long availableImages = insertIndex_ - saveIndex_;
+   if (availableImages < 1)
       return 0;
-   return img->GetPixels();
+
+   long targetIndex = saveIndex_;
+   ++saveIndex_;
+   return FindFrameImage(targetIndex, channel);
 }
 
-const mm::ImgBuffer* CircularBuffer::GetNextImageBuffer(unsigned channel)
+bool CircularBuffer::GetNextFrame(std::vector<const mm::ImgBuffer*>& images)
 {
    MMThreadGuard guard(g_bufferLock);
 
+   images.clear();
    long availableImages = insertIndex_ - saveIndex_;
    if (availableImages < 1)
-      return 0;
+      return false;
 
-   long targetIndex = saveIndex_ % frameArray_.size();
+   long targetIndex = saveIndex_;
    ++saveIndex_;
-   return frameArray_[targetIndex].FindImage(channel);
+   for (unsigned i = 0; i < numChannels_; ++i)
+   {
+      const mm::ImgBuffer* pImg = FindFrameImage(targetIndex, i);
+      if (!pImg)
+         break;
+      images.push_back(pImg);
+   }
+   return true;
 }
@@ -27,12 +27,14 @@
 #include "Error.h"
 #include "ErrorCodes.h"
 #include "FrameBuffer.h"
+#include "SequenceBuffer.h"
 
 #include "../MMDevice/DeviceThreads.h"
 #include "../MMDevice/MMDevice.h"
 
 #include <chrono>
 #include <memory>
+#include <string>
 #include <vector>
 
 #ifdef _MSC_VER
@@ -40,16 +42,43 @@
 #endif
 
 
+class FrameSlab;
+class SpillFile;
 class ThreadPool;
 class TaskSet_CopyMemory;
 
-class CircularBuffer
+// The pixels of all frames are stored in a single FrameSlab, so that
+// Initialize() only needs to record the new geometry; each slot is set up
+// for it when it is next written.
+//
+// With a spill file, an insert into a full buffer first moves the oldest
+// unread frame to the file instead of failing. Frames on disk are always
+// the oldest ones, so they are read back first and the order is preserved.
+class CircularBuffer : public SequenceBuffer
 {
 public:
-   CircularBuffer(unsigned int memorySizeMB);
+   // Copies images using pool, or a pool of its own if pool is null. See
+   // FrameSlab for hugePages and prefault. If spillSizeMB is nonzero, a
+   // SpillFile of that size is created in spillDirectory (throws CMMError
+   // on failure).
+   CircularBuffer(unsigned int memorySizeMB, std::shared_ptr<ThreadPool> pool = nullptr,
+         bool hugePages = false, bool prefault = false,
+         const std::string& spillDirectory = std::string(), unsigned spillSizeMB = 0);
    ~CircularBuffer();
 
    unsigned GetMemorySizeMB() const { return memorySizeMB_; }
+   unsigned long long GetResidentBytes() const;
+   bool UsesHugePages() const;
+
+   // Frames that fit in the spill file (included in GetSize())
+   unsigned long GetSpillCapacity() const;
+   // Frames currently waiting in the spill file
+   unsigned long GetSpilledImageCount() const;
+   // Frames moved to the spill file since the buffer was last cleared
+   unsigned long long GetTotalSpilledImageCount() const;
+   // Average rate at which frames were moved to the spill file since the
+   // buffer was last cleared, in MB/s (0 if none were)
+   double GetSpillBandwidthMBps() const;
 
    bool Initialize(unsigned channels, unsigned int xSize, unsigned int ySize, unsigned int pixDepth);
    unsigned long GetSize() const;
@@ -59,42 +88,86 @@ public:
    unsigned int Width() const {MMThreadGuard guard(g_bufferLock); return width_;}
    unsigned int Height() const {MMThreadGuard guard(g_bufferLock); return height_;}
    unsigned int Depth() const {MMThreadGuard guard(g_bufferLock); return pixDepth_;}
-
-   bool InsertImage(const unsigned char* pixArray, unsigned int width, unsigned int height, unsigned int byteDepth, const Metadata* pMd) throw (CMMError);
-   bool InsertMultiChannel(const unsigned char* pixArray, unsigned int numChannels, unsigned int width, unsigned int height, unsigned int byteDepth, const Metadata* pMd) throw (CMMError);
-   bool InsertImage(const unsigned char* pixArray, unsigned int width, unsigned int height, unsigned int byteDepth, unsigned int nComponents, const Metadata* pMd) throw (CMMError);
-   bool InsertMultiChannel(const unsigned char* pixArray, unsigned int numChannels, unsigned int width, unsigned int height, unsigned int byteDepth, unsigned int nComponents, const Metadata* pMd) throw (CMMError);
-   const unsigned char* GetTopImage() const;
-   const unsigned char* GetNextImage();
-   const mm::ImgBuffer* GetTopImageBuffer(unsigned channel) const;
-   const mm::ImgBuffer* GetNthFromTopImageBuffer(unsigned long n) const;
+   unsigned GetNumberOfChannels() const {MMThreadGuard guard(g_bufferLock); return numChannels_;}
+
+   using SequenceBuffer::InsertImage;
+   using SequenceBuffer::InsertMultiChannel;
+   bool InsertMultiChannel(const unsigned char* pixArray, unsigned int numChannels, unsigned int width, unsigned int height, unsigned int byteDepth, unsigned int nComponents, const BinaryMetadata& md) throw (CMMError);
+   unsigned char* AcquireWriteSlot(unsigned int width, unsigned int height, unsigned int byteDepth) throw (CMMError);
+   using SequenceBuffer::CommitWriteSlot;
+   bool CommitWriteSlot(unsigned int nComponents, const BinaryMetadata& md);
+   bool AbandonWriteSlot();
+   using SequenceBuffer::GetNthFromTopImageBuffer;
    const mm::ImgBuffer* GetNthFromTopImageBuffer(long n, unsigned channel) const;
    const mm::ImgBuffer* GetNextImageBuffer(unsigned channel);
+   bool GetNextFrame(std::vector<const mm::ImgBuffer*>& images);
    void Clear(); 
 
-   bool Overflow() {MMThreadGuard guard(g_bufferLock); return overflow_;}
+   bool Overflow() const {MMThreadGuard guard(g_bufferLock); return overflow_;}
 
    mutable MMThreadLock g_bufferLock;
    mutable MMThreadLock g_insertLock;
 
 private:
+   struct Slot
+   {
+      Slot() : generation(0) {}
+
+      // The slot is set up for the current geometry if equal to generation_
+      unsigned long generation;
+      mm::FrameBuffer frame;
+   };
+
+   typedef std::vector<std::unique_ptr<Slot[]>> SlotChunks;
+
+   mm::ImgBuffer* PrepareSlotImage(SlotChunks& chunks, unsigned char* storage, long index, unsigned channel);
+   const mm::ImgBuffer* FindSlotImage(const SlotChunks& chunks, long index, unsigned channel) const;
+   const mm::ImgBuffer* FindFrameImage(long frame, unsigned channel) const;
+   bool MakeRoomForInsert();
+   void StoreImageMetadata(mm::ImgBuffer* pImg, const BinaryMetadata& md, unsigned int width, unsigned int height, unsigned int byteDepth, unsigned int nComponents);
+   void AdvanceInsertIndex();
+
    unsigned int width_;
    unsigned int height_;
    unsigned int pixDepth_;
    long imageCounter_;
    std::chrono::time_point<std::chrono::steady_clock> startTime_;
-   std::map<std::string, long> imageNumbers_;
+   std::map<std::string, long, std::less<>> imageNumbers_;
 
    // Invariants:
    // 0 <= saveIndex_ <= insertIndex_
-   // insertIndex_ - saveIndex_ <= frameArray_.size()
+   // insertIndex_ - max(saveIndex_, spillIndex_) <= capacity_
+   // spillIndex_ - saveIndex_ <= spillCapacity_
+   // Frames before spillIndex_ that have not been read are in the spill
+   // file; the others are in the slab
    long insertIndex_;
    long saveIndex_;
+   long spillIndex_;
 
    unsigned long memorySizeMB_;
    unsigned int numChannels_;
    bool overflow_;
-   std::vector<mm::FrameBuffer> frameArray_;
+
+   std::unique_ptr<FrameSlab> slab_;
+   unsigned long capacity_; // Frames
+   std::size_t frameBytes_; // All channels of a frame
+   unsigned long generation_; // Incremented when the geometry changes
+   // Allocated on first use
+   SlotChunks slotChunks_;
+
+   std::unique_ptr<SpillFile> spillFile_;
+   unsigned long spillCapacity_; // Frames
+   SlotChunks spillChunks_;
+   unsigned long long totalSpilled_;
+   unsigned long long spilledBytes_;
+   double spillSeconds_;
+
+   // Slot reserved by AcquireWriteSlot(); guarded by g_insertLock, which is
+   // held until the slot is committed or abandoned
+   mm::ImgBuffer* writeSlot_;
+   unsigned int writeSlotWidth_;
+   unsigned int writeSlotHeight_;
+   unsigned int writeSlotDepth_;
 
    std::shared_ptr<ThreadPool> threadPool_;
    std::shared_ptr<TaskSet_CopyMemory> tasksMemCopy_;
@@ -27,9 +27,16 @@
 
 #include "Configuration.h"
 #include "Error.h"
+#include <algorithm>
+#include <map>
+#include <set>
 #include <string>
+#include <utility>
 #include <vector>
 
+// Identifies a device property: (device label, property name)
+typedef std::pair<std::string, std::string> PropertyKey;
+
 /**
  * Encapsulates a collection (map) of user-defined presets.
  */
@@ -44,6 +51,7 @@ public:
    void Define(const char* configName)
    {
       configs_[configName];
+      Changed();
    }
 
 	/**
@@ -53,6 +61,7 @@ public:
    {
       PropertySetting setting(deviceLabel, propName, value);
       configs_[configName].addSetting(setting);
+      Changed();
 	}
 
    /**
@@ -82,6 +91,7 @@ public:
 	  
 	  configs_[newConfigName] = it->second;
       configs_.erase(it->first);
+      Changed();
       return true;
    }
 
@@ -98,6 +108,7 @@ public:
       if (it == configs_.end())
          return false;
       configs_.erase(configName);
+      Changed();
       return true;
    }
 
@@ -117,6 +128,7 @@ public:
 	  
 	  // Delete the specified property
       configs_[configName].deleteSetting(deviceLabel,propName);
+      Changed();
 	  return true;
    }
 
@@ -138,11 +150,181 @@ public:
       return configs_.size() == 0;
    }
 
+   /**
+    * Returns the number of settings in the largest preset that includes the
+    * given property, or 0 if no preset includes it.
+    */
+   size_t LargestPresetIncluding(const std::string& deviceLabel,
+         const std::string& propName) const
+   {
+      const std::map<PropertyKey, size_t>& index = GetPropertyIndex();
+      std::map<PropertyKey, size_t>::const_iterator found =
+         index.find(PropertyKey(deviceLabel, propName));
+      return found == index.end() ? 0 : found->second;
+   }
+
+   /**
+    * Returns, for each property included in any preset, the number of
+    * settings in the largest preset that includes it.
+    */
+   const std::map<PropertyKey, size_t>& GetPropertyIndex() const
+   {
+      if (!propertyIndexValid_)
+      {
+         propertyIndex_.clear();
+         for (typename std::map<std::string, T>::const_iterator it = configs_.begin();
+               it != configs_.end(); ++it)
+         {
+            const size_t size = it->second.size();
+            for (size_t i = 0; i < size; ++i)
+            {
+               PropertySetting setting = it->second.getSetting(i);
+               size_t& largest = propertyIndex_[PropertyKey(
+                     setting.getDeviceLabel(), setting.getPropertyName())];
+               largest = (std::max)(largest, size);
+            }
+         }
+         propertyIndexValid_ = true;
+      }
+      return propertyIndex_;
+   }
+
+   /**
+    * Matches the presets against the given system state. Afterwards, until
+    * the presets change, UpdateState() keeps track of which presets match.
+    */
+   void SyncState(Configuration& state)
+   {
+      trackedProperties_.clear();
+      mismatches_.clear();
+      matching_.clear();
+      missing_ = 0;
+      for (typename std::map<std::string, T>::const_iterator it = configs_.begin();
+            it != configs_.end(); ++it)
+      {
+         mismatches_[it->first] = 0;
+         for (size_t i = 0; i < it->second.size(); ++i)
+         {
+            PropertySetting setting = it->second.getSetting(i);
+            trackedProperties_[PropertyKey(setting.getDeviceLabel(),
+                  setting.getPropertyName())].presets.push_back(
+                  std::make_pair(it->first, setting.getPropertyValue()));
+         }
+      }
+      for (typename TrackedProperties::iterator it = trackedProperties_.begin();
+            it != trackedProperties_.end(); ++it)
+      {
+         TrackedProperty& prop = it->second;
+         prop.known = state.isPropertyIncluded(it->first.first.c_str(),
+               it->first.second.c_str());
+         if (prop.known)
+            prop.value = state.getSetting(it->first.first.c_str(),
+                  it->first.second.c_str()).getPropertyValue();
+         else
+            ++missing_;
+         for (size_t i = 0; i < prop.presets.size(); ++i)
+         {
+            if (!prop.known || prop.value != prop.presets[i].second)
+               ++mismatches_[prop.presets[i].first];
+         }
+      }
+      for (std::map<std::string, size_t>::const_iterator it = mismatches_.begin();
+            it != mismatches_.end(); ++it)
+      {
+         if (it->second == 0)
+            matching_.insert(it->first);
+      }
+      stateSynced_ = true;
+   }
+
+   /**
+    * Records a new value in the system state. Returns true if the result of
+    * GetCurrentPreset() may have changed. Does nothing unless SyncState()
+    * has been called since the presets last changed.
+    */
+   bool UpdateState(const PropertySetting& setting)
+   {
+      if (!stateSynced_)
+         return false;
+      typename TrackedProperties::iterator found = trackedProperties_.find(
+            PropertyKey(setting.getDeviceLabel(), setting.getPropertyName()));
+      if (found == trackedProperties_.end())
+         return false;
+      TrackedProperty& prop = found->second;
+      const std::string value = setting.getPropertyValue();
+      if (prop.known && prop.value == value)
+         return false;
+
+      const bool wasComplete = missing_ == 0;
+      const std::string before = matching_.empty() ? std::string() : *matching_.begin();
+      for (size_t i = 0; i < prop.presets.size(); ++i)
+      {
+         const std::string& preset = prop.presets[i].first;
+         const bool didMatch = prop.known && prop.value == prop.presets[i].second;
+         const bool doesMatch = value == prop.presets[i].second;
+         if (didMatch && !doesMatch && mismatches_[preset]++ == 0)
+            matching_.erase(preset);
+         else if (!didMatch && doesMatch && --mismatches_[preset] == 0)
+            matching_.insert(preset);
+      }
+      if (!prop.known)
+      {
+         prop.known = true;
+         --missing_;
+      }
+      prop.value = value;
+
+      const std::string after = matching_.empty() ? std::string() : *matching_.begin();
+      return (missing_ == 0) != wasComplete || after != before;
+   }
+
+   bool IsStateSynced() const { return stateSynced_; }
+
+   /**
+    * Gets the first preset (by name) that matches the state, or an empty
+    * string if none does. Returns false if the state is not synced or lacks
+    * some property used by the presets, in which case the presets lacking it
+    * do not match.
+    */
+   bool GetCurrentPreset(std::string& preset) const
+   {
+      preset = matching_.empty() ? std::string() : *matching_.begin();
+      return stateSynced_ && missing_ == 0;
+   }
+
 protected:
-   ConfigGroupBase() {}
+   ConfigGroupBase() : propertyIndexValid_(false), stateSynced_(false), missing_(0) {}
    virtual ~ConfigGroupBase() {}
 
+   // Must be called whenever the settings of the presets change
+   void Changed()
+   {
+      propertyIndexValid_ = false;
+      stateSynced_ = false;
+   }
+
    std::map<std::string, T> configs_;
+
+private:
+   // Rebuilt when first needed after a change; presets are edited in bulk
+   // (when loading a configuration) but looked up on every property change.
+   mutable std::map<PropertyKey, size_t> propertyIndex_;
+   mutable bool propertyIndexValid_;
+
+   // Current preset tracking
+   struct TrackedProperty
+   {
+      TrackedProperty() : known(false) {}
+      bool known; // Whether the state includes the property
+      std::string value;
+      std::vector< std::pair<std::string, std::string> > presets; // (preset, value)
+   };
+   typedef std::map<PropertyKey, TrackedProperty> TrackedProperties;
+   TrackedProperties trackedProperties_;
+   std::map<std::string, size_t> mismatches_; // Preset -> mismatching settings
+   std::set<std::string> matching_; // Presets without mismatches
+   bool stateSynced_;
+   size_t missing_; // Tracked properties not in the state
 };
 
 
@@ -158,7 +340,7 @@ class ConfigGroup : public ConfigGroupBase<Configuration>
  */
 class ConfigGroupCollection {
 public:
-   ConfigGroupCollection() {}
+   ConfigGroupCollection() : propertyIndexValid_(false), version_(0) {}
    ~ConfigGroupCollection() {}
 
    /**
@@ -167,6 +349,7 @@ public:
    void Define(const char* groupName, const char* configName)
    {
       groups_[groupName].Define(configName);
+      Changed(groupName);
    }
 
    /**
@@ -175,6 +358,7 @@ public:
    void Define(const char* groupName, const char* configName, const char* deviceLabel, const char* propName, const char* value)
    {
       groups_[groupName].Define(configName, deviceLabel, propName, value);
+      Changed(groupName);
    }
 
    /**
@@ -186,6 +370,7 @@ public:
       if (it == groups_.end())
       {
          groups_[groupName]; // effectively inserts an empty group
+         Changed(groupName);
          return true;
       }
       else
@@ -232,6 +417,7 @@ public:
             return false; // group not found
          if (it->second.Rename(oldConfigName, newConfigName))
          {
+            Changed(groupName);
             // NOTE: changed to not remove empty groups, N.A. 1.31.2006
             // check if the config group is empty, and if so remove it
             //if (it->second.IsEmpty())
@@ -259,6 +445,7 @@ public:
          return false; // group not found
       if (it->second.Delete(configName, deviceLabel, propName))
       {
+         Changed(groupName);
          return true;
       }
       else
@@ -280,6 +467,7 @@ public:
          return false; // group not found
       if (it->second.Delete(configName))
       {
+         Changed(groupName);
          // NOTE: changed to not remove empty groups, N.A. 1.31.2006
          // check if the config group is empty, and if so remove it
          //if (it->second.IsEmpty())
@@ -303,6 +491,8 @@ public:
       if (it != groups_.end())
       {
          groups_.erase(it->first);
+         changedAt_.erase(groupName);
+         propertyIndexValid_ = false;
          return true;
       }
       return false; //not found
@@ -324,6 +514,8 @@ public:
          {
             groups_[newGroupName] = it->second;
             groups_.erase(it->first);
+            changedAt_.erase(oldGroupName);
+            Changed(newGroupName);
             return true;
          }
          return false; //not found
@@ -366,11 +558,155 @@ public:
    void Clear()
    {
       groups_.clear();
+      changedAt_.clear();
+      propertyIndexValid_ = false;
+   }
+
+   /**
+    * Returns the groups that have a preset of at least minSettings settings
+    * that includes the given property.
+    */
+   std::vector<std::string> GetGroupsIncluding(const std::string& deviceLabel,
+         const std::string& propName, size_t minSettings) const
+   {
+      std::vector<std::string> groupList;
+      const PropertyIndex& index = GetPropertyIndex();
+      PropertyIndex::const_iterator found =
+         index.find(PropertyKey(deviceLabel, propName));
+      if (found == index.end())
+         return groupList;
+      for (std::vector< std::pair<std::string, size_t> >::const_iterator it =
+            found->second.begin(); it != found->second.end(); ++it)
+      {
+         if (it->second >= minSettings)
+            groupList.push_back(it->first);
+      }
+      return groupList;
+   }
+
+   /**
+    * Matches the presets of all groups against the given system state (see
+    * ConfigGroupBase::SyncState()).
+    */
+   void SyncState(Configuration& state)
+   {
+      for (std::map<std::string, ConfigGroup>::iterator it = groups_.begin();
+            it != groups_.end(); ++it)
+      {
+         // Groups whose presets changed have already been marked
+         const bool wasSynced = it->second.IsStateSynced();
+         std::string before;
+         const bool wasComplete = it->second.GetCurrentPreset(before);
+         it->second.SyncState(state);
+         std::string after;
+         const bool isComplete = it->second.GetCurrentPreset(after);
+         if (wasSynced && (isComplete != wasComplete || after != before))
+            changedAt_[it->first] = ++version_;
+      }
+   }
+
+   /**
+    * Records a new value in the system state, updating the current preset
+    * of the groups that include the property.
+    */
+   void UpdateState(const PropertySetting& setting)
+   {
+      const PropertyIndex& index = GetPropertyIndex();
+      PropertyIndex::const_iterator found = index.find(
+            PropertyKey(setting.getDeviceLabel(), setting.getPropertyName()));
+      if (found == index.end())
+         return;
+      for (std::vector< std::pair<std::string, size_t> >::const_iterator it =
+            found->second.begin(); it != found->second.end(); ++it)
+      {
+         if (groups_[it->first].UpdateState(setting))
+            changedAt_[it->first] = ++version_;
+      }
+   }
+
+   /**
+    * Gets the current preset of a group, syncing the group with the given
+    * state if its presets changed since it was last synced. Returns false
+    * if the state lacks some property used by the group's presets (see
+    * ConfigGroupBase::GetCurrentPreset()).
+    */
+   bool GetCurrentPreset(const char* groupName, Configuration& state,
+         std::string& preset)
+   {
+      std::map<std::string, ConfigGroup>::iterator it = groups_.find(groupName);
+      if (it == groups_.end())
+      {
+         preset.clear();
+         return true;
+      }
+      if (!it->second.IsStateSynced())
+         it->second.SyncState(state);
+      return it->second.GetCurrentPreset(preset);
+   }
+
+   /**
+    * Returns a number that increases whenever a group is defined or edited,
+    * or its current preset changes.
+    */
+   long GetVersion() const { return version_; }
+
+   /**
+    * Returns the groups that were defined or edited, or whose current
+    * preset changed, since GetVersion() returned the given version.
+    */
+   std::vector<std::string> GetGroupsChangedSince(long version) const
+   {
+      std::vector<std::string> groupList;
+      for (std::map<std::string, long>::const_iterator it = changedAt_.begin();
+            it != changedAt_.end(); ++it)
+      {
+         if (it->second > version)
+            groupList.push_back(it->first);
+      }
+      return groupList;
    }
 
 
 private:
+   typedef std::map< PropertyKey, std::vector< std::pair<std::string, size_t> > > PropertyIndex;
+
+   const PropertyIndex& GetPropertyIndex() const
+   {
+      if (!propertyIndexValid_)
+      {
+         propertyIndex_.clear();
+         for (std::map<std::string, ConfigGroup>::const_iterator it = groups_.begin();
+               it != groups_.end(); ++it)
+         {
+            const std::map<PropertyKey, size_t>& groupIndex = it->second.GetPropertyIndex();
+            for (std::map<PropertyKey, size_t>::const_iterator prop = groupIndex.begin();
+                  prop != groupIndex.end(); ++prop)
+            {
+               propertyIndex_[prop->first].push_back(
+                     std::make_pair(it->first, prop->second));
+            }
+         }
+         propertyIndexValid_ = true;
+      }
+      return propertyIndex_;
+   }
+
+   // Must be called whenever a group or its presets change
+   void Changed(const std::string& groupName)
+   {
+      propertyIndexValid_ = false;
+      changedAt_[groupName] = ++version_;
+   }
+
    std::map<std::string, ConfigGroup> groups_;
+
+   // Property -> (group, size of its largest preset including the property),
+   // rebuilt when first needed after a change
+   mutable PropertyIndex propertyIndex_;
+   mutable bool propertyIndexValid_;
+
+   long version_;
+   std::map<std::string, long> changedAt_; // Group -> version of last change
 };
 
 /**
@@ -425,6 +761,7 @@ public:
    {
       PropertySetting setting(deviceLabel, propName, value);
       configs_[resolutionID].addSetting(setting);
+      Changed();
       if (configs_[resolutionID].getPixelSizeUm() == 0.0)
       {
          // this is the first setting, so it is OK to set pixel size
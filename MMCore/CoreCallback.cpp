@@ -29,8 +29,11 @@
 #include "../MMDevice/DeviceUtils.h"
 #include "../MMDevice/ImgBuffer.h"
 #include "CircularBuffer.h"
+#include "ConfigGroup.h"
 #include "CoreCallback.h"
+#include "DeviceIdleWaiter.h"
 #include "DeviceManager.h"
+#include "ImageInsertQueue.h"
 
 #include <cassert>
 #include <chrono>
@@ -49,6 +52,7 @@ CoreCallback::CoreCallback(CMMCore* c) :
 
 CoreCallback::~CoreCallback()
 {
+   insertQueue_.reset();
    delete pValueChangeLock_;
 }
 
@@ -205,109 +209,134 @@ CoreCallback::Sleep(const MM::Device*, double intervalMs)
 
 
 /**
- * Get the metadata tags attached to device caller, and merge them with metadata
- * in pMd (if not null). Returns a metadata object.
+ * Get the metadata tags attached to device caller, and merge them into md,
+ * along with the camera label.
  */
-Metadata
-CoreCallback::AddCameraMetadata(const MM::Device* caller, const Metadata* pMd)
+void
+CoreCallback::AddCameraMetadata(const MM::Device* caller, BinaryMetadata& md)
 {
-   Metadata newMD;
-   if (pMd)
-   {
-      newMD = *pMd;
-   }
-
    std::shared_ptr<CameraInstance> camera =
       std::static_pointer_cast<CameraInstance>(
             core_->deviceManager_->GetDevice(caller));
 
-   std::string label = camera->GetLabel();
-   newMD.put("Camera", label);
-
-   std::string serializedMD;
-   try
-   {
-      serializedMD = camera->GetTags();
-   }
-   catch (const CMMError&)
-   {
-      return newMD;
-   }
-
-   Metadata devMD;
-   devMD.Restore(serializedMD.c_str());
-   newMD.Merge(devMD);
-
-   return newMD;
+   md.PutImageTag("Camera", camera->GetLabel());
+   camera->MergeTags(md);
 }
 
 int CoreCallback::InsertImage(const MM::Device* caller, const unsigned char* buf, unsigned width, unsigned height, unsigned byteDepth, const char* serializedMetadata, const bool doProcess)
 {
-   Metadata md;
+   BinaryMetadata md;
    md.Restore(serializedMetadata);
-   return InsertImage(caller, buf, width, height, byteDepth, &md, doProcess);
+   return InsertChannels(caller, buf, 1, width, height, byteDepth, 1, md, doProcess);
 }
 
 int CoreCallback::InsertImage(const MM::Device* caller, const unsigned char* buf, unsigned width, unsigned height, unsigned byteDepth, const Metadata* pMd, bool doProcess)
 {
-   try 
-   {
-      Metadata md = AddCameraMetadata(caller, pMd);
-
-      if(doProcess)
-      {
-         MM::ImageProcessor* ip = GetImageProcessor(caller);
-         if( NULL != ip)
-         {
-            ip->Process(const_cast<unsigned char*>(buf), width, height, byteDepth);
-         }
-      }
-      if (core_->cbuf_->InsertImage(buf, width, height, byteDepth, &md))
-         return DEVICE_OK;
-      else
-         return DEVICE_BUFFER_OVERFLOW;
-   }
-   catch (CMMError& /*e*/)
-   {
-      return DEVICE_INCOMPATIBLE_IMAGE;
-   }
+   BinaryMetadata md;
+   if (pMd)
+      md = BinaryMetadata(*pMd);
+   return InsertChannels(caller, buf, 1, width, height, byteDepth, 1, md, doProcess);
 }
 
 int CoreCallback::InsertImage(const MM::Device* caller, const unsigned char* buf, unsigned width, unsigned height, unsigned byteDepth, unsigned nComponents, const char* serializedMetadata, const bool doProcess)
 {
-   Metadata md;
+   BinaryMetadata md;
    md.Restore(serializedMetadata);
-   return InsertImage(caller, buf, width, height, byteDepth, nComponents, &md, doProcess);
+   return InsertChannels(caller, buf, 1, width, height, byteDepth, nComponents, md, doProcess);
 }
 
-int CoreCallback::InsertImage(const MM::Device* caller, const unsigned char* buf, unsigned width, unsigned height, unsigned byteDepth, unsigned nComponents, const Metadata* pMd, bool doProcess)
+int CoreCallback::InsertImage(const MM::Device* caller, const unsigned char* buf, unsigned width, unsigned height, unsigned byteDepth, unsigned nComponents, const unsigned char* metadataRecords, unsigned metadataSize, const bool doProcess)
 {
-   try 
+   BinaryMetadata md;
+   if (!md.AssignRecords(metadataRecords, metadataSize))
+      return DEVICE_INVALID_INPUT_PARAM;
+   return InsertChannels(caller, buf, 1, width, height, byteDepth, nComponents, md, doProcess);
+}
+
+int CoreCallback::InsertImageAsync(const MM::Device* caller, const unsigned char* buf, unsigned width, unsigned height, unsigned byteDepth, unsigned nComponents, const unsigned char* metadataRecords, unsigned metadataSize, MM::ImageReleaseCallback release, void* releaseContext)
+{
+   std::shared_ptr<ImageInsertQueue> queue = GetInsertQueue();
+   if (queue)
    {
-      Metadata md = AddCameraMetadata(caller, pMd);
+      return queue->Enqueue(caller, buf, width, height, byteDepth,
+            nComponents, metadataRecords, metadataSize, release,
+            releaseContext);
+   }
 
-      if(doProcess)
-      {
-         MM::ImageProcessor* ip = GetImageProcessor(caller);
-         if( NULL != ip)
-         {
-            ip->Process(const_cast<unsigned char*>(buf), width, height, byteDepth);
-         }
-      }
-      if (core_->cbuf_->InsertImage(buf, width, height, byteDepth, nComponents, &md))
-         return DEVICE_OK;
-      else
-         return DEVICE_BUFFER_OVERFLOW;
+   int ret = InsertImage(caller, buf, width, height, byteDepth, nComponents,
+         metadataRecords, metadataSize);
+   if (ret == DEVICE_OK && release)
+      release(releaseContext, buf);
+   return ret;
+}
+
+int CoreCallback::FlushImageInserts(const MM::Device* caller)
+{
+   std::shared_ptr<ImageInsertQueue> queue = GetInsertQueue();
+   if (!queue)
+      return DEVICE_OK;
+   return queue->Flush(caller);
+}
+
+bool CoreCallback::IsImageInsertQueueEnabled()
+{
+   return static_cast<bool>(GetInsertQueue());
+}
+
+std::shared_ptr<ImageInsertQueue> CoreCallback::GetInsertQueue()
+{
+   std::lock_guard<std::mutex> lock(insertQueueMutex_);
+   return insertQueue_;
+}
+
+void CoreCallback::SetImageInsertQueueDepth(unsigned depth)
+{
+   std::shared_ptr<ImageInsertQueue> newQueue;
+   if (depth > 0)
+   {
+      newQueue = std::make_shared<ImageInsertQueue>(depth,
+         [this](const MM::Device* caller, const unsigned char* buf,
+               unsigned width, unsigned height, unsigned byteDepth,
+               unsigned nComponents, BinaryMetadata& md) {
+            return InsertChannels(caller, buf, 1, width, height, byteDepth,
+                  nComponents, md, true);
+         });
    }
-   catch (CMMError& /*e*/)
+
+   std::shared_ptr<ImageInsertQueue> oldQueue;
    {
-      return DEVICE_INCOMPATIBLE_IMAGE;
+      std::lock_guard<std::mutex> lock(insertQueueMutex_);
+      oldQueue.swap(insertQueue_);
+      insertQueue_ = newQueue;
    }
+   // The old queue finishes inserting its images when destroyed (here,
+   // unless a camera thread still holds it)
+}
+
+unsigned CoreCallback::GetImageInsertQueueDepth()
+{
+   std::shared_ptr<ImageInsertQueue> queue = GetInsertQueue();
+   return queue ? queue->GetDepth() : 0;
+}
+
+void CoreCallback::WaitForImageInserts()
+{
+   std::shared_ptr<ImageInsertQueue> queue = GetInsertQueue();
+   if (queue)
+      queue->Flush(0);
+}
+
+int CoreCallback::InsertImage(const MM::Device* caller, const unsigned char* buf, unsigned width, unsigned height, unsigned byteDepth, unsigned nComponents, const Metadata* pMd, bool doProcess)
+{
+   BinaryMetadata md;
+   if (pMd)
+      md = BinaryMetadata(*pMd);
+   return InsertChannels(caller, buf, 1, width, height, byteDepth, nComponents, md, doProcess);
 }
 
 int CoreCallback::InsertImage(const MM::Device* caller, const ImgBuffer & imgBuf)
 {
-   Metadata md = imgBuf.GetMetadata();
+   BinaryMetadata md(imgBuf.GetMetadata());
    unsigned char* p = const_cast<unsigned char*>(imgBuf.GetPixels());
    MM::ImageProcessor* ip = GetImageProcessor(caller);
    if( NULL != ip)
@@ -315,8 +344,8 @@ int CoreCallback::InsertImage(const MM::Device* caller, const ImgBuffer & imgBuf
       ip->Process(p, imgBuf.Width(), imgBuf.Height(), imgBuf.Depth());
    }
 
-   return InsertImage(caller, imgBuf.GetPixels(), imgBuf.Width(), 
-      imgBuf.Height(), imgBuf.Depth(), &md);
+   return InsertChannels(caller, imgBuf.GetPixels(), 1, imgBuf.Width(),
+      imgBuf.Height(), imgBuf.Depth(), 1, md, true);
 }
 
 void CoreCallback::ClearImageBuffer(const MM::Device* /*caller*/)
@@ -341,17 +370,28 @@ int CoreCallback::InsertMultiChannel(const MM::Device* caller,
                               unsigned height,
                               unsigned byteDepth,
                               Metadata* pMd)
+{
+   BinaryMetadata md;
+   if (pMd)
+      md = BinaryMetadata(*pMd);
+   return InsertChannels(caller, buf, numChannels, width, height, byteDepth, 1, md, true);
+}
+
+int CoreCallback::InsertChannels(const MM::Device* caller, const unsigned char* buf, unsigned numChannels, unsigned width, unsigned height, unsigned byteDepth, unsigned nComponents, BinaryMetadata& md, bool doProcess)
 {
    try
    {
-      Metadata md = AddCameraMetadata(caller, pMd);
+      AddCameraMetadata(caller, md);
 
-      MM::ImageProcessor* ip = GetImageProcessor(caller);
-      if( NULL != ip)
+      if(doProcess)
       {
-         ip->Process( const_cast<unsigned char*>(buf), width, height, byteDepth);
+         MM::ImageProcessor* ip = GetImageProcessor(caller);
+         if( NULL != ip)
+         {
+            ip->Process(const_cast<unsigned char*>(buf), width, height, byteDepth);
+         }
       }
-      if (core_->cbuf_->InsertMultiChannel(buf, numChannels, width, height, byteDepth, &md))
+      if (core_->cbuf_->InsertMultiChannel(buf, numChannels, width, height, byteDepth, nComponents, md))
          return DEVICE_OK;
       else
          return DEVICE_BUFFER_OVERFLOW;
@@ -360,11 +400,85 @@ int CoreCallback::InsertMultiChannel(const MM::Device* caller,
    {
       return DEVICE_INCOMPATIBLE_IMAGE;
    }
+}
+
+int CoreCallback::AcquireImageWriteSlot(const MM::Device* /*caller*/, unsigned width, unsigned height, unsigned byteDepth, unsigned char** pixels)
+{
+   if (!pixels)
+      return DEVICE_INVALID_INPUT_PARAM;
+   *pixels = 0;
+
+   try
+   {
+      unsigned char* slot = core_->cbuf_->AcquireWriteSlot(width, height, byteDepth);
+      if (!slot)
+         return DEVICE_BUFFER_OVERFLOW;
+      *pixels = slot;
+      return DEVICE_OK;
+   }
+   catch (CMMError& /*e*/)
+   {
+      return DEVICE_INCOMPATIBLE_IMAGE;
+   }
+}
+
+int CoreCallback::CommitImageWriteSlot(const MM::Device* caller, unsigned char* pixels, unsigned nComponents, const char* serializedMetadata, const bool doProcess)
+{
+   BinaryMetadata md;
+   md.Restore(serializedMetadata);
+   return CommitWriteSlot(caller, pixels, nComponents, md, doProcess);
+}
+
+int CoreCallback::CommitImageWriteSlot(const MM::Device* caller, unsigned char* pixels, unsigned nComponents, const unsigned char* metadataRecords, unsigned metadataSize, const bool doProcess)
+{
+   BinaryMetadata md;
+   if (!md.AssignRecords(metadataRecords, metadataSize))
+   {
+      core_->cbuf_->AbandonWriteSlot();
+      return DEVICE_INVALID_INPUT_PARAM;
+   }
+   return CommitWriteSlot(caller, pixels, nComponents, md, doProcess);
+}
+
+int CoreCallback::CommitWriteSlot(const MM::Device* caller, unsigned char* pixels, unsigned nComponents, BinaryMetadata& md, bool doProcess)
+{
+   try
+   {
+      AddCameraMetadata(caller, md);
+   }
+   catch (CMMError& /*e*/)
+   {
+      core_->cbuf_->AbandonWriteSlot();
+      return DEVICE_ERR;
+   }
 
+   if (doProcess)
+   {
+      MM::ImageProcessor* ip = GetImageProcessor(caller);
+      if (NULL != ip)
+      {
+         ip->Process(pixels, core_->cbuf_->Width(), core_->cbuf_->Height(),
+               core_->cbuf_->Depth());
+      }
+   }
+
+   if (!core_->cbuf_->CommitWriteSlot(nComponents, md))
+      return DEVICE_ERR;
+   return DEVICE_OK;
+}
+
+int CoreCallback::AbandonImageWriteSlot(const MM::Device* /*caller*/)
+{
+   if (!core_->cbuf_->AbandonWriteSlot())
+      return DEVICE_ERR;
+   return DEVICE_OK;
 }
 
 int CoreCallback::AcqFinished(const MM::Device* caller, int /*statusCode*/)
 {
+   // Images still queued belong to this acquisition
+   FlushImageInserts(caller);
+
    std::shared_ptr<DeviceInstance> camera;
    try
    {
@@ -447,13 +561,20 @@ int CoreCallback::PrepareForAcq(const MM::Device* /*caller*/)
 /**
  * Handler for the property change event from the device.
  */
-int CoreCallback::OnPropertiesChanged(const MM::Device* /* caller */)
+int CoreCallback::OnPropertiesChanged(const MM::Device* caller)
 {
    if (core_->externalCallback_)
       core_->externalCallback_->onPropertiesChanged();
 
-   // TODO It is inconsistent that we do not update the system state cache in
-   // this case. However, doing so would be time-consuming (if not unsafe).
+   // Reading the device here would be time-consuming (if not unsafe), so
+   // leave it to the next incremental cache update
+   if (caller)
+   {
+      char label[MM::MaxStrLength];
+      caller->GetLabel(label);
+      MMThreadGuard scg(core_->stateCacheLock_);
+      core_->dirtyDevices_.insert(label);
+   }
 
    return DEVICE_OK;
 }
@@ -471,67 +592,54 @@ int CoreCallback::OnPropertyChanged(const MM::Device* device, const char* propNa
       bool readOnly;
       device->GetPropertyReadOnly(propName, readOnly);
       const PropertySetting* ps = new PropertySetting(label, propName, value, readOnly);
+      // Find the config groups with a preset containing this property, to
+      // notify their change. Only groups with presets of more than 1
+      // property count, since the UI treats groups with one property
+      // differently, whereas the core does not....
+      std::vector<std::string> configGroups;
+      bool pixelSizeAffected;
       {
          MMThreadGuard scg(core_->stateCacheLock_);
-         core_->stateCache_.addSetting(*ps);
+         core_->cacheSetting(*ps);
+         configGroups = core_->configGroups_->GetGroupsIncluding(label, propName, 2);
+         pixelSizeAffected =
+            core_->pixelSizeGroup_->LargestPresetIncluding(label, propName) > 0;
       }
       core_->externalCallback_->onPropertyChanged(label, propName, value);
 
-      // Find all configs that contain this property and callback to indicate 
-      // that the config group changed
-      // TODO: Assess whether performance is better by maintaining a map tying
-      // property to configurations
-      std::vector<std::string> configGroups = 
-         core_->getAvailableConfigGroups ();
-      for (std::vector<std::string>::iterator it = configGroups.begin(); 
-            it != configGroups.end(); ++it) 
+      for (std::vector<std::string>::iterator it = configGroups.begin();
+            it != configGroups.end(); ++it)
       {
-         std::vector<std::string> configs = 
-            core_->getAvailableConfigs((*it).c_str());
-         bool found = false;
-         for (std::vector<std::string>::iterator itc = configs.begin();
-               itc != configs.end() && !found; itc++) 
-         {
-            Configuration config = 
-               core_->getConfigData((*it).c_str(), (*itc).c_str());
-            // only callback when there is more than 1 property in a group
-            // This is needed, since the UI treats groups with one 
-            // property differently, whereas the core does not....
-            if (config.size() > 1 && config.isPropertyIncluded(label, propName)) {
-               found = true;
-               // If we are part of this configuration, notify that it 
-               // was changed. Get the new config from cache rather 
-               // than by querying the hardware
-               std::string currentConfig = 
-                  core_->getCurrentConfigFromCache( (*it).c_str() );
-               OnConfigGroupChanged((*it).c_str(), currentConfig.c_str());
-            }
-         }
+         // Get the new config from cache rather than by querying the
+         // hardware
+         std::string currentConfig =
+            core_->getCurrentConfigFromCache( (*it).c_str() );
+         OnConfigGroupChanged((*it).c_str(), currentConfig.c_str());
       }
-          
 
       // Check if pixel size was potentially affected.  If so, update from cache
-      std::vector<std::string> pixelSizeConfigs = core_->getAvailablePixelSizeConfigs();
-      bool found = false;
-      for (std::vector<std::string>::iterator itpsc = pixelSizeConfigs.begin();
-            itpsc != pixelSizeConfigs.end() && !found; itpsc++) 
+      if (pixelSizeAffected)
       {
-         Configuration pixelSizeConfig = core_->getPixelSizeConfigData( (*itpsc).c_str());
-         if (pixelSizeConfig.isPropertyIncluded(label, propName)) {
-            found = true;
-            double pixSizeUm;
-            try {
-               // update pixel size from cache
-               pixSizeUm = core_->getPixelSizeUm(true);
-               OnPixelSizeAffineChanged(core_->getPixelSizeAffine(true));
-            }
-            catch (const CMMError&) {
-               pixSizeUm = 0.0;
-            }
-            OnPixelSizeChanged(pixSizeUm);
+         double pixSizeUm;
+         try {
+            // update pixel size from cache
+            pixSizeUm = core_->getPixelSizeUm(true);
+            OnPixelSizeAffineChanged(core_->getPixelSizeAffine(true));
+         }
+         catch (const CMMError&) {
+            pixSizeUm = 0.0;
          }
+         OnPixelSizeChanged(pixSizeUm);
       }
    }
+   else if (device)
+   {
+      // The cache is not updated without a listener
+      char label[MM::MaxStrLength];
+      device->GetLabel(label);
+      MMThreadGuard scg(core_->stateCacheLock_);
+      core_->dirtyDevices_.insert(label);
+   }
 
    return DEVICE_OK;
 }
@@ -658,6 +766,33 @@ int CoreCallback::OnMagnifierChanged(const MM::Device* /* device */)
    return DEVICE_OK;
 }
 
+/**
+ * Device signals that it is no longer busy; wakes threads waiting for it
+ */
+int CoreCallback::OnBecameIdle(const MM::Device* device)
+{
+   core_->idleWaiter_->NotifyIdle(device);
+   return DEVICE_OK;
+}
+
+int CoreCallback::OnCameraTagsChanged(const MM::Device* device)
+{
+   std::shared_ptr<CameraInstance> camera;
+   try
+   {
+      camera = std::dynamic_pointer_cast<CameraInstance>(
+            core_->deviceManager_->GetDevice(device));
+   }
+   catch (const CMMError&)
+   {
+      // Not loaded yet; its tags are read when first needed
+      return DEVICE_OK;
+   }
+   if (camera)
+      camera->InvalidateTags();
+   return DEVICE_OK;
+}
+
 
 
 int CoreCallback::SetSerialProperties(const char* portName,
@@ -797,6 +932,40 @@ int CoreCallback::GetSerialAnswer(const MM::Device*, const char* portName, unsig
    return DEVICE_OK;
 }
 
+/**
+ * Sends several ASCII commands back-to-back and receives their answers in
+ * order. Answer i is written to answers + i * ansLength.
+ */
+int CoreCallback::SetSerialCommands(const MM::Device* caller, const char* portName, unsigned numCommands, const char* const* commands, const char* commandTerm, unsigned long ansLength, char* answers, const char* answerTerm)
+{
+   std::vector<std::string> answerList;
+   try
+   {
+      std::shared_ptr<SerialInstance> pSerial =
+         core_->deviceManager_->GetDeviceOfType<SerialInstance>(portName);
+      // don't allow self reference
+      if (pSerial->GetRawPtr() == caller)
+         return DEVICE_SELF_REFERENCE;
+
+      answerList = core_->sendSerialPortCommands(portName,
+            std::vector<std::string>(commands, commands + numCommands),
+            commandTerm, answerTerm);
+   }
+   catch (...)
+   {
+      // trap all exceptions and return generic serial error
+      return DEVICE_SERIAL_COMMAND_FAILED;
+   }
+
+   for (unsigned i = 0; i < numCommands; ++i)
+   {
+      if (answerList[i].length() >= ansLength)
+         return DEVICE_SERIAL_BUFFER_OVERRUN;
+      strcpy(answers + i * ansLength, answerList[i].c_str());
+   }
+   return DEVICE_OK;
+}
+
 const char* CoreCallback::GetImage()
 {
    try
@@ -31,6 +31,11 @@
 #include "MMEventCallback.h"
 #include "../MMDevice/DeviceUtils.h"
 
+#include <memory>
+#include <mutex>
+
+class ImageInsertQueue;
+
 namespace mm
 {
    class DeviceManager;
@@ -76,6 +81,7 @@ public:
    int PurgeSerial(const MM::Device* caller, const char* portName);
    int SetSerialCommand(const MM::Device*, const char* portName, const char* command, const char* term);
    int GetSerialAnswer(const MM::Device*, const char* portName, unsigned long ansLength, char* answerTxt, const char* term);
+   int SetSerialCommands(const MM::Device* caller, const char* portName, unsigned numCommands, const char* const* commands, const char* commandTerm, unsigned long ansLength, char* answers, const char* answerTerm);
 
    /*Deprecated*/ unsigned long GetClockTicksUs(const MM::Device* caller);
 
@@ -87,11 +93,19 @@ public:
    int InsertImage(const MM::Device* caller, const ImgBuffer& imgBuf); // Note: _not_ mm::ImgBuffer
    int InsertImage(const MM::Device* caller, const unsigned char* buf, unsigned width, unsigned height, unsigned byteDepth, const char* serializedMetadata, const bool doProcess = true);
    int InsertImage(const MM::Device* caller, const unsigned char* buf, unsigned width, unsigned height, unsigned byteDepth, unsigned nComponents, const char* serializedMetadata, const bool doProcess = true);
+   int InsertImage(const MM::Device* caller, const unsigned char* buf, unsigned width, unsigned height, unsigned byteDepth, unsigned nComponents, const unsigned char* metadataRecords, unsigned metadataSize, const bool doProcess = true);
+   int InsertImageAsync(const MM::Device* caller, const unsigned char* buf, unsigned width, unsigned height, unsigned byteDepth, unsigned nComponents, const unsigned char* metadataRecords, unsigned metadataSize, MM::ImageReleaseCallback release, void* releaseContext);
+   int FlushImageInserts(const MM::Device* caller);
+   bool IsImageInsertQueueEnabled();
 
    /*Deprecated*/ int InsertImage(const MM::Device* caller, const unsigned char* buf, unsigned width, unsigned height, unsigned byteDepth, const Metadata* pMd = 0, const bool doProcess = true);
    /*Deprecated*/ int InsertImage(const MM::Device* caller, const unsigned char* buf, unsigned width, unsigned height, unsigned byteDepth, unsigned nComponents, const Metadata* pMd = 0, const bool doProcess = true);
 
    /*Deprecated*/ int InsertMultiChannel(const MM::Device* caller, const unsigned char* buf, unsigned numChannels, unsigned width, unsigned height, unsigned byteDepth, Metadata* pMd = 0);
+   int AcquireImageWriteSlot(const MM::Device* caller, unsigned width, unsigned height, unsigned byteDepth, unsigned char** pixels);
+   int CommitImageWriteSlot(const MM::Device* caller, unsigned char* pixels, unsigned nComponents, const char* serializedMetadata, const bool doProcess = true);
+   int CommitImageWriteSlot(const MM::Device* caller, unsigned char* pixels, unsigned nComponents, const unsigned char* metadataRecords, unsigned metadataSize, const bool doProcess = true);
+   int AbandonImageWriteSlot(const MM::Device* caller);
    void ClearImageBuffer(const MM::Device* caller);
    bool InitializeImageBuffer(unsigned channels, unsigned slices, unsigned int w, unsigned int h, unsigned int pixDepth);
 
@@ -121,6 +135,8 @@ public:
    int OnExposureChanged(const MM::Device* device, double newExposure);
    int OnSLMExposureChanged(const MM::Device* device, double newExposure);
    int OnMagnifierChanged(const MM::Device* device);
+   int OnBecameIdle(const MM::Device* device);
+   int OnCameraTagsChanged(const MM::Device* device);
 
 
    void NextPostedError(int& errorCode, char* pMessage, int maxlen, int& messageLength);
@@ -137,11 +153,23 @@ public:
    void GetLoadedDeviceOfType(const MM::Device* caller, MM::DeviceType devType,
          char* deviceName, const unsigned int deviceIterator);
 
+   // Depth 0 disables the insert queue used by InsertImageAsync()
+   void SetImageInsertQueueDepth(unsigned depth);
+   unsigned GetImageInsertQueueDepth();
+   // Waits until all queued images have been inserted
+   void WaitForImageInserts();
+
 private:
    CMMCore* core_;
    MMThreadLock* pValueChangeLock_;
 
-   Metadata AddCameraMetadata(const MM::Device* caller, const Metadata* pMd);
+   std::mutex insertQueueMutex_;
+   std::shared_ptr<ImageInsertQueue> insertQueue_;
+
+   void AddCameraMetadata(const MM::Device* caller, BinaryMetadata& md);
+   int InsertChannels(const MM::Device* caller, const unsigned char* buf, unsigned numChannels, unsigned width, unsigned height, unsigned byteDepth, unsigned nComponents, BinaryMetadata& md, bool doProcess);
+   int CommitWriteSlot(const MM::Device* caller, unsigned char* pixels, unsigned nComponents, BinaryMetadata& md, bool doProcess);
+   std::shared_ptr<ImageInsertQueue> GetInsertQueue();
 
    int OnConfigGroupChanged(const char* groupName, const char* newConfigName);
    int OnPixelSizeChanged(double newPixelSizeUm);
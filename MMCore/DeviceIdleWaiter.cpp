@@ -0,0 +1,95 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          DeviceIdleWaiter.cpp
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Waits for devices to stop being busy, woken by their
+//                became-idle notifications or by polling.
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#include "DeviceIdleWaiter.h"
+
+#include <algorithm>
+
+
+namespace {
+
+const std::chrono::microseconds FirstPollInterval(20);
+
+} // anonymous namespace
+
+
+DeviceIdleWaiter::DeviceIdleWaiter() :
+   notifications_(0)
+{
+}
+
+void DeviceIdleWaiter::NotifyIdle(const void* id)
+{
+   {
+      std::lock_guard<std::mutex> lock(mutex_);
+      notifyingDevices_.insert(id);
+      ++notifications_;
+   }
+   idle_.notify_all();
+}
+
+void DeviceIdleWaiter::Forget(const void* id)
+{
+   std::lock_guard<std::mutex> lock(mutex_);
+   notifyingDevices_.erase(id);
+}
+
+bool DeviceIdleWaiter::Wait(const std::vector<Device>& devices,
+      std::chrono::steady_clock::time_point deadline,
+      std::chrono::microseconds maxPollInterval, size_t& stillBusy)
+{
+   std::vector<size_t> busy;
+   for (size_t i = 0; i < devices.size(); ++i)
+      busy.push_back(i);
+
+   std::chrono::microseconds pollInterval =
+      std::min(FirstPollInterval, maxPollInterval);
+   for (;;)
+   {
+      // A notification arriving after this is not missed, even if it comes
+      // before we start waiting
+      unsigned long long seen;
+      {
+         std::lock_guard<std::mutex> lock(mutex_);
+         seen = notifications_;
+      }
+
+      busy.erase(std::remove_if(busy.begin(), busy.end(),
+               [&](size_t i) { return !devices[i].busy(); }), busy.end());
+      if (busy.empty())
+         return true;
+
+      const std::chrono::steady_clock::time_point now =
+         std::chrono::steady_clock::now();
+      if (now >= deadline)
+      {
+         stillBusy = busy.front();
+         return false;
+      }
+
+      std::unique_lock<std::mutex> lock(mutex_);
+      const bool allNotify = std::all_of(busy.begin(), busy.end(),
+            [&](size_t i) { return notifyingDevices_.count(devices[i].id) > 0; });
+      const std::chrono::steady_clock::time_point wakeUp =
+         std::min(deadline, now + (allNotify ? maxPollInterval : pollInterval));
+      idle_.wait_until(lock, wakeUp, [&] { return notifications_ != seen; });
+      if (!allNotify)
+         pollInterval = std::min(2 * pollInterval, maxPollInterval);
+   }
+}
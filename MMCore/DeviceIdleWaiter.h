@@ -0,0 +1,70 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          DeviceIdleWaiter.h
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Waits for devices to stop being busy, woken by their
+//                became-idle notifications or by polling.
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <vector>
+
+
+/**
+ * Waits until a set of devices are all idle.
+ *
+ * Devices that call MM::Core::OnBecameIdle() are remembered; while only
+ * such devices are still busy, Wait() sleeps until one of them reports being
+ * idle, checking again at the maximum poll interval only in case a
+ * notification is missed. Otherwise it polls, starting at a few
+ * microseconds and doubling the interval up to the maximum, so that short
+ * waits end soon after the device does.
+ *
+ * All devices are waited for together, so the total wait is that of the
+ * slowest device.
+ */
+class DeviceIdleWaiter
+{
+public:
+   struct Device
+   {
+      const void* id; // Identifies the device in NotifyIdle()
+      std::function<bool ()> busy;
+   };
+
+   DeviceIdleWaiter();
+
+   // Called (from any thread) when a device has become idle
+   void NotifyIdle(const void* id);
+   // Forgets a device, e.g. when it is unloaded
+   void Forget(const void* id);
+
+   // Returns true once no device is busy. Returns false if a device is still
+   // busy at the deadline, setting stillBusy to the index of the first one.
+   bool Wait(const std::vector<Device>& devices,
+         std::chrono::steady_clock::time_point deadline,
+         std::chrono::microseconds maxPollInterval, size_t& stillBusy);
+
+private:
+   std::mutex mutex_;
+   std::condition_variable idle_;
+   unsigned long long notifications_;
+   std::set<const void*> notifyingDevices_;
+};
@@ -41,13 +41,10 @@ DeviceManager::LoadDevice(std::shared_ptr<LoadedDeviceAdapter> module,
       mm::logging::Logger deviceLogger,
       mm::logging::Logger coreLogger)
 {
-   for (DeviceConstIterator it = devices_.begin(), end = devices_.end(); it != end; ++it)
+   if (deviceLabelIndex_.count(label))
    {
-      if (it->first == label)
-      {
-         throw CMMError("The specified device label " + ToQuotedString(label) +
-               " is already in use", MMERR_DuplicateLabel);
-      }
+      throw CMMError("The specified device label " + ToQuotedString(label) +
+            " is already in use", MMERR_DuplicateLabel);
    }
 
    std::shared_ptr<DeviceInstance> device = module->LoadDevice(core,
@@ -72,7 +69,8 @@ DeviceManager::LoadDevice(std::shared_ptr<LoadedDeviceAdapter> module,
       device->SetDescription(description);
    }
 
-   devices_.push_back(std::make_pair(label, device));
+   devices_.push_back(device);
+   deviceLabelIndex_.insert(std::make_pair(label, device));
    deviceRawPtrIndex_.insert(std::make_pair(device->GetRawPtr(), device));
    return device;
 }
@@ -84,16 +82,14 @@ DeviceManager::UnloadDevice(std::shared_ptr<DeviceInstance> device)
    if (device == 0)
       return;
 
-   for (DeviceIterator it = devices_.begin(), end = devices_.end(); it != end; ++it)
-   {
-      if (it->second == device)
-      {
-         device->Shutdown(); // TODO Should be automatic
-         deviceRawPtrIndex_.erase(it->second->GetRawPtr());
-         devices_.erase(it);
-         break;
-      }
-   }
+   DeviceIterator it = std::find(devices_.begin(), devices_.end(), device);
+   if (it == devices_.end())
+      return;
+
+   device->Shutdown(); // TODO Should be automatic
+   deviceRawPtrIndex_.erase(device->GetRawPtr());
+   deviceLabelIndex_.erase(device->GetLabel());
+   devices_.erase(it);
 }
 
 
@@ -111,13 +107,13 @@ DeviceManager::UnloadAllDevices()
    std::vector< std::shared_ptr<DeviceInstance> > serialDevices;
    for (DeviceIterator it = devices_.begin(), end = devices_.end(); it != end; ++it)
    {
-      if (it->second->GetType() == MM::SerialDevice)
+      if ((*it)->GetType() == MM::SerialDevice)
       {
-         serialDevices.push_back(it->second);
+         serialDevices.push_back(*it);
       }
       else
       {
-         nonSerialDevices.push_back(it->second);
+         nonSerialDevices.push_back(*it);
       }
    }
 
@@ -140,6 +136,7 @@ DeviceManager::UnloadAllDevices()
    }
 
    deviceRawPtrIndex_.clear();
+   deviceLabelIndex_.clear();
    devices_.clear();
 
    // Now the only remaining references to the device objects should be in
@@ -155,27 +152,11 @@ DeviceManager::UnloadAllDevices()
 }
 
 
-namespace
-{
-   class DevicePairMatcheslabel
-   {
-      std::string s_;
-   public:
-      DevicePairMatcheslabel(const std::string& s) : s_(s) {}
-      bool operator()(const std::pair< std::string,
-            std::shared_ptr<DeviceInstance> >& p) const
-      { return p.first == s_; }
-   };
-} // anonymous namespace
-
-
 std::shared_ptr<DeviceInstance>
 DeviceManager::GetDevice(const std::string& label) const
 {
-   DeviceConstIterator found =
-      std::find_if(devices_.begin(), devices_.end(),
-            DevicePairMatcheslabel(label));
-   if (found == devices_.end())
+   auto found = deviceLabelIndex_.find(label);
+   if (found == deviceLabelIndex_.end())
    {
       throw CMMError("No device with label " + ToQuotedString(label));
    }
@@ -197,8 +178,7 @@ DeviceManager::GetDevice(const char* label) const
 std::shared_ptr<DeviceInstance>
 DeviceManager::GetDevice(const MM::Device* rawPtr) const
 {
-   typedef std::map< const MM::Device*, std::weak_ptr<DeviceInstance> >::const_iterator Iterator;
-   Iterator it = deviceRawPtrIndex_.find(rawPtr);
+   auto it = deviceRawPtrIndex_.find(rawPtr);
    if (it == deviceRawPtrIndex_.end())
       throw CMMError("Invalid device pointer");
    return it->second.lock();
@@ -211,9 +191,9 @@ DeviceManager::GetDeviceList(MM::DeviceType type) const
    std::vector<std::string> labels;
    for (DeviceConstIterator it = devices_.begin(), end = devices_.end(); it != end; ++it)
    {
-      if (type == MM::AnyType || it->second->GetType() == type)
+      if (type == MM::AnyType || (*it)->GetType() == type)
       {
-         labels.push_back(it->first);
+         labels.push_back((*it)->GetLabel());
       }
    }
    return labels;
@@ -240,10 +220,10 @@ DeviceManager::GetLoadedPeripherals(const char* label) const
 
    for (DeviceConstIterator it = devices_.begin(), end = devices_.end(); it != end; ++it)
    {
-      std::string parentID = it->second->GetParentID();
+      std::string parentID = (*it)->GetParentID();
       if (parentID == label)
       {
-         labels.push_back(it->second->GetLabel());
+         labels.push_back((*it)->GetLabel());
       }
    }
 
@@ -264,10 +244,10 @@ DeviceManager::GetParentDevice(std::shared_ptr<DeviceInstance> device) const
       std::shared_ptr<HubInstance> parentHub;
       for (DeviceConstIterator it = devices_.begin(), end = devices_.end(); it != end; ++it)
       {
-         if (it->second->GetType() == MM::HubDevice &&
-               device->GetAdapterModule() == it->second->GetAdapterModule())
+         if ((*it)->GetType() == MM::HubDevice &&
+               device->GetAdapterModule() == (*it)->GetAdapterModule())
          {
-            parentHub = std::static_pointer_cast<HubInstance>(it->second);
+            parentHub = std::static_pointer_cast<HubInstance>(*it);
          }
       }
       // This returns the last matching hub; not sure why it was coded that
@@ -277,14 +257,12 @@ DeviceManager::GetParentDevice(std::shared_ptr<DeviceInstance> device) const
    }
    else
    {
-      for (DeviceConstIterator it = devices_.begin(), end = devices_.end(); it != end; ++it)
+      auto found = deviceLabelIndex_.find(parentLabel);
+      if (found != deviceLabelIndex_.end() &&
+            found->second->GetType() == MM::HubDevice &&
+            found->second->GetAdapterModule() == device->GetAdapterModule())
       {
-         if (it->first == parentLabel &&
-               it->second->GetType() == MM::HubDevice &&
-               it->second->GetAdapterModule() == device->GetAdapterModule())
-         {
-            return std::static_pointer_cast<HubInstance>(it->second);
-         }
+         return std::static_pointer_cast<HubInstance>(found->second);
       }
       // TODO We should probably throw when the parent is missing.
       return std::shared_ptr<HubInstance>();
@@ -24,9 +24,9 @@
 #include "Error.h"
 #include "Logging/Logger.h"
 
-#include <map>
 #include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 class CMMCore;
@@ -39,18 +39,21 @@ namespace mm
 
 class DeviceManager /* final */
 {
-   // Store devices in an ordered container. We could use a map or hash map to
-   // retrieve by name, but the number of devices is so small that it is not
-   // known to be worth it.
-   std::vector< std::pair<std::string, std::shared_ptr<DeviceInstance> > > devices_;
-   typedef std::vector< std::pair<std::string, std::shared_ptr<DeviceInstance> > >::const_iterator
+   // Devices in load order, which GetDeviceList() and unloading follow.
+   std::vector< std::shared_ptr<DeviceInstance> > devices_;
+   typedef std::vector< std::shared_ptr<DeviceInstance> >::const_iterator
       DeviceConstIterator;
-   typedef std::vector< std::pair<std::string, std::shared_ptr<DeviceInstance> > >::iterator
+   typedef std::vector< std::shared_ptr<DeviceInstance> >::iterator
       DeviceIterator;
 
-   // Map raw device pointers to DeviceInstance objects, for those few places
-   // where we need to retrieve device information from raw pointers.
-   std::map< const MM::Device*, std::weak_ptr<DeviceInstance> > deviceRawPtrIndex_;
+   // Almost every Core API call looks up at least one device by label, so
+   // index them rather than search devices_.
+   std::unordered_map< std::string, std::shared_ptr<DeviceInstance> > deviceLabelIndex_;
+
+   // Map raw device pointers to DeviceInstance objects, for those places
+   // (mostly CoreCallback) where we need to retrieve device information from
+   // raw pointers.
+   std::unordered_map< const MM::Device*, std::weak_ptr<DeviceInstance> > deviceRawPtrIndex_;
 
 public:
    ~DeviceManager();
@@ -90,6 +93,8 @@ public:
    std::shared_ptr<TDeviceInstance>
    GetDeviceOfType(std::shared_ptr<DeviceInstance> device) const
    {
+      // The type is cached by the DeviceInstance, so this does not call into
+      // the device
       if (device->GetType() != TDeviceInstance::RawDeviceClass::Type)
          throw CMMError("Device " + ToQuotedString(device->GetLabel()) +
                " is of the wrong type for the requested operation");
@@ -139,6 +139,32 @@ std::string CameraInstance::GetTags()
 
 void CameraInstance::AddTag(const char* key, const char* deviceLabel, const char* value) { return GetImpl()->AddTag(key, deviceLabel, value); }
 void CameraInstance::RemoveTag(const char* key) { return GetImpl()->RemoveTag(key); }
+
+void CameraInstance::MergeTags(BinaryMetadata& md)
+{
+   std::lock_guard<std::mutex> lock(tagsMutex_);
+   if (tagsStale_)
+   {
+      std::string serializedTags;
+      try
+      {
+         serializedTags = GetTags();
+      }
+      catch (const CMMError&)
+      {
+         return;
+      }
+      tags_.Restore(serializedTags.c_str());
+      tagsStale_ = false;
+   }
+   md.Merge(tags_);
+}
+
+void CameraInstance::InvalidateTags()
+{
+   std::lock_guard<std::mutex> lock(tagsMutex_);
+   tagsStale_ = true;
+}
 int CameraInstance::IsExposureSequenceable(bool& isSequenceable) const { return GetImpl()->IsExposureSequenceable(isSequenceable); }
 int CameraInstance::GetExposureSequenceMaxLength(long& nrEvents) const { return GetImpl()->GetExposureSequenceMaxLength(nrEvents); }
 int CameraInstance::StartExposureSequence() { return GetImpl()->StartExposureSequence(); }
@@ -21,6 +21,10 @@
 
 #include "DeviceInstanceBase.h"
 
+#include "../../MMDevice/BinaryMetadata.h"
+
+#include <mutex>
+
 
 class CameraInstance : public DeviceInstanceBase<MM::Camera>
 {
@@ -33,7 +37,8 @@ public:
          const std::string& label,
          mm::logging::Logger deviceLogger,
          mm::logging::Logger coreLogger) :
-      DeviceInstanceBase<MM::Camera>(core, adapter, name, pDevice, deleteFunction, label, deviceLogger, coreLogger)
+      DeviceInstanceBase<MM::Camera>(core, adapter, name, pDevice, deleteFunction, label, deviceLogger, coreLogger),
+      tagsStale_(true)
    {}
 
    int SnapImage();
@@ -75,6 +80,13 @@ public:
    std::string GetTags();
    void AddTag(const char* key, const char* deviceLabel, const char* value);
    void RemoveTag(const char* key);
+
+   // Adds the camera's tags to md, reading them from the camera only if
+   // they changed since the last call
+   void MergeTags(BinaryMetadata& md);
+   // Called when the camera reports that its tags changed
+   void InvalidateTags();
+
    int IsExposureSequenceable(bool& isSequenceable) const;
    int GetExposureSequenceMaxLength(long& nrEvents) const;
    int StartExposureSequence();
@@ -82,4 +94,9 @@ public:
    int ClearExposureSequence();
    int AddToExposureSequence(double exposureTime_ms);
    int SendExposureSequence() const;
+
+private:
+   std::mutex tagsMutex_;
+   bool tagsStale_;
+   BinaryMetadata tags_;
 };
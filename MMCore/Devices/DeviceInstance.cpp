@@ -28,6 +28,8 @@
 #include "../Logging/Logger.h"
 #include "../MMCore.h"
 
+#include <chrono>
+
 
 int
 DeviceInstance::LogMessage(const char* msg, bool debugOnly)
@@ -50,7 +52,9 @@ DeviceInstance::DeviceInstance(CMMCore* core,
    core_(core),
    adapter_(adapter),
    label_(label),
+   type_(pDevice->GetType()),
    deleteFunction_(deleteFunction),
+   initializationTimeMs_(0.0),
    deviceLogger_(deviceLogger),
    coreLogger_(coreLogger)
 {
@@ -332,7 +336,12 @@ DeviceInstance::UsesDelay()
 void
 DeviceInstance::Initialize()
 {
-   ThrowIfError(pImpl_->Initialize());
+   const std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+   const int err = pImpl_->Initialize();
+   initializationTimeMs_ = std::chrono::duration<double, std::milli>(
+         std::chrono::steady_clock::now() - start).count();
+   ThrowIfError(err);
 }
 
 void
@@ -341,10 +350,6 @@ DeviceInstance::Shutdown()
    ThrowIfError(pImpl_->Shutdown());
 }
 
-MM::DeviceType
-DeviceInstance::GetType() const
-{ return pImpl_->GetType(); }
-
 std::string
 DeviceInstance::GetName() const
 {
@@ -67,8 +67,10 @@ private:
    CMMCore* core_; // Weak reference
    std::shared_ptr<LoadedDeviceAdapter> adapter_;
    const std::string label_;
+   const MM::DeviceType type_; // Fixed for the life of the device
    std::string description_;
    DeleteDeviceFunction deleteFunction_;
+   double initializationTimeMs_;
    mm::logging::Logger deviceLogger_;
    mm::logging::Logger coreLogger_;
 
@@ -80,6 +82,8 @@ public:
    std::string GetLabel() const /* final */ { return label_; }
    std::string GetDescription() const /* final */ { return description_; }
    void SetDescription(const std::string& description) /* final */ { description_ = description; }
+   // Duration of the last Initialize() call, or 0 if never called
+   double GetInitializationTimeMs() const /* final */ { return initializationTimeMs_; }
 
    // It would be nice to get rid of the need for raw pointers, but for now we
    // need it for the few CoreCallback methods that return a device pointer.
@@ -207,7 +211,7 @@ public:
    bool UsesDelay();
    void Initialize();
    void Shutdown();
-   MM::DeviceType GetType() const; // TODO Make private (can use RTTI)
+   MM::DeviceType GetType() const /* final */ { return type_; } // TODO Make private (can use RTTI)
    std::string GetName() const;
    void SetCallback(MM::Core* callback);
    bool SupportsDeviceDetection();
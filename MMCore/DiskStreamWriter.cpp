@@ -0,0 +1,568 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          DiskStreamWriter.cpp
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Writes the images in the sequence buffer to disk as they
+//                arrive, without passing them through the application.
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#include "DiskStreamWriter.h"
+
+#include "ErrorCodes.h"
+#include "SequenceBuffer.h"
+#include "TaskSet_CopyMemory.h"
+#include "ThreadPool.h"
+
+#include "../MMDevice/MMDevice.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <malloc.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+namespace {
+
+// Unbuffered writes must be aligned to the disk sector size, which is at
+// most 4 kB in practice
+const std::size_t Alignment = 4096;
+// Chunks are enlarged to hold a frame if needed
+const std::size_t MinChunkBytes = 16 << 20;
+const std::size_t ChunkCount = 4;
+
+const char IndexMagic[8] = { 'M', 'M', 'S', 'T', 'R', 'I', 'D', 'X' };
+const std::uint32_t IndexVersion = 2;
+
+unsigned char* AllocateAligned(std::size_t bytes)
+{
+#ifdef _WIN32
+   return static_cast<unsigned char*>(_aligned_malloc(bytes, Alignment));
+#else
+   void* p = 0;
+   if (posix_memalign(&p, Alignment, bytes) != 0)
+      return 0;
+   return static_cast<unsigned char*>(p);
+#endif
+}
+
+std::size_t RoundUpToAlignment(std::size_t bytes)
+{
+   return (bytes + Alignment - 1) / Alignment * Alignment;
+}
+
+void FreeAligned(unsigned char* p)
+{
+#ifdef _WIN32
+   _aligned_free(p);
+#else
+   std::free(p);
+#endif
+}
+
+std::string LastErrorString()
+{
+#ifdef _WIN32
+   return "Windows error " + std::to_string(GetLastError());
+#else
+   return std::strerror(errno);
+#endif
+}
+
+template <typename T>
+void WriteValue(std::ofstream& stream, T value)
+{
+   stream.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+long long NanosecondsSince(std::chrono::steady_clock::time_point start)
+{
+   return std::chrono::duration_cast<std::chrono::nanoseconds>(
+         std::chrono::steady_clock::now() - start).count();
+}
+
+} // anonymous namespace
+
+
+// File written with unbuffered I/O, in multiples of Alignment from aligned
+// memory
+class DiskStreamWriter::RawFile
+{
+public:
+   explicit RawFile(const std::string& path) throw (CMMError)
+   {
+#ifdef _WIN32
+      handle_ = CreateFileA(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ, 0,
+            CREATE_ALWAYS, FILE_FLAG_NO_BUFFERING, 0);
+      if (handle_ == INVALID_HANDLE_VALUE)
+         throw CMMError("Cannot create " + path + " (" + LastErrorString() + ")",
+               MMERR_FileOpenFailed);
+#else
+      const int flags = O_WRONLY | O_CREAT | O_TRUNC;
+      const mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH;
+#ifdef O_DIRECT
+      fd_ = open(path.c_str(), flags | O_DIRECT, mode);
+      // Some file systems (e.g. tmpfs) do not support O_DIRECT
+      if (fd_ < 0 && errno == EINVAL)
+#endif
+         fd_ = open(path.c_str(), flags, mode);
+      if (fd_ < 0)
+         throw CMMError("Cannot create " + path + " (" + LastErrorString() + ")",
+               MMERR_FileOpenFailed);
+#ifdef F_NOCACHE
+      fcntl(fd_, F_NOCACHE, 1);
+#endif
+#endif
+   }
+
+   ~RawFile()
+   {
+#ifdef _WIN32
+      CloseHandle(handle_);
+#else
+      close(fd_);
+#endif
+   }
+
+   bool Write(const unsigned char* data, std::size_t bytes)
+   {
+      while (bytes > 0)
+      {
+#ifdef _WIN32
+         const DWORD request = static_cast<DWORD>(std::min<std::size_t>(bytes, 1 << 30));
+         DWORD written = 0;
+         if (!WriteFile(handle_, data, request, &written, 0) || written == 0)
+            return false;
+#else
+         const ssize_t written = write(fd_, data, bytes);
+         if (written < 0 && errno == EINTR)
+            continue;
+         if (written <= 0)
+            return false;
+#endif
+         data += written;
+         bytes -= written;
+      }
+      return true;
+   }
+
+   // Removes the padding of the last write
+   bool Truncate(std::uint64_t length)
+   {
+#ifdef _WIN32
+      LARGE_INTEGER position;
+      position.QuadPart = static_cast<LONGLONG>(length);
+      return SetFilePointerEx(handle_, position, 0, FILE_BEGIN) &&
+         SetEndOfFile(handle_);
+#else
+      return ftruncate(fd_, static_cast<off_t>(length)) == 0;
+#endif
+   }
+
+private:
+#ifdef _WIN32
+   HANDLE handle_;
+#else
+   int fd_;
+#endif
+};
+
+
+DiskStreamWriter::DiskStreamWriter(SequenceBuffer* buffer, const std::string& prefix,
+      std::shared_ptr<ThreadPool> pool) throw (CMMError) :
+   buffer_(buffer),
+   rawPath_(prefix + ".raw"),
+   indexPath_(prefix + ".idx"),
+   threadPool_(pool ? pool : std::make_shared<ThreadPool>()),
+   tasksMemCopy_(std::make_shared<TaskSet_CopyMemory>(threadPool_)),
+   chunkBytes_(0),
+   current_(0),
+   rawOffset_(0),
+   collectorDone_(false),
+   stopRequested_(false),
+   abandon_(false),
+   failed_(false),
+   imageCount_(0),
+   bytesWritten_(0),
+   writeNanoseconds_(0),
+   stallNanoseconds_(0),
+   maxBacklog_(0),
+   stopped_(false)
+{
+   rawFile_.reset(new RawFile(rawPath_));
+
+   index_.open(indexPath_.c_str(), std::ios::binary | std::ios::trunc);
+   if (!index_)
+      throw CMMError("Cannot create " + indexPath_, MMERR_FileOpenFailed);
+   index_.write(IndexMagic, sizeof(IndexMagic));
+   WriteValue(index_, IndexVersion);
+   WriteValue(index_, static_cast<std::uint32_t>(DEVICE_INTERFACE_VERSION));
+
+   const std::size_t frameBytes = static_cast<std::size_t>(buffer_->Width()) *
+      buffer_->Height() * buffer_->Depth() * buffer_->GetNumberOfChannels();
+   chunkBytes_ = std::max(MinChunkBytes, RoundUpToAlignment(frameBytes));
+   if (!AllocateChunks(chunkBytes_, chunks_))
+      throw CMMError("Cannot allocate memory for streaming to disk",
+            MMERR_OutOfMemory);
+   for (Chunk& chunk : chunks_)
+      freeChunks_.push_back(&chunk);
+
+   writerThread_ = std::thread(&DiskStreamWriter::WriterThreadFunc, this);
+   collectorThread_ = std::thread(&DiskStreamWriter::CollectorThreadFunc, this);
+}
+
+DiskStreamWriter::~DiskStreamWriter()
+{
+   if (!stopped_)
+   {
+      {
+         std::lock_guard<std::mutex> lock(mutex_);
+         abandon_ = true;
+      }
+      cv_.notify_all();
+      buffer_->WakeImageWaiters();
+      collectorThread_.join();
+      writerThread_.join();
+      Finish();
+   }
+   FreeChunks(chunks_);
+}
+
+void DiskStreamWriter::Stop() throw (CMMError)
+{
+   if (stopped_)
+      return;
+   stopRequested_ = true;
+   buffer_->WakeImageWaiters();
+   collectorThread_.join();
+   writerThread_.join();
+   Finish();
+   stopped_ = true;
+
+   if (failed_)
+   {
+      std::lock_guard<std::mutex> lock(mutex_);
+      throw CMMError(error_);
+   }
+}
+
+double DiskStreamWriter::GetWriteBandwidthMBps() const
+{
+   const long long ns = writeNanoseconds_.load();
+   if (ns <= 0)
+      return 0.0;
+   return bytesWritten_.load() / (ns * 1e-9) / (1 << 20);
+}
+
+double DiskStreamWriter::GetStallSeconds() const
+{
+   return stallNanoseconds_.load() * 1e-9;
+}
+
+void DiskStreamWriter::CollectorThreadFunc()
+{
+   for (;;)
+   {
+      // Images inserted before Stop() was called are still written
+      const bool stopping = stopRequested_.load();
+      if (abandon_ || failed_)
+         break;
+      const bool collected = CollectAvailable();
+      if (failed_)
+         break;
+      if (!collected)
+      {
+         if (stopping)
+            break;
+         buffer_->WaitForImages([this] {
+            return stopRequested_.load() || abandon_.load() || failed_.load();
+         });
+      }
+   }
+
+   if (!abandon_ && !failed_ && current_ && current_->used > 0)
+      SubmitChunk();
+
+   {
+      std::lock_guard<std::mutex> lock(mutex_);
+      collectorDone_ = true;
+   }
+   cv_.notify_all();
+}
+
+// Returns whether any image was collected
+bool DiskStreamWriter::CollectAvailable()
+{
+   bool collected = false;
+   while (!abandon_ && !failed_)
+   {
+      const unsigned long backlog = buffer_->GetRemainingImageCount();
+      if (backlog == 0)
+         break;
+      if (backlog > maxBacklog_.load())
+         maxBacklog_ = backlog;
+
+      const std::size_t frameBytes = static_cast<std::size_t>(buffer_->Width()) *
+         buffer_->Height() * buffer_->Depth() * buffer_->GetNumberOfChannels();
+      if (frameBytes > chunkBytes_ && !ResizeChunks(frameBytes))
+         break;
+
+      // Once taken from the buffer, the slot may be reused as soon as the
+      // buffer fills up again, so the copy must not stop halfway to wait
+      // for the disk
+      if (!WaitForRoom(frameBytes))
+         break;
+
+      if (!buffer_->GetNextFrame(frame_))
+         break;
+      collected = true;
+
+      for (std::size_t channel = 0; channel < frame_.size(); ++channel)
+      {
+         const mm::ImgBuffer* img = frame_[channel];
+         const BinaryMetadata& md = img->GetBinaryMetadata();
+         const std::size_t bytes =
+            static_cast<std::size_t>(img->Width()) * img->Height() * img->Depth();
+
+         WriteValue(index_, static_cast<std::uint64_t>(rawOffset_));
+         WriteValue(index_, static_cast<std::uint32_t>(img->Width()));
+         WriteValue(index_, static_cast<std::uint32_t>(img->Height()));
+         WriteValue(index_, static_cast<std::uint32_t>(img->Depth()));
+         WriteValue(index_, static_cast<std::uint32_t>(channel));
+         WriteValue(index_, static_cast<std::uint32_t>(md.GetRecordsSize()));
+         if (md.GetRecordsSize() > 0)
+            index_.write(reinterpret_cast<const char*>(md.GetRecords()),
+                  md.GetRecordsSize());
+         if (!index_)
+         {
+            Fail("Cannot write to " + indexPath_);
+            return collected;
+         }
+
+         if (!Append(img->GetPixels(), bytes))
+            return collected;
+         ++imageCount_;
+      }
+   }
+   return collected;
+}
+
+// Replaces the chunks with ones that hold a frame of the given size (the
+// sequence buffer was given larger images than when we started), keeping
+// the data in the current chunk. Waits for the other chunks to be written.
+bool DiskStreamWriter::ResizeChunks(std::size_t frameBytes)
+{
+   const std::size_t chunkBytes = RoundUpToAlignment(frameBytes);
+   std::vector<Chunk> chunks;
+   {
+      std::unique_lock<std::mutex> lock(mutex_);
+      const std::size_t inUse = current_ ? 1 : 0;
+      if (freeChunks_.size() + inUse < ChunkCount)
+      {
+         auto start = std::chrono::steady_clock::now();
+         cv_.wait(lock, [&] {
+            return freeChunks_.size() + inUse == ChunkCount || abandon_ || failed_;
+         });
+         stallNanoseconds_ += NanosecondsSince(start);
+      }
+      if (abandon_ || failed_)
+         return false;
+
+      if (AllocateChunks(chunkBytes, chunks))
+      {
+         if (current_)
+         {
+            std::memcpy(chunks[0].data, current_->data, current_->used);
+            chunks[0].used = current_->used;
+         }
+         chunks_.swap(chunks);
+         chunkBytes_ = chunkBytes;
+         freeChunks_.clear();
+         std::size_t i = 0;
+         if (current_)
+            current_ = &chunks_[i++];
+         for (; i < chunks_.size(); ++i)
+            freeChunks_.push_back(&chunks_[i]);
+      }
+   }
+   // Now holds the old chunks, unless allocation failed
+   if (chunks.empty())
+   {
+      Fail("Cannot allocate memory for streaming images of " +
+            std::to_string(frameBytes) + " bytes to disk");
+      return false;
+   }
+   FreeChunks(chunks);
+   return true;
+}
+
+// Waits until the current and free chunks can take the given number of
+// bytes, which must not exceed chunkBytes_
+bool DiskStreamWriter::WaitForRoom(std::size_t bytes)
+{
+   const std::size_t room = current_ ? chunkBytes_ - current_->used : 0;
+   if (bytes <= room)
+      return !abandon_ && !failed_;
+   const std::size_t needed = (bytes - room + chunkBytes_ - 1) / chunkBytes_;
+
+   std::unique_lock<std::mutex> lock(mutex_);
+   if (freeChunks_.size() < needed)
+   {
+      // The disk is not keeping up
+      auto start = std::chrono::steady_clock::now();
+      cv_.wait(lock, [&] {
+         return freeChunks_.size() >= needed || abandon_ || failed_;
+      });
+      stallNanoseconds_ += NanosecondsSince(start);
+   }
+   return !abandon_ && !failed_;
+}
+
+bool DiskStreamWriter::Append(const unsigned char* data, std::size_t bytes)
+{
+   rawOffset_ += bytes;
+   while (bytes > 0)
+   {
+      if (!current_)
+      {
+         std::unique_lock<std::mutex> lock(mutex_);
+         if (freeChunks_.empty())
+         {
+            // The disk is not keeping up
+            auto start = std::chrono::steady_clock::now();
+            cv_.wait(lock, [&] {
+               return !freeChunks_.empty() || abandon_ || failed_;
+            });
+            stallNanoseconds_ += NanosecondsSince(start);
+         }
+         if (abandon_ || failed_)
+            return false;
+         current_ = freeChunks_.front();
+         freeChunks_.pop_front();
+         current_->used = 0;
+      }
+
+      const std::size_t n = std::min(bytes, chunkBytes_ - current_->used);
+      tasksMemCopy_->MemCopy(current_->data + current_->used, data, n);
+      current_->used += n;
+      data += n;
+      bytes -= n;
+      if (current_->used == chunkBytes_)
+         SubmitChunk();
+   }
+   return true;
+}
+
+void DiskStreamWriter::SubmitChunk()
+{
+   {
+      std::lock_guard<std::mutex> lock(mutex_);
+      fullChunks_.push_back(current_);
+   }
+   current_ = 0;
+   cv_.notify_all();
+}
+
+void DiskStreamWriter::WriterThreadFunc()
+{
+   for (;;)
+   {
+      Chunk* chunk;
+      {
+         std::unique_lock<std::mutex> lock(mutex_);
+         cv_.wait(lock, [&] { return !fullChunks_.empty() || collectorDone_; });
+         if (fullChunks_.empty())
+            break;
+         chunk = fullChunks_.front();
+         fullChunks_.pop_front();
+      }
+
+      // Only the last chunk can be partly filled; it is padded to the
+      // alignment and the padding is truncated in Finish()
+      const std::size_t length = (chunk->used + Alignment - 1) / Alignment * Alignment;
+      std::memset(chunk->data + chunk->used, 0, length - chunk->used);
+      auto start = std::chrono::steady_clock::now();
+      const bool ok = rawFile_->Write(chunk->data, length);
+      writeNanoseconds_ += NanosecondsSince(start);
+      if (!ok)
+      {
+         Fail("Cannot write to " + rawPath_ + " (" + LastErrorString() + ")");
+         break;
+      }
+      bytesWritten_ += chunk->used;
+
+      {
+         std::lock_guard<std::mutex> lock(mutex_);
+         freeChunks_.push_back(chunk);
+      }
+      cv_.notify_all();
+   }
+}
+
+void DiskStreamWriter::Fail(const std::string& message)
+{
+   {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (error_.empty())
+         error_ = message;
+      failed_ = true;
+   }
+   cv_.notify_all();
+   buffer_->WakeImageWaiters();
+}
+
+bool DiskStreamWriter::AllocateChunks(std::size_t chunkBytes,
+      std::vector<Chunk>& chunks)
+{
+   chunks.reserve(ChunkCount);
+   for (std::size_t i = 0; i < ChunkCount; ++i)
+   {
+      Chunk chunk;
+      chunk.data = AllocateAligned(chunkBytes);
+      chunk.used = 0;
+      if (!chunk.data)
+      {
+         FreeChunks(chunks);
+         return false;
+      }
+      chunks.push_back(chunk);
+   }
+   return true;
+}
+
+void DiskStreamWriter::FreeChunks(std::vector<Chunk>& chunks)
+{
+   for (Chunk& chunk : chunks)
+      FreeAligned(chunk.data);
+   chunks.clear();
+}
+
+void DiskStreamWriter::Finish()
+{
+   if (!rawFile_->Truncate(bytesWritten_.load()))
+      Fail("Cannot write to " + rawPath_ + " (" + LastErrorString() + ")");
+   rawFile_.reset();
+   index_.close();
+   if (index_.fail())
+      Fail("Cannot write to " + indexPath_);
+}
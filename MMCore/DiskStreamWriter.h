@@ -0,0 +1,153 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          DiskStreamWriter.h
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Writes the images in the sequence buffer to disk as they
+//                arrive, without passing them through the application.
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#pragma once
+
+#include "Error.h"
+#include "FrameBuffer.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _MSC_VER
+#pragma warning( disable : 4290 ) // exception declaration warning
+#endif
+
+
+class SequenceBuffer;
+class TaskSet_CopyMemory;
+class ThreadPool;
+
+/**
+ * Consumes the images in a sequence buffer and writes them to disk.
+ *
+ * Two files are written: prefix.raw holds the pixels of all images, back to
+ * back, and prefix.idx is an index with the location, size and metadata of
+ * each image (see below). The images of the channels of a multi-channel
+ * frame are written one after the other.
+ *
+ * A collector thread, woken by the buffer when images are inserted, pops
+ * frames and copies them into large page-aligned chunks (at least as large
+ * as a frame, so that a frame can always be copied in one go); a writer
+ * thread writes full chunks to prefix.raw with
+ * unbuffered I/O (O_DIRECT on Linux, F_NOCACHE on macOS,
+ * FILE_FLAG_NO_BUFFERING on Windows), so that the data does not go through
+ * the OS page cache. If the disk falls behind, the collector waits for a
+ * free chunk and images accumulate in the sequence buffer; the time spent
+ * waiting and the largest number of waiting images are recorded.
+ *
+ * Index format (little-endian): the 8 bytes "MMSTRIDX", a uint32 version
+ * (2) and a uint32 device interface version (DEVICE_INTERFACE_VERSION, which
+ * identifies the metadata encoding), then for each image a record of uint64
+ * offset in prefix.raw, uint32 width, height, bytes per pixel, channel, and
+ * metadata length, followed by the metadata as given by
+ * BinaryMetadata::GetRecords() (read it with AssignRecords()).
+ */
+class DiskStreamWriter
+{
+public:
+   // Creates the files and starts consuming images. Throws CMMError if the
+   // files cannot be created.
+   DiskStreamWriter(SequenceBuffer* buffer, const std::string& prefix,
+         std::shared_ptr<ThreadPool> pool) throw (CMMError);
+   // Stops without writing the remaining images
+   ~DiskStreamWriter();
+
+   // Writes the images remaining in the buffer, then closes the files.
+   // Throws CMMError if writing failed at any point.
+   void Stop() throw (CMMError);
+
+   // False once stopped or once writing has failed
+   bool IsRunning() const { return !stopped_.load() && !failed_.load(); }
+
+   unsigned long long GetImageCount() const { return imageCount_.load(); }
+   unsigned long long GetBytesWritten() const { return bytesWritten_.load(); }
+   // Throughput of the writes themselves, in MB/s
+   double GetWriteBandwidthMBps() const;
+   // Total time spent waiting for the disk
+   double GetStallSeconds() const;
+   // Largest number of images waiting in the buffer
+   unsigned long GetMaxBacklog() const { return maxBacklog_.load(); }
+
+private:
+   DiskStreamWriter(const DiskStreamWriter&);
+   DiskStreamWriter& operator=(const DiskStreamWriter&);
+
+   class RawFile;
+   struct Chunk
+   {
+      unsigned char* data;
+      std::size_t used;
+   };
+
+   void CollectorThreadFunc();
+   void WriterThreadFunc();
+   bool CollectAvailable();
+   bool ResizeChunks(std::size_t frameBytes);
+   bool WaitForRoom(std::size_t bytes);
+   bool Append(const unsigned char* data, std::size_t bytes);
+   void SubmitChunk();
+   void Fail(const std::string& message);
+   void Finish();
+   static bool AllocateChunks(std::size_t chunkBytes, std::vector<Chunk>& chunks);
+   static void FreeChunks(std::vector<Chunk>& chunks);
+
+   SequenceBuffer* buffer_;
+   std::string rawPath_;
+   std::string indexPath_;
+   std::unique_ptr<RawFile> rawFile_;
+   std::ofstream index_;
+   std::shared_ptr<ThreadPool> threadPool_;
+   std::shared_ptr<TaskSet_CopyMemory> tasksMemCopy_;
+
+   std::vector<Chunk> chunks_;
+   std::size_t chunkBytes_;
+   Chunk* current_; // Being filled by the collector
+   std::vector<const mm::ImgBuffer*> frame_; // Being collected
+   std::uint64_t rawOffset_; // Bytes appended so far
+
+   std::mutex mutex_;
+   std::condition_variable cv_;
+   std::deque<Chunk*> fullChunks_;
+   std::deque<Chunk*> freeChunks_;
+   bool collectorDone_;
+   std::string error_;
+
+   std::atomic<bool> stopRequested_;
+   std::atomic<bool> abandon_;
+   std::atomic<bool> failed_;
+   std::atomic<unsigned long long> imageCount_;
+   std::atomic<unsigned long long> bytesWritten_;
+   std::atomic<long long> writeNanoseconds_;
+   std::atomic<long long> stallNanoseconds_;
+   std::atomic<unsigned long> maxBacklog_;
+
+   std::thread collectorThread_;
+   std::thread writerThread_;
+   std::atomic<bool> stopped_;
+};
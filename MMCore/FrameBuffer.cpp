@@ -24,15 +24,21 @@
 namespace mm {
 
 ImgBuffer::ImgBuffer(unsigned xSize, unsigned ySize, unsigned pixDepth) :
-   pixels_(0), width_(xSize), height_(ySize), pixDepth_(pixDepth)
+   pixels_(0), ownsPixels_(true), width_(xSize), height_(ySize), pixDepth_(pixDepth)
 {
    pixels_ = new unsigned char[xSize * ySize * pixDepth];
    memset(pixels_, 0, xSize * ySize * pixDepth);
 }
 
+ImgBuffer::ImgBuffer(unsigned char* pixels, unsigned xSize, unsigned ySize, unsigned pixDepth) :
+   pixels_(pixels), ownsPixels_(false), width_(xSize), height_(ySize), pixDepth_(pixDepth)
+{
+}
+
 ImgBuffer::~ImgBuffer()
 {
-   delete[] pixels_;
+   if (ownsPixels_)
+      delete[] pixels_;
 }
 
 const unsigned char* ImgBuffer::GetPixels() const
@@ -40,6 +46,11 @@ const unsigned char* ImgBuffer::GetPixels() const
    return pixels_;
 }
 
+unsigned char* ImgBuffer::GetPixelsRW()
+{
+   return pixels_;
+}
+
 void ImgBuffer::SetPixels(const void* pix)
 {
    memcpy((void*)pixels_, pix, width_ * height_ * pixDepth_);
@@ -50,8 +61,10 @@ void ImgBuffer::Resize(unsigned xSize, unsigned ySize, unsigned pixDepth)
    // re-allocate internal buffer if it is not big enough
    if (width_ * height_ * pixDepth_ < xSize * ySize * pixDepth)
    {
-      delete[] pixels_;
+      if (ownsPixels_)
+         delete[] pixels_;
       pixels_ = new unsigned char [xSize * ySize * pixDepth];
+      ownsPixels_ = true;
    }
 
    width_ = xSize;
@@ -64,8 +77,10 @@ void ImgBuffer::Resize(unsigned xSize, unsigned ySize)
    // re-allocate internal buffer if it is not big enough
    if (width_ * height_ < xSize * ySize)
    {
-      delete[] pixels_;
+      if (ownsPixels_)
+         delete[] pixels_;
       pixels_ = new unsigned char[xSize * ySize * pixDepth_];
+      ownsPixels_ = true;
    }
 
    width_ = xSize;
@@ -74,13 +89,35 @@ void ImgBuffer::Resize(unsigned xSize, unsigned ySize)
    memset(pixels_, 0, width_ * height_ * pixDepth_);
 }
 
-void ImgBuffer::SetMetadata(const Metadata& md)
+void ImgBuffer::Attach(unsigned char* pixels, unsigned xSize, unsigned ySize, unsigned pixDepth)
+{
+   if (ownsPixels_)
+      delete[] pixels_;
+   pixels_ = pixels;
+   ownsPixels_ = false;
+   width_ = xSize;
+   height_ = ySize;
+   pixDepth_ = pixDepth;
+}
+
+const BinaryMetadata& ImgBuffer::GetBinaryMetadata() const
+{
+   static const BinaryMetadata empty;
+   return metadata_ ? *metadata_ : empty;
+}
+
+BinaryMetadata& ImgBuffer::GetBinaryMetadataRW()
 {
-   //metadata_ = md;
-   // Serialize/Restore instead of =operator used to avoid object new/delete
-   // issues across the DLL boundary (on Windows)
-   // TODO: this is inefficient and should be revised
-    metadata_.Restore(md.Serialize().c_str());
+   if (!metadata_)
+      metadata_.reset(new BinaryMetadata());
+   return *metadata_;
+}
+
+Metadata ImgBuffer::GetMetadata() const
+{
+   Metadata md;
+   GetBinaryMetadata().ToMetadata(md);
+   return md;
 }
 
 
@@ -127,6 +164,26 @@ void FrameBuffer::Preallocate(unsigned channels)
    }
 }
 
+void FrameBuffer::Attach(unsigned char* pixels, unsigned channels, unsigned xSize, unsigned ySize, unsigned byteDepth)
+{
+   width_ = xSize;
+   height_ = ySize;
+   depth_ = byteDepth;
+
+   const size_t imageBytes = static_cast<size_t>(xSize) * ySize * byteDepth;
+   for (size_t i = channels; i < channels_.size(); i++)
+      delete channels_[i];
+   channels_.resize(channels, 0);
+   for (unsigned i = 0; i < channels; i++)
+   {
+      unsigned char* channelPixels = pixels + i * imageBytes;
+      if (channels_[i])
+         channels_[i]->Attach(channelPixels, xSize, ySize, byteDepth);
+      else
+         channels_[i] = new ImgBuffer(channelPixels, xSize, ySize, byteDepth);
+   }
+}
+
 void FrameBuffer::Resize(unsigned xSize, unsigned ySize, unsigned byteDepth)
 {
    Clear();
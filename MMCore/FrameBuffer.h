@@ -18,24 +18,32 @@
 
 #pragma once
 
+#include "../MMDevice/BinaryMetadata.h"
 #include "../MMDevice/ImageMetadata.h"
 
+#include <cstddef>
+#include <map>
+#include <memory>
 #include <string>
 #include <vector>
-#include <map>
 
 namespace mm {
 
 class ImgBuffer
 {
    unsigned char* pixels_;
+   bool ownsPixels_;
    unsigned int width_;
    unsigned int height_;
    unsigned int pixDepth_;
-   Metadata metadata_;
+   // Allocated when first set and then reused, so that images that never
+   // get metadata (such as unused buffer slots) stay small
+   std::unique_ptr<BinaryMetadata> metadata_;
 
 public:
    ImgBuffer(unsigned xSize, unsigned ySize, unsigned pixDepth);
+   // Uses the given pixels, which must outlive the ImgBuffer
+   ImgBuffer(unsigned char* pixels, unsigned xSize, unsigned ySize, unsigned pixDepth);
    ~ImgBuffer();
 
    unsigned int Width() const {return width_;}
@@ -43,12 +51,22 @@ public:
    unsigned int Depth() const {return pixDepth_;}
    void SetPixels(const void* pixArray);
    const unsigned char* GetPixels() const;
+   unsigned char* GetPixelsRW();
 
    void Resize(unsigned xSize, unsigned ySize, unsigned pixDepth);
    void Resize(unsigned xSize, unsigned ySize);
+   // Switches to the given pixels, which must outlive the ImgBuffer
+   void Attach(unsigned char* pixels, unsigned xSize, unsigned ySize, unsigned pixDepth);
+
+   void SetMetadata(const BinaryMetadata& md) {GetBinaryMetadataRW() = md;}
+   const BinaryMetadata& GetBinaryMetadata() const;
+   BinaryMetadata& GetBinaryMetadataRW();
+   Metadata GetMetadata() const;
 
-   void SetMetadata(const Metadata& md);
-   const Metadata& GetMetadata() const {return metadata_;}
+   // Memory taken by an image besides its pixels, once it has metadata
+   // (not counting metadata too large for BinaryMetadata's own storage)
+   static std::size_t GetOverheadBytes()
+   {return sizeof(ImgBuffer) + sizeof(BinaryMetadata);}
 
 private:
    ImgBuffer& operator=(const ImgBuffer&);
@@ -71,6 +89,9 @@ public:
    void Resize(unsigned xSize, unsigned ySize, unsigned pixDepth);
    void Clear();
    void Preallocate(unsigned channels);
+   // Sets the size and uses channels consecutive images starting at pixels,
+   // reusing the existing ImgBuffers
+   void Attach(unsigned char* pixels, unsigned channels, unsigned xSize, unsigned ySize, unsigned byteDepth);
 
    ImgBuffer* FindImage(unsigned channel) const;
    const unsigned char* GetPixels(unsigned channel) const;
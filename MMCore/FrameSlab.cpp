@@ -0,0 +1,249 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          FrameSlab.cpp
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Contiguous, optionally huge page-backed memory holding the
+//                pixels of all frames in the circular buffer.
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#include "FrameSlab.h"
+
+#include <algorithm>
+#include <new>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <intrin.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
+#endif
+
+
+namespace {
+
+const std::size_t MB = 1 << 20;
+const std::size_t GB = 1 << 30;
+
+// Prefaulting and residency are handled in steps of this size
+const std::size_t StepBytes = 64 * MB;
+
+std::size_t RoundUp(std::size_t bytes, std::size_t multiple)
+{
+   return (bytes + multiple - 1) / multiple * multiple;
+}
+
+std::size_t GetSystemPageSize()
+{
+#ifdef _WIN32
+   SYSTEM_INFO info;
+   GetSystemInfo(&info);
+   return info.dwPageSize;
+#else
+   return static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+#endif
+}
+
+// Faults in the page holding p for writing without changing its contents,
+// even if it is being written concurrently
+void TouchForWrite(unsigned char* p)
+{
+#ifdef _MSC_VER
+   _InterlockedOr8(reinterpret_cast<volatile char*>(p), 0);
+#else
+   __atomic_fetch_or(p, static_cast<unsigned char>(0), __ATOMIC_RELAXED);
+#endif
+}
+
+} // anonymous namespace
+
+
+FrameSlab::FrameSlab(std::size_t bytes, bool hugePages) :
+   data_(0),
+   size_(0),
+   pageSize_(GetSystemPageSize()),
+   hugePages_(false),
+   prefaulting_(false),
+   stopPrefault_(false),
+   prefaultedBytes_(0)
+{
+   Map(std::max<std::size_t>(bytes, 1), hugePages);
+}
+
+FrameSlab::~FrameSlab()
+{
+   StopPrefault();
+   Unmap();
+}
+
+void FrameSlab::Map(std::size_t bytes, bool hugePages)
+{
+#ifdef _WIN32
+   if (hugePages)
+   {
+      const std::size_t largePage = GetLargePageMinimum();
+      if (largePage > 0)
+      {
+         const std::size_t size = RoundUp(bytes, largePage);
+         void* p = VirtualAlloc(0, size,
+               MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+         if (p)
+         {
+            data_ = static_cast<unsigned char*>(p);
+            size_ = size;
+            pageSize_ = largePage;
+            hugePages_ = true;
+            return;
+         }
+      }
+   }
+   const std::size_t size = RoundUp(bytes, pageSize_);
+   void* p = VirtualAlloc(0, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+   if (!p)
+      throw std::bad_alloc();
+   data_ = static_cast<unsigned char*>(p);
+   size_ = size;
+#else
+   const int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef __linux__
+   if (hugePages)
+   {
+      struct { std::size_t size; int log2; } candidates[] = { { GB, 30 }, { 2 * MB, 21 } };
+      for (const auto& c : candidates)
+      {
+         if (c.size == GB && bytes < GB)
+            continue;
+         const std::size_t size = RoundUp(bytes, c.size);
+         void* p = mmap(0, size, PROT_READ | PROT_WRITE,
+               flags | MAP_HUGETLB | (c.log2 << MAP_HUGE_SHIFT), -1, 0);
+         if (p != MAP_FAILED)
+         {
+            data_ = static_cast<unsigned char*>(p);
+            size_ = size;
+            pageSize_ = c.size;
+            hugePages_ = true;
+            return;
+         }
+      }
+   }
+#endif
+   const std::size_t size = RoundUp(bytes, pageSize_);
+#ifdef MAP_NORESERVE
+   void* p = mmap(0, size, PROT_READ | PROT_WRITE, flags | MAP_NORESERVE, -1, 0);
+#else
+   void* p = mmap(0, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+#endif
+   if (p == MAP_FAILED)
+      throw std::bad_alloc();
+   data_ = static_cast<unsigned char*>(p);
+   size_ = size;
+#ifdef MADV_HUGEPAGE
+   if (hugePages)
+      madvise(p, size, MADV_HUGEPAGE); // Best effort
+#endif
+#endif
+}
+
+void FrameSlab::Unmap()
+{
+   if (!data_)
+      return;
+#ifdef _WIN32
+   VirtualFree(data_, 0, MEM_RELEASE);
+#else
+   munmap(data_, size_);
+#endif
+   data_ = 0;
+   size_ = 0;
+}
+
+void FrameSlab::StartPrefault()
+{
+   if (prefaultThread_.joinable())
+      return;
+   prefaulting_ = true;
+   prefaultThread_ = std::thread(&FrameSlab::PrefaultThreadFunc, this);
+}
+
+void FrameSlab::StopPrefault()
+{
+   if (!prefaultThread_.joinable())
+      return;
+   stopPrefault_ = true;
+   prefaultThread_.join();
+}
+
+void FrameSlab::PrefaultThreadFunc()
+{
+   const std::size_t step = RoundUp(StepBytes, pageSize_);
+#ifdef __linux__
+   bool usePopulate = true;
+#endif
+   for (std::size_t offset = 0; offset < size_ && !stopPrefault_; offset += step)
+   {
+      const std::size_t len = std::min(step, size_ - offset);
+#ifdef __linux__
+      // Kernel 5.14 and later
+      if (usePopulate && madvise(data_ + offset, len, MADV_POPULATE_WRITE) != 0)
+         usePopulate = false;
+      if (!usePopulate)
+#endif
+      {
+         for (std::size_t i = 0; i < len; i += pageSize_)
+            TouchForWrite(data_ + offset + i);
+      }
+      prefaultedBytes_ = offset + len;
+   }
+   prefaulting_ = false;
+}
+
+std::size_t FrameSlab::GetResidentBytes() const
+{
+#if defined(__linux__) || defined(__APPLE__)
+   const std::size_t basePage = GetSystemPageSize();
+#ifdef __APPLE__
+   std::vector<char> vec(StepBytes / basePage);
+#else
+   std::vector<unsigned char> vec(StepBytes / basePage);
+#endif
+   std::size_t resident = 0;
+   for (std::size_t offset = 0; offset < size_; offset += StepBytes)
+   {
+      const std::size_t len = std::min(StepBytes, size_ - offset);
+      if (mincore(data_ + offset, len, &vec[0]) != 0)
+         return prefaultedBytes_;
+      const std::size_t pages = (len + basePage - 1) / basePage;
+      for (std::size_t i = 0; i < pages; ++i)
+      {
+         if (vec[i] & 1)
+            resident += basePage;
+      }
+   }
+   return resident;
+#else
+   if (hugePages_)
+      return size_;
+   return prefaultedBytes_;
+#endif
+}
@@ -0,0 +1,84 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          FrameSlab.h
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Contiguous, optionally huge page-backed memory holding the
+//                pixels of all frames in the circular buffer.
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <thread>
+
+
+/**
+ * A single block of memory for frame storage.
+ *
+ * The memory is mapped directly from the OS (rather than allocated from the
+ * heap), so it is zero-filled and takes up physical memory only as pages are
+ * first written. With huge pages, 1 GB pages are tried first for blocks of at
+ * least 1 GB, then 2 MB pages (Linux: hugetlbfs, which requires pages to have
+ * been reserved by the administrator; Windows: large pages, which requires
+ * the "Lock pages in memory" privilege). If neither is available, normal
+ * pages are used, with transparent huge pages requested on Linux.
+ *
+ * Prefaulting touches every page on a background thread so that the first
+ * pass through the buffer does not pay for page faults. It never modifies
+ * the contents, so the memory can be used while it is in progress.
+ */
+class FrameSlab
+{
+public:
+   // Throws std::bad_alloc if the memory cannot be mapped
+   FrameSlab(std::size_t bytes, bool hugePages);
+   // Stops prefaulting and unmaps the memory
+   ~FrameSlab();
+
+   unsigned char* GetData() const { return data_; }
+   std::size_t GetSize() const { return size_; }
+   // Size of the pages actually in use
+   std::size_t GetPageSize() const { return pageSize_; }
+   // Whether explicitly reserved huge pages are in use (transparent huge
+   // pages do not count)
+   bool UsesHugePages() const { return hugePages_; }
+
+   void StartPrefault();
+   bool IsPrefaulting() const { return prefaulting_.load(); }
+
+   // Physical memory currently used by the slab. Measured on Linux and
+   // macOS; elsewhere, the whole slab if huge pages are in use (they are
+   // locked in memory), otherwise the part touched by prefaulting.
+   std::size_t GetResidentBytes() const;
+
+private:
+   FrameSlab(const FrameSlab&);
+   FrameSlab& operator=(const FrameSlab&);
+
+   void Map(std::size_t bytes, bool hugePages);
+   void Unmap();
+   void PrefaultThreadFunc();
+   void StopPrefault();
+
+   unsigned char* data_;
+   std::size_t size_;
+   std::size_t pageSize_;
+   bool hugePages_;
+
+   std::thread prefaultThread_;
+   std::atomic<bool> prefaulting_;
+   std::atomic<bool> stopPrefault_;
+   std::atomic<std::size_t> prefaultedBytes_;
+};
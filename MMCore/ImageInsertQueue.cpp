@@ -0,0 +1,117 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          ImageInsertQueue.cpp
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Bounded queue of images waiting to be inserted into the
+//                sequence buffer, so that cameras need not wait for the copy.
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#include "ImageInsertQueue.h"
+
+#include <algorithm>
+#include <cassert>
+
+
+ImageInsertQueue::ImageInsertQueue(unsigned depth, InsertFunction insert) :
+   insert_(insert),
+   entries_(std::max(1u, depth)),
+   head_(0),
+   count_(0),
+   stop_(false)
+{
+   thread_ = std::thread(&ImageInsertQueue::ThreadFunc, this);
+}
+
+ImageInsertQueue::~ImageInsertQueue()
+{
+   {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+   }
+   queuedCV_.notify_one();
+   thread_.join();
+}
+
+int ImageInsertQueue::Enqueue(const MM::Device* caller,
+      const unsigned char* buf, unsigned width, unsigned height,
+      unsigned byteDepth, unsigned nComponents,
+      const unsigned char* metadataRecords, unsigned metadataSize,
+      MM::ImageReleaseCallback release, void* releaseContext)
+{
+   std::unique_lock<std::mutex> lock(mutex_);
+   int ret = TakeError(caller);
+   if (ret != DEVICE_OK)
+      return ret;
+
+   doneCV_.wait(lock, [&] { return count_ < entries_.size(); });
+
+   Entry& entry = entries_[(head_ + count_) % entries_.size()];
+   if (!entry.md.AssignRecords(metadataRecords, metadataSize))
+      return DEVICE_INVALID_INPUT_PARAM;
+   entry.caller = caller;
+   entry.buf = buf;
+   entry.width = width;
+   entry.height = height;
+   entry.byteDepth = byteDepth;
+   entry.nComponents = nComponents;
+   entry.release = release;
+   entry.releaseContext = releaseContext;
+   ++count_;
+   lock.unlock();
+   queuedCV_.notify_one();
+   return DEVICE_OK;
+}
+
+int ImageInsertQueue::Flush(const MM::Device* caller)
+{
+   std::unique_lock<std::mutex> lock(mutex_);
+   doneCV_.wait(lock, [&] { return count_ == 0; });
+   return TakeError(caller);
+}
+
+int ImageInsertQueue::TakeError(const MM::Device* caller)
+{
+   std::map<const MM::Device*, int>::iterator it = errors_.find(caller);
+   if (it == errors_.end())
+      return DEVICE_OK;
+   int ret = it->second;
+   errors_.erase(it);
+   return ret;
+}
+
+void ImageInsertQueue::ThreadFunc()
+{
+   std::unique_lock<std::mutex> lock(mutex_);
+   for (;;)
+   {
+      queuedCV_.wait(lock, [&] { return stop_ || count_ > 0; });
+      if (count_ == 0) // Stopping, and nothing left to insert
+         break;
+
+      Entry& entry = entries_[head_];
+      lock.unlock();
+
+      int ret = insert_(entry.caller, entry.buf, entry.width, entry.height,
+            entry.byteDepth, entry.nComponents, entry.md);
+      if (entry.release)
+         entry.release(entry.releaseContext, entry.buf);
+
+      lock.lock();
+      if (ret != DEVICE_OK)
+         errors_.insert(std::make_pair(entry.caller, ret)); // Keep the first
+      head_ = (head_ + 1) % entries_.size();
+      --count_;
+      doneCV_.notify_all();
+   }
+}
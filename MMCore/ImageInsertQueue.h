@@ -0,0 +1,99 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          ImageInsertQueue.h
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Bounded queue of images waiting to be inserted into the
+//                sequence buffer, so that cameras need not wait for the copy.
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#pragma once
+
+#include "../MMDevice/BinaryMetadata.h"
+#include "../MMDevice/MMDevice.h"
+
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+/**
+ * Inserts images on a worker thread, in the order they were queued.
+ *
+ * Implements the queueing for MM::Core::InsertImageAsync(): Enqueue() returns
+ * as soon as the image is queued, blocking only while the queue holds as many
+ * images as its depth. The worker calls the insert function for each image
+ * and then the camera's release callback. An insert error is kept for the
+ * camera that queued the image and returned by its next call to Enqueue() or
+ * Flush().
+ *
+ * The queue entries (including their metadata storage) are allocated once,
+ * so queueing does not allocate.
+ */
+class ImageInsertQueue
+{
+public:
+   typedef std::function<int (const MM::Device* caller,
+         const unsigned char* buf, unsigned width, unsigned height,
+         unsigned byteDepth, unsigned nComponents, BinaryMetadata& md)>
+      InsertFunction;
+
+   ImageInsertQueue(unsigned depth, InsertFunction insert);
+   // Inserts all queued images before returning
+   ~ImageInsertQueue();
+
+   unsigned GetDepth() const { return static_cast<unsigned>(entries_.size()); }
+
+   int Enqueue(const MM::Device* caller, const unsigned char* buf,
+         unsigned width, unsigned height, unsigned byteDepth,
+         unsigned nComponents, const unsigned char* metadataRecords,
+         unsigned metadataSize, MM::ImageReleaseCallback release,
+         void* releaseContext);
+
+   // Waits until the queue is empty and returns (and clears) the first
+   // pending error for caller.
+   int Flush(const MM::Device* caller);
+
+private:
+   struct Entry
+   {
+      const MM::Device* caller;
+      const unsigned char* buf;
+      unsigned width;
+      unsigned height;
+      unsigned byteDepth;
+      unsigned nComponents;
+      BinaryMetadata md;
+      MM::ImageReleaseCallback release;
+      void* releaseContext;
+   };
+
+   void ThreadFunc();
+   int TakeError(const MM::Device* caller);
+
+   const InsertFunction insert_;
+
+   std::mutex mutex_;
+   std::condition_variable queuedCV_; // Entry added, or stopping
+   std::condition_variable doneCV_; // Entry removed
+   std::vector<Entry> entries_; // Ring
+   size_t head_; // Oldest entry, which the worker is inserting
+   size_t count_;
+   bool stop_;
+   std::map<const MM::Device*, int> errors_;
+
+   std::thread thread_;
+};
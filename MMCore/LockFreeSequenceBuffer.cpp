@@ -0,0 +1,389 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          LockFreeSequenceBuffer.cpp
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Sequence buffer in which readers and the inserting camera
+//                thread do not share a lock.
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#include "LockFreeSequenceBuffer.h"
+
+#include "TaskSet_CopyMemory.h"
+
+#include "../MMDevice/DeviceUtils.h"
+
+#include <thread>
+
+
+namespace {
+
+const long long bytesInMB = 1 << 20;
+
+// Same arbitrary limit as CircularBuffer.
+const unsigned long maxCBSize = 10000000;
+
+} // anonymous namespace
+
+
+LockFreeSequenceBuffer::ReaderGuard::ReaderGuard(const LockFreeSequenceBuffer& buf) :
+   buf_(buf),
+   admitted_(true)
+{
+   // Sequentially consistent ordering pairs with Initialize(): either
+   // Initialize() sees our registration and waits for us, or we see the
+   // reconfiguring flag and back off.
+   buf_.activeReaders_.fetch_add(1);
+   if (buf_.reconfiguring_.load())
+      admitted_ = false;
+}
+
+LockFreeSequenceBuffer::ReaderGuard::~ReaderGuard()
+{
+   buf_.activeReaders_.fetch_sub(1, std::memory_order_release);
+}
+
+
+LockFreeSequenceBuffer::LockFreeSequenceBuffer(unsigned int memorySizeMB, std::shared_ptr<ThreadPool> pool) :
+   memorySizeMB_(memorySizeMB),
+   width_(0),
+   height_(0),
+   pixDepth_(0),
+   numChannels_(0),
+   capacity_(0),
+   allocatedBytes_(0),
+   insertCursor_(0),
+   saveCursor_(0),
+   overflow_(false),
+   activeReaders_(0),
+   reconfiguring_(false),
+   writeSlot_(0),
+   writeSlotPos_(0),
+   startTime_(std::chrono::steady_clock::now()),
+   threadPool_(pool ? pool : std::make_shared<ThreadPool>()),
+   tasksMemCopy_(std::make_shared<TaskSet_CopyMemory>(threadPool_))
+{
+}
+
+LockFreeSequenceBuffer::~LockFreeSequenceBuffer() {}
+
+bool LockFreeSequenceBuffer::Initialize(unsigned channels, unsigned int w, unsigned int h, unsigned int pixDepth)
+{
+   std::lock_guard<std::mutex> lock(producerMutex_);
+   imageNumbers_.clear();
+   startTime_ = std::chrono::steady_clock::now();
+
+   if (w == 0 || h==0 || pixDepth == 0 || channels == 0)
+      return false; // does not make sense
+
+   if (w == Width() && h == Height() && pixDepth == Depth() && channels == numChannels_)
+      if (capacity_.load() > 0)
+         return true; // nothing to change
+
+   // Keep readers out while the slots are replaced.
+   reconfiguring_.store(true);
+   while (activeReaders_.load() != 0)
+      std::this_thread::yield();
+
+   bool ret = true;
+   try
+   {
+      capacity_.store(0);
+      slots_.reset();
+      allocatedBytes_.store(0);
+
+      width_.store(w);
+      height_.store(h);
+      pixDepth_.store(pixDepth);
+      numChannels_ = channels;
+
+      insertCursor_.store(0);
+      saveCursor_.store(0);
+      overflow_.store(false);
+
+      unsigned long frameSizeBytes = w * h * pixDepth * channels;
+      // Count the slots' images, not just their pixels, against the
+      // footprint; for small images they are a large part of it
+      const std::size_t slotBytes = frameSizeBytes +
+         sizeof(Slot) + channels * mm::ImgBuffer::GetOverheadBytes();
+      unsigned long cbSize = (unsigned long) ((memorySizeMB_ * bytesInMB) / slotBytes);
+      if (cbSize > maxCBSize)
+         cbSize = maxCBSize;
+
+      if (cbSize == 0)
+      {
+         ret = false; // memory footprint too small
+      }
+      else
+      {
+         // could conceivably throw an out-of-memory exception
+         std::unique_ptr<Slot[]> slots(new Slot[cbSize]);
+         for (unsigned long i = 0; i < cbSize; i++)
+         {
+            slots[i].frame.Resize(w, h, pixDepth);
+            slots[i].frame.Preallocate(channels);
+         }
+         slots_ = std::move(slots);
+         capacity_.store(cbSize);
+         allocatedBytes_.store(static_cast<unsigned long long>(cbSize) * frameSizeBytes);
+      }
+   }
+   catch (... /* std::bad_alloc& ex */)
+   {
+      slots_.reset();
+      capacity_.store(0);
+      allocatedBytes_.store(0);
+      ret = false;
+   }
+
+   reconfiguring_.store(false);
+   return ret;
+}
+
+void LockFreeSequenceBuffer::Clear()
+{
+   std::lock_guard<std::mutex> lock(producerMutex_);
+
+   // Any concurrent pop that has not yet claimed its position will fail its
+   // compare-and-swap and observe an empty buffer.
+   saveCursor_.store(insertCursor_.load(std::memory_order_relaxed),
+         std::memory_order_release);
+   overflow_.store(false, std::memory_order_release);
+   startTime_ = std::chrono::steady_clock::now();
+   imageNumbers_.clear();
+}
+
+unsigned long LockFreeSequenceBuffer::GetSize() const
+{
+   return capacity_.load(std::memory_order_relaxed);
+}
+
+unsigned long LockFreeSequenceBuffer::GetFreeSize() const
+{
+   unsigned long capacity = GetSize();
+   unsigned long remaining = GetRemainingImageCount();
+   if (remaining > capacity)
+      return 0;
+   return capacity - remaining;
+}
+
+unsigned long LockFreeSequenceBuffer::GetRemainingImageCount() const
+{
+   // Load the save cursor first: it never passes the insert cursor, so the
+   // difference cannot go negative.
+   std::uint64_t save = saveCursor_.load(std::memory_order_acquire);
+   std::uint64_t insert = insertCursor_.load(std::memory_order_acquire);
+   return static_cast<unsigned long>(insert - save);
+}
+
+/**
+* Inserts a multi-channel frame in the buffer.
+*/
+bool LockFreeSequenceBuffer::InsertMultiChannel(const unsigned char* pixArray, unsigned int numChannels, unsigned int width, unsigned int height, unsigned int byteDepth, unsigned int nComponents, const BinaryMetadata& md) throw (CMMError)
+{
+   std::lock_guard<std::mutex> lock(producerMutex_);
+
+   if (width != Width() || height != Height() || byteDepth != Depth())
+      throw CMMError("Incompatible image dimensions in the circular buffer", MMERR_CircularBufferIncompatibleImage);
+
+   const unsigned long capacity = capacity_.load(std::memory_order_relaxed);
+   const std::uint64_t pos = insertCursor_.load(std::memory_order_relaxed);
+   if (capacity == 0 ||
+         pos - saveCursor_.load(std::memory_order_acquire) >= capacity)
+   {
+      overflow_.store(true, std::memory_order_release);
+      return false;
+   }
+
+   Slot& slot = slots_[pos % capacity];
+
+   // Mark the slot as being written before touching its contents, so that a
+   // reader peeking at its previous occupant can tell it is gone.
+   slot.sequence.store(2 * pos + 1, std::memory_order_relaxed);
+   std::atomic_thread_fence(std::memory_order_release);
+
+   const unsigned long singleChannelSize = (unsigned long)width * height * byteDepth;
+   for (unsigned i = 0; i < numChannels; i++)
+   {
+      mm::ImgBuffer* pImg = slot.frame.FindImage(i);
+      if (!pImg)
+         return false;
+
+      StoreImageMetadata(pImg, md, width, height, byteDepth, nComponents);
+      tasksMemCopy_->MemCopy(pImg->GetPixelsRW(),
+            pixArray + i * singleChannelSize, singleChannelSize);
+   }
+
+   slot.sequence.store(2 * pos + 2, std::memory_order_release);
+   insertCursor_.store(pos + 1, std::memory_order_release);
+   NotifyImageInserted();
+   return true;
+}
+
+unsigned char* LockFreeSequenceBuffer::AcquireWriteSlot(unsigned int width, unsigned int height, unsigned int byteDepth) throw (CMMError)
+{
+   std::unique_lock<std::mutex> lock(producerMutex_);
+
+   if (width != Width() || height != Height() || byteDepth != Depth())
+      throw CMMError("Incompatible image dimensions in the circular buffer", MMERR_CircularBufferIncompatibleImage);
+   // The slot holds one image; the other channels would be left stale
+   if (numChannels_ != 1)
+      throw CMMError("Write slots require a single-channel circular buffer", MMERR_CircularBufferIncompatibleImage);
+
+   const unsigned long capacity = capacity_.load(std::memory_order_relaxed);
+   const std::uint64_t pos = insertCursor_.load(std::memory_order_relaxed);
+   if (capacity == 0 ||
+         pos - saveCursor_.load(std::memory_order_acquire) >= capacity)
+   {
+      overflow_.store(true, std::memory_order_release);
+      return 0;
+   }
+
+   Slot& slot = slots_[pos % capacity];
+   mm::ImgBuffer* pImg = slot.frame.FindImage(0);
+   if (!pImg)
+      return 0;
+
+   // As in InsertMultiChannel(), retire the previous occupant first. If the
+   // slot is abandoned it stays marked as being written, which is harmless
+   // because its old contents may already have been overwritten.
+   slot.sequence.store(2 * pos + 1, std::memory_order_relaxed);
+   std::atomic_thread_fence(std::memory_order_release);
+
+   writeSlot_ = &slot;
+   writeSlotPos_ = pos;
+
+   // Keep producerMutex_ locked until the slot is committed or abandoned
+   lock.release();
+   return pImg->GetPixelsRW();
+}
+
+bool LockFreeSequenceBuffer::CommitWriteSlot(unsigned int nComponents, const BinaryMetadata& md)
+{
+   if (!writeSlot_)
+      return false;
+
+   Slot& slot = *writeSlot_;
+   const std::uint64_t pos = writeSlotPos_;
+   writeSlot_ = 0;
+
+   StoreImageMetadata(slot.frame.FindImage(0), md,
+         Width(), Height(), Depth(), nComponents);
+
+   slot.sequence.store(2 * pos + 2, std::memory_order_release);
+   insertCursor_.store(pos + 1, std::memory_order_release);
+   producerMutex_.unlock();
+   NotifyImageInserted();
+   return true;
+}
+
+bool LockFreeSequenceBuffer::AbandonWriteSlot()
+{
+   if (!writeSlot_)
+      return false;
+
+   writeSlot_ = 0;
+   producerMutex_.unlock();
+   return true;
+}
+
+// Called with producerMutex_ held.
+void LockFreeSequenceBuffer::StoreImageMetadata(mm::ImgBuffer* pImg, const BinaryMetadata& md, unsigned int width, unsigned int height, unsigned int byteDepth, unsigned int nComponents)
+{
+   BinaryMetadata& imgMd = pImg->GetBinaryMetadataRW();
+   imgMd = md;
+
+   const char* cameraName = imgMd.FindString("Camera");
+   if (!cameraName)
+      cameraName = "";
+   auto it = imageNumbers_.find(cameraName);
+   if (it == imageNumbers_.end())
+      it = imageNumbers_.emplace(cameraName, 0).first;
+   imgMd.PutImageTag(MM::g_Keyword_Metadata_ImageNumber, it->second);
+   ++it->second;
+
+   AddCoreImageTags(imgMd, width, height, byteDepth, nComponents, startTime_);
+}
+
+const mm::ImgBuffer* LockFreeSequenceBuffer::GetNthFromTopImageBuffer(long n,
+      unsigned channel) const
+{
+   if (n < 0)
+      return 0;
+
+   ReaderGuard guard(*this);
+   if (!guard.Admitted())
+      return 0;
+
+   std::uint64_t save = saveCursor_.load(std::memory_order_acquire);
+   std::uint64_t insert = insertCursor_.load(std::memory_order_acquire);
+   if (static_cast<std::uint64_t>(n) + 1 > insert - save)
+      return 0;
+
+   const unsigned long capacity = capacity_.load(std::memory_order_relaxed);
+   const std::uint64_t target = insert - n - 1;
+   const Slot& slot = slots_[target % capacity];
+   if (slot.sequence.load(std::memory_order_acquire) != 2 * target + 2)
+      return 0; // Overwritten since we read the cursors
+   return slot.frame.FindImage(channel);
+}
+
+const mm::ImgBuffer* LockFreeSequenceBuffer::GetNextImageBuffer(unsigned channel)
+{
+   ReaderGuard guard(*this);
+   if (!guard.Admitted())
+      return 0;
+
+   std::uint64_t save = saveCursor_.load(std::memory_order_acquire);
+   for (;;)
+   {
+      if (save >= insertCursor_.load(std::memory_order_acquire))
+         return 0;
+      if (saveCursor_.compare_exchange_weak(save, save + 1,
+               std::memory_order_acq_rel, std::memory_order_acquire))
+         break;
+   }
+
+   const unsigned long capacity = capacity_.load(std::memory_order_relaxed);
+   return slots_[save % capacity].frame.FindImage(channel);
+}
+
+bool LockFreeSequenceBuffer::GetNextFrame(std::vector<const mm::ImgBuffer*>& images)
+{
+   images.clear();
+   ReaderGuard guard(*this);
+   if (!guard.Admitted())
+      return false;
+
+   std::uint64_t save = saveCursor_.load(std::memory_order_acquire);
+   for (;;)
+   {
+      if (save >= insertCursor_.load(std::memory_order_acquire))
+         return false;
+      if (saveCursor_.compare_exchange_weak(save, save + 1,
+               std::memory_order_acq_rel, std::memory_order_acquire))
+         break;
+   }
+
+   const unsigned long capacity = capacity_.load(std::memory_order_relaxed);
+   const mm::FrameBuffer& frame = slots_[save % capacity].frame;
+   const unsigned channels = GetNumberOfChannels();
+   for (unsigned i = 0; i < channels; ++i)
+   {
+      const mm::ImgBuffer* pImg = frame.FindImage(i);
+      if (!pImg)
+         break;
+      images.push_back(pImg);
+   }
+   return true;
+}
@@ -0,0 +1,147 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          LockFreeSequenceBuffer.h
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Sequence buffer in which readers and the inserting camera
+//                thread do not share a lock.
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#pragma once
+
+#include "SequenceBuffer.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+class ThreadPool;
+class TaskSet_CopyMemory;
+
+
+/**
+ * Single-producer, multi-consumer sequence buffer.
+ *
+ * Frames are addressed by monotonically increasing 64-bit positions. The
+ * insert cursor is only advanced by the (single) producer after the frame
+ * has been fully written; the save cursor is advanced by consumers with a
+ * compare-and-swap. Each slot carries a sequence number that tells readers
+ * which position it currently holds and whether it is being written, so that
+ * peeking at the most recent frames never observes a half-written slot.
+ *
+ * Concurrent inserts (e.g. from several physical cameras of a Multi Camera)
+ * are serialized among themselves, but never wait for readers, and readers
+ * never wait for inserts.
+ *
+ * Initialize() is the only operation that waits: it drains in-flight readers
+ * before reallocating the frame storage.
+ */
+class LockFreeSequenceBuffer : public SequenceBuffer
+{
+public:
+   // Copies images using pool, or a pool of its own if pool is null
+   LockFreeSequenceBuffer(unsigned int memorySizeMB, std::shared_ptr<ThreadPool> pool = nullptr);
+   ~LockFreeSequenceBuffer();
+
+   unsigned GetMemorySizeMB() const { return memorySizeMB_; }
+   // All slots are allocated (and zeroed) by Initialize()
+   unsigned long long GetResidentBytes() const { return allocatedBytes_.load(); }
+
+   bool Initialize(unsigned channels, unsigned int xSize, unsigned int ySize, unsigned int pixDepth);
+   unsigned long GetSize() const;
+   unsigned long GetFreeSize() const;
+   unsigned long GetRemainingImageCount() const;
+
+   unsigned int Width() const { return width_.load(std::memory_order_relaxed); }
+   unsigned int Height() const { return height_.load(std::memory_order_relaxed); }
+   unsigned int Depth() const { return pixDepth_.load(std::memory_order_relaxed); }
+   unsigned GetNumberOfChannels() const { return numChannels_.load(std::memory_order_relaxed); }
+
+   using SequenceBuffer::InsertImage;
+   using SequenceBuffer::InsertMultiChannel;
+   bool InsertMultiChannel(const unsigned char* pixArray, unsigned int numChannels, unsigned int width, unsigned int height, unsigned int byteDepth, unsigned int nComponents, const BinaryMetadata& md) throw (CMMError);
+   unsigned char* AcquireWriteSlot(unsigned int width, unsigned int height, unsigned int byteDepth) throw (CMMError);
+   using SequenceBuffer::CommitWriteSlot;
+   bool CommitWriteSlot(unsigned int nComponents, const BinaryMetadata& md);
+   bool AbandonWriteSlot();
+   using SequenceBuffer::GetNthFromTopImageBuffer;
+   const mm::ImgBuffer* GetNthFromTopImageBuffer(long n, unsigned channel) const;
+   const mm::ImgBuffer* GetNextImageBuffer(unsigned channel);
+   bool GetNextFrame(std::vector<const mm::ImgBuffer*>& images);
+   void Clear();
+
+   bool Overflow() const { return overflow_.load(std::memory_order_acquire); }
+
+private:
+   LockFreeSequenceBuffer(const LockFreeSequenceBuffer&);
+   LockFreeSequenceBuffer& operator=(const LockFreeSequenceBuffer&);
+
+   struct Slot
+   {
+      // 2 * pos + 1 while position pos is being written, 2 * pos + 2 once
+      // it has been committed; 0 if never written.
+      std::atomic<std::uint64_t> sequence;
+      mm::FrameBuffer frame;
+
+      Slot() : sequence(0) {}
+   };
+
+   void StoreImageMetadata(mm::ImgBuffer* pImg, const BinaryMetadata& md, unsigned int width, unsigned int height, unsigned int byteDepth, unsigned int nComponents);
+
+   // RAII registration of a reader; see Initialize().
+   class ReaderGuard
+   {
+      const LockFreeSequenceBuffer& buf_;
+      bool admitted_;
+   public:
+      explicit ReaderGuard(const LockFreeSequenceBuffer& buf);
+      ~ReaderGuard();
+      bool Admitted() const { return admitted_; }
+   };
+
+   const unsigned long memorySizeMB_;
+
+   std::atomic<unsigned> width_;
+   std::atomic<unsigned> height_;
+   std::atomic<unsigned> pixDepth_;
+   std::atomic<unsigned> numChannels_;
+
+   std::unique_ptr<Slot[]> slots_;
+   std::atomic<unsigned long> capacity_;
+   std::atomic<unsigned long long> allocatedBytes_;
+
+   // Invariant: saveCursor_ <= insertCursor_ <= saveCursor_ + capacity_
+   std::atomic<std::uint64_t> insertCursor_;
+   std::atomic<std::uint64_t> saveCursor_;
+   std::atomic<bool> overflow_;
+
+   mutable std::atomic<unsigned> activeReaders_;
+   std::atomic<bool> reconfiguring_;
+
+   // Serializes producers (and Initialize()/Clear()) only; never taken by
+   // readers.
+   std::mutex producerMutex_;
+   // Slot reserved by AcquireWriteSlot(), which leaves producerMutex_ locked
+   // until the slot is committed or abandoned
+   Slot* writeSlot_;
+   std::uint64_t writeSlotPos_;
+   std::chrono::steady_clock::time_point startTime_;
+   std::map<std::string, long, std::less<>> imageNumbers_;
+
+   std::shared_ptr<ThreadPool> threadPool_;
+   std::shared_ptr<TaskSet_CopyMemory> tasksMemCopy_;
+};
@@ -3,6 +3,7 @@
 #include "CoreUtils.h"
 #include "Error.h"
 
+#include <algorithm>
 #include <memory>
 #include <mutex>
 #include <utility>
@@ -30,6 +31,17 @@ const char* StringForLogLevel(LogLevel level)
    }
 }
 
+const char* StringForOverflowPolicy(OverflowPolicy policy)
+{
+   switch (policy)
+   {
+      case OverflowPolicyBlock: return "block";
+      case OverflowPolicyDropOldest: return "drop oldest";
+      case OverflowPolicyDropDebug: return "drop debug";
+      default: return "(unknown)";
+   }
+}
+
 } // anonymous namespace
 
 const logging::SinkMode LogManager::PrimarySinkMode = logging::SinkModeAsynchronous;
@@ -40,7 +52,9 @@ LogManager::LogManager() :
    primaryLogLevel_(LogLevelInfo),
    usingStdErr_(false),
    nextSecondaryHandle_(0)
-{}
+{
+   UpdateMinimumLevel();
+}
 
 
 void
@@ -61,6 +75,7 @@ LogManager::SetUseStdErr(bool flag)
                std::make_shared<LevelFilter>(primaryLogLevel_));
       }
       loggingCore_->AddSink(stdErrSink_, PrimarySinkMode);
+      UpdateMinimumLevel();
 
       LOG_INFO(internalLogger_) << "Enabled logging to stderr";
    }
@@ -69,6 +84,7 @@ LogManager::SetUseStdErr(bool flag)
       LOG_INFO(internalLogger_) << "Disabling logging to stderr";
 
       loggingCore_->RemoveSink(stdErrSink_, PrimarySinkMode);
+      UpdateMinimumLevel();
    }
 }
 
@@ -98,6 +114,7 @@ LogManager::SetPrimaryLogFilename(const std::string& filename, bool truncate)
          LOG_INFO(internalLogger_) << "Disabling primary log file";
          loggingCore_->RemoveSink(primaryFileSink_, PrimarySinkMode);
          primaryFileSink_.reset();
+         UpdateMinimumLevel();
       }
       return;
    }
@@ -118,6 +135,7 @@ LogManager::SetPrimaryLogFilename(const std::string& filename, bool truncate)
       }
       primaryFileSink_.reset();
       primaryFilename_.clear();
+      UpdateMinimumLevel();
       throw CMMError("Cannot open file " + ToQuotedString(filename));
    }
 
@@ -127,6 +145,7 @@ LogManager::SetPrimaryLogFilename(const std::string& filename, bool truncate)
    {
       loggingCore_->AddSink(newSink, PrimarySinkMode);
       primaryFileSink_ = newSink;
+      UpdateMinimumLevel();
       LOG_INFO(internalLogger_) << "Enabled primary log file " <<
          primaryFilename_;
    }
@@ -205,6 +224,7 @@ LogManager::SetPrimaryLogLevel(LogLevel level)
    }
 
    loggingCore_->AtomicSetSinkFilters(changes.begin(), changes.end());
+   UpdateMinimumLevel();
 
    LOG_INFO(internalLogger_) << "Switched primary log level from " <<
       StringForLogLevel(oldLevel) << " to " << StringForLogLevel(level);
@@ -241,9 +261,10 @@ LogManager::AddSecondaryLogFile(LogLevel level,
 
    LogFileHandle handle = nextSecondaryHandle_++;
    secondaryLogFiles_.insert(std::make_pair(handle,
-            LogFileInfo(filename, sink, mode)));
+            LogFileInfo(filename, sink, mode, level)));
 
    loggingCore_->AddSink(sink, mode);
+   UpdateMinimumLevel();
 
    LOG_INFO(internalLogger_) << "Added secondary log file " << filename <<
       " with log level " << StringForLogLevel(level);
@@ -270,6 +291,68 @@ LogManager::RemoveSecondaryLogFile(LogManager::LogFileHandle handle)
       foundIt->second.filename_;
    loggingCore_->RemoveSink(foundIt->second.sink_, foundIt->second.mode_);
    secondaryLogFiles_.erase(foundIt);
+   UpdateMinimumLevel();
+}
+
+
+void
+LogManager::SetQueueCapacity(std::size_t lines)
+{
+   std::lock_guard<std::mutex> lock(mutex_);
+
+   loggingCore_->SetAsyncQueueCapacity(lines);
+   LOG_INFO(internalLogger_) << "Set log queue capacity to " <<
+      loggingCore_->GetAsyncQueueCapacity() << " lines";
+}
+
+
+std::size_t
+LogManager::GetQueueCapacity() const
+{
+   return loggingCore_->GetAsyncQueueCapacity();
+}
+
+
+void
+LogManager::SetQueueFlushInterval(std::chrono::milliseconds interval)
+{
+   std::lock_guard<std::mutex> lock(mutex_);
+
+   loggingCore_->SetAsyncQueueFlushInterval(interval);
+   LOG_INFO(internalLogger_) << "Set log flush interval to " <<
+      interval.count() << " ms";
+}
+
+
+std::chrono::milliseconds
+LogManager::GetQueueFlushInterval() const
+{
+   return loggingCore_->GetAsyncQueueFlushInterval();
+}
+
+
+void
+LogManager::SetQueueOverflowPolicy(OverflowPolicy policy)
+{
+   std::lock_guard<std::mutex> lock(mutex_);
+
+   loggingCore_->SetAsyncQueueOverflowPolicy(policy, LogLevelInfo);
+   LOG_INFO(internalLogger_) << "Set log queue overflow policy to " <<
+      StringForOverflowPolicy(policy);
+}
+
+
+OverflowPolicy
+LogManager::GetQueueOverflowPolicy() const
+{
+   return loggingCore_->GetAsyncQueueOverflowPolicy();
+}
+
+
+unsigned long long
+LogManager::GetDroppedEntryCount() const
+{
+   return loggingCore_->GetDroppedEntryCount();
 }
 
 
@@ -279,4 +362,21 @@ LogManager::NewLogger(const std::string& label)
    return loggingCore_->NewLogger(label);
 }
 
+
+void
+LogManager::UpdateMinimumLevel()
+{
+   // With no sinks, nothing is logged
+   int minLevel = LogLevelFatal + 1;
+   if (usingStdErr_ || primaryFileSink_)
+      minLevel = primaryLogLevel_;
+   for (std::map<LogFileHandle, LogFileInfo>::const_iterator
+         it = secondaryLogFiles_.begin(), end = secondaryLogFiles_.end();
+         it != end; ++it)
+   {
+      minLevel = std::min(minLevel, static_cast<int>(it->second.level_));
+   }
+   loggingCore_->SetMinimumLevel(minLevel);
+}
+
 } // namespace mm
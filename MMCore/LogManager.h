@@ -2,6 +2,8 @@
 
 #include "Logging/Logging.h"
 
+#include <chrono>
+#include <cstddef>
 #include <map>
 #include <mutex>
 #include <string>
@@ -37,13 +39,16 @@ private:
       std::string filename_;
       std::shared_ptr<logging::LogSink> sink_;
       logging::SinkMode mode_;
+      logging::LogLevel level_;
 
       LogFileInfo(const std::string& filename,
             std::shared_ptr<logging::LogSink> sink,
-            logging::SinkMode mode) :
+            logging::SinkMode mode,
+            logging::LogLevel level) :
          filename_(filename),
          sink_(sink),
-         mode_(mode)
+         mode_(mode),
+         level_(level)
       {}
    };
    std::map<LogFileHandle, LogFileInfo> secondaryLogFiles_;
@@ -70,7 +75,22 @@ public:
    // We could add an atomic SwapSecondaryLogFile(handle, filename, truncate),
    // nice for log rotation, but we don't need it now.
 
+   // Queue between logging threads and the (asynchronous) log files
+   void SetQueueCapacity(std::size_t lines);
+   std::size_t GetQueueCapacity() const;
+   void SetQueueFlushInterval(std::chrono::milliseconds interval);
+   std::chrono::milliseconds GetQueueFlushInterval() const;
+   // With OverflowPolicyDropDebug, debug and trace entries are dropped
+   void SetQueueOverflowPolicy(logging::OverflowPolicy policy);
+   logging::OverflowPolicy GetQueueOverflowPolicy() const;
+   unsigned long long GetDroppedEntryCount() const;
+
    logging::Logger NewLogger(const std::string& label);
+
+private:
+   // Let loggers skip entries that no sink would accept. Call with mutex_
+   // held, after any change to the sinks or their levels.
+   void UpdateMinimumLevel();
 };
 
 } // namespace mm
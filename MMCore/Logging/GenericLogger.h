@@ -16,7 +16,9 @@
 
 #pragma once
 
+#include <atomic>
 #include <functional>
+#include <memory>
 #include <sstream>
 #include <string>
 
@@ -33,14 +35,27 @@ template <typename TEntryData>
 class GenericLogger
 {
    std::function<void (TEntryData, const char*)> impl_;
+   // Entries below this level would be filtered out by every sink; null if
+   // all entries are to be sent
+   std::shared_ptr<const std::atomic<int> > minLevel_;
 
 public:
    typedef TEntryData EntryDataType;
 
-   GenericLogger(std::function<void (TEntryData, const char*)> f) :
-      impl_(f)
+   GenericLogger(std::function<void (TEntryData, const char*)> f,
+         std::shared_ptr<const std::atomic<int> > minLevel = nullptr) :
+      impl_(f),
+      minLevel_(minLevel)
    {}
 
+   // Whether an entry would be logged at all; checked by the LOG_* macros
+   // before formatting the entry
+   bool IsEnabled(TEntryData entryData) const
+   {
+      return !minLevel_ || static_cast<int>(entryData.GetLevel()) >=
+         minLevel_->load(std::memory_order_relaxed);
+   }
+
    void operator()(TEntryData entryData, const char* message) const
    { impl_(entryData, message); }
 
@@ -23,6 +23,10 @@
 #include "GenericSink.h"
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstddef>
 #include <functional>
 #include <memory>
 #include <mutex>
@@ -73,8 +77,17 @@ private:
    // _and_ the queue receive loop stopped.
    std::vector< std::shared_ptr<SinkType> > asynchronousSinks_;
 
+   // Shared with the loggers, which check it before formatting entries
+   std::shared_ptr< std::atomic<int> > minLevel_;
+
+   // Entries below this level may be dropped with OverflowPolicyDropDebug
+   std::atomic<int> droppableBelowLevel_;
+
 public:
-   GenericLoggingCore() { StartAsyncReceiveLoop(); }
+   GenericLoggingCore() :
+      minLevel_(std::make_shared< std::atomic<int> >(INT_MIN)),
+      droppableBelowLevel_(INT_MIN)
+   { StartAsyncReceiveLoop(); }
    ~GenericLoggingCore() { StopAsyncReceiveLoop(); }
 
    /**
@@ -88,9 +101,70 @@ public:
       // guaranteed to be safe to call at any time.
       return internal::GenericLogger<EntryDataType>(
             std::bind(&GenericLoggingCore::SendEntryToShared,
-               this->shared_from_this(), metadata, std::placeholders::_1, std::placeholders::_2));
+               this->shared_from_this(), metadata, std::placeholders::_1, std::placeholders::_2),
+            minLevel_);
+   }
+
+   /**
+    * Set the level below which loggers drop entries without formatting them.
+    *
+    * This must be no higher than the lowest level accepted by the sinks'
+    * filters; the filters still apply. By default, all entries are sent.
+    */
+   void SetMinimumLevel(int level)
+   { minLevel_->store(level, std::memory_order_relaxed); }
+
+   /**
+    * Set the capacity, in line packets, of the queue for asynchronous sinks.
+    *
+    * The capacity is rounded up to a power of 2. Entries longer than the
+    * capacity are truncated.
+    */
+   void SetAsyncQueueCapacity(std::size_t capacity)
+   {
+      std::lock_guard<std::mutex> lock(asyncQueueMutex_);
+      StopAsyncReceiveLoop();
+      asyncQueue_.SetCapacity(capacity,
+            std::bind(&GenericLoggingCore::RunAsynchronousSinks, this, std::placeholders::_1));
+      StartAsyncReceiveLoop();
    }
 
+   std::size_t GetAsyncQueueCapacity() const
+   { return asyncQueue_.GetCapacity(); }
+
+   /**
+    * Set how long to collect entries for asynchronous sinks before passing
+    * them on in a batch.
+    */
+   void SetAsyncQueueFlushInterval(std::chrono::milliseconds interval)
+   { asyncQueue_.SetFlushInterval(interval); }
+
+   std::chrono::milliseconds GetAsyncQueueFlushInterval()
+   { return asyncQueue_.GetFlushInterval(); }
+
+   /**
+    * Set what happens to entries sent while the asynchronous queue is full.
+    *
+    * With OverflowPolicyDropDebug, entries below droppableBelowLevel are
+    * dropped; logging threads wait for room for the others.
+    */
+   void SetAsyncQueueOverflowPolicy(OverflowPolicy policy,
+         int droppableBelowLevel = INT_MIN)
+   {
+      droppableBelowLevel_.store(droppableBelowLevel, std::memory_order_relaxed);
+      asyncQueue_.SetOverflowPolicy(policy);
+   }
+
+   OverflowPolicy GetAsyncQueueOverflowPolicy() const
+   { return asyncQueue_.GetOverflowPolicy(); }
+
+   /**
+    * Get the number of entries dropped because the asynchronous queue was
+    * full.
+    */
+   unsigned long long GetDroppedEntryCount() const
+   { return asyncQueue_.GetDroppedEntryCount(); }
+
    /**
     * Add a synchronous or asynchronous sink.
     */
@@ -281,7 +355,9 @@ private:
             (*it)->Consume(packets);
          }
       }
-      asyncQueue_.SendPackets(packets.Begin(), packets.End());
+      asyncQueue_.SendPackets(packets.Begin(), packets.End(),
+            static_cast<int>(entryData.GetLevel()) <
+            droppableBelowLevel_.load(std::memory_order_relaxed));
    }
 
    // Called on the receive thread of GenericPacketQueue
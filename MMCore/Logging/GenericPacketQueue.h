@@ -16,17 +16,40 @@
 
 #pragma once
 
+#include "GenericLinePacket.h"
+#include "GenericPacketArray.h"
+
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <condition_variable>
+#include <cstddef>
+#include <cstdint>
 #include <functional>
+#include <iterator>
+#include <memory>
 #include <mutex>
+#include <new>
 #include <thread>
+#include <type_traits>
+#include <vector>
 
 
 namespace mm
 {
 namespace logging
 {
+
+
+// What a logging thread does when the asynchronous queue is full
+enum OverflowPolicy
+{
+   OverflowPolicyBlock, // Wait for the receive thread to make room
+   OverflowPolicyDropOldest, // Discard the oldest queued entries
+   OverflowPolicyDropDebug, // Discard the new entry if droppable, else wait
+};
+
+
 namespace internal
 {
 
@@ -34,14 +57,182 @@ template <typename TMetadata>
 class GenericPacketQueue
 {
    typedef GenericPacketArray<TMetadata> PacketArrayType;
+   typedef GenericLinePacket<TMetadata> LinePacketType;
+
+   static_assert(std::is_trivially_destructible<LinePacketType>::value,
+         "Packets are stored in raw slots and never destroyed");
+
+   enum PushResult
+   {
+      PushDone,
+      PushFull,
+      PushClosed,
+   };
+
+   // Bounded ring of packets, written by the logging threads and read by the
+   // receive thread without locking.
+   //
+   // Each slot has a sequence number telling whether it is free to be written
+   // for position p (== p) or holds the packet for position p (== p + 1). An
+   // entry's packets go in consecutive slots, claimed together by advancing
+   // tail_, so that entries from different threads do not interleave. Entries
+   // are likewise taken whole, by advancing head_ past them; with
+   // OverflowPolicyDropOldest, logging threads also do this to discard them.
+   class Ring
+   {
+      struct Slot
+      {
+         std::atomic<std::uint64_t> sequence;
+         std::atomic<std::uint32_t> entryLength; // Valid in an entry's first slot
+         typename std::aligned_storage<sizeof(LinePacketType),
+                  alignof(LinePacketType)>::type packet;
+      };
+
+      static const std::uint64_t ClosedBit = std::uint64_t(1) << 63;
+
+      // head_ and tail_ are padded onto cache lines of their own, rather than
+      // over-aligned, so that a Ring can be allocated with plain new
+      static const std::size_t CacheLineSize = 64;
+      typedef std::atomic<std::uint64_t> Position;
+
+      const std::uint64_t mask_;
+      std::unique_ptr<Slot[]> slots_;
+      char padBeforeHead_[CacheLineSize];
+      Position head_;
+      char padBeforeTail_[CacheLineSize - sizeof(Position)];
+      Position tail_;
+      char padAfterTail_[CacheLineSize - sizeof(Position)];
+
+   public:
+      // Capacity is rounded up to a power of 2
+      explicit Ring(std::size_t capacity) :
+         mask_(RoundUpToPowerOf2(capacity) - 1),
+         slots_(new Slot[mask_ + 1]),
+         head_(0),
+         tail_(0)
+      {
+         for (std::uint64_t i = 0; i <= mask_; ++i)
+         {
+            slots_[i].sequence.store(i, std::memory_order_relaxed);
+            slots_[i].entryLength.store(0, std::memory_order_relaxed);
+         }
+      }
+
+      std::size_t GetCapacity() const
+      { return static_cast<std::size_t>(mask_ + 1); }
+
+      // Count must not exceed the capacity
+      template <typename TPacketIter>
+      PushResult TryPush(TPacketIter first, std::size_t count)
+      {
+         std::uint64_t pos = tail_.load(std::memory_order_relaxed);
+         for (;;)
+         {
+            if (pos & ClosedBit)
+               return PushClosed;
+            const std::uint64_t head = head_.load(std::memory_order_acquire);
+            if (pos + count > head + GetCapacity())
+               return PushFull;
+            if (tail_.compare_exchange_weak(pos, pos + count,
+                     std::memory_order_relaxed))
+               break;
+         }
+
+         for (std::size_t i = 0; i < count; ++i, ++first)
+         {
+            Slot& slot = slots_[(pos + i) & mask_];
+            // The reader may not have finished copying the previous packet
+            while (slot.sequence.load(std::memory_order_acquire) != pos + i)
+               std::this_thread::yield();
+            new (&slot.packet) LinePacketType(*first);
+            if (i == 0)
+               slot.entryLength.store(static_cast<std::uint32_t>(count),
+                     std::memory_order_relaxed);
+            slot.sequence.store(pos + i + 1, std::memory_order_release);
+         }
+         return PushDone;
+      }
+
+      // Takes the oldest entry, appending it to out (or discarding it if out
+      // is null). Returns its packet count, or 0 if no complete entry is at
+      // the head.
+      std::size_t TryPop(PacketArrayType* out)
+      {
+         std::uint64_t head = head_.load(std::memory_order_relaxed);
+         std::uint32_t count;
+         for (;;)
+         {
+            const Slot& slot = slots_[head & mask_];
+            if (slot.sequence.load(std::memory_order_acquire) != head + 1)
+               return 0;
+            count = slot.entryLength.load(std::memory_order_relaxed);
+            if (head_.compare_exchange_weak(head, head + count,
+                     std::memory_order_relaxed))
+               break;
+         }
+
+         for (std::uint32_t i = 0; i < count; ++i)
+         {
+            Slot& slot = slots_[(head + i) & mask_];
+            // The rest of the entry may still be being written
+            while (slot.sequence.load(std::memory_order_acquire) != head + i + 1)
+               std::this_thread::yield();
+            if (out)
+            {
+               const LinePacketType* packet =
+                  reinterpret_cast<const LinePacketType*>(&slot.packet);
+               out->Append(packet, packet + 1);
+            }
+            slot.sequence.store(head + i + GetCapacity(),
+                  std::memory_order_release);
+         }
+         return count;
+      }
+
+      bool IsEmpty() const
+      {
+         const std::uint64_t head = head_.load(std::memory_order_acquire);
+         return slots_[head & mask_].sequence.load(std::memory_order_acquire) !=
+            head + 1;
+      }
+
+      // Make further pushes fail; returns the end of the pushed entries
+      std::uint64_t Close()
+      { return tail_.fetch_or(ClosedBit, std::memory_order_acq_rel); }
+
+      bool IsTakenUpTo(std::uint64_t end) const
+      { return head_.load(std::memory_order_acquire) == end; }
+
+   private:
+      static std::uint64_t RoundUpToPowerOf2(std::size_t n)
+      {
+         std::uint64_t p = 1;
+         while (p < n)
+            p <<= 1;
+         return p;
+      }
+   };
 
 private:
-   // The "queue" for asynchronous sinks.
+   // The current ring, and all the rings it replaced (a logging thread may
+   // still be about to find out that one has been closed). Changed only
+   // while the receive loop is stopped.
+   std::atomic<Ring*> ring_;
+   std::vector< std::unique_ptr<Ring> > rings_;
+
+   std::atomic<int> overflowPolicy_; // OverflowPolicy
+   std::atomic<unsigned long long> droppedEntries_;
+
    std::mutex mutex_;
-   std::condition_variable condVar_;
-   PacketArrayType queue_;
+   std::condition_variable condVar_; // Wakes the receive thread
+   std::condition_variable roomCondVar_; // Wakes logging threads waiting for room
+   // Set while the receive thread waits without timeout, so that logging
+   // threads know to wake it
+   std::atomic<bool> receiverSleeping_;
+   bool wakeRequested_; // Protected by mutex_
+   std::chrono::milliseconds flushInterval_; // Protected by mutex_
 
-   // Swapped with queue_ and accessed from receiving thread.
+   // Accessed from receiving thread.
    PacketArrayType received_;
 
    bool shutdownRequested_; // Protected by mutex_
@@ -52,16 +243,124 @@ private:
    std::thread loopThread_; // Protected by threadMutex_
 
 public:
+   static const std::size_t DefaultCapacity = 16384;
+
    GenericPacketQueue() :
+      overflowPolicy_(OverflowPolicyBlock),
+      droppedEntries_(0),
+      receiverSleeping_(false),
+      wakeRequested_(false),
+      flushInterval_(10),
       shutdownRequested_(false)
-   {}
+   {
+      rings_.emplace_back(new Ring(DefaultCapacity));
+      ring_.store(rings_.back().get(), std::memory_order_release);
+   }
 
+   /**
+    * Queue the packets of one entry.
+    *
+    * If the queue is full, the overflow policy applies; droppable tells
+    * whether OverflowPolicyDropDebug may discard the entry. An entry with
+    * more packets than the queue's capacity is truncated.
+    */
    template <typename TPacketIter>
-   void SendPackets(TPacketIter first, TPacketIter last)
+   void SendPackets(TPacketIter first, TPacketIter last, bool droppable)
+   {
+      const std::size_t count =
+         static_cast<std::size_t>(std::distance(first, last));
+      if (count == 0)
+         return;
+
+      for (;;)
+      {
+         Ring* ring = ring_.load(std::memory_order_acquire);
+         switch (ring->TryPush(first,
+                  (std::min)(count, ring->GetCapacity())))
+         {
+            case PushDone:
+               WakeReceiverIfSleeping();
+               return;
+            case PushClosed: // Capacity being changed
+               std::this_thread::yield();
+               continue;
+            case PushFull:
+               break;
+         }
+
+         switch (overflowPolicy_.load(std::memory_order_relaxed))
+         {
+            case OverflowPolicyDropOldest:
+               if (ring->TryPop(0))
+                  droppedEntries_.fetch_add(1, std::memory_order_relaxed);
+               else
+                  std::this_thread::yield();
+               continue;
+            case OverflowPolicyDropDebug:
+               if (droppable)
+               {
+                  droppedEntries_.fetch_add(1, std::memory_order_relaxed);
+                  return;
+               }
+               break;
+         }
+         WaitForRoom();
+      }
+   }
+
+   void SetOverflowPolicy(OverflowPolicy policy)
+   { overflowPolicy_.store(policy, std::memory_order_relaxed); }
+
+   OverflowPolicy GetOverflowPolicy() const
+   {
+      return static_cast<OverflowPolicy>(
+            overflowPolicy_.load(std::memory_order_relaxed));
+   }
+
+   // Entries discarded because the queue was full
+   unsigned long long GetDroppedEntryCount() const
+   { return droppedEntries_.load(std::memory_order_relaxed); }
+
+   // How long the receive loop waits, while entries keep coming, before
+   // taking them in a batch
+   void SetFlushInterval(std::chrono::milliseconds interval)
    {
       std::lock_guard<std::mutex> lock(mutex_);
-      queue_.Append(first, last);
-      condVar_.notify_one();
+      flushInterval_ = interval;
+   }
+
+   std::chrono::milliseconds GetFlushInterval()
+   {
+      std::lock_guard<std::mutex> lock(mutex_);
+      return flushInterval_;
+   }
+
+   std::size_t GetCapacity() const
+   { return ring_.load(std::memory_order_acquire)->GetCapacity(); }
+
+   /**
+    * Replace the ring with one of the given capacity (in packets, rounded up
+    * to a power of 2).
+    *
+    * Must be called while the receive loop is stopped. Entries already
+    * queued are passed to consume.
+    */
+   void SetCapacity(std::size_t capacity,
+         std::function<void (PacketArrayType&)> consume)
+   {
+      Ring* old = ring_.load(std::memory_order_relaxed);
+      rings_.emplace_back(new Ring((std::max)(capacity, std::size_t(1))));
+
+      const std::uint64_t end = old->Close();
+      while (!old->IsTakenUpTo(end))
+      {
+         if (!old->TryPop(&received_))
+            std::this_thread::yield();
+      }
+      consume(received_);
+      received_.Clear();
+
+      ring_.store(rings_.back().get(), std::memory_order_release);
    }
 
    void RunReceiveLoop(std::function<void (PacketArrayType&)>
@@ -106,16 +405,36 @@ public:
    }
 
 private:
-   void ReceiveLoop(std::function<void (PacketArrayType&)> consume)
+   void WakeReceiverIfSleeping()
    {
-      using namespace std::chrono_literals;
+      // Pairs with the fence in ReceiveLoop(): either we see that the
+      // receiver is sleeping, or it sees our packets before it sleeps.
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (receiverSleeping_.load(std::memory_order_relaxed))
+      {
+         std::lock_guard<std::mutex> lock(mutex_);
+         wakeRequested_ = true;
+         condVar_.notify_one();
+      }
+   }
+
+   void WaitForRoom()
+   {
+      std::unique_lock<std::mutex> lock(mutex_);
+      wakeRequested_ = true;
+      condVar_.notify_one();
+      // Time out in case room was made before we started waiting
+      roomCondVar_.wait_for(lock, std::chrono::milliseconds(1));
+   }
 
+   void ReceiveLoop(std::function<void (PacketArrayType&)> consume)
+   {
       // The loop operates in one of two modes: timed wait and untimed wait.
       //
-      // When in timed wait mode, the loop unconditionally waits for a fixed
-      // interval before checking for data. If data is available, it is
-      // processed and the loop repeats an unconditional wait. If no data is
-      // available, the loop switches to untimed wait mode.
+      // When in timed wait mode, the loop waits for the flush interval before
+      // checking for data. If data is available, it is processed and the
+      // loop repeats the wait. If no data is available, the loop switches to
+      // untimed wait mode. The wait is cut short if the queue fills up.
       //
       // In untimed wait mode, the loop waits on a condition variable until
       // notification from the frontend. Once data is available, the loop
@@ -126,59 +445,60 @@ private:
       // threads and limiting the frequency of stream flushing.
 
       bool timedWaitMode = true;
-      bool shuttingDown = false;
 
       for (;;)
       {
-         if (timedWaitMode)
+         bool shuttingDown = false;
          {
-            // TODO Make interval configurable
-            std::this_thread::sleep_for(10ms);
-
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (timedWaitMode)
             {
-               std::lock_guard<std::mutex> lock(mutex_);
-               if (shutdownRequested_)
-               {
-                  shutdownRequested_ = false; // Allow for restarting
-                  shuttingDown = true;
-               }
-               if (!shuttingDown && queue_.IsEmpty())
-               {
-                  timedWaitMode = false;
-                  continue;
-               }
-               queue_.Swap(received_);
+               condVar_.wait_for(lock, flushInterval_, [this]
+                     { return shutdownRequested_ || wakeRequested_; });
             }
-            consume(received_);
-            received_.Clear();
-
-            if (shuttingDown)
-               return;
-         }
-         else // untimed wait mode
-         {
+            else
             {
-               std::unique_lock<std::mutex> lock(mutex_);
-               while (queue_.IsEmpty())
-               {
-                  condVar_.wait(lock);
-                  if (shutdownRequested_)
-                  {
-                     shutdownRequested_ = false; // Allow for restarting
-                     shuttingDown = true;
-                     break;
-                  }
-               }
-               queue_.Swap(received_);
+               receiverSleeping_.store(true, std::memory_order_relaxed);
+               std::atomic_thread_fence(std::memory_order_seq_cst);
+               condVar_.wait(lock, [this] {
+                     return shutdownRequested_ || wakeRequested_ ||
+                        !ring_.load(std::memory_order_acquire)->IsEmpty();
+                  });
+               receiverSleeping_.store(false, std::memory_order_relaxed);
+            }
+            wakeRequested_ = false;
+            if (shutdownRequested_)
+            {
+               shutdownRequested_ = false; // Allow for restarting
+               shuttingDown = true;
             }
-            consume(received_);
-            received_.Clear();
+         }
 
-            if (shuttingDown)
-               return;
+         // Take at most a ring's worth (unless shutting down), so that
+         // received_ stays bounded
+         Ring* ring = ring_.load(std::memory_order_acquire);
+         std::size_t taken = 0;
+         while (shuttingDown || taken < ring->GetCapacity())
+         {
+            const std::size_t count = ring->TryPop(&received_);
+            if (count == 0)
+               break;
+            taken += count;
+         }
 
-            timedWaitMode = true;
+         if (taken == 0 && !shuttingDown)
+         {
+            timedWaitMode = false;
+            continue;
          }
+         consume(received_);
+         received_.Clear();
+         roomCondVar_.notify_all();
+
+         if (shuttingDown)
+            return;
+
+         timedWaitMode = true;
       }
    }
 };
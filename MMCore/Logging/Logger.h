@@ -48,8 +48,15 @@ typedef internal::GenericLogStream<Logger> LogStream;
 // In C++ pre-11, the above statement will fail for some data types of x (e.g.
 // const char*). So, to make the left hand side of << an lvalue, we need to use
 // a trick.
+//
+// The level is checked first, so that a disabled statement does not build the
+// stream or evaluate its operands. (The check is a loop rather than an if, so
+// that an unbraced if containing the statement can be followed by an else
+// without ambiguity.)
 
 #define LOG_WITH_LEVEL(logger, level) \
+   for (bool mmLogEnabled = (logger).IsEnabled(level); mmLogEnabled; \
+         mmLogEnabled = false) \
    for (::mm::logging::LogStream strm((logger), (level)); \
          !strm.Used(); strm.MarkUsed()) \
       strm
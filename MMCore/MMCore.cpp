@@ -48,19 +48,30 @@
 #include "CoreCallback.h"
 #include "CoreProperty.h"
 #include "CoreUtils.h"
+#include "DeviceIdleWaiter.h"
 #include "DeviceManager.h"
 #include "Devices/DeviceInstances.h"
+#include "DiskStreamWriter.h"
 #include "Host.h"
+#include "LockFreeSequenceBuffer.h"
 #include "LogManager.h"
 #include "MMCore.h"
 #include "MMEventCallback.h"
 #include "PluginManager.h"
+#include "ThreadPool.h"
 
 #include <algorithm>
 #include <cassert>
 #include <chrono>
+#include <condition_variable>
 #include <cstring>
+#include <exception>
 #include <fstream>
+#include <functional>
+#include <future>
+#include <iterator>
+#include <map>
+#include <mutex>
 #include <set>
 #include <sstream>
 #include <vector>
@@ -113,7 +124,7 @@ using namespace std;
  * (Keep the 3 numbers on one line to make it easier to look at diffs when
  * merging/rebasing.)
  */
-const int MMCore_versionMajor = 10, MMCore_versionMinor = 4, MMCore_versionPatch = 0;
+const int MMCore_versionMajor = 10, MMCore_versionMinor = 17, MMCore_versionPatch = 0;
 
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -139,6 +150,16 @@ CMMCore::CMMCore() :
    externalCallback_(0),
    pixelSizeGroup_(0),
    cbuf_(0),
+   lockFreeSequenceBuffer_(false),
+   parallelDeviceInitialization_(false),
+   parallelSystemState_(false),
+   parallelConfigApplication_(false),
+   systemStateDeviceTimeoutMs_(0),
+   circularBufferHugePages_(false),
+   circularBufferPrefault_(false),
+   circularBufferSpillSizeMB_(0),
+   threadPool_(std::make_shared<ThreadPool>()),
+   idleWaiter_(new DeviceIdleWaiter()),
    pluginManager_(new CPluginManager()),
    deviceManager_(new mm::DeviceManager()),
    pPostedErrorsLock_(NULL)
@@ -152,7 +173,7 @@ CMMCore::CMMCore() :
    callback_ = new CoreCallback(this);
 
    const unsigned seqBufMegabytes = (sizeof(void*) > 4) ? 250 : 25;
-   cbuf_ = new CircularBuffer(seqBufMegabytes);
+   cbuf_ = newSequenceBuffer(seqBufMegabytes);
 
    nullAffine_ = new std::vector<double>(6);
    for (int i = 0; i < 6; i++) {
@@ -182,6 +203,7 @@ CMMCore::~CMMCore()
    delete callback_;
    delete configGroups_;
    delete properties_;
+   diskStreamWriter_.reset(); // Uses cbuf_
    delete cbuf_;
    delete pixelSizeGroup_;
    delete pPostedErrorsLock_;
@@ -310,6 +332,113 @@ void CMMCore::stopSecondaryLogFile(int handle) throw (CMMError)
 }
 
 
+/**
+ * Set the capacity of the queue holding log entries on their way to the log
+ * files, in lines.
+ *
+ * Each line of an entry (and each 127 characters of a long line) takes one
+ * place in the queue. The capacity is rounded up to a power of 2. What
+ * happens when the queue is full is set by setLogOverflowPolicy(). Entries
+ * already queued are written before the capacity is changed.
+ *
+ * @param lines The capacity (default 16384)
+ */
+void CMMCore::setLogQueueCapacity(unsigned lines) throw (CMMError)
+{
+   if (lines == 0)
+      throw CMMError("Log queue capacity must be at least 1");
+   logManager_->SetQueueCapacity(lines);
+}
+
+
+/**
+ * Return the capacity of the log queue, in lines.
+ */
+unsigned CMMCore::getLogQueueCapacity() const
+{
+   return static_cast<unsigned>(logManager_->GetQueueCapacity());
+}
+
+
+/**
+ * Set how long log entries are collected before being written to the log
+ * files, while entries keep coming.
+ *
+ * A longer interval writes in larger batches; a shorter one keeps the log
+ * files more up to date and the queue less full.
+ *
+ * @param intervalMs The interval in milliseconds (default 10)
+ */
+void CMMCore::setLogFlushInterval(unsigned intervalMs)
+{
+   logManager_->SetQueueFlushInterval(std::chrono::milliseconds(intervalMs));
+}
+
+
+/**
+ * Return the log flush interval in milliseconds.
+ */
+unsigned CMMCore::getLogFlushInterval() const
+{
+   return static_cast<unsigned>(logManager_->GetQueueFlushInterval().count());
+}
+
+
+/**
+ * Set what happens to log entries when the log queue is full.
+ *
+ * - "Block" (the default): the logging thread waits until the entry can be
+ *   queued. No entries are lost.
+ * - "DropOldest": the oldest queued entries are discarded to make room.
+ *   Logging never waits.
+ * - "DropDebug": debug entries are discarded; logging threads wait for room
+ *   for other entries.
+ *
+ * Discarded entries are counted by getDroppedLogEntryCount().
+ */
+void CMMCore::setLogOverflowPolicy(const char* policy) throw (CMMError)
+{
+   if (!policy)
+      throw CMMError("Null log overflow policy");
+
+   using namespace mm::logging;
+   const std::string policyStr(policy);
+   if (policyStr == "Block")
+      logManager_->SetQueueOverflowPolicy(OverflowPolicyBlock);
+   else if (policyStr == "DropOldest")
+      logManager_->SetQueueOverflowPolicy(OverflowPolicyDropOldest);
+   else if (policyStr == "DropDebug")
+      logManager_->SetQueueOverflowPolicy(OverflowPolicyDropDebug);
+   else
+      throw CMMError("Unknown log overflow policy " + ToQuotedString(policyStr));
+}
+
+
+/**
+ * Return the log overflow policy ("Block", "DropOldest" or "DropDebug").
+ */
+std::string CMMCore::getLogOverflowPolicy() const
+{
+   using namespace mm::logging;
+   switch (logManager_->GetQueueOverflowPolicy())
+   {
+      case OverflowPolicyDropOldest: return "DropOldest";
+      case OverflowPolicyDropDebug: return "DropDebug";
+      default: return "Block";
+   }
+}
+
+
+/**
+ * Return the number of log entries discarded because the log queue was full,
+ * since the Core was created.
+ */
+long CMMCore::getDroppedLogEntryCount() const
+{
+   return static_cast<long>(logManager_->GetDroppedEntryCount());
+}
+
+
 /*!
  Displays current user name.
  */
@@ -433,39 +562,7 @@ string CMMCore::getAPIVersionInfo() const
 Configuration CMMCore::getSystemState()
 {
    Configuration config;
-   vector<string> devices = deviceManager_->GetDeviceList();
-   for (vector<string>::const_iterator i = devices.begin(), dend = devices.end(); i != dend; ++i)
-   {
-      std::shared_ptr<DeviceInstance> pDev = deviceManager_->GetDevice(*i);
-      mm::DeviceModuleLockGuard guard(pDev);
-      std::vector<std::string> propertyNames = pDev->GetPropertyNames();
-      for (std::vector<std::string>::const_iterator it = propertyNames.begin(), end = propertyNames.end();
-            it != end; ++it)
-      {
-         std::string val;
-         try
-         {
-            val = pDev->GetProperty(*it);
-         }
-         catch (const CMMError&)
-         {
-            // XXX BUG This should not be ignored, but the interface does not
-            // allow throwing from this function. Keeping old behavior for now.
-         }
-
-         bool readOnly = false;
-         try
-         {
-            readOnly = pDev->GetPropertyReadOnly(it->c_str());
-         }
-         catch (const CMMError&)
-         {
-            // XXX BUG This should not be ignored, but the interface does not
-            // allow throwing from this function. Keeping old behavior for now.
-         }
-         config.addSetting(PropertySetting(i->c_str(), it->c_str(), val.c_str(), readOnly));
-      }
-   }
+   readDeviceStates(deviceManager_->GetDeviceList(), config);
 
    // add core properties
    vector<string> coreProps = properties_->GetNames();
@@ -479,6 +576,146 @@ Configuration CMMCore::getSystemState()
    return config;
 }
 
+/**
+ * Reads the properties of the given devices into config, in device order.
+ *
+ * Devices of one module are read one after the other (they share a lock);
+ * if parallel system state is enabled, modules are read concurrently. The
+ * devices that timed out are recorded for getSystemStateTimedOutDevices().
+ */
+void CMMCore::readDeviceStates(const std::vector<std::string>& devices, Configuration& config)
+{
+   const long timeoutMs = systemStateDeviceTimeoutMs_;
+   std::vector< std::shared_ptr<DeviceInstance> > pDevices;
+   std::vector< std::vector<size_t> > moduleDevices;
+   std::map<LoadedDeviceAdapter*, size_t> moduleIndex;
+   for (size_t i = 0; i < devices.size(); ++i)
+   {
+      pDevices.push_back(deviceManager_->GetDevice(devices[i]));
+      LoadedDeviceAdapter* module = pDevices[i]->GetAdapterModule().get();
+      std::map<LoadedDeviceAdapter*, size_t>::iterator it = moduleIndex.find(module);
+      if (it == moduleIndex.end())
+      {
+         it = moduleIndex.insert(std::make_pair(module, moduleDevices.size())).first;
+         moduleDevices.push_back(std::vector<size_t>());
+      }
+      moduleDevices[it->second].push_back(i);
+   }
+
+   std::vector< std::vector<PropertySetting> > settings(pDevices.size());
+   std::vector<char> timedOut(pDevices.size(), 0);
+   auto readModule = [&](const std::vector<size_t>& indices)
+   {
+      for (size_t i : indices)
+         timedOut[i] = readDeviceState(pDevices[i], timeoutMs, settings[i]);
+   };
+
+   if (parallelSystemState_ && moduleDevices.size() > 1)
+   {
+      // Devices mostly wait for their hardware, so each module gets a
+      // thread rather than sharing the Core's compute threads
+      ThreadPool pool(moduleDevices.size());
+      std::vector< std::future<void> > reads;
+      for (const std::vector<size_t>& indices : moduleDevices)
+         reads.push_back(pool.Submit([&readModule, &indices] { readModule(indices); }));
+      for (std::future<void>& read : reads)
+         read.wait();
+      for (std::future<void>& read : reads)
+         read.get();
+   }
+   else
+   {
+      for (const std::vector<size_t>& indices : moduleDevices)
+         readModule(indices);
+   }
+
+   for (const std::vector<PropertySetting>& deviceSettings : settings)
+   {
+      for (const PropertySetting& setting : deviceSettings)
+         config.addSetting(setting);
+   }
+
+   std::vector<std::string> timedOutDevices;
+   for (size_t i = 0; i < devices.size(); ++i)
+   {
+      if (timedOut[i])
+         timedOutDevices.push_back(devices[i]);
+   }
+   MMThreadGuard scg(stateCacheLock_);
+   timedOutDevices_.swap(timedOutDevices);
+}
+
+/**
+ * Reads all properties of one device.
+ *
+ * If timeoutMs is positive and reading takes longer, the remaining
+ * properties are taken from the system state cache (and logged), the device
+ * is marked dirty so that the next incremental update reads it again, and
+ * true is returned. The time is checked between properties; a slow
+ * GetProperty() cannot be interrupted.
+ */
+bool CMMCore::readDeviceState(std::shared_ptr<DeviceInstance> pDev, long timeoutMs,
+      std::vector<PropertySetting>& settings)
+{
+   const std::string label = pDev->GetLabel();
+   mm::DeviceModuleLockGuard guard(pDev);
+   const std::chrono::steady_clock::time_point deadline =
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+   std::vector<std::string> propertyNames = pDev->GetPropertyNames();
+   for (std::vector<std::string>::const_iterator it = propertyNames.begin(), end = propertyNames.end();
+         it != end; ++it)
+   {
+      if (timeoutMs > 0 && std::chrono::steady_clock::now() > deadline)
+      {
+         std::string cached;
+         std::string missing;
+         {
+            MMThreadGuard scg(stateCacheLock_);
+            for (; it != end; ++it)
+            {
+               if (stateCache_.isPropertyIncluded(label.c_str(), it->c_str()))
+               {
+                  settings.push_back(stateCache_.getSetting(label.c_str(), it->c_str()));
+                  cached += (cached.empty() ? "" : ", ") + *it;
+               }
+               else
+                  missing += (missing.empty() ? "" : ", ") + *it;
+            }
+            dirtyDevices_.insert(label);
+         }
+         LOG_WARNING(coreLogger_) << "Reading the properties of " << label <<
+            " took longer than " << timeoutMs << " ms; using cached values for: " <<
+            (cached.empty() ? "(none)" : cached) <<
+            (missing.empty() ? "" : "; omitting (not cached): ") << missing;
+         return true;
+      }
+
+      std::string val;
+      try
+      {
+         val = pDev->GetProperty(*it);
+      }
+      catch (const CMMError&)
+      {
+         // XXX BUG This should not be ignored, but the interface does not
+         // allow throwing from this function. Keeping old behavior for now.
+      }
+
+      bool readOnly = false;
+      try
+      {
+         readOnly = pDev->GetPropertyReadOnly(it->c_str());
+      }
+      catch (const CMMError&)
+      {
+         // XXX BUG This should not be ignored, but the interface does not
+         // allow throwing from this function. Keeping old behavior for now.
+      }
+      settings.push_back(PropertySetting(label.c_str(), it->c_str(), val.c_str(), readOnly));
+   }
+   return false;
+}
+
 /**
  * Returns the entire system state, i.e. the collection of all property values from all devices.
  * This method will return cached values instead of querying each device
@@ -589,21 +826,16 @@ Configuration CMMCore::getConfigGroupState(const char* group, bool fromCache) th
  */
 void CMMCore::setSystemState(const Configuration& conf)
 {
+   Configuration writable;
    for (unsigned i=0; i<conf.size(); i++)
    {
       PropertySetting s = conf.getSetting(i);
       if (!s.getReadOnly())
-      {
-         try
-         {
-            setProperty(s.getDeviceLabel().c_str(), s.getPropertyName().c_str(), s.getPropertyValue().c_str());
-         }
-         catch (CMMError&)
-         {
-            // Do not give up yet.
-         }
-      }
+         writable.addSetting(s);
    }
+   // Do not give up on the first failure (see applySettings())
+   std::string lastError;
+   applySettings(writable, lastError);
    // TODO Should throw if any of the property setting failed.
 
    updateSystemStateCache();
@@ -724,6 +956,11 @@ void CMMCore::loadDevice(const char* label, const char* moduleName, const char*
             e);
    }
 
+   {
+      MMThreadGuard scg(stateCacheLock_);
+      dirtyDevices_.insert(label);
+   }
+
    LOG_INFO(coreLogger_) << "Did load device " << deviceName <<
       " from " << moduleName << "; label = " << label;
 }
@@ -788,9 +1025,13 @@ void CMMCore::unloadDevice(const char* label///< the name of the device to unloa
 {
    std::shared_ptr<DeviceInstance> pDevice = deviceManager_->GetDevice(label);
 
+   // Queued images may refer to the device
+   callback_->WaitForImageInserts();
+
    try {
       mm::DeviceModuleLockGuard guard(pDevice);
       LOG_DEBUG(coreLogger_) << "Will unload device " << label;
+      idleWaiter_->Forget(pDevice->GetRawPtr());
       deviceManager_->UnloadDevice(pDevice);
       LOG_DEBUG(coreLogger_) << "Did unload device " << label;
    }
@@ -807,23 +1048,34 @@ void CMMCore::unloadDevice(const char* label///< the name of the device to unloa
 void CMMCore::unloadAllDevices() throw (CMMError)
 {
    try {
-      configGroups_->Clear();
+      {
+         MMThreadGuard g(settingPrerequisitesLock_);
+         settingPrerequisites_.clear();
+      }
+      {
+         MMThreadGuard scg(stateCacheLock_);
+         configGroups_->Clear();
 
-      //selected channel group is no longer valid
-      //channelGroup_ = "":
+         //selected channel group is no longer valid
+         //channelGroup_ = "":
 
-      // clear pixel size configurations
-      if (!pixelSizeGroup_->IsEmpty())
-      {
-         std::vector<std::string> pixelSizes = pixelSizeGroup_->GetAvailable();
-         for (std::vector<std::string>::iterator it = pixelSizes.begin();
-               it != pixelSizes.end(); it++)
+         // clear pixel size configurations
+         if (!pixelSizeGroup_->IsEmpty())
          {
-            pixelSizeGroup_->Delete((*it).c_str());
+            std::vector<std::string> pixelSizes = pixelSizeGroup_->GetAvailable();
+            for (std::vector<std::string>::iterator it = pixelSizes.begin();
+                  it != pixelSizes.end(); it++)
+            {
+               pixelSizeGroup_->Delete((*it).c_str());
+            }
          }
       }
 
       LOG_DEBUG(coreLogger_) << "Will unload all devices";
+      callback_->WaitForImageInserts();
+      std::vector<std::string> devices = deviceManager_->GetDeviceList();
+      for (std::vector<std::string>::const_iterator it = devices.begin(), end = devices.end(); it != end; ++it)
+         idleWaiter_->Forget(deviceManager_->GetDevice(*it)->GetRawPtr());
       deviceManager_->UnloadAllDevices();
       LOG_INFO(coreLogger_) << "Did unload all devices";
 
@@ -888,6 +1140,20 @@ void CMMCore::initializeAllDevices() throw (CMMError)
    vector<string> devices = deviceManager_->GetDeviceList();
    LOG_INFO(coreLogger_) << "Will initialize " << devices.size() << " devices";
 
+   {
+      // Devices create most of their properties when initialized
+      MMThreadGuard scg(stateCacheLock_);
+      dirtyDevices_.insert(devices.begin(), devices.end());
+   }
+
+   if (parallelDeviceInitialization_)
+   {
+      initializeDevicesInParallel(devices);
+      LOG_INFO(coreLogger_) << "Finished initializing " << devices.size() << " devices";
+      updateCoreProperties();
+      return;
+   }
+
    for (size_t i=0; i<devices.size(); i++)
    {
       std::shared_ptr<DeviceInstance> pDevice;
@@ -901,7 +1167,8 @@ void CMMCore::initializeAllDevices() throw (CMMError)
       mm::DeviceModuleLockGuard guard(pDevice);
       LOG_INFO(coreLogger_) << "Will initialize device " << devices[i];
       pDevice->Initialize();
-      LOG_INFO(coreLogger_) << "Did initialize device " << devices[i];
+      LOG_INFO(coreLogger_) << "Did initialize device " << devices[i] <<
+         " (" << pDevice->GetInitializationTimeMs() << " ms)";
 
       assignDefaultRole(pDevice);
    }
@@ -911,6 +1178,178 @@ void CMMCore::initializeAllDevices() throw (CMMError)
    updateCoreProperties();
 }
 
+/**
+ * Initializes the given devices, running those that do not depend on each
+ * other concurrently.
+ *
+ * Two devices keep the order in which they are listed (and are never
+ * initialized at the same time) if they belong to the same adapter module,
+ * if one is the parent hub of the other, if one is the serial port of the
+ * other, or if they use the same serial port. Default roles are assigned in
+ * list order once all devices are done.
+ *
+ * If a device fails, no more devices are started; once those already
+ * running have finished, the first error is thrown.
+ */
+void CMMCore::initializeDevicesInParallel(const std::vector<std::string>& devices) throw (CMMError)
+{
+   const size_t count = devices.size();
+   std::vector< std::shared_ptr<DeviceInstance> > pDevices(count);
+   std::vector<std::string> parents(count);
+   std::vector<std::string> ports(count);
+   std::set< std::shared_ptr<LoadedDeviceAdapter> > modules;
+   for (size_t i = 0; i < count; ++i)
+   {
+      try {
+         pDevices[i] = deviceManager_->GetDevice(devices[i]);
+      }
+      catch (CMMError& err) {
+         logError(devices[i].c_str(), err.getMsg().c_str());
+         throw;
+      }
+      mm::DeviceModuleLockGuard guard(pDevices[i]);
+      parents[i] = pDevices[i]->GetParentID();
+      if (pDevices[i]->HasProperty(MM::g_Keyword_Port))
+         ports[i] = pDevices[i]->GetProperty(MM::g_Keyword_Port);
+      modules.insert(pDevices[i]->GetAdapterModule());
+   }
+
+   // Each device waits for the related devices listed before it
+   std::vector< std::vector<size_t> > dependents(count);
+   std::vector<size_t> waitingFor(count, 0);
+   for (size_t j = 0; j < count; ++j)
+   {
+      for (size_t i = 0; i < j; ++i)
+      {
+         const bool related =
+            pDevices[i]->GetAdapterModule() == pDevices[j]->GetAdapterModule() ||
+            parents[j] == devices[i] || parents[i] == devices[j] ||
+            ports[j] == devices[i] || ports[i] == devices[j] ||
+            (!ports[i].empty() && ports[i] == ports[j]);
+         if (related)
+         {
+            dependents[i].push_back(j);
+            ++waitingFor[j];
+         }
+      }
+   }
+
+   LOG_INFO(coreLogger_) << "Will initialize devices from " << modules.size() <<
+      " modules in parallel";
+
+   std::mutex mutex;
+   std::condition_variable done;
+   size_t running = 0;
+   std::vector<bool> initialized(count, false);
+   std::exception_ptr firstError;
+
+   // At most one device per module can be initializing at any time. The
+   // pool is declared last so that its threads finish before the state
+   // they use goes away.
+   ThreadPool pool(modules.size());
+   std::function<void(size_t)> start; // Called with mutex locked
+   start = [&](size_t index)
+   {
+      ++running;
+      pool.Submit([&, index]
+      {
+         std::exception_ptr error;
+         try
+         {
+            mm::DeviceModuleLockGuard guard(pDevices[index]);
+            LOG_INFO(coreLogger_) << "Will initialize device " << devices[index];
+            pDevices[index]->Initialize();
+            LOG_INFO(coreLogger_) << "Did initialize device " << devices[index] <<
+               " (" << pDevices[index]->GetInitializationTimeMs() << " ms)";
+         }
+         catch (...)
+         {
+            error = std::current_exception();
+         }
+
+         std::lock_guard<std::mutex> lock(mutex);
+         --running;
+         if (error)
+         {
+            if (!firstError)
+               firstError = error;
+         }
+         else
+         {
+            initialized[index] = true;
+            if (!firstError)
+            {
+               for (size_t dependent : dependents[index])
+               {
+                  if (--waitingFor[dependent] == 0)
+                     start(dependent);
+               }
+            }
+         }
+         done.notify_all();
+      });
+   };
+
+   {
+      std::unique_lock<std::mutex> lock(mutex);
+      for (size_t i = 0; i < count; ++i)
+      {
+         if (waitingFor[i] == 0)
+            start(i);
+      }
+      done.wait(lock, [&] { return running == 0; });
+   }
+
+   for (size_t i = 0; i < count; ++i)
+   {
+      if (initialized[i])
+         assignDefaultRole(pDevices[i]);
+   }
+
+   if (firstError)
+      std::rethrow_exception(firstError);
+}
+
+/**
+ * Enables or disables initializing devices in parallel.
+ *
+ * When enabled, initializeAllDevices() initializes devices from different
+ * adapter modules concurrently, except where one depends on another (a hub
+ * and its peripherals, a serial port and the devices using it, or devices
+ * sharing a serial port), which are initialized in the order they were
+ * loaded, as are devices from the same module. This can shorten startup
+ * considerably when several devices each take seconds to initialize.
+ *
+ * Disabled by default, as adapters that share hardware or libraries without
+ * sharing a module or serial port may not expect to be initialized at the
+ * same time.
+ */
+void CMMCore::enableParallelDeviceInitialization(bool enable)
+{
+   parallelDeviceInitialization_ = enable;
+   LOG_INFO(coreLogger_) << "Parallel device initialization " <<
+      (enable ? "enabled" : "disabled");
+}
+
+/**
+ * Returns whether devices are initialized in parallel.
+ */
+bool CMMCore::isParallelDeviceInitializationEnabled() const
+{
+   return parallelDeviceInitialization_;
+}
+
+/**
+ * Returns how long the device's last initialization took.
+ *
+ * @param label   the device label
+ * @return the time in milliseconds, or 0 if the device was never initialized
+ */
+double CMMCore::getDeviceInitializationTime(const char* label) throw (CMMError)
+{
+   return deviceManager_->GetDevice(label)->GetInitializationTimeMs();
+}
+
 /**
  * Updates CoreProperties (currently all Core properties are 
  * devices types) with the loaded hardware.
@@ -953,11 +1392,17 @@ void CMMCore::initializeDevice(const char* label ///< the device to initialize
 {
    std::shared_ptr<DeviceInstance> pDevice = deviceManager_->GetDevice(label);
 
+   {
+      MMThreadGuard scg(stateCacheLock_);
+      dirtyDevices_.insert(label);
+   }
+
    mm::DeviceModuleLockGuard guard(pDevice);
 
    LOG_INFO(coreLogger_) << "Will initialize device " << label;
    pDevice->Initialize();
-   LOG_INFO(coreLogger_) << "Did initialize device " << label;
+   LOG_INFO(coreLogger_) << "Did initialize device " << label <<
+      " (" << pDevice->GetInitializationTimeMs() << " ms)";
 
    updateCoreProperties();
 }
@@ -965,17 +1410,179 @@ void CMMCore::initializeDevice(const char* label ///< the device to initialize
 
 
 /**
- * Updates the state of the entire hardware.
+ * Updates the state of the entire hardware.
+ */
+void CMMCore::updateSystemStateCache()
+{
+   LOG_DEBUG(coreLogger_) << "Will update system state cache";
+   {
+      // Devices marked while reading stay marked
+      MMThreadGuard scg(stateCacheLock_);
+      dirtyDevices_.clear();
+   }
+   Configuration wk = getSystemState();
+   {
+      MMThreadGuard scg(stateCacheLock_);
+      cacheState(wk);
+   }
+   LOG_INFO(coreLogger_) << "Did update system state cache";
+}
+
+/**
+ * Updates the system state cache for the devices marked dirty since the
+ * last update.
+ *
+ * Devices are marked dirty when loaded or initialized, when they report
+ * that their properties changed without giving the new values, when
+ * reading them timed out, and by markDeviceStateDirty(). Values set through
+ * the Core or reported by devices are already in the cache, so this is
+ * usually much faster than updateSystemStateCache(). Properties that change
+ * on their own (such as sensor readouts) are only refreshed if the device
+ * is marked.
+ */
+void CMMCore::updateSystemStateCacheIncremental()
+{
+   std::set<std::string> dirty;
+   {
+      MMThreadGuard scg(stateCacheLock_);
+      dirty.swap(dirtyDevices_);
+   }
+
+   // Keep the device order; skip devices unloaded since being marked
+   std::vector<std::string> devices;
+   vector<string> loaded = deviceManager_->GetDeviceList();
+   for (vector<string>::const_iterator it = loaded.begin(), end = loaded.end(); it != end; ++it)
+   {
+      if (dirty.count(*it))
+         devices.push_back(*it);
+   }
+   LOG_DEBUG(coreLogger_) << "Will update system state cache for " <<
+      devices.size() << " devices";
+
+   Configuration wk;
+   readDeviceStates(devices, wk);
+   {
+      MMThreadGuard scg(stateCacheLock_);
+      for (size_t i = 0; i < wk.size(); ++i)
+         cacheSetting(wk.getSetting(i));
+   }
+   LOG_DEBUG(coreLogger_) << "Did update system state cache for " <<
+      devices.size() << " devices";
+}
+
+/**
+ * Marks a device whose properties may have changed without the Core
+ * knowing, so that updateSystemStateCacheIncremental() reads it again.
+ *
+ * @param label   the device label
+ */
+void CMMCore::markDeviceStateDirty(const char* label) throw (CMMError)
+{
+   deviceManager_->GetDevice(label);
+   MMThreadGuard scg(stateCacheLock_);
+   dirtyDevices_.insert(label);
+}
+
+/**
+ * Returns a number that increases whenever a configuration group is defined
+ * or edited, or its current preset (as given by getCurrentConfigFromCache())
+ * changes.
+ *
+ * Together with getConfigGroupsChangedSince(), this allows a user interface
+ * to refresh only the groups that need it.
+ */
+long CMMCore::getConfigGroupsVersion() const
+{
+   MMThreadGuard scg(stateCacheLock_);
+   return configGroups_->GetVersion();
+}
+
+/**
+ * Returns the configuration groups that were defined or edited, or whose
+ * current preset changed, since getConfigGroupsVersion() returned the given
+ * version. Deleted groups are not included.
+ *
+ * @param version   a value previously returned by getConfigGroupsVersion()
+ */
+std::vector<std::string> CMMCore::getConfigGroupsChangedSince(long version) const
+{
+   MMThreadGuard scg(stateCacheLock_);
+   return configGroups_->GetGroupsChangedSince(version);
+}
+
+// Caller must hold stateCacheLock_
+void CMMCore::cacheSetting(const PropertySetting& setting) const
+{
+   stateCache_.addSetting(setting);
+   configGroups_->UpdateState(setting);
+   pixelSizeGroup_->UpdateState(setting);
+}
+
+// Caller must hold stateCacheLock_
+void CMMCore::cacheState(const Configuration& state)
+{
+   stateCache_ = state;
+   configGroups_->SyncState(stateCache_);
+   pixelSizeGroup_->SyncState(stateCache_);
+}
+
+/**
+ * Enables or disables reading devices in parallel for getSystemState() and
+ * the system state cache updates.
+ *
+ * When enabled, devices from different adapter modules are read
+ * concurrently, one thread per module; devices of the same module are still
+ * read one after the other. Disabled by default.
+ */
+void CMMCore::enableParallelSystemState(bool enable)
+{
+   parallelSystemState_ = enable;
+   LOG_INFO(coreLogger_) << "Parallel system state " <<
+      (enable ? "enabled" : "disabled");
+}
+
+/**
+ * Returns whether devices are read in parallel for the system state.
+ */
+bool CMMCore::isParallelSystemStateEnabled() const
+{
+   return parallelSystemState_;
+}
+
+/**
+ * Sets how long reading the properties of one device may take for
+ * getSystemState() and the system state cache updates.
+ *
+ * Once a device has taken longer, its remaining properties are taken from
+ * the system state cache (properties not in the cache are left out), it is
+ * marked dirty (see updateSystemStateCacheIncremental()), and it is listed
+ * by getSystemStateTimedOutDevices(). A property read already in progress
+ * cannot be interrupted. 0 (the default) means no limit.
+ *
+ * @param timeoutMs   the time limit per device in milliseconds, or 0
+ */
+void CMMCore::setSystemStateDeviceTimeoutMs(long timeoutMs)
+{
+   systemStateDeviceTimeoutMs_ = timeoutMs > 0 ? timeoutMs : 0;
+}
+
+/**
+ * Returns the time limit for reading one device's properties.
+ */
+long CMMCore::getSystemStateDeviceTimeoutMs() const
+{
+   return systemStateDeviceTimeoutMs_;
+}
+
+/**
+ * Returns the devices that took longer than the time limit (see
+ * setSystemStateDeviceTimeoutMs()) in the last getSystemState() or system
+ * state cache update, so that some of their values are stale.
  */
-void CMMCore::updateSystemStateCache()
+std::vector<std::string> CMMCore::getSystemStateTimedOutDevices() const
 {
-   LOG_DEBUG(coreLogger_) << "Will update system state cache";
-   Configuration wk = getSystemState();
-   {
-      MMThreadGuard scg(stateCacheLock_);
-      stateCache_ = wk;
-   }
-   LOG_INFO(coreLogger_) << "Did update system state cache";
+   MMThreadGuard scg(stateCacheLock_);
+   return timedOutDevices_;
 }
 
 /**
@@ -1205,36 +1812,59 @@ void CMMCore::waitForDevice(const char* label) throw (CMMError)
  */
 void CMMCore::waitForDevice(std::shared_ptr<DeviceInstance> pDev) throw (CMMError)
 {
-   LOG_DEBUG(coreLogger_) << "Waiting for device " << pDev->GetLabel() << "...";
+   waitForDevices(std::vector< std::shared_ptr<DeviceInstance> >(1, pDev));
+}
 
-   auto now = std::chrono::steady_clock::now();
-   auto timeout = std::chrono::duration<long long, std::milli>(timeoutMs_);
-   auto deadline = now + timeout;
+/**
+ * Waits until none of the devices is busy, or throws once the timeout has
+ * passed.
+ *
+ * The devices are waited for together, so the timeout applies to the wait
+ * as a whole. Devices that report becoming idle (MM::Core::OnBecameIdle())
+ * end the wait as soon as they do; others are polled, starting at short
+ * intervals that double up to the polling interval.
+ */
+void CMMCore::waitForDevices(const std::vector< std::shared_ptr<DeviceInstance> >& devices) throw (CMMError)
+{
+   if (devices.empty())
+      return;
+   if (devices.size() == 1)
+      LOG_DEBUG(coreLogger_) << "Waiting for device " << devices[0]->GetLabel() << "...";
+   else
+      LOG_DEBUG(coreLogger_) << "Waiting for " << devices.size() << " devices...";
 
-   while (true)
+   std::vector<DeviceIdleWaiter::Device> waited;
+   for (const std::shared_ptr<DeviceInstance>& pDev : devices)
    {
+      DeviceIdleWaiter::Device device;
+      device.id = pDev->GetRawPtr();
+      device.busy = [pDev]
       {
          mm::DeviceModuleLockGuard guard(pDev);
-         if (!pDev->Busy())
-         {
-            break;
-         }
-      }
-
-      if (std::chrono::steady_clock::now() > deadline)
-      {
-         string label = pDev->GetLabel();
-         std::ostringstream mez;
-         mez << "wait timed out after " << timeoutMs_ << " ms. ";
-         logError(label.c_str(), mez.str().c_str());
-         throw CMMError("Wait for device " + ToQuotedString(label) + " timed out after " +
-               ToString(timeoutMs_) + "ms",
-               MMERR_DevicePollingTimeout);
-      }
+         return pDev->Busy();
+      };
+      waited.push_back(device);
+   }
 
-     sleep(pollingIntervalMs_);
+   const std::chrono::steady_clock::time_point deadline =
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs_);
+   size_t stillBusy;
+   if (!idleWaiter_->Wait(waited, deadline,
+            std::chrono::milliseconds(std::max(pollingIntervalMs_, 1L)), stillBusy))
+   {
+      string label = devices[stillBusy]->GetLabel();
+      std::ostringstream mez;
+      mez << "wait timed out after " << timeoutMs_ << " ms. ";
+      logError(label.c_str(), mez.str().c_str());
+      throw CMMError("Wait for device " + ToQuotedString(label) + " timed out after " +
+            ToString(timeoutMs_) + "ms",
+            MMERR_DevicePollingTimeout);
    }
-   LOG_DEBUG(coreLogger_) << "Finished waiting for device " << pDev->GetLabel();
+
+   if (devices.size() == 1)
+      LOG_DEBUG(coreLogger_) << "Finished waiting for device " << devices[0]->GetLabel();
+   else
+      LOG_DEBUG(coreLogger_) << "Finished waiting for " << devices.size() << " devices";
 }
 
 /**
@@ -1291,9 +1921,11 @@ bool CMMCore::deviceTypeBusy(MM::DeviceType devType) throw (CMMError)
  */
 void CMMCore::waitForDeviceType(MM::DeviceType devType) throw (CMMError)
 {
-   vector<string> devices = deviceManager_->GetDeviceList(devType);
-   for (size_t i=0; i<devices.size(); i++)
-      waitForDevice(devices[i].c_str());
+   vector<string> labels = deviceManager_->GetDeviceList(devType);
+   std::vector< std::shared_ptr<DeviceInstance> > devices;
+   for (size_t i=0; i<labels.size(); i++)
+      devices.push_back(deviceManager_->GetDevice(labels[i]));
+   waitForDevices(devices);
 }
 
 /**
@@ -1308,8 +1940,15 @@ void CMMCore::waitForConfig(const char* group, const char* configName) throw (CM
 
    Configuration cfg = getConfigData(group, configName);
    try {
+      std::set<std::string> labels;
+      std::vector< std::shared_ptr<DeviceInstance> > devices;
       for(size_t i=0; i<cfg.size(); i++)
-         waitForDevice(cfg.getSetting(i).getDeviceLabel().c_str());
+      {
+         const std::string label = cfg.getSetting(i).getDeviceLabel();
+         if (!IsCoreDeviceLabel(label.c_str()) && labels.insert(label).second)
+            devices.push_back(deviceManager_->GetDevice(label));
+      }
+      waitForDevices(devices);
    } catch (CMMError& err) {
       // trap MM exceptions and keep quiet - this is not a good time to blow up
       logError("waitForConfig", err.getMsg().c_str());
@@ -1323,6 +1962,7 @@ void CMMCore::waitForConfig(const char* group, const char* configName) throw (CM
  */
 void CMMCore::waitForImageSynchro() throw (CMMError)
 {
+   std::vector< std::shared_ptr<DeviceInstance> > devices;
    for (std::vector< std::weak_ptr<DeviceInstance> >::iterator
          it = imageSynchroDevices_.begin(), end = imageSynchroDevices_.end();
          it != end; ++it)
@@ -1330,9 +1970,10 @@ void CMMCore::waitForImageSynchro() throw (CMMError)
       std::shared_ptr<DeviceInstance> device = it->lock();
       if (device)
       {
-         waitForDevice(device);
+         devices.push_back(device);
       }
    }
+   waitForDevices(devices);
 }
 
 /**
@@ -2525,7 +3166,7 @@ void CMMCore::setAutoShutter(bool state)
    autoShutter_ = state;
    {
       MMThreadGuard scg(stateCacheLock_);
-      stateCache_.addSetting(PropertySetting(MM::g_Keyword_CoreDevice, MM::g_Keyword_CoreAutoShutter, state ? "1" : "0"));
+      cacheSetting(PropertySetting(MM::g_Keyword_CoreDevice, MM::g_Keyword_CoreAutoShutter, state ? "1" : "0"));
    }
    LOG_DEBUG(coreLogger_) << "Autoshutter turned " << (state ? "on" : "off");
 }
@@ -2560,7 +3201,7 @@ void CMMCore::setShutterOpen(const char* shutterLabel, bool state) throw (CMMErr
       {
          {
             MMThreadGuard scg(stateCacheLock_);
-            stateCache_.addSetting(PropertySetting(shutterLabel, MM::g_Keyword_State, CDeviceUtils::ConvertToString(state)));
+            cacheSetting(PropertySetting(shutterLabel, MM::g_Keyword_State, CDeviceUtils::ConvertToString(state)));
          }
       }
    }
@@ -3146,6 +3787,8 @@ void* CMMCore::popNextImageMD(Metadata& md) throw (CMMError)
  */
 void CMMCore::clearCircularBuffer() throw (CMMError)
 {
+   // Images still queued for insertion would otherwise land after the clear
+   callback_->WaitForImageInserts();
    cbuf_->Clear();
 }
 
@@ -3155,12 +3798,31 @@ void CMMCore::clearCircularBuffer() throw (CMMError)
 void CMMCore::setCircularBufferMemoryFootprint(unsigned sizeMB ///< n megabytes
                                                ) throw (CMMError)
 {
+   if (isStreamingToDisk())
+      throw CMMError("Cannot change the circular buffer while streaming to disk");
+   if (diskStreamWriter_)
+   {
+      // A stopped or failed writer still refers to the buffer
+      try
+      {
+         diskStreamWriter_->Stop();
+      }
+      catch (const CMMError& e)
+      {
+         LOG_ERROR(coreLogger_) << "Streaming to disk failed: " << e.getMsg();
+      }
+      diskStreamWriter_.reset();
+   }
+
+   // Queued inserts write into cbuf_
+   callback_->WaitForImageInserts();
    delete cbuf_; // discard old buffer
+   cbuf_ = 0;
    LOG_DEBUG(coreLogger_) << "Will set circular buffer size to " <<
       sizeMB << " MB";
 	try
 	{
-		cbuf_ = new CircularBuffer(sizeMB);
+		cbuf_ = newSequenceBuffer(sizeMB);
 	}
 	catch(bad_alloc& ex)
 	{
@@ -3172,29 +3834,461 @@ void CMMCore::setCircularBufferMemoryFootprint(unsigned sizeMB ///< n megabytes
 	if (NULL == cbuf_) throw CMMError(getCoreErrorText(MMERR_OutOfMemory).c_str(), MMERR_OutOfMemory);
 
 
-	try
-	{
+	try
+	{
+
+		// attempt to initialize based on the current camera settings
+      std::shared_ptr<CameraInstance> camera = currentCameraDevice_.lock();
+      if (camera)
+		{
+         mm::DeviceModuleLockGuard guard(camera);
+         if (!cbuf_->Initialize(camera->GetNumberOfChannels(), camera->GetImageWidth(), camera->GetImageHeight(), camera->GetImageBytesPerPixel()))
+				throw CMMError(getCoreErrorText(MMERR_CircularBufferFailedToInitialize).c_str(), MMERR_CircularBufferFailedToInitialize);
+		}
+
+      LOG_DEBUG(coreLogger_) << "Did set circular buffer size to " <<
+         sizeMB << " MB";
+	}
+	catch(bad_alloc& ex)
+	{
+		ostringstream messs;
+		messs << getCoreErrorText(MMERR_OutOfMemory).c_str() << " " << ex.what() << endl;
+		throw CMMError(messs.str().c_str() , MMERR_OutOfMemory);
+	}
+	if (NULL == cbuf_)
+      throw CMMError(getCoreErrorText(MMERR_OutOfMemory).c_str(), MMERR_OutOfMemory);
+}
+
+/**
+ * Selects the implementation of the sequence (circular) buffer.
+ *
+ * When enabled, the buffer uses atomic insert/save cursors so that the
+ * camera's insert thread and image readers (popNextImage(), getLastImage(),
+ * etc.) never wait for each other. This reduces contention at high frame
+ * rates. The default is the conventional mutex-protected buffer.
+ *
+ * Switching discards any images in the buffer and re-initializes it with the
+ * current memory footprint. Not allowed while a sequence acquisition is
+ * running.
+ */
+void CMMCore::enableLockFreeSequenceBuffer(bool enable) throw (CMMError)
+{
+   if (enable == lockFreeSequenceBuffer_)
+      return;
+
+   if (isSequenceRunning())
+      throw CMMError(getCoreErrorText(MMERR_NotAllowedDuringSequenceAcquisition).c_str(),
+            MMERR_NotAllowedDuringSequenceAcquisition);
+
+   LOG_DEBUG(coreLogger_) << "Will switch to " <<
+      (enable ? "lock-free" : "default") << " sequence buffer";
+   const unsigned sizeMB = getCircularBufferMemoryFootprint();
+   lockFreeSequenceBuffer_ = enable; // Read by newSequenceBuffer()
+   try
+   {
+      setCircularBufferMemoryFootprint(sizeMB);
+   }
+   catch (const CMMError&)
+   {
+      // Go back to a buffer of the previous kind, if possible
+      lockFreeSequenceBuffer_ = !enable;
+      try
+      {
+         setCircularBufferMemoryFootprint(sizeMB);
+      }
+      catch (const CMMError& e)
+      {
+         LOG_ERROR(coreLogger_) << "Failed to restore sequence buffer: " << e.getMsg();
+      }
+      throw;
+   }
+}
+
+/**
+ * Returns whether the lock-free sequence buffer is in use.
+ */
+bool CMMCore::isLockFreeSequenceBufferEnabled() const
+{
+   return lockFreeSequenceBuffer_;
+}
+
+/**
+ * Selects whether the circular buffer is backed by huge pages.
+ *
+ * Huge pages (2 MB or 1 GB instead of 4 kB) reduce the cost of faulting in
+ * and accessing large buffers. They must have been reserved in the OS (on
+ * Linux, via vm.nr_hugepages; on Windows, the user needs the "Lock pages in
+ * memory" privilege). If none are available, normal pages are used (on
+ * Linux, with transparent huge pages requested) and a warning is logged.
+ *
+ * Does not apply to the lock-free sequence buffer. Switching discards any
+ * images in the buffer. Not allowed while a sequence acquisition is running.
+ */
+void CMMCore::enableCircularBufferHugePages(bool enable) throw (CMMError)
+{
+   if (enable == circularBufferHugePages_)
+      return;
+
+   if (isSequenceRunning())
+      throw CMMError(getCoreErrorText(MMERR_NotAllowedDuringSequenceAcquisition).c_str(),
+            MMERR_NotAllowedDuringSequenceAcquisition);
+
+   LOG_DEBUG(coreLogger_) << "Will " << (enable ? "enable" : "disable") <<
+      " huge pages for the circular buffer";
+   circularBufferHugePages_ = enable;
+   setCircularBufferMemoryFootprint(getCircularBufferMemoryFootprint());
+
+   CircularBuffer* circularBuffer = dynamic_cast<CircularBuffer*>(cbuf_);
+   if (enable && circularBuffer && !circularBuffer->UsesHugePages())
+      LOG_WARNING(coreLogger_) << "No huge pages available for the circular buffer; "
+         "using normal pages";
+}
+
+/**
+ * Returns whether huge pages were requested for the circular buffer.
+ */
+bool CMMCore::isCircularBufferHugePagesEnabled() const
+{
+   return circularBufferHugePages_;
+}
+
+/**
+ * Selects whether the circular buffer memory is faulted in ahead of use.
+ *
+ * Memory for the circular buffer is only assigned by the OS as images are
+ * first written, which can slow down the first pass through a large buffer.
+ * When enabled, a background thread faults in the whole buffer as soon as it
+ * is created, without blocking acquisition. Use
+ * getCircularBufferResidentMB() to follow its progress.
+ *
+ * Does not apply to the lock-free sequence buffer, which always allocates
+ * its memory upfront. Switching discards any images in the buffer. Not
+ * allowed while a sequence acquisition is running.
+ */
+void CMMCore::enableCircularBufferPrefault(bool enable) throw (CMMError)
+{
+   if (enable == circularBufferPrefault_)
+      return;
+
+   if (isSequenceRunning())
+      throw CMMError(getCoreErrorText(MMERR_NotAllowedDuringSequenceAcquisition).c_str(),
+            MMERR_NotAllowedDuringSequenceAcquisition);
+
+   LOG_DEBUG(coreLogger_) << "Will " << (enable ? "enable" : "disable") <<
+      " prefaulting of the circular buffer";
+   circularBufferPrefault_ = enable;
+   setCircularBufferMemoryFootprint(getCircularBufferMemoryFootprint());
+}
+
+/**
+ * Returns whether prefaulting of the circular buffer is enabled.
+ */
+bool CMMCore::isCircularBufferPrefaultEnabled() const
+{
+   return circularBufferPrefault_;
+}
+
+/**
+ * Returns the physical memory currently used by the sequence buffer, in MB.
+ *
+ * This can be less than the memory footprint, as the OS only assigns memory
+ * to the circular buffer as it is written (or prefaulted).
+ */
+unsigned CMMCore::getCircularBufferResidentMB()
+{
+   if (cbuf_)
+   {
+      return static_cast<unsigned>(cbuf_->GetResidentBytes() >> 20);
+   }
+   return 0;
+}
+
+/**
+ * Sets up a scratch file to take images that do not fit in the circular
+ * buffer.
+ *
+ * Normally, inserting an image into a full circular buffer fails (and the
+ * camera typically stops or discards the buffered images). With a spill
+ * file, the oldest image not yet retrieved is instead moved to a
+ * memory-mapped file of sizeMB megabytes, created in scratchDirectory, to
+ * make room for the new one. Images are still retrieved in order, so that a
+ * burst of images can exceed the available memory without loss as long as
+ * the disk keeps up. A fast local disk (such as an NVMe SSD) should be used.
+ *
+ * The file is deleted when the buffer is discarded. Pass 0 for sizeMB to
+ * stop using a spill file. Does not apply to the lock-free sequence buffer.
+ * Discards any images in the buffer. Not allowed while a sequence
+ * acquisition is running.
+ *
+ * @param scratchDirectory Directory in which to create the file
+ * @param sizeMB Size of the file in megabytes
+ */
+void CMMCore::setCircularBufferSpill(const char* scratchDirectory, unsigned sizeMB) throw (CMMError)
+{
+   const std::string directory = scratchDirectory ? scratchDirectory : "";
+   if (sizeMB > 0 && directory.empty())
+      throw CMMError("No scratch directory given for the circular buffer spill file");
+   if (directory == circularBufferSpillDirectory_ && sizeMB == circularBufferSpillSizeMB_)
+      return;
+
+   if (isSequenceRunning())
+      throw CMMError(getCoreErrorText(MMERR_NotAllowedDuringSequenceAcquisition).c_str(),
+            MMERR_NotAllowedDuringSequenceAcquisition);
+
+   LOG_DEBUG(coreLogger_) << "Will set circular buffer spill file to " <<
+      sizeMB << " MB in " << directory;
+   const std::string previousDirectory = circularBufferSpillDirectory_;
+   const unsigned previousSizeMB = circularBufferSpillSizeMB_;
+   const unsigned memorySizeMB = getCircularBufferMemoryFootprint();
+   circularBufferSpillDirectory_ = sizeMB > 0 ? directory : "";
+   circularBufferSpillSizeMB_ = sizeMB;
+   try
+   {
+      setCircularBufferMemoryFootprint(memorySizeMB);
+   }
+   catch (const CMMError&)
+   {
+      circularBufferSpillDirectory_ = previousDirectory;
+      circularBufferSpillSizeMB_ = previousSizeMB;
+      setCircularBufferMemoryFootprint(memorySizeMB);
+      throw;
+   }
+}
+
+/**
+ * Returns the directory of the circular buffer spill file (empty if none is
+ * used).
+ */
+std::string CMMCore::getCircularBufferSpillDirectory() const
+{
+   return circularBufferSpillDirectory_;
+}
+
+/**
+ * Returns the size of the circular buffer spill file in MB (0 if none is
+ * used).
+ */
+unsigned CMMCore::getCircularBufferSpillSizeMB() const
+{
+   return circularBufferSpillSizeMB_;
+}
+
+/**
+ * Returns the number of images that fit in the spill file for the current
+ * image size. These are included in getBufferTotalCapacity().
+ */
+long CMMCore::getCircularBufferSpillCapacity()
+{
+   CircularBuffer* circularBuffer = dynamic_cast<CircularBuffer*>(cbuf_);
+   if (circularBuffer)
+   {
+      return static_cast<long>(circularBuffer->GetSpillCapacity());
+   }
+   return 0;
+}
+
+/**
+ * Returns the number of images currently in the spill file, waiting to be
+ * retrieved. These are included in getRemainingImageCount().
+ */
+long CMMCore::getCircularBufferSpilledImageCount()
+{
+   CircularBuffer* circularBuffer = dynamic_cast<CircularBuffer*>(cbuf_);
+   if (circularBuffer)
+   {
+      return static_cast<long>(circularBuffer->GetSpilledImageCount());
+   }
+   return 0;
+}
+
+/**
+ * Returns the number of images moved to the spill file since the circular
+ * buffer was last cleared (e.g. at the start of a sequence acquisition).
+ */
+long CMMCore::getCircularBufferTotalSpilledImageCount()
+{
+   CircularBuffer* circularBuffer = dynamic_cast<CircularBuffer*>(cbuf_);
+   if (circularBuffer)
+   {
+      return static_cast<long>(circularBuffer->GetTotalSpilledImageCount());
+   }
+   return 0;
+}
+
+/**
+ * Returns the average rate at which images were moved to the spill file
+ * since the circular buffer was last cleared, in MB/s (0 if none were).
+ *
+ * Moving an image happens on the thread inserting the next one, so this
+ * should comfortably exceed the data rate of the camera.
+ */
+double CMMCore::getCircularBufferSpillBandwidth()
+{
+   CircularBuffer* circularBuffer = dynamic_cast<CircularBuffer*>(cbuf_);
+   if (circularBuffer)
+   {
+      return circularBuffer->GetSpillBandwidthMBps();
+   }
+   return 0.0;
+}
+
+/**
+ * Starts writing images from the sequence buffer to disk.
+ *
+ * Images are taken from the buffer as they arrive (as with popNextImage())
+ * and written by native threads, so that they do not need to be passed to
+ * the application. The pixels are written back to back to filePrefix.raw,
+ * bypassing the OS file cache where possible; the channels of a
+ * multi-channel frame follow each other. filePrefix.idx receives an index:
+ * the 8 bytes "MMSTRIDX", a 32-bit version (2) and the 32-bit device
+ * interface version, followed, for each image, by its 64-bit offset in the
+ * raw file, its 32-bit width, height, bytes per pixel, channel and metadata
+ * length, and its metadata in the binary encoding of that device interface
+ * version (all little-endian). Existing files are overwritten.
+ *
+ * Do not call popNextImage() while streaming, as the images it returns are
+ * not written. getLastImage() can be used to display the images. If the
+ * disk does not keep up, images accumulate in the buffer; see
+ * getStreamToDiskStallTime() and getStreamToDiskMaxBacklog(). The buffer
+ * cannot be resized while streaming.
+ *
+ * @param filePrefix Path of the files without the extension
+ */
+void CMMCore::startStreamToDisk(const char* filePrefix) throw (CMMError)
+{
+   if (isStreamingToDisk())
+      throw CMMError("Already streaming to disk");
+   if (!filePrefix || !*filePrefix)
+      throw CMMError("No file given for streaming to disk");
+
+   diskStreamWriter_.reset();
+   diskStreamWriter_.reset(new DiskStreamWriter(cbuf_, filePrefix, threadPool_));
+   LOG_INFO(coreLogger_) << "Started streaming to " << filePrefix << ".raw";
+}
+
+/**
+ * Stops writing images to disk, once the images remaining in the sequence
+ * buffer have been written.
+ *
+ * Stop the sequence acquisition first so that the buffer does not keep
+ * receiving images. Throws if writing failed at any point (in which case
+ * streaming stopped at that point). Does nothing if not streaming.
+ */
+void CMMCore::stopStreamToDisk() throw (CMMError)
+{
+   if (!diskStreamWriter_)
+      return;
+   try
+   {
+      diskStreamWriter_->Stop();
+   }
+   catch (const CMMError& e)
+   {
+      LOG_ERROR(coreLogger_) << "Streaming to disk failed: " << e.getMsg();
+      throw;
+   }
+   LOG_INFO(coreLogger_) << "Stopped streaming to disk after " <<
+      diskStreamWriter_->GetImageCount() << " images";
+}
+
+/**
+ * Returns whether images are being written to disk. Returns false if
+ * writing has failed; call stopStreamToDisk() to get the error.
+ */
+bool CMMCore::isStreamingToDisk() const
+{
+   return diskStreamWriter_ && diskStreamWriter_->IsRunning();
+}
+
+/**
+ * Returns the number of images written to disk since streaming was last
+ * started.
+ */
+long CMMCore::getStreamToDiskImageCount() const
+{
+   if (diskStreamWriter_)
+   {
+      return static_cast<long>(diskStreamWriter_->GetImageCount());
+   }
+   return 0;
+}
+
+/**
+ * Returns the throughput of the disk writes since streaming was last
+ * started, in MB/s.
+ *
+ * This is the rate at which the disk accepts data; if it is not well above
+ * the data rate of the camera, images will accumulate in the buffer.
+ */
+double CMMCore::getStreamToDiskBandwidth() const
+{
+   if (diskStreamWriter_)
+   {
+      return diskStreamWriter_->GetWriteBandwidthMBps();
+   }
+   return 0.0;
+}
+
+/**
+ * Returns the total time, in milliseconds, that streaming waited for the
+ * disk since it was last started. While waiting, images accumulate in the
+ * sequence buffer.
+ */
+double CMMCore::getStreamToDiskStallTime() const
+{
+   if (diskStreamWriter_)
+   {
+      return diskStreamWriter_->GetStallSeconds() * 1000.0;
+   }
+   return 0.0;
+}
+
+/**
+ * Returns the largest number of images that were waiting in the sequence
+ * buffer to be written since streaming was last started.
+ */
+long CMMCore::getStreamToDiskMaxBacklog() const
+{
+   if (diskStreamWriter_)
+   {
+      return static_cast<long>(diskStreamWriter_->GetMaxBacklog());
+   }
+   return 0;
+}
+
+/**
+ * Sets the number of images that cameras can queue for insertion into the
+ * sequence buffer.
+ *
+ * With a nonzero depth, images that cameras insert with
+ * InsertImageAsync() are copied into the sequence buffer on a separate
+ * thread, so that the camera can read out the next frame in the meantime.
+ * Images still become available in the order they were acquired. If
+ * depth images are waiting, the camera waits for the oldest one to be
+ * inserted. The default, 0, inserts images on the camera's thread.
+ *
+ * Not allowed while a sequence acquisition is running.
+ */
+void CMMCore::setImageInsertQueueDepth(unsigned depth) throw (CMMError)
+{
+   if (depth == getImageInsertQueueDepth())
+      return;
+
+   if (isSequenceRunning())
+      throw CMMError(getCoreErrorText(MMERR_NotAllowedDuringSequenceAcquisition).c_str(),
+            MMERR_NotAllowedDuringSequenceAcquisition);
 
-		// attempt to initialize based on the current camera settings
-      std::shared_ptr<CameraInstance> camera = currentCameraDevice_.lock();
-      if (camera)
-		{
-         mm::DeviceModuleLockGuard guard(camera);
-         if (!cbuf_->Initialize(camera->GetNumberOfChannels(), camera->GetImageWidth(), camera->GetImageHeight(), camera->GetImageBytesPerPixel()))
-				throw CMMError(getCoreErrorText(MMERR_CircularBufferFailedToInitialize).c_str(), MMERR_CircularBufferFailedToInitialize);
-		}
+   LOG_DEBUG(coreLogger_) << "Will set image insert queue depth to " << depth;
+   callback_->SetImageInsertQueueDepth(depth);
+}
 
-      LOG_DEBUG(coreLogger_) << "Did set circular buffer size to " <<
-         sizeMB << " MB";
-	}
-	catch(bad_alloc& ex)
-	{
-		ostringstream messs;
-		messs << getCoreErrorText(MMERR_OutOfMemory).c_str() << " " << ex.what() << endl;
-		throw CMMError(messs.str().c_str() , MMERR_OutOfMemory);
-	}
-	if (NULL == cbuf_)
-      throw CMMError(getCoreErrorText(MMERR_OutOfMemory).c_str(), MMERR_OutOfMemory);
+/**
+ * Returns the image insert queue depth (0 if images are inserted on the
+ * camera's thread).
+ */
+unsigned CMMCore::getImageInsertQueueDepth() const
+{
+   return callback_->GetImageInsertQueueDepth();
 }
 
 /**
@@ -3344,7 +4438,7 @@ void CMMCore::setAutoFocusDevice(const char* autofocusLabel) throw (CMMError)
    std::string newAutofocusLabel = getAutoFocusDevice();
    {
       MMThreadGuard scg(stateCacheLock_);
-      stateCache_.addSetting(PropertySetting(MM::g_Keyword_CoreDevice, MM::g_Keyword_CoreAutoFocus, newAutofocusLabel.c_str()));
+      cacheSetting(PropertySetting(MM::g_Keyword_CoreDevice, MM::g_Keyword_CoreAutoFocus, newAutofocusLabel.c_str()));
    }
 }
 
@@ -3411,7 +4505,7 @@ void CMMCore::setImageProcessorDevice(const char* procLabel) throw (CMMError)
    std::string newProcLabel = getImageProcessorDevice();
    {
       MMThreadGuard scg(stateCacheLock_);
-      stateCache_.addSetting(PropertySetting(MM::g_Keyword_CoreDevice, MM::g_Keyword_CoreImageProcessor, newProcLabel.c_str()));
+      cacheSetting(PropertySetting(MM::g_Keyword_CoreDevice, MM::g_Keyword_CoreImageProcessor, newProcLabel.c_str()));
    }
 }
 
@@ -3435,7 +4529,7 @@ void CMMCore::setSLMDevice(const char* slmLabel) throw (CMMError)
    std::string newSLMLabel = getSLMDevice();
    {
       MMThreadGuard scg(stateCacheLock_);
-      stateCache_.addSetting(PropertySetting(MM::g_Keyword_CoreDevice, MM::g_Keyword_CoreSLM, newSLMLabel.c_str()));
+      cacheSetting(PropertySetting(MM::g_Keyword_CoreDevice, MM::g_Keyword_CoreSLM, newSLMLabel.c_str()));
    }
 }
 
@@ -3460,7 +4554,7 @@ void CMMCore::setGalvoDevice(const char* galvoLabel) throw (CMMError)
    std::string newGalvoLabel = getGalvoDevice();
    {
       MMThreadGuard scg(stateCacheLock_);
-      stateCache_.addSetting(PropertySetting(MM::g_Keyword_CoreDevice, MM::g_Keyword_CoreGalvo, newGalvoLabel.c_str()));
+      cacheSetting(PropertySetting(MM::g_Keyword_CoreDevice, MM::g_Keyword_CoreGalvo, newGalvoLabel.c_str()));
    }
 }
 
@@ -3487,7 +4581,7 @@ void CMMCore::setChannelGroup(const char* chGroup) throw (CMMError)
 
    {
       MMThreadGuard scg(stateCacheLock_);
-      stateCache_.addSetting(PropertySetting(MM::g_Keyword_CoreDevice, MM::g_Keyword_CoreChannelGroup, channelGroup_.c_str()));
+      cacheSetting(PropertySetting(MM::g_Keyword_CoreDevice, MM::g_Keyword_CoreChannelGroup, channelGroup_.c_str()));
    }
    if (externalCallback_ != 0) 
    {
@@ -3549,7 +4643,7 @@ void CMMCore::setShutterDevice(const char* shutterLabel) throw (CMMError)
    std::string newShutterLabel = getShutterDevice();
    {
       MMThreadGuard scg(stateCacheLock_);
-      stateCache_.addSetting(PropertySetting(MM::g_Keyword_CoreDevice, MM::g_Keyword_CoreShutter, newShutterLabel.c_str()));
+      cacheSetting(PropertySetting(MM::g_Keyword_CoreDevice, MM::g_Keyword_CoreShutter, newShutterLabel.c_str()));
    }
 }
 
@@ -3574,7 +4668,7 @@ void CMMCore::setFocusDevice(const char* focusLabel) throw (CMMError)
    std::string newFocusLabel = getFocusDevice();
    {
       MMThreadGuard scg(stateCacheLock_);
-      stateCache_.addSetting(PropertySetting(MM::g_Keyword_CoreDevice, MM::g_Keyword_CoreFocus, newFocusLabel.c_str()));
+      cacheSetting(PropertySetting(MM::g_Keyword_CoreDevice, MM::g_Keyword_CoreFocus, newFocusLabel.c_str()));
    }
 }
 
@@ -3597,7 +4691,7 @@ void CMMCore::setXYStageDevice(const char* xyDeviceLabel) throw (CMMError)
    std::string newXYStageLabel = getXYStageDevice();
    {
       MMThreadGuard scg(stateCacheLock_);
-      stateCache_.addSetting(PropertySetting(MM::g_Keyword_CoreDevice, MM::g_Keyword_CoreXYStage, newXYStageLabel.c_str()));
+      cacheSetting(PropertySetting(MM::g_Keyword_CoreDevice, MM::g_Keyword_CoreXYStage, newXYStageLabel.c_str()));
    }
 }
 
@@ -3636,7 +4730,7 @@ void CMMCore::setCameraDevice(const char* cameraLabel) throw (CMMError)
    std::string newCameraLabel = getCameraDevice();
    {
       MMThreadGuard scg(stateCacheLock_);
-      stateCache_.addSetting(PropertySetting(MM::g_Keyword_CoreDevice, MM::g_Keyword_CoreCamera, newCameraLabel.c_str()));
+      cacheSetting(PropertySetting(MM::g_Keyword_CoreDevice, MM::g_Keyword_CoreCamera, newCameraLabel.c_str()));
    }
 }
 
@@ -3740,7 +4834,7 @@ string CMMCore::getProperty(const char* label, const char* propName) throw (CMME
    PropertySetting s(label, propName, value.c_str());
    {
       MMThreadGuard scg(stateCacheLock_);
-      stateCache_.addSetting(s);
+      cacheSetting(s);
    }
 
    return value;
@@ -3793,7 +4887,7 @@ void CMMCore::setProperty(const char* label, const char* propName,
       properties_->Execute(propName, propValue);
       {
          MMThreadGuard scg(stateCacheLock_);
-         stateCache_.addSetting(PropertySetting(MM::g_Keyword_CoreDevice, propName, propValue));
+         cacheSetting(PropertySetting(MM::g_Keyword_CoreDevice, propName, propValue));
       }
 
       LOG_DEBUG(coreLogger_) << "Did set Core property: " <<
@@ -3809,7 +4903,7 @@ void CMMCore::setProperty(const char* label, const char* propName,
 
       {
          MMThreadGuard scg(stateCacheLock_);
-         stateCache_.addSetting(PropertySetting(label, propName, propValue));
+         cacheSetting(PropertySetting(label, propName, propValue));
       }
    }
 }
@@ -4233,7 +5327,7 @@ void CMMCore::setExposure(const char* label, double dExp) throw (CMMError)
       {
          {
             MMThreadGuard scg(stateCacheLock_);
-            stateCache_.addSetting(PropertySetting(label, MM::g_Keyword_Exposure, CDeviceUtils::ConvertToString(dExp)));
+            cacheSetting(PropertySetting(label, MM::g_Keyword_Exposure, CDeviceUtils::ConvertToString(dExp)));
          }
       }
    }
@@ -4616,7 +5710,7 @@ void CMMCore::setState(const char* deviceLabel, long state) throw (CMMError)
    {
       {
          MMThreadGuard scg(stateCacheLock_);
-         stateCache_.addSetting(PropertySetting(deviceLabel, MM::g_Keyword_State, CDeviceUtils::ConvertToString(state)));
+         cacheSetting(PropertySetting(deviceLabel, MM::g_Keyword_State, CDeviceUtils::ConvertToString(state)));
       }
    }
    if (pStateDev->HasProperty(MM::g_Keyword_Label))
@@ -4625,7 +5719,7 @@ void CMMCore::setState(const char* deviceLabel, long state) throw (CMMError)
 
       {
          MMThreadGuard scg(stateCacheLock_);
-         stateCache_.addSetting(PropertySetting(deviceLabel, MM::g_Keyword_Label, posLbl.c_str()));
+         cacheSetting(PropertySetting(deviceLabel, MM::g_Keyword_Label, posLbl.c_str()));
       }
    }
 
@@ -4697,7 +5791,7 @@ void CMMCore::setStateLabel(const char* deviceLabel, const char* stateLabel) thr
    {
       {
          MMThreadGuard scg(stateCacheLock_);
-         stateCache_.addSetting(PropertySetting(deviceLabel, MM::g_Keyword_Label, stateLabel));
+         cacheSetting(PropertySetting(deviceLabel, MM::g_Keyword_Label, stateLabel));
       }
    }
    if (pStateDev->HasProperty(MM::g_Keyword_State))
@@ -4705,7 +5799,7 @@ void CMMCore::setStateLabel(const char* deviceLabel, const char* stateLabel) thr
       long state = getStateFromLabel(deviceLabel, stateLabel);
       {
          MMThreadGuard scg(stateCacheLock_);
-         stateCache_.addSetting(PropertySetting(deviceLabel, MM::g_Keyword_State,
+         cacheSetting(PropertySetting(deviceLabel, MM::g_Keyword_State,
                   CDeviceUtils::ConvertToString(state)));
       }
    }
@@ -4837,7 +5931,12 @@ void CMMCore::defineConfigGroup(const char* groupName) throw (CMMError)
 {
    CheckConfigGroupName(groupName);
 
-   if (!configGroups_->Define(groupName))
+   bool defined;
+   {
+      MMThreadGuard scg(stateCacheLock_);
+      defined = configGroups_->Define(groupName);
+   }
+   if (!defined)
       throw CMMError(ToQuotedString(groupName) + ": " + getCoreErrorText(MMERR_DuplicateConfigGroup),
             MMERR_DuplicateConfigGroup);
 
@@ -4853,7 +5952,12 @@ void CMMCore::deleteConfigGroup(const char* groupName) throw (CMMError)
 {
    CheckConfigGroupName(groupName);
 
-   if (!configGroups_->Delete(groupName))
+   bool deleted;
+   {
+      MMThreadGuard scg(stateCacheLock_);
+      deleted = configGroups_->Delete(groupName);
+   }
+   if (!deleted)
       throw CMMError(ToQuotedString(groupName) + ": " + getCoreErrorText(MMERR_NoConfigGroup),
             MMERR_NoConfigGroup);
 
@@ -4873,7 +5977,12 @@ void CMMCore::renameConfigGroup(const char* oldGroupName, const char* newGroupNa
    CheckConfigGroupName(oldGroupName);
    CheckConfigGroupName(newGroupName);
 
-   if (!configGroups_->RenameGroup(oldGroupName, newGroupName))
+   bool renamed;
+   {
+      MMThreadGuard scg(stateCacheLock_);
+      renamed = configGroups_->RenameGroup(oldGroupName, newGroupName);
+   }
+   if (!renamed)
       throw CMMError(ToQuotedString(oldGroupName) + ": " + getCoreErrorText(MMERR_NoConfigGroup),
             MMERR_NoConfigGroup);
 
@@ -4898,7 +6007,10 @@ void CMMCore::defineConfig(const char* groupName, const char* configName) throw
    CheckConfigGroupName(groupName);
    CheckConfigPresetName(configName);
 
-   configGroups_->Define(groupName, configName);
+   {
+      MMThreadGuard scg(stateCacheLock_);
+      configGroups_->Define(groupName, configName);
+   }
 
    LOG_DEBUG(coreLogger_) << "Config group " << groupName <<
       ": added preset " << configName;
@@ -4925,7 +6037,10 @@ void CMMCore::defineConfig(const char* groupName, const char* configName, const
    CheckPropertyName(propName);
    CheckPropertyValue(value);
 
-   configGroups_->Define(groupName, configName, deviceLabel, propName, value);
+   {
+      MMThreadGuard scg(stateCacheLock_);
+      configGroups_->Define(groupName, configName, deviceLabel, propName, value);
+   }
 
    LOG_DEBUG(coreLogger_) << "Config group " << groupName <<
       ": preset " << configName << ": added setting " <<
@@ -4955,7 +6070,10 @@ void CMMCore::definePixelSizeConfig(const char* resolutionID, const char* device
    CheckPropertyName(propName);
    CheckPropertyValue(value);
 
-   pixelSizeGroup_->Define(resolutionID, deviceLabel, propName, value);
+   {
+      MMThreadGuard scg(stateCacheLock_);
+      pixelSizeGroup_->Define(resolutionID, deviceLabel, propName, value);
+   }
 
    LOG_DEBUG(coreLogger_) << "Pixel size config: "
       "preset " << resolutionID << ": added setting : " <<
@@ -4970,7 +6088,10 @@ void CMMCore::definePixelSizeConfig(const char* resolutionID) throw (CMMError)
 {
    CheckConfigPresetName(resolutionID);
 
-   pixelSizeGroup_->Define(resolutionID);
+   {
+      MMThreadGuard scg(stateCacheLock_);
+      pixelSizeGroup_->Define(resolutionID);
+   }
 
    LOG_DEBUG(coreLogger_) << "Pixel size config: "
       "added preset " << resolutionID;
@@ -5117,7 +6238,12 @@ void CMMCore::renameConfig(const char* groupName, const char* oldConfigName, con
    CheckConfigPresetName(oldConfigName);
    CheckConfigPresetName(newConfigName);
 
-   if (!configGroups_->RenameConfig(groupName, oldConfigName, newConfigName)) {
+   bool renamed;
+   {
+      MMThreadGuard scg(stateCacheLock_);
+      renamed = configGroups_->RenameConfig(groupName, oldConfigName, newConfigName);
+   }
+   if (!renamed) {
       logError("renameConfig", getCoreErrorText(MMERR_NoConfiguration).c_str());
       throw CMMError("Configuration group " + ToQuotedString(oldConfigName) +
             " does not exist",
@@ -5140,7 +6266,12 @@ void CMMCore::deleteConfig(const char* groupName, const char* configName) throw
 
    ostringstream os;
    os << groupName << "/" << configName;
-   if (!configGroups_->Delete(groupName, configName)) {
+   bool deleted;
+   {
+      MMThreadGuard scg(stateCacheLock_);
+      deleted = configGroups_->Delete(groupName, configName);
+   }
+   if (!deleted) {
       logError("deleteConfig", getCoreErrorText(MMERR_NoConfiguration).c_str());
       throw CMMError("Configuration group " + ToQuotedString(groupName) +
             " does not exist",
@@ -5165,7 +6296,12 @@ void CMMCore::deleteConfig(const char* groupName, const char* configName, const
 
    ostringstream os;
    os << groupName << "/" << configName << "/" << deviceLabel << "/" << propName;
-   if (!configGroups_->Delete(groupName, configName, deviceLabel, propName)) {
+   bool deleted;
+   {
+      MMThreadGuard scg(stateCacheLock_);
+      deleted = configGroups_->Delete(groupName, configName, deviceLabel, propName);
+   }
+   if (!deleted) {
       logError("deleteConfig", getCoreErrorText(MMERR_NoConfiguration).c_str());
       throw CMMError("Property " + ToQuotedString(propName) +
             " of device " + ToQuotedString(deviceLabel) +
@@ -5266,6 +6402,16 @@ string CMMCore::getCurrentConfigFromCache(const char* groupName) throw (CMMError
 {
    CheckConfigGroupName(groupName);
 
+   {
+      // The current preset is kept track of as the cache changes
+      MMThreadGuard scg(stateCacheLock_);
+      std::string current;
+      if (configGroups_->GetCurrentPreset(groupName, stateCache_, current))
+         return current;
+   }
+
+   // Some property of the group is not in the cache; this either throws or
+   // finds it among the Core properties
    vector<string> cfgs = configGroups_->GetAvailableConfigs(groupName);
    if (cfgs.empty())
       return "";
@@ -5308,6 +6454,30 @@ Configuration CMMCore::getConfigData(const char* groupName, const char* configNa
    return *pCfg;
 }
 
+/**
+ * Enables or disables applying configurations in parallel, for setConfig(),
+ * setPixelSizeConfig() and setSystemState().
+ *
+ * When enabled, the settings of devices from different adapter modules are
+ * applied concurrently, one thread per module; the settings of one module
+ * are still applied one after the other, in order. Settings found to depend
+ * on others are applied after them regardless. Disabled by default.
+ */
+void CMMCore::enableParallelConfigApplication(bool enable)
+{
+   parallelConfigApplication_ = enable;
+   LOG_INFO(coreLogger_) << "Parallel config application " <<
+      (enable ? "enabled" : "disabled");
+}
+
+/**
+ * Returns whether configurations are applied in parallel.
+ */
+bool CMMCore::isParallelConfigApplicationEnabled() const
+{
+   return parallelConfigApplication_;
+}
+
 /**
  * Returns the configuration object for a give pixel size preset.
  * @return The configuration object
@@ -5340,7 +6510,12 @@ void CMMCore::renamePixelSizeConfig(const char* oldConfigName, const char* newCo
    CheckConfigPresetName(oldConfigName);
    CheckConfigPresetName(newConfigName);
 
-   if (!pixelSizeGroup_->Rename(oldConfigName, newConfigName)) {
+   bool renamed;
+   {
+      MMThreadGuard scg(stateCacheLock_);
+      renamed = pixelSizeGroup_->Rename(oldConfigName, newConfigName);
+   }
+   if (!renamed) {
       logError("renamePixelSizeConfig", getCoreErrorText(MMERR_NoConfiguration).c_str());
       throw CMMError("Pixel size configuration preset " + ToQuotedString(oldConfigName) +
             " does not exist",
@@ -5360,7 +6535,12 @@ void CMMCore::deletePixelSizeConfig(const char* configName) throw (CMMError)
 {
    CheckConfigPresetName(configName);
 
-   if (!pixelSizeGroup_->Delete(configName)) {
+   bool deleted;
+   {
+      MMThreadGuard scg(stateCacheLock_);
+      deleted = pixelSizeGroup_->Delete(configName);
+   }
+   if (!deleted) {
       logError("deletePixelSizeConfig", getCoreErrorText(MMERR_NoConfiguration).c_str());
       throw CMMError("Pixel size configuration preset " + ToQuotedString(configName) +
             " does not exist",
@@ -5384,6 +6564,18 @@ string CMMCore::getCurrentPixelSizeConfig() throw (CMMError)
  **/
 string CMMCore::getCurrentPixelSizeConfig(bool cached) throw (CMMError)
 {
+   if (cached)
+   {
+      // The current preset is kept track of as the cache changes; missing
+      // properties simply do not match
+      MMThreadGuard scg(stateCacheLock_);
+      if (!pixelSizeGroup_->IsStateSynced())
+         pixelSizeGroup_->SyncState(stateCache_);
+      std::string current;
+      pixelSizeGroup_->GetCurrentPreset(current);
+      return current;
+   }
+
    // get a list of configuration names
    vector<string> cfgs = pixelSizeGroup_->GetAvailable();
    if (cfgs.empty())
@@ -5841,6 +7033,76 @@ std::string CMMCore::getSerialPortAnswer(const char* portLabel, const char* term
    return string(answerBuf);
 }
 
+/**
+ * Sends several commands to the serial port and returns their answers.
+ *
+ * The commands, each followed by commandTerm, are written back-to-back
+ * without waiting in between; then one answer per command is read, in
+ * order, each delimited by answerTerm. With controllers that accept a new
+ * command before answering the previous one, N queries take about one
+ * round trip instead of N. Do not use it with controllers that drop or
+ * reject commands received while busy.
+ *
+ * If an answer cannot be read, the port is purged (discarding the remaining
+ * answers) and an exception is thrown.
+ *
+ * @param portLabel the serial port
+ * @param commands the commands, without terminators
+ * @param commandTerm the terminator sent after each command
+ * @param answerTerm the terminator of each answer; must not be empty
+ * @return the answers without terminators, one per command
+ */
+std::vector<std::string> CMMCore::sendSerialPortCommands(const char* portLabel,
+      const std::vector<std::string>& commands, const char* commandTerm,
+      const char* answerTerm) throw (CMMError)
+{
+   std::shared_ptr<SerialInstance> pSerial =
+      deviceManager_->GetDeviceOfType<SerialInstance>(portLabel);
+   if (!answerTerm || answerTerm[0] == '\0')
+      throw CMMError("Null or empty terminator; cannot delimit received message");
+   if (!commandTerm)
+      commandTerm = "";
+
+   std::vector<std::string> answers;
+   if (commands.empty())
+      return answers;
+
+   // One write, so that the commands leave without gaps
+   std::string batch;
+   for (std::vector<std::string>::const_iterator it = commands.begin(),
+         end = commands.end(); it != end; ++it)
+   {
+      batch += *it;
+      batch += commandTerm;
+   }
+
+   int ret = pSerial->Write(reinterpret_cast<const unsigned char*>(batch.data()),
+         static_cast<unsigned long>(batch.size()));
+   if (ret == DEVICE_OK)
+   {
+      answers.reserve(commands.size());
+      const int bufLen = 1024;
+      char answerBuf[bufLen];
+      while (answers.size() < commands.size())
+      {
+         ret = pSerial->GetAnswer(answerBuf, bufLen, answerTerm);
+         if (ret != DEVICE_OK)
+            break;
+         answers.push_back(answerBuf);
+      }
+   }
+   if (ret != DEVICE_OK)
+   {
+      string errText = getDeviceErrorText(ret, pSerial);
+      logError(portLabel, errText.c_str());
+      // Unread answers would otherwise be taken for answers to later commands
+      pSerial->Purge();
+      throw CMMError(errText);
+   }
+
+   return answers;
+}
+
 /**
  * Sends an array of characters to the serial port and returns immediately.
  */
@@ -7014,6 +8276,83 @@ void CMMCore::registerCallback(MMEventCallback* cb)
    externalCallback_ = cb;
 }
 
+/**
+ * Sets the number of threads in the Core's thread pool.
+ *
+ * The pool is shared by the Core's parallel work, such as copying images into
+ * the sequence buffer. The default, 0, creates one thread per logical CPU.
+ * Any affinity set with setThreadPoolAffinity() is kept.
+ *
+ * Discards any images in the sequence buffer. Not allowed while a sequence
+ * acquisition is running.
+ *
+ * @param threadCount the number of threads, or 0 for one per logical CPU
+ */
+void CMMCore::setThreadPoolSize(unsigned threadCount) throw (CMMError)
+{
+   if (isSequenceRunning())
+      throw CMMError(getCoreErrorText(MMERR_NotAllowedDuringSequenceAcquisition).c_str(),
+            MMERR_NotAllowedDuringSequenceAcquisition);
+
+   LOG_DEBUG(coreLogger_) << "Will set thread pool size to " << threadCount;
+   std::shared_ptr<ThreadPool> pool = std::make_shared<ThreadPool>(threadCount);
+   const std::vector<unsigned> affinity = threadPool_->GetAffinity();
+   if (!affinity.empty() && !pool->SetAffinity(affinity))
+      LOG_WARNING(coreLogger_) << "Could not apply thread pool affinity to new threads";
+   threadPool_ = pool;
+
+   // Recreate the buffer so that it uses the new pool
+   setCircularBufferMemoryFootprint(getCircularBufferMemoryFootprint());
+   LOG_DEBUG(coreLogger_) << "Did set thread pool size to " << threadPool_->GetSize();
+}
+
+/**
+ * Returns the number of threads in the Core's thread pool.
+ */
+unsigned CMMCore::getThreadPoolSize() const
+{
+   return static_cast<unsigned>(threadPool_->GetSize());
+}
+
+/**
+ * Restricts the Core's thread pool to the given logical CPUs.
+ *
+ * Use this to keep the Core's parallel work off the CPUs reserved for other
+ * tasks. An empty list removes the restriction, allowing the threads to run
+ * on any CPU available to the calling thread. While set, the Core does not
+ * move the threads to the NUMA node holding the sequence buffer.
+ *
+ * Currently supported on Linux only.
+ *
+ * @param cpus the logical CPU numbers
+ */
+void CMMCore::setThreadPoolAffinity(const std::vector<long>& cpus) throw (CMMError)
+{
+   std::vector<unsigned> cpuList;
+   for (std::vector<long>::const_iterator it = cpus.begin(); it != cpus.end(); ++it)
+   {
+      if (*it < 0)
+         throw CMMError("Invalid CPU number " + ToString(*it));
+      cpuList.push_back(static_cast<unsigned>(*it));
+   }
+
+   if (!threadPool_->SetAffinity(cpuList))
+      throw CMMError("Cannot set the thread pool affinity to the given CPUs "
+            "(not supported on this platform, or no CPU available)");
+   LOG_DEBUG(coreLogger_) << "Did set thread pool affinity to " <<
+      cpuList.size() << " CPUs";
+}
+
+/**
+ * Returns the CPUs set with setThreadPoolAffinity(), or an empty list if the
+ * thread pool is not restricted.
+ */
+std::vector<long> CMMCore::getThreadPoolAffinity() const
+{
+   const std::vector<unsigned> affinity = threadPool_->GetAffinity();
+   return std::vector<long>(affinity.begin(), affinity.end());
+}
+
 
 /**
  * Returns the latest focus score from the focusing device.
@@ -7246,6 +8585,15 @@ double CMMCore::getAutoFocusOffset() throw (CMMError)
 // Private methods
 ///////////////////////////////////////////////////////////////////////////////
 
+SequenceBuffer* CMMCore::newSequenceBuffer(unsigned sizeMB) const
+{
+   if (lockFreeSequenceBuffer_)
+      return new LockFreeSequenceBuffer(sizeMB, threadPool_);
+   return new CircularBuffer(sizeMB, threadPool_, circularBufferHugePages_,
+         circularBufferPrefault_, circularBufferSpillDirectory_,
+         circularBufferSpillSizeMB_);
+}
+
 void CMMCore::InitializeErrorMessages()
 {
    errorText_[MMERR_OK] = "No errors.";
@@ -7447,6 +8795,13 @@ bool CMMCore::IsCoreDeviceLabel(const char* label) const throw (CMMError)
    return (strcmp(label, MM::g_Keyword_CoreDevice) == 0);
 }
 
+// Key for a setting's learned prerequisites, which hold for the property
+// taking that value
+static std::string PrerequisitesKey(const PropertySetting& setting)
+{
+   return setting.getKey() + "=" + setting.getPropertyValue();
+}
+
 /**
  * Set all properties in a configuration
  * Upon error, don't stop, but try to set all failed properties again
@@ -7455,95 +8810,334 @@ bool CMMCore::IsCoreDeviceLabel(const char* label) const throw (CMMError)
  */
 void CMMCore::applyConfiguration(const Configuration& config) throw (CMMError)
 {
-   std::ostringstream sall;
-   bool error = false;
-   vector<PropertySetting> failedProps;
-   for (size_t i=0; i<config.size(); i++)
+   std::string lastError;
+   std::vector<PropertySetting> failed = applySettings(config, lastError);
+   if (!failed.empty())
+      throw CMMError(lastError.c_str(), MMERR_DEVICE_GENERIC);
+}
+
+/*
+ * Helper function for applyConfiguration
+ * Applies the settings and returns those that could not be applied, setting
+ * lastError to the last error message.
+ *
+ * By default, the settings are applied in the order of the configuration.
+ * With parallel config application enabled, Core settings are applied
+ * first. Device settings are then applied in rounds: a setting goes in a
+ * later round than the settings it has been found to depend on (see below).
+ * Within a round, the settings of one adapter module are applied in order,
+ * and different modules are applied concurrently.
+ *
+ * It is possible that setting certain properties fails because they are
+ * dependent on other properties to be set first. Failed settings are
+ * therefore applied again until none are left or none succeed. A setting
+ * that succeeds on retry may depend on the settings applied between its last
+ * failure and its success (see learnSettingPrerequisites()). Once confirmed,
+ * such a dependency puts the setting in a later round than its
+ * prerequisites (when applying in parallel) instead of letting it fail
+ * first. A confirmed prerequisite is forgotten when the setting succeeds
+ * without it having been applied.
+ */
+std::vector<PropertySetting> CMMCore::applySettings(const Configuration& config, std::string& lastError)
+{
+   const bool parallel = parallelConfigApplication_;
+   std::vector<PropertySetting> failed;
+   std::vector<std::string> succeeded; // Keys of the applied settings
+   std::vector<PropertySetting> settings; // Device settings, if parallel
+   for (size_t i = 0; i < config.size(); ++i)
    {
       PropertySetting setting = config.getSetting(i);
+      if (!parallel || !IsCoreDeviceLabel(setting.getDeviceLabel().c_str()))
+         settings.push_back(setting);
+      else if (applySetting(setting, lastError))
+         succeeded.push_back(setting.getKey());
+      else
+         failed.push_back(setting);
+   }
+
+   // Each setting's round is one more than the latest round of its
+   // prerequisites in this configuration
+   std::map<std::string, size_t> settingIndex;
+   for (size_t i = 0; i < settings.size(); ++i)
+      settingIndex[settings[i].getKey()] = i;
+   std::vector<size_t> rounds(settings.size(), 0);
+   size_t roundCount = settings.empty() ? 0 : 1;
+   if (parallel)
+   {
+      MMThreadGuard g(settingPrerequisitesLock_);
+      enum { Unvisited, Visiting, Done };
+      std::vector<int> visits(settings.size(), Unvisited);
+      std::function<size_t (size_t)> roundOf = [&](size_t i) -> size_t
+      {
+         if (visits[i] == Done)
+            return rounds[i];
+         visits[i] = Visiting;
+         std::map<std::string, SettingPrerequisites>::const_iterator found =
+            settingPrerequisites_.find(PrerequisitesKey(settings[i]));
+         if (found != settingPrerequisites_.end() && found->second.confirmed)
+         {
+            for (const std::string& prerequisite : found->second.keys)
+            {
+               std::map<std::string, size_t>::const_iterator it = settingIndex.find(prerequisite);
+               // Skip contradicting prerequisites (cycles)
+               if (it != settingIndex.end() && visits[it->second] != Visiting)
+                  rounds[i] = std::max(rounds[i], roundOf(it->second) + 1);
+            }
+         }
+         visits[i] = Done;
+         return rounds[i];
+      };
+      for (size_t i = 0; i < settings.size(); ++i)
+         roundCount = std::max(roundCount, roundOf(i) + 1);
+   }
 
-      // perform special processing for core commands
-      if (setting.getDeviceLabel().compare(MM::g_Keyword_CoreDevice) == 0)
+   std::vector<char> applied(settings.size(), 0);
+   std::vector<std::string> errors(settings.size());
+   auto applyModule = [&](const std::vector<size_t>& indices)
+   {
+      for (size_t i : indices)
+         applied[i] = applySetting(settings[i], errors[i]);
+   };
+   for (size_t round = 0; round < roundCount; ++round)
+   {
+      std::vector< std::vector<size_t> > moduleSettings;
+      std::map<LoadedDeviceAdapter*, size_t> moduleIndex;
+      for (size_t i = 0; i < settings.size(); ++i)
       {
-         properties_->Execute(setting.getPropertyName().c_str(), setting.getPropertyValue().c_str());
+         if (rounds[i] != round)
+            continue;
+         // Unknown devices fail when applied. Serially, all settings are
+         // applied in order as one group.
+         LoadedDeviceAdapter* module = 0;
+         if (parallel)
          {
-            MMThreadGuard scg(stateCacheLock_);
-            stateCache_.addSetting(PropertySetting(MM::g_Keyword_CoreDevice, setting.getPropertyName().c_str(), setting.getPropertyValue().c_str()));
+            try
+            {
+               module = deviceManager_->GetDevice(settings[i].getDeviceLabel())->
+                  GetAdapterModule().get();
+            }
+            catch (const CMMError&)
+            {
+            }
+         }
+         std::map<LoadedDeviceAdapter*, size_t>::iterator it = moduleIndex.find(module);
+         if (it == moduleIndex.end())
+         {
+            it = moduleIndex.insert(std::make_pair(module, moduleSettings.size())).first;
+            moduleSettings.push_back(std::vector<size_t>());
          }
+         moduleSettings[it->second].push_back(i);
+      }
+
+      if (parallel && moduleSettings.size() > 1)
+      {
+         // Devices mostly wait for their hardware, so each module gets a
+         // thread rather than sharing the Core's compute threads
+         ThreadPool pool(moduleSettings.size());
+         std::vector< std::future<void> > sets;
+         for (const std::vector<size_t>& indices : moduleSettings)
+            sets.push_back(pool.Submit([&applyModule, &indices] { applyModule(indices); }));
+         for (std::future<void>& set : sets)
+            set.wait();
+         for (std::future<void>& set : sets)
+            set.get();
       }
       else
       {
-         // normal processing
-         std::shared_ptr<DeviceInstance> pDevice =
-            deviceManager_->GetDevice(setting.getDeviceLabel());
-         mm::DeviceModuleLockGuard guard(pDevice);
-         try
+         for (const std::vector<size_t>& indices : moduleSettings)
+            applyModule(indices);
+      }
+   }
+
+   // Settings are listed in succeeded by round; a setting that failed may
+   // have needed any setting from its own round on. failedAt holds, for
+   // each failed setting, where in succeeded the settings applied since its
+   // last failure start.
+   std::vector<size_t> failedAt(failed.size(), succeeded.size());
+   std::vector<size_t> roundStart(roundCount);
+   for (size_t round = 0; round < roundCount; ++round)
+   {
+      roundStart[round] = succeeded.size();
+      for (size_t i = 0; i < settings.size(); ++i)
+      {
+         if (rounds[i] == round && applied[i])
+            succeeded.push_back(settings[i].getKey());
+      }
+   }
+   for (size_t i = 0; i < settings.size(); ++i)
+   {
+      if (!applied[i])
+      {
+         failed.push_back(settings[i]);
+         failedAt.push_back(roundStart[rounds[i]]);
+         lastError = errors[i];
+      }
+   }
+
+   if (parallel)
+   {
+      // Forget prerequisites that a setting did without, and orderings
+      // learned from a failure that did not recur (which can only be told
+      // when the rounds were used)
+      MMThreadGuard g(settingPrerequisitesLock_);
+      for (size_t i = 0; i < settings.size(); ++i)
+      {
+         if (!applied[i])
+            continue;
+         std::map<std::string, SettingPrerequisites>::iterator found =
+            settingPrerequisites_.find(PrerequisitesKey(settings[i]));
+         if (found == settingPrerequisites_.end())
+            continue;
+         if (found->second.confirmed)
          {
-            pDevice->SetProperty(setting.getPropertyName(),
-                  setting.getPropertyValue());
+            std::set<std::string>& keys = found->second.keys;
+            for (std::set<std::string>::iterator it = keys.begin(); it != keys.end(); )
+            {
+               std::map<std::string, size_t>::const_iterator index = settingIndex.find(*it);
+               if (index == settingIndex.end() || !applied[index->second] ||
+                     rounds[index->second] >= rounds[i])
+                  it = keys.erase(it);
+               else
+                  ++it;
+            }
+            if (!keys.empty())
+               continue;
+         }
+         LOG_DEBUG(coreLogger_) << "Setting " << found->first <<
+            " succeeded without its learned prerequisites; forgetting them";
+         settingPrerequisites_.erase(found);
+      }
+   }
 
+   while (!failed.empty())
+   {
+      std::vector<PropertySetting> stillFailed;
+      std::vector<size_t> stillFailedAt;
+      for (size_t i = 0; i < failed.size(); ++i)
+      {
+         const PropertySetting& setting = failed[i];
+         std::string error;
+         if (applySetting(setting, error))
+         {
+            if (!IsCoreDeviceLabel(setting.getDeviceLabel().c_str()))
             {
-               MMThreadGuard scg(stateCacheLock_);
-               stateCache_.addSetting(setting);
+               learnSettingPrerequisites(PrerequisitesKey(setting), std::set<std::string>(
+                        succeeded.begin() + failedAt[i], succeeded.end()));
             }
+            succeeded.push_back(setting.getKey());
          }
-         catch (const CMMError&)
+         else
          {
-            failedProps.push_back(setting);
-            error = true;
+            stillFailed.push_back(setting);
+            stillFailedAt.push_back(succeeded.size());
+            logError(setting.getDeviceLabel().c_str(), error.c_str());
+            lastError = error;
          }
       }
+      const bool progress = stillFailed.size() < failed.size();
+      failed.swap(stillFailed);
+      failedAt.swap(stillFailedAt);
+      if (!progress)
+         break;
    }
-   if (error)
+   return failed;
+}
+
+/*
+ * Helper function for applySettings
+ * Records that the setting succeeded on retry after the given settings were
+ * applied (since its last failure). Nothing is learned if none were (the
+ * failure was transient).
+ *
+ * A first observation is not used for ordering, because the failure may
+ * have been transient and the settings applied in the meantime unrelated.
+ * If the setting fails and succeeds on retry again, only the settings
+ * applied in the meantime both times are kept, and the ordering is
+ * confirmed. (If no settings were, the new observation replaces the old.)
+ */
+void CMMCore::learnSettingPrerequisites(const std::string& key,
+      const std::set<std::string>& appliedSinceFailure)
+{
+   if (appliedSinceFailure.empty())
+      return;
+
+   MMThreadGuard g(settingPrerequisitesLock_);
+   std::map<std::string, SettingPrerequisites>::iterator found =
+      settingPrerequisites_.find(key);
+   if (found == settingPrerequisites_.end())
    {
-      string errorString;
-      while (failedProps.size() > (unsigned) applyProperties(failedProps, errorString) )
-      {
-         if (failedProps.size() == 0)
-            return;
-      }
+      SettingPrerequisites prerequisites;
+      prerequisites.keys = appliedSinceFailure;
+      prerequisites.confirmed = false;
+      settingPrerequisites_.insert(std::make_pair(key, prerequisites));
+      return;
+   }
 
-      throw CMMError(errorString.c_str(), MMERR_DEVICE_GENERIC);
+   std::set<std::string> common;
+   std::set_intersection(found->second.keys.begin(), found->second.keys.end(),
+         appliedSinceFailure.begin(), appliedSinceFailure.end(),
+         std::inserter(common, common.begin()));
+   if (common.empty())
+   {
+      found->second.keys = appliedSinceFailure;
+      found->second.confirmed = false;
+   }
+   else
+   {
+      LOG_DEBUG(coreLogger_) << "Setting " << key <<
+         " succeeded after others again; will apply it after them from now on";
+      found->second.keys.swap(common);
+      found->second.confirmed = true;
    }
 }
 
 /*
- * Helper function for applyConfiguration
- * It is possible that setting certain properties failed because they are dependent
- * on other properties to be set first. As a workaround, continue to apply these failed
- * properties until there are none left or none succeed
- * returns number of properties successfully set
+ * Helper function for applySettings
+ * Sets one property and records it in the cache. Returns false, with the
+ * error message, if it failed.
  */
-int CMMCore::applyProperties(vector<PropertySetting>& props, string& lastError)
+bool CMMCore::applySetting(const PropertySetting& setting, std::string& error)
 {
-  // int succeeded = 0;
-   vector<PropertySetting> failedProps;
-   for (size_t i=0; i<props.size(); i++)
+   const std::string label = setting.getDeviceLabel();
+   const std::string propName = setting.getPropertyName();
+   const std::string value = setting.getPropertyValue();
+   const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+   try
    {
-      // normal processing
-      std::shared_ptr<DeviceInstance> pDevice =
-         deviceManager_->GetDevice(props[i].getDeviceLabel());
-      mm::DeviceModuleLockGuard guard(pDevice);
-      try
-      {
-         pDevice->SetProperty(props[i].getPropertyName(),
-               props[i].getPropertyValue());
+      CheckDeviceLabel(label.c_str());
+      CheckPropertyName(propName.c_str());
+      CheckPropertyValue(value.c_str());
 
-         {
-            MMThreadGuard scg(stateCacheLock_);
-            stateCache_.addSetting(props[i]);
-         }
+      if (IsCoreDeviceLabel(label.c_str()))
+      {
+         properties_->Execute(propName.c_str(), value.c_str());
       }
-      catch (const CMMError& e)
+      else
       {
-         failedProps.push_back(props[i]);
-         std::string message = e.getFullMsg();
-         logError(props[i].getDeviceLabel().c_str(), message.c_str());
-         lastError = message;
+         std::shared_ptr<DeviceInstance> pDevice = deviceManager_->GetDevice(label);
+         mm::DeviceModuleLockGuard guard(pDevice);
+         pDevice->SetProperty(propName, value);
       }
    }
-   props = failedProps;
-   return (int) failedProps.size();
+   catch (const CMMError& e)
+   {
+      error = e.getFullMsg();
+      LOG_DEBUG(coreLogger_) << "Failed to set " << label << "-" << propName <<
+         " = " << value << " (" << std::fixed << std::setprecision(1) <<
+         std::chrono::duration<double, std::milli>(
+               std::chrono::steady_clock::now() - start).count() << " ms)";
+      return false;
+   }
+
+   {
+      MMThreadGuard scg(stateCacheLock_);
+      cacheSetting(PropertySetting(label.c_str(), propName.c_str(), value.c_str()));
+   }
+   LOG_DEBUG(coreLogger_) << "Did set " << label << "-" << propName <<
+      " = " << value << " (" << std::fixed << std::setprecision(1) <<
+      std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - start).count() << " ms)";
+   return true;
 }
 
 
@@ -66,6 +66,7 @@
 #include <deque>
 #include <map>
 #include <memory>
+#include <set>
 #include <string>
 #include <vector>
 
@@ -84,14 +85,17 @@
 
 
 class CPluginManager;
-class CircularBuffer;
 class ConfigGroupCollection;
 class CoreCallback;
 class CorePropertyCollection;
+class DeviceIdleWaiter;
+class DiskStreamWriter;
 class MMEventCallback;
 class Metadata;
 class PixelSizeConfigGroup;
 class PropertyBlock;
+class SequenceBuffer;
+class ThreadPool;
 
 class AutoFocusInstance;
 class CameraInstance;
@@ -147,6 +151,9 @@ public:
    void unloadAllDevices() throw (CMMError);
    void initializeAllDevices() throw (CMMError);
    void initializeDevice(const char* label) throw (CMMError);
+   void enableParallelDeviceInitialization(bool enable);
+   bool isParallelDeviceInitializationEnabled() const;
+   double getDeviceInitializationTime(const char* label) throw (CMMError);
    void reset() throw (CMMError);
 
    void unloadLibrary(const char* moduleName) throw (CMMError);
@@ -166,6 +173,10 @@ public:
    void saveSystemConfiguration(const char* fileName) throw (CMMError);
    void loadSystemConfiguration(const char* fileName) throw (CMMError);
    void registerCallback(MMEventCallback* cb);
+   void setThreadPoolSize(unsigned threadCount) throw (CMMError);
+   unsigned getThreadPoolSize() const;
+   void setThreadPoolAffinity(const std::vector<long>& cpus) throw (CMMError);
+   std::vector<long> getThreadPoolAffinity() const;
    ///@}
 
    /** \name Logging and log management. */
@@ -184,6 +195,14 @@ public:
          bool truncate = true, bool synchronous = false) throw (CMMError);
    void stopSecondaryLogFile(int handle) throw (CMMError);
 
+   void setLogQueueCapacity(unsigned lines) throw (CMMError);
+   unsigned getLogQueueCapacity() const;
+   void setLogFlushInterval(unsigned intervalMs);
+   unsigned getLogFlushInterval() const;
+   void setLogOverflowPolicy(const char* policy) throw (CMMError);
+   std::string getLogOverflowPolicy() const;
+   long getDroppedLogEntryCount() const;
+
    ///@}
 
    /** \name Device listing. */
@@ -284,10 +303,19 @@ public:
    ///@{
    Configuration getSystemStateCache() const;
    void updateSystemStateCache();
+   void updateSystemStateCacheIncremental();
+   void markDeviceStateDirty(const char* label) throw (CMMError);
+   void enableParallelSystemState(bool enable);
+   bool isParallelSystemStateEnabled() const;
+   void setSystemStateDeviceTimeoutMs(long timeoutMs);
+   long getSystemStateDeviceTimeoutMs() const;
+   std::vector<std::string> getSystemStateTimedOutDevices() const;
    std::string getPropertyFromCache(const char* deviceLabel,
          const char* propName) const throw (CMMError);
    std::string getCurrentConfigFromCache(const char* groupName) throw (CMMError);
    Configuration getConfigGroupStateFromCache(const char* group) throw (CMMError);
+   long getConfigGroupsVersion() const;
+   std::vector<std::string> getConfigGroupsChangedSince(long version) const;
    ///@}
 
    /** \name Configuration groups. */
@@ -313,6 +341,8 @@ public:
    std::string getCurrentConfig(const char* groupName) throw (CMMError);
    Configuration getConfigData(const char* configGroup,
          const char* configName) throw (CMMError);
+   void enableParallelConfigApplication(bool enable);
+   bool isParallelConfigApplicationEnabled() const;
    ///@}
 
    /** \name The pixel size configuration group. */
@@ -425,6 +455,29 @@ public:
    unsigned getCircularBufferMemoryFootprint();
    void initializeCircularBuffer() throw (CMMError);
    void clearCircularBuffer() throw (CMMError);
+   void enableLockFreeSequenceBuffer(bool enable) throw (CMMError);
+   bool isLockFreeSequenceBufferEnabled() const;
+   void enableCircularBufferHugePages(bool enable) throw (CMMError);
+   bool isCircularBufferHugePagesEnabled() const;
+   void enableCircularBufferPrefault(bool enable) throw (CMMError);
+   bool isCircularBufferPrefaultEnabled() const;
+   unsigned getCircularBufferResidentMB();
+   void setCircularBufferSpill(const char* scratchDirectory, unsigned sizeMB) throw (CMMError);
+   std::string getCircularBufferSpillDirectory() const;
+   unsigned getCircularBufferSpillSizeMB() const;
+   long getCircularBufferSpillCapacity();
+   long getCircularBufferSpilledImageCount();
+   long getCircularBufferTotalSpilledImageCount();
+   double getCircularBufferSpillBandwidth();
+   void startStreamToDisk(const char* filePrefix) throw (CMMError);
+   void stopStreamToDisk() throw (CMMError);
+   bool isStreamingToDisk() const;
+   long getStreamToDiskImageCount() const;
+   double getStreamToDiskBandwidth() const;
+   double getStreamToDiskStallTime() const;
+   long getStreamToDiskMaxBacklog() const;
+   void setImageInsertQueueDepth(unsigned depth) throw (CMMError);
+   unsigned getImageInsertQueueDepth() const;
 
    bool isExposureSequenceable(const char* cameraLabel) throw (CMMError);
    void startExposureSequence(const char* cameraLabel) throw (CMMError);
@@ -543,6 +596,9 @@ public:
          const char* term) throw (CMMError);
    std::string getSerialPortAnswer(const char* portLabel,
          const char* term) throw (CMMError);
+   std::vector<std::string> sendSerialPortCommands(const char* portLabel,
+         const std::vector<std::string>& commands, const char* commandTerm,
+         const char* answerTerm) throw (CMMError);
    void writeToSerialPort(const char* portLabel,
          const std::vector<char> &data) throw (CMMError);
    std::vector<char> readFromSerialPort(const char* portLabel)
@@ -664,12 +720,24 @@ private:
    long timeoutMs_;
    bool autoShutter_;
    std::vector<double> *nullAffine_;
-   MM::Core* callback_;                 // core services for devices
+   CoreCallback* callback_;             // core services for devices
    ConfigGroupCollection* configGroups_;
    CorePropertyCollection* properties_;
    MMEventCallback* externalCallback_;  // notification hook to the higher layer (e.g. GUI)
    PixelSizeConfigGroup* pixelSizeGroup_;
-   CircularBuffer* cbuf_;
+   SequenceBuffer* cbuf_;
+   bool lockFreeSequenceBuffer_;
+   bool parallelDeviceInitialization_;
+   bool parallelSystemState_;
+   bool parallelConfigApplication_;
+   long systemStateDeviceTimeoutMs_;
+   bool circularBufferHugePages_;
+   bool circularBufferPrefault_;
+   std::string circularBufferSpillDirectory_;
+   unsigned circularBufferSpillSizeMB_;
+   std::shared_ptr<ThreadPool> threadPool_; // Shared by core subsystems
+   std::unique_ptr<DiskStreamWriter> diskStreamWriter_;
+   std::unique_ptr<DeviceIdleWaiter> idleWaiter_;
 
    std::vector< std::weak_ptr<DeviceInstance> > imageSynchroDevices_;
    std::shared_ptr<CPluginManager> pluginManager_;
@@ -680,7 +748,22 @@ private:
    // Must be unlocked when calling MMEventCallback or calling device methods
    // or acquiring a module lock
    mutable MMThreadLock stateCacheLock_;
-   mutable Configuration stateCache_; // Synchronized by stateCacheLock_
+   // Synchronized by stateCacheLock_; update through cacheSetting() and
+   // cacheState() so that the current presets are kept track of
+   mutable Configuration stateCache_;
+   std::set<std::string> dirtyDevices_; // Synchronized by stateCacheLock_
+   std::vector<std::string> timedOutDevices_; // Synchronized by stateCacheLock_
+
+   // Keys of settings that a setting has been found to need applied first;
+   // only used for ordering once confirmed (see applySettings())
+   struct SettingPrerequisites
+   {
+      std::set<std::string> keys;
+      bool confirmed;
+   };
+   // Setting key and value -> its prerequisites
+   MMThreadLock settingPrerequisitesLock_;
+   std::map<std::string, SettingPrerequisites> settingPrerequisites_;
 
    MMThreadLock* pPostedErrorsLock_;
    mutable std::deque<std::pair< int, std::string> > postedErrors_;
@@ -700,16 +783,26 @@ private:
    bool IsCoreDeviceLabel(const char* label) const throw (CMMError);
 
    void applyConfiguration(const Configuration& config) throw (CMMError);
-   int applyProperties(std::vector<PropertySetting>& props, std::string& lastError);
+   std::vector<PropertySetting> applySettings(const Configuration& config, std::string& lastError);
+   bool applySetting(const PropertySetting& setting, std::string& error);
+   void learnSettingPrerequisites(const std::string& key, const std::set<std::string>& appliedSinceFailure);
    void waitForDevice(std::shared_ptr<DeviceInstance> pDev) throw (CMMError);
+   void waitForDevices(const std::vector< std::shared_ptr<DeviceInstance> >& devices) throw (CMMError);
    Configuration getConfigGroupState(const char* group, bool fromCache) throw (CMMError);
    std::string getDeviceErrorText(int deviceCode, std::shared_ptr<DeviceInstance> pDevice);
    std::string getDeviceName(std::shared_ptr<DeviceInstance> pDev);
    void logError(const char* device, const char* msg);
    void updateAllowedChannelGroups();
    void assignDefaultRole(std::shared_ptr<DeviceInstance> pDev);
+   void initializeDevicesInParallel(const std::vector<std::string>& devices) throw (CMMError);
+   void readDeviceStates(const std::vector<std::string>& devices, Configuration& config);
+   bool readDeviceState(std::shared_ptr<DeviceInstance> pDev, long timeoutMs,
+         std::vector<PropertySetting>& settings);
+   void cacheSetting(const PropertySetting& setting) const;
+   void cacheState(const Configuration& state);
    void updateCoreProperty(const char* propName, MM::DeviceType devType) throw (CMMError);
    void loadSystemConfigurationImpl(const char* fileName) throw (CMMError);
+   SequenceBuffer* newSequenceBuffer(unsigned sizeMB) const;
 };
 
 #endif //_MMCORE_H_
@@ -41,11 +41,20 @@ void Semaphore::Wait(size_t count)
     count_ -= count;
 }
 
+bool Semaphore::TryWait(size_t count)
+{
+    std::lock_guard<std::mutex> lock(mx_);
+    if (count_ < count)
+        return false;
+    count_ -= count;
+    return true;
+}
+
 void Semaphore::Release(size_t count)
 {
-    {
-        std::lock_guard<std::mutex> lock(mx_);
-        count_ += count;
-    }
+    // Notify under the lock: once a waiter sees the count, it may destroy
+    // the semaphore
+    std::lock_guard<std::mutex> lock(mx_);
+    count_ += count;
     cv_.notify_all();
 }
@@ -34,6 +34,8 @@ public:
     explicit Semaphore(size_t initCount);
 
     void Wait(size_t count = 1);
+    // Like Wait() but returns false instead of blocking
+    bool TryWait(size_t count = 1);
     void Release(size_t count = 1);
 
 private:
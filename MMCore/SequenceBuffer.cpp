@@ -0,0 +1,131 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          SequenceBuffer.cpp
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Interface shared by the sequence (circular) buffer
+//                implementations used for camera sequence acquisition.
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#include "SequenceBuffer.h"
+
+#include "../MMDevice/MMDeviceConstants.h"
+
+#include <cstdio>
+#include <ctime>
+#include <string>
+
+
+// Formats as "yyyy-mm-dd hh:mm:ss.uuuuuu" (26 chars) into buf (at least 32
+// chars); avoids allocating a string for every image.
+static void FormatLocalTime(std::chrono::time_point<std::chrono::system_clock> tp, char* buf) {
+   using namespace std::chrono;
+   auto us = duration_cast<microseconds>(tp.time_since_epoch());
+   auto secs = duration_cast<seconds>(us);
+   auto whole = duration_cast<microseconds>(secs);
+   auto frac = static_cast<int>((us - whole).count());
+
+   // As of C++14/17, it is simpler (and probably faster) to use C functions for
+   // date-time formatting
+
+   std::time_t t(secs.count()); // time_t is seconds on platforms we support
+   std::tm *ptm;
+#ifdef _WIN32 // Windows localtime() is documented thread-safe
+   ptm = std::localtime(&t);
+#else // POSIX has localtime_r()
+   std::tm tmstruct;
+   ptm = localtime_r(&t, &tmstruct);
+#endif
+
+   const char *timeFmt = "%Y-%m-%d %H:%M:%S";
+   std::size_t len = std::strftime(buf, 32, timeFmt, ptm);
+   std::snprintf(buf + len, 32 - len, ".%06d", frac);
+}
+
+
+const unsigned char* SequenceBuffer::GetTopImage() const
+{
+   const mm::ImgBuffer* img = GetNthFromTopImageBuffer(0, 0);
+   if (!img)
+      return 0;
+   return img->GetPixels();
+}
+
+const unsigned char* SequenceBuffer::GetNextImage()
+{
+   const mm::ImgBuffer* img = GetNextImageBuffer(0);
+   if (!img)
+      return 0;
+   return img->GetPixels();
+}
+
+void SequenceBuffer::WakeImageWaiters()
+{
+   {
+      std::lock_guard<std::mutex> lock(waitMutex_);
+   }
+   waitCV_.notify_all();
+}
+
+void SequenceBuffer::NotifyImageInserted()
+{
+   std::atomic_thread_fence(std::memory_order_seq_cst);
+   if (imageWaiters_.load(std::memory_order_relaxed) == 0)
+      return;
+   // Taking the mutex ensures that a waiter that has checked for images is
+   // already waiting
+   {
+      std::lock_guard<std::mutex> lock(waitMutex_);
+   }
+   waitCV_.notify_all();
+}
+
+void SequenceBuffer::AddCoreImageTags(BinaryMetadata& md, unsigned width,
+      unsigned height, unsigned byteDepth, unsigned nComponents,
+      std::chrono::steady_clock::time_point startTime)
+{
+   if (!md.HasTag(MM::g_Keyword_Elapsed_Time_ms))
+   {
+      // if time tag was not supplied by the camera insert current timestamp
+      using namespace std::chrono;
+      auto elapsed = steady_clock::now() - startTime;
+      md.PutImageTag(MM::g_Keyword_Elapsed_Time_ms,
+         duration_cast<milliseconds>(elapsed).count());
+   }
+
+   // Note: It is not ideal to use local time. I think this tag is rarely
+   // used. Consider replacing with UTC (micro)seconds-since-epoch (with
+   // different tag key) after addressing current usage.
+   auto now = std::chrono::system_clock::now();
+   char timeInCore[32];
+   FormatLocalTime(now, timeInCore);
+   md.PutImageTag(MM::g_Keyword_Metadata_TimeInCore, timeInCore);
+
+   md.PutImageTag("Width",width);
+   md.PutImageTag("Height",height);
+   if (byteDepth == 1)
+      md.PutImageTag("PixelType","GRAY8");
+   else if (byteDepth == 2)
+      md.PutImageTag("PixelType","GRAY16");
+   else if (byteDepth == 4)
+   {
+      if (nComponents == 1)
+         md.PutImageTag("PixelType","GRAY32");
+      else
+         md.PutImageTag("PixelType","RGB32");
+   }
+   else if (byteDepth == 8)
+      md.PutImageTag("PixelType","RGB64");
+   else
+      md.PutImageTag("PixelType","Unknown");
+}
@@ -0,0 +1,147 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          SequenceBuffer.h
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Interface shared by the sequence (circular) buffer
+//                implementations used for camera sequence acquisition.
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#pragma once
+
+#include "Error.h"
+#include "FrameBuffer.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+#ifdef _MSC_VER
+#pragma warning( disable : 4290 ) // exception declaration warning
+#endif
+
+
+/**
+ * Abstract sequence buffer.
+ *
+ * CMMCore and CoreCallback access the sequence buffer only through this
+ * interface, so that the implementation can be chosen at runtime (see
+ * CMMCore::enableLockFreeSequenceBuffer()).
+ *
+ * Image pointers returned by the Get*() methods remain valid until the slot
+ * is reused by a later insert (or the buffer is re-initialized); callers are
+ * expected to copy the data promptly.
+ */
+class SequenceBuffer
+{
+public:
+   SequenceBuffer() : imageWaiters_(0) {}
+   virtual ~SequenceBuffer() {}
+
+   virtual unsigned GetMemorySizeMB() const = 0;
+   // Physical memory currently used for frame storage
+   virtual unsigned long long GetResidentBytes() const = 0;
+
+   virtual bool Initialize(unsigned channels, unsigned int xSize, unsigned int ySize, unsigned int pixDepth) = 0;
+   virtual unsigned long GetSize() const = 0;
+   virtual unsigned long GetFreeSize() const = 0;
+   virtual unsigned long GetRemainingImageCount() const = 0;
+
+   virtual unsigned int Width() const = 0;
+   virtual unsigned int Height() const = 0;
+   virtual unsigned int Depth() const = 0;
+   virtual unsigned GetNumberOfChannels() const = 0;
+
+   bool InsertImage(const unsigned char* pixArray, unsigned int width, unsigned int height, unsigned int byteDepth, const BinaryMetadata& md) throw (CMMError)
+   { return InsertMultiChannel(pixArray, 1, width, height, byteDepth, 1, md); }
+   bool InsertImage(const unsigned char* pixArray, unsigned int width, unsigned int height, unsigned int byteDepth, unsigned int nComponents, const BinaryMetadata& md) throw (CMMError)
+   { return InsertMultiChannel(pixArray, 1, width, height, byteDepth, nComponents, md); }
+   virtual bool InsertMultiChannel(const unsigned char* pixArray, unsigned int numChannels, unsigned int width, unsigned int height, unsigned int byteDepth, unsigned int nComponents, const BinaryMetadata& md) throw (CMMError) = 0;
+
+   // Metadata overloads, converting to BinaryMetadata
+   bool InsertImage(const unsigned char* pixArray, unsigned int width, unsigned int height, unsigned int byteDepth, const Metadata* pMd) throw (CMMError)
+   { return InsertMultiChannel(pixArray, 1, width, height, byteDepth, 1, pMd); }
+   bool InsertMultiChannel(const unsigned char* pixArray, unsigned int numChannels, unsigned int width, unsigned int height, unsigned int byteDepth, const Metadata* pMd) throw (CMMError)
+   { return InsertMultiChannel(pixArray, numChannels, width, height, byteDepth, 1, pMd); }
+   bool InsertImage(const unsigned char* pixArray, unsigned int width, unsigned int height, unsigned int byteDepth, unsigned int nComponents, const Metadata* pMd) throw (CMMError)
+   { return InsertMultiChannel(pixArray, 1, width, height, byteDepth, nComponents, pMd); }
+   bool InsertMultiChannel(const unsigned char* pixArray, unsigned int numChannels, unsigned int width, unsigned int height, unsigned int byteDepth, unsigned int nComponents, const Metadata* pMd) throw (CMMError)
+   { return InsertMultiChannel(pixArray, numChannels, width, height, byteDepth, nComponents, pMd ? BinaryMetadata(*pMd) : BinaryMetadata()); }
+
+   // Zero-copy insert of a single-channel image. AcquireWriteSlot() returns
+   // the pixels of the next slot for the caller to fill in, or null if the
+   // buffer is full; it throws if the image or the buffer's channel count
+   // (which must be 1) does not match. Inserts are excluded until the slot
+   // is committed (which publishes it with the given metadata) or
+   // abandoned; both must be called on the thread that acquired the slot,
+   // and return false if no slot is held.
+   virtual unsigned char* AcquireWriteSlot(unsigned int width, unsigned int height, unsigned int byteDepth) throw (CMMError) = 0;
+   virtual bool CommitWriteSlot(unsigned int nComponents, const BinaryMetadata& md) = 0;
+   bool CommitWriteSlot(unsigned int nComponents, const Metadata* pMd)
+   { return CommitWriteSlot(nComponents, pMd ? BinaryMetadata(*pMd) : BinaryMetadata()); }
+   virtual bool AbandonWriteSlot() = 0;
+
+   const unsigned char* GetTopImage() const;
+   const unsigned char* GetNextImage();
+   const mm::ImgBuffer* GetTopImageBuffer(unsigned channel) const
+   { return GetNthFromTopImageBuffer(0, channel); }
+   const mm::ImgBuffer* GetNthFromTopImageBuffer(unsigned long n) const
+   { return GetNthFromTopImageBuffer(static_cast<long>(n), 0); }
+   virtual const mm::ImgBuffer* GetNthFromTopImageBuffer(long n, unsigned channel) const = 0;
+   virtual const mm::ImgBuffer* GetNextImageBuffer(unsigned channel) = 0;
+   // Takes the next frame, as GetNextImageBuffer() does, and stores the
+   // image of each of its channels in images. Returns false, leaving images
+   // empty, if there is no frame.
+   virtual bool GetNextFrame(std::vector<const mm::ImgBuffer*>& images) = 0;
+   virtual void Clear() = 0;
+
+   virtual bool Overflow() const = 0;
+
+   // Blocks until there are images to take or stop() returns true, for
+   // consumers that would otherwise poll. Whoever makes stop() true must
+   // then call WakeImageWaiters().
+   template <typename Predicate>
+   void WaitForImages(Predicate stop)
+   {
+      std::unique_lock<std::mutex> lock(waitMutex_);
+      ++imageWaiters_;
+      // Pairs with the fence in NotifyImageInserted(): either the inserter
+      // sees us waiting or we see its image
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      waitCV_.wait(lock, [&] { return GetRemainingImageCount() > 0 || stop(); });
+      --imageWaiters_;
+   }
+   void WakeImageWaiters();
+
+protected:
+   // Implementations call this after publishing a frame, outside of any
+   // lock that GetRemainingImageCount() takes.
+   void NotifyImageInserted();
+
+   // Adds the tags that the Core attaches to every inserted image (elapsed
+   // time if not supplied by the camera, time in core, geometry and pixel
+   // type). The image number is handled by the implementations.
+   static void AddCoreImageTags(BinaryMetadata& md, unsigned width, unsigned height,
+         unsigned byteDepth, unsigned nComponents,
+         std::chrono::steady_clock::time_point startTime);
+
+private:
+   SequenceBuffer(const SequenceBuffer&);
+   SequenceBuffer& operator=(const SequenceBuffer&);
+
+   std::mutex waitMutex_;
+   std::condition_variable waitCV_;
+   std::atomic<unsigned> imageWaiters_;
+};
@@ -0,0 +1,171 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          SpillFile.cpp
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Memory-mapped scratch file holding frames that did not fit
+//                in the circular buffer.
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#include "SpillFile.h"
+
+#include "ErrorCodes.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+
+namespace {
+
+std::size_t GetPageSize()
+{
+#ifdef _WIN32
+   SYSTEM_INFO info;
+   GetSystemInfo(&info);
+   return info.dwAllocationGranularity;
+#else
+   return static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+#endif
+}
+
+CMMError SpillFileError(const std::string& directory, const char* what)
+{
+#ifdef _WIN32
+   const unsigned long err = GetLastError();
+   return CMMError("Cannot " + std::string(what) + " circular buffer spill file in " +
+         directory + " (Windows error " + std::to_string(err) + ")",
+         MMERR_FileOpenFailed);
+#else
+   const int err = errno;
+   return CMMError("Cannot " + std::string(what) + " circular buffer spill file in " +
+         directory + ": " + std::strerror(err), MMERR_FileOpenFailed);
+#endif
+}
+
+} // anonymous namespace
+
+
+SpillFile::SpillFile(const std::string& directory, std::size_t bytes) throw (CMMError) :
+   directory_(directory),
+   data_(0),
+   size_(0)
+{
+   const std::size_t page = GetPageSize();
+   const std::size_t size = (std::max<std::size_t>(bytes, 1) + page - 1) / page * page;
+
+#ifdef _WIN32
+   char path[MAX_PATH];
+   if (!GetTempFileNameA(directory.c_str(), "mmc", 0, path))
+      throw SpillFileError(directory, "create");
+   file_ = CreateFileA(path, GENERIC_READ | GENERIC_WRITE,
+         FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, 0,
+         CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_DELETE_ON_CLOSE, 0);
+   if (file_ == INVALID_HANDLE_VALUE)
+   {
+      CMMError error = SpillFileError(directory, "create");
+      DeleteFileA(path);
+      throw error;
+   }
+   const unsigned long long size64 = size;
+   mapping_ = CreateFileMappingA(file_, 0, PAGE_READWRITE,
+         static_cast<DWORD>(size64 >> 32), static_cast<DWORD>(size64), 0);
+   if (!mapping_)
+   {
+      CMMError error = SpillFileError(directory, "allocate");
+      CloseHandle(file_);
+      throw error;
+   }
+   void* p = MapViewOfFile(mapping_, FILE_MAP_ALL_ACCESS, 0, 0, size);
+   if (!p)
+   {
+      CMMError error = SpillFileError(directory, "map");
+      CloseHandle(mapping_);
+      CloseHandle(file_);
+      throw error;
+   }
+#else
+   std::string pathTemplate = directory + "/mmcore-spill-XXXXXX";
+   std::vector<char> path(pathTemplate.begin(), pathTemplate.end());
+   path.push_back('\0');
+   fd_ = mkstemp(&path[0]);
+   if (fd_ < 0)
+      throw SpillFileError(directory, "create");
+   unlink(&path[0]);
+
+   // Reserve the disk space upfront so that running out of it cannot
+   // surface as a crash when writing through the mapping
+   int err = EOPNOTSUPP;
+#ifdef __linux__
+   err = posix_fallocate(fd_, 0, static_cast<off_t>(size));
+#endif
+   if (err == EOPNOTSUPP || err == EINVAL)
+      err = ftruncate(fd_, static_cast<off_t>(size)) == 0 ? 0 : errno;
+   if (err != 0)
+   {
+      errno = err;
+      CMMError error = SpillFileError(directory, "allocate");
+      close(fd_);
+      throw error;
+   }
+
+   void* p = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+   if (p == MAP_FAILED)
+   {
+      CMMError error = SpillFileError(directory, "map");
+      close(fd_);
+      throw error;
+   }
+#endif
+   data_ = static_cast<unsigned char*>(p);
+   size_ = size;
+}
+
+SpillFile::~SpillFile()
+{
+#ifdef _WIN32
+   UnmapViewOfFile(data_);
+   CloseHandle(mapping_);
+   CloseHandle(file_);
+#else
+   munmap(data_, size_);
+   close(fd_);
+#endif
+}
+
+void SpillFile::StartWriteback(std::size_t offset, std::size_t length)
+{
+   if (offset >= size_)
+      return;
+   length = std::min(length, size_ - offset);
+#ifdef _WIN32
+   // Initiates the writes without waiting for the disk
+   FlushViewOfFile(data_ + offset, length);
+#elif defined(__linux__)
+   sync_file_range(fd_, static_cast<off_t>(offset), static_cast<off_t>(length),
+         SYNC_FILE_RANGE_WRITE);
+#else
+   const std::size_t page = GetPageSize();
+   const std::size_t start = offset / page * page;
+   msync(data_ + start, offset + length - start, MS_ASYNC);
+#endif
+}
@@ -0,0 +1,69 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          SpillFile.h
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Memory-mapped scratch file holding frames that did not fit
+//                in the circular buffer.
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#pragma once
+
+#include "Error.h"
+
+#include <cstddef>
+#include <string>
+
+#ifdef _MSC_VER
+#pragma warning( disable : 4290 ) // exception declaration warning
+#endif
+
+
+/**
+ * A temporary file of fixed size, mapped into memory.
+ *
+ * The file is created with a unique name in the given directory and deleted
+ * when the object is destroyed (on POSIX systems it is unlinked right away,
+ * so that it does not outlive a crash). Data written through the mapping is
+ * evicted from memory by the OS once it has reached the disk; call
+ * StartWriteback() after writing a range so that this happens early.
+ */
+class SpillFile
+{
+public:
+   // Throws CMMError (MMERR_FileOpenFailed) if the file cannot be created
+   // or mapped
+   SpillFile(const std::string& directory, std::size_t bytes) throw (CMMError);
+   ~SpillFile();
+
+   unsigned char* GetData() const { return data_; }
+   std::size_t GetSize() const { return size_; }
+   const std::string& GetDirectory() const { return directory_; }
+
+   // Starts writing the given range to disk without waiting for it
+   void StartWriteback(std::size_t offset, std::size_t length);
+
+private:
+   SpillFile(const SpillFile&);
+   SpillFile& operator=(const SpillFile&);
+
+   std::string directory_;
+   unsigned char* data_;
+   std::size_t size_;
+#ifdef _WIN32
+   void* file_;
+   void* mapping_;
+#else
+   int fd_;
+#endif
+};
@@ -38,11 +38,19 @@ Task::Task(std::shared_ptr<Semaphore> semaphore, size_t taskIndex, size_t totalT
     assert(taskIndex < totalTaskCount);
 }
 
+Task::Task()
+    : taskIndex_(0),
+    totalTaskCount_(1),
+    usedTaskCount_(1)
+{
+}
+
 Task::~Task()
 {
 }
 
 void Task::Done()
 {
-    semaphore_->Release();
+    if (semaphore_)
+        semaphore_->Release();
 }
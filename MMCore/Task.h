@@ -38,7 +38,13 @@ public:
     Task& operator=(const Task&) = delete;
 
     virtual void Execute() = 0;
-    void Done();
+    // Called by the thread pool after Execute(); the pool does not access
+    // the task afterwards
+    virtual void Done();
+
+protected:
+    // A standalone task, not part of a task set
+    Task();
 
 private:
     const std::shared_ptr<Semaphore> semaphore_;
@@ -50,5 +50,19 @@ void TaskSet::Execute()
 
 void TaskSet::Wait()
 {
+    // On a pool thread, run queued tasks (possibly ours) rather than block a
+    // thread that they may need. Once none are queued, ours are all running.
+    if (pool_->IsPoolThread())
+    {
+        while (!semaphore_->TryWait(usedTaskCount_))
+        {
+            if (!pool_->RunPendingTask())
+            {
+                semaphore_->Wait(usedTaskCount_);
+                return;
+            }
+        }
+        return;
+    }
     semaphore_->Wait(usedTaskCount_);
 }
@@ -24,20 +24,276 @@
 #include "TaskSet_CopyMemory.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
 #include <cstring>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MMCORE_HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#ifdef __linux__
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+const size_t DefaultCacheSize = 8 * 1024 * 1024;
+
+// Until measured, split only copies of several MB, over a few threads
+const size_t DefaultMaxTaskCount = 4;
+const size_t DefaultMinChunkBytes = 1 << 20;
+
+// Copies without polluting the cache, for buffers that do not fit in it
+void StreamingCopy(void* dst, const void* src, size_t bytes)
+{
+#ifdef MMCORE_HAVE_SSE2
+    char* d = static_cast<char*>(dst);
+    const char* s = static_cast<const char*>(src);
+
+    // Non-temporal stores need an aligned destination
+    const size_t head = std::min(bytes,
+        (16 - reinterpret_cast<std::uintptr_t>(d) % 16) % 16);
+    std::memcpy(d, s, head);
+    d += head;
+    s += head;
+    bytes -= head;
+
+    for (size_t blocks = bytes / 64; blocks > 0; --blocks)
+    {
+        const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s));
+        const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + 16));
+        const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + 32));
+        const __m128i e = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + 48));
+        _mm_stream_si128(reinterpret_cast<__m128i*>(d), a);
+        _mm_stream_si128(reinterpret_cast<__m128i*>(d + 16), b);
+        _mm_stream_si128(reinterpret_cast<__m128i*>(d + 32), c);
+        _mm_stream_si128(reinterpret_cast<__m128i*>(d + 48), e);
+        d += 64;
+        s += 64;
+    }
+    _mm_sfence();
+    std::memcpy(d, s, bytes % 64);
+#else
+    std::memcpy(dst, src, bytes);
+#endif
+}
+
+void Copy(void* dst, const void* src, size_t bytes, bool streaming)
+{
+    if (streaming)
+        StreamingCopy(dst, src, bytes);
+    else
+        std::memcpy(dst, src, bytes);
+}
+
+#ifdef __linux__
+std::string ReadLine(const std::string& path)
+{
+    std::ifstream file(path.c_str());
+    std::string line;
+    std::getline(file, line);
+    return line;
+}
+
+// Parses the kernel's CPU and node list format, e.g. "0-3,8-11"
+std::vector<unsigned> ParseList(const std::string& list)
+{
+    std::vector<unsigned> result;
+    const char* p = list.c_str();
+    while (*p)
+    {
+        unsigned first = 0;
+        unsigned last = 0;
+        int consumed = 0;
+        if (std::sscanf(p, "%u-%u%n", &first, &last, &consumed) == 2 ||
+            std::sscanf(p, "%u%n", &first, &consumed) == 1)
+        {
+            if (last < first)
+                last = first;
+            for (unsigned n = first; n <= last; ++n)
+                result.push_back(n);
+        }
+        else
+            break;
+        p += consumed;
+        if (*p == ',')
+            ++p;
+    }
+    return result;
+}
+#endif
+
+size_t GetLastLevelCacheSize()
+{
+#if defined(__linux__)
+    size_t size = 0;
+    int level = 0;
+    for (int index = 0; index < 16; ++index)
+    {
+        const std::string dir = "/sys/devices/system/cpu/cpu0/cache/index" +
+            std::to_string(index) + "/";
+        const std::string levelStr = ReadLine(dir + "level");
+        if (levelStr.empty())
+            break;
+        if (ReadLine(dir + "type") == "Instruction")
+            continue;
+        size_t kb = 0;
+        char unit = 'K';
+        if (std::sscanf(ReadLine(dir + "size").c_str(), "%zu%c", &kb, &unit) < 1)
+            continue;
+        const int thisLevel = std::stoi(levelStr);
+        if (thisLevel > level)
+        {
+            level = thisLevel;
+            size = kb * (unit == 'M' ? 1024 * 1024 : 1024);
+        }
+    }
+    return size > 0 ? size : DefaultCacheSize;
+#elif defined(_WIN32)
+    DWORD bufferBytes = 0;
+    GetLogicalProcessorInformation(nullptr, &bufferBytes);
+    std::vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION> info(
+        bufferBytes / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION));
+    if (info.empty() || !GetLogicalProcessorInformation(&info[0], &bufferBytes))
+        return DefaultCacheSize;
+    size_t size = 0;
+    BYTE level = 0;
+    for (const auto& i : info)
+    {
+        if (i.Relationship == RelationCache && i.Cache.Type != CacheInstruction &&
+            i.Cache.Level > level)
+        {
+            level = i.Cache.Level;
+            size = i.Cache.Size;
+        }
+    }
+    return size > 0 ? size : DefaultCacheSize;
+#else
+    return DefaultCacheSize;
+#endif
+}
+
+// One logical CPU per physical core of each NUMA node, restricted to those the
+// process may run on. Empty unless there are multiple nodes.
+const std::vector<std::vector<unsigned>>& GetNodeCpus()
+{
+    static const std::vector<std::vector<unsigned>> nodeCpus = []() {
+        std::vector<std::vector<unsigned>> result;
+#ifdef __linux__
+        cpu_set_t allowed;
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+            return result;
+
+        const std::vector<unsigned> nodes =
+            ParseList(ReadLine("/sys/devices/system/node/online"));
+        if (nodes.size() < 2)
+            return result;
+        for (unsigned node : nodes)
+        {
+            if (node >= result.size())
+                result.resize(node + 1);
+            const std::vector<unsigned> cpus = ParseList(ReadLine(
+                "/sys/devices/system/node/node" + std::to_string(node) + "/cpulist"));
+            for (unsigned cpu : cpus)
+            {
+                if (cpu >= CPU_SETSIZE || !CPU_ISSET(cpu, &allowed))
+                    continue;
+                // Skip hyperthread siblings
+                const std::vector<unsigned> siblings = ParseList(ReadLine(
+                    "/sys/devices/system/cpu/cpu" + std::to_string(cpu) +
+                    "/topology/thread_siblings_list"));
+                if (siblings.empty() || siblings.front() == cpu)
+                    result[node].push_back(cpu);
+            }
+        }
+#endif
+        return result;
+    }();
+    return nodeCpus;
+}
+
+#ifdef __linux__
+// Moves the calling thread to the given CPUs, saving its previous affinity
+bool PinCurrentThread(const std::vector<unsigned>& cpus, cpu_set_t& previous)
+{
+    if (sched_getaffinity(0, sizeof(previous), &previous) != 0)
+        return false;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (unsigned cpu : cpus)
+    {
+        if (cpu < CPU_SETSIZE)
+            CPU_SET(cpu, &set);
+    }
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+#endif
+
+// NUMA node holding the page at addr, or -1 if unknown
+int GetMemoryNode(const void* addr)
+{
+#if defined(__linux__) && defined(SYS_get_mempolicy)
+    const unsigned long flags = 1 | 2; // MPOL_F_NODE | MPOL_F_ADDR
+    int node = -1;
+    if (syscall(SYS_get_mempolicy, &node, nullptr, 0UL, addr, flags) != 0)
+        return -1;
+    return node;
+#else
+    (void)addr;
+    return -1;
+#endif
+}
+
+// The profile in use. Never freed, since the measuring thread may still be
+// running at exit.
+std::atomic<const TaskSet_CopyMemory::Profile*>& CurrentProfile()
+{
+    static std::atomic<const TaskSet_CopyMemory::Profile*> current([]() {
+        TaskSet_CopyMemory::Profile* profile = new TaskSet_CopyMemory::Profile();
+        profile->maxTaskCount = DefaultMaxTaskCount;
+        profile->minChunkBytes = DefaultMinChunkBytes;
+        profile->streamingThreshold = GetLastLevelCacheSize();
+        profile->bandwidth = 0.0;
+        return profile;
+    }());
+    return current;
+}
+
+std::atomic<bool> measurementStarted(false);
+std::atomic<bool> measurementDone(false);
+
+} // namespace
 
 TaskSet_CopyMemory::ATask::ATask(std::shared_ptr<Semaphore> semDone, size_t taskIndex, size_t totalTaskCount)
     : Task(semDone, taskIndex, totalTaskCount)
 {
 }
 
-void TaskSet_CopyMemory::ATask::SetUp(void* dst, const void* src, size_t bytes, size_t usedTaskCount)
+void TaskSet_CopyMemory::ATask::SetUp(void* dst, const void* src, size_t bytes, size_t usedTaskCount, bool streaming,
+    const std::vector<unsigned>* cpus)
 {
     dst_ = dst;
     src_ = src;
     bytes_ = bytes;
     usedTaskCount_ = usedTaskCount;
+    streaming_ = streaming;
+    cpus_ = cpus;
 }
 
 void TaskSet_CopyMemory::ATask::Execute()
@@ -45,41 +301,196 @@ void TaskSet_CopyMemory::ATask::Execute()
     if (taskIndex_ >= usedTaskCount_)
         return;
 
-    size_t chunkBytes = bytes_ / usedTaskCount_;
+    // Chunks start on cache line boundaries so that tasks do not write to
+    // the same line
+    const size_t chunkBytes = (bytes_ / usedTaskCount_) & ~size_t(63);
     const size_t chunkOffset = taskIndex_ * chunkBytes;
-    if (taskIndex_ == usedTaskCount_ - 1)
-        chunkBytes += bytes_ % usedTaskCount_;
+    const size_t bytes = (taskIndex_ == usedTaskCount_ - 1) ?
+        bytes_ - chunkOffset : chunkBytes;
 
     void* dst = static_cast<char*>(dst_) + chunkOffset;
     const void* src = static_cast<const char*>(src_) + chunkOffset;
 
-    std::memcpy(dst, src, chunkBytes);
+#ifdef __linux__
+    // Only for this copy; the thread belongs to a pool shared with other work
+    cpu_set_t previous;
+    const bool pinned = cpus_ && PinCurrentThread(*cpus_, previous);
+    Copy(dst, src, bytes, streaming_);
+    if (pinned)
+        sched_setaffinity(0, sizeof(previous), &previous);
+#else
+    Copy(dst, src, bytes, streaming_);
+#endif
 }
 
 TaskSet_CopyMemory::TaskSet_CopyMemory(std::shared_ptr<ThreadPool> pool)
-    : TaskSet(pool)
+    : TaskSet(pool),
+    fixedProfile_(),
+    useFixedProfile_(false)
+{
+    CreateTasks<ATask>();
+}
+
+TaskSet_CopyMemory::TaskSet_CopyMemory(std::shared_ptr<ThreadPool> pool, const Profile& profile)
+    : TaskSet(pool),
+    fixedProfile_(profile),
+    useFixedProfile_(true)
 {
     CreateTasks<ATask>();
 }
 
+TaskSet_CopyMemory::Profile TaskSet_CopyMemory::GetProfile()
+{
+    return *CurrentProfile().load();
+}
+
+TaskSet_CopyMemory::Profile TaskSet_CopyMemory::GetMeasuredProfile()
+{
+    if (!measurementStarted.exchange(true))
+    {
+        CurrentProfile().store(new Profile(MeasureProfile()));
+        measurementDone = true;
+    }
+    while (!measurementDone)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    return GetProfile();
+}
+
+// Measures on a thread of its own, so that the copy that triggered it is not
+// delayed
+void TaskSet_CopyMemory::StartProfileMeasurement()
+{
+    if (measurementStarted.exchange(true))
+        return;
+    std::thread([]() {
+        CurrentProfile().store(new Profile(MeasureProfile()));
+        measurementDone = true;
+    }).detach();
+}
+
+TaskSet_CopyMemory::Profile TaskSet_CopyMemory::MeasureProfile()
+{
+    using namespace std::chrono;
+
+    // Measure with no limit on task count or chunk size
+    Profile profile;
+    profile.streamingThreshold = GetLastLevelCacheSize();
+    profile.maxTaskCount = std::numeric_limits<size_t>::max();
+    profile.minChunkBytes = 1;
+    profile.bandwidth = 0.0;
+
+    TaskSet_CopyMemory engine(std::make_shared<ThreadPool>(), profile);
+    const size_t poolSize = engine.tasks_.size();
+    if (poolSize == 0)
+        return profile;
+
+    // Large enough to measure memory, not cache, bandwidth
+    const size_t bytes = std::min<size_t>(64 << 20,
+        std::max<size_t>(16 << 20, 2 * profile.streamingThreshold));
+    std::vector<char> src(bytes, 1);
+    std::vector<char> dst(bytes);
+
+    auto timeCopy = [&](size_t copyBytes, size_t taskCount) {
+        const auto start = steady_clock::now();
+        engine.SetUp(&dst[0], &src[0], copyBytes, taskCount, profile, nullptr);
+        engine.Execute();
+        engine.Wait();
+        return duration<double>(steady_clock::now() - start).count();
+    };
+
+    std::vector<std::pair<size_t, double>> bandwidths; // Task count, GB/s
+    for (size_t taskCount = 1; ; taskCount = std::min(2 * taskCount, poolSize))
+    {
+        double best = std::numeric_limits<double>::max();
+        for (int rep = 0; rep < 3; ++rep)
+            best = std::min(best, timeCopy(bytes, taskCount));
+        bandwidths.emplace_back(taskCount, bytes / best / 1e9);
+        if (taskCount == poolSize)
+            break;
+    }
+
+    double maxBandwidth = 0.0;
+    for (const auto& b : bandwidths)
+        maxBandwidth = std::max(maxBandwidth, b.second);
+    for (const auto& b : bandwidths)
+    {
+        // Fewest tasks that get close to the maximum
+        if (b.second >= 0.9 * maxBandwidth)
+        {
+            profile.maxTaskCount = b.first;
+            profile.bandwidth = b.second;
+            break;
+        }
+    }
+
+    // Cost of dispatching tasks, from tiny copies
+    std::vector<double> overheads;
+    for (int rep = 0; rep < 31; ++rep)
+        overheads.push_back(timeCopy(profile.maxTaskCount * 64, profile.maxTaskCount));
+    std::nth_element(overheads.begin(), overheads.begin() + overheads.size() / 2,
+        overheads.end());
+    const double overhead = overheads[overheads.size() / 2];
+
+    // A chunk should take at least as long to copy as the dispatch
+    const double singleBandwidth = bandwidths.front().second * 1e9;
+    profile.minChunkBytes = std::min<size_t>(16 << 20,
+        std::max<size_t>(64 << 10, static_cast<size_t>(overhead * singleBandwidth)));
+    return profile;
+}
+
 void TaskSet_CopyMemory::SetUp(void* dst, const void* src, size_t bytes)
 {
     assert(dst);
     assert(src);
     assert(bytes > 0);
 
-    // Call memcpy directly without threading for small frames up to 1MB
-    // Otherwise do parallel copy and add one thread for each 1MB
-    // The limits were found experimentally
-    usedTaskCount_ = std::min<size_t>(1 + bytes / 1000000, tasks_.size());
+    const Profile& profile = useFixedProfile_ ? fixedProfile_ : *CurrentProfile().load();
+    size_t taskCount = std::min(bytes / profile.minChunkBytes, profile.maxTaskCount);
+    const std::vector<unsigned>* cpus = nullptr;
+    if (taskCount > 1)
+    {
+        if (!useFixedProfile_ && !measurementStarted.load())
+            StartProfileMeasurement();
+        cpus = GetMemoryNodeCpus(dst);
+        if (cpus)
+            taskCount = std::min(taskCount, cpus->size());
+    }
+    SetUp(dst, src, bytes, taskCount, profile, cpus);
+}
+
+void TaskSet_CopyMemory::SetUp(void* dst, const void* src, size_t bytes, size_t taskCount,
+    const Profile& profile, const std::vector<unsigned>* cpus)
+{
+    const bool streaming = bytes >= profile.streamingThreshold;
+
+    // Copy directly without threading if not worth splitting
+    usedTaskCount_ = std::max<size_t>(1, std::min(taskCount, tasks_.size()));
     if (usedTaskCount_ == 1)
     {
-        std::memcpy(dst, src, bytes);
+        Copy(dst, src, bytes, streaming);
         return;
     }
 
     for (Task* task : tasks_)
-        static_cast<ATask*>(task)->SetUp(dst, src, bytes, usedTaskCount_);
+        static_cast<ATask*>(task)->SetUp(dst, src, bytes, usedTaskCount_, streaming, cpus);
+}
+
+// The CPUs of the node holding dst, or null if the tasks should run anywhere
+const std::vector<unsigned>* TaskSet_CopyMemory::GetMemoryNodeCpus(const void* dst) const
+{
+    const std::vector<std::vector<unsigned>>& nodeCpus = GetNodeCpus();
+    if (nodeCpus.empty())
+        return nullptr;
+
+    const int node = GetMemoryNode(dst);
+    if (node < 0 || static_cast<size_t>(node) >= nodeCpus.size() ||
+        nodeCpus[node].empty())
+        return nullptr;
+
+    // A fixed affinity takes precedence
+    if (!pool_->GetAffinity().empty())
+        return nullptr;
+    return &nodeCpus[node];
 }
 
 void TaskSet_CopyMemory::Execute()
@@ -25,15 +25,38 @@
 
 #include "TaskSet.h"
 
+// Copies large buffers using the thread pool. The number of threads, the
+// minimum size worth splitting and the size from which the copy bypasses the
+// cache start out at conservative defaults; the first large copy starts
+// measuring the bandwidth on a background thread, and later copies use the
+// result. On NUMA systems (Linux only), each task moves its thread to the
+// (physical) cores of the node holding the destination while it copies,
+// unless the pool has a fixed affinity.
 class TaskSet_CopyMemory : public TaskSet
 {
+public:
+    struct Profile
+    {
+        // More tasks than this do not increase the measured bandwidth
+        size_t maxTaskCount;
+        // Chunks smaller than this take longer to dispatch than to copy
+        size_t minChunkBytes;
+        // Copies of at least this size (the last-level cache size) use
+        // non-temporal stores, so as not to evict the cache for a frame that
+        // would not fit in it anyway
+        size_t streamingThreshold;
+        // Measured with maxTaskCount tasks, in GB/s (0 if not measured)
+        double bandwidth;
+    };
+
 private:
     class ATask : public Task
     {
     public:
         explicit ATask(std::shared_ptr<Semaphore> semDone, size_t taskIndex, size_t totalTaskCount);
 
-        void SetUp(void* dst, const void* src, size_t bytes, size_t usedTaskCount);
+        void SetUp(void* dst, const void* src, size_t bytes, size_t usedTaskCount, bool streaming,
+            const std::vector<unsigned>* cpus);
 
         virtual void Execute() override;
 
@@ -41,11 +64,19 @@ private:
         void* dst_{ nullptr };
         const void* src_{ nullptr };
         size_t bytes_{ 0 };
+        bool streaming_{ false };
+        const std::vector<unsigned>* cpus_{ nullptr }; // Where to run, if set
     };
 
 public:
     explicit TaskSet_CopyMemory(std::shared_ptr<ThreadPool> pool);
 
+    // The defaults until the measurement has finished
+    static Profile GetProfile();
+    // Measures the profile now (which takes a few tens of ms) unless it has
+    // been measured already, and returns it
+    static Profile GetMeasuredProfile();
+
     void SetUp(void* dst, const void* src, size_t bytes);
 
     virtual void Execute() override;
@@ -53,4 +84,19 @@ public:
 
     // Helper blocking method calling SetUp, Execute and Wait
     void MemCopy(void* dst, const void* src, size_t bytes);
+
+private:
+    TaskSet_CopyMemory(std::shared_ptr<ThreadPool> pool, const Profile& profile);
+
+    static Profile MeasureProfile();
+    static void StartProfileMeasurement();
+
+    void SetUp(void* dst, const void* src, size_t bytes, size_t taskCount,
+        const Profile& profile, const std::vector<unsigned>* cpus);
+    const std::vector<unsigned>* GetMemoryNodeCpus(const void* dst) const;
+
+private:
+    // Used instead of the shared profile while measuring it
+    const Profile fixedProfile_;
+    const bool useFixedProfile_;
 };
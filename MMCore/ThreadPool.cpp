@@ -31,14 +31,127 @@
 #include <mutex>
 #include <thread>
 
-ThreadPool::ThreadPool()
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace {
+
+// Number of times an idle thread looks for work before going to sleep
+const int SpinCount = 64;
+
+const int64_t InitialDequeCapacity = 64;
+
+// The pool and worker index of the current thread, if it is a pool thread
+thread_local const ThreadPool* currentPool = nullptr;
+thread_local size_t currentWorker = 0;
+
+} // namespace
+
+ThreadPool::WorkDeque::Array::Array(int64_t capacity)
+    : capacity(capacity),
+    slots(new std::atomic<Task*>[static_cast<size_t>(capacity)])
+{
+    assert((capacity & (capacity - 1)) == 0);
+}
+
+Task* ThreadPool::WorkDeque::Array::Get(int64_t i) const
+{
+    return slots[static_cast<size_t>(i & (capacity - 1))].load(std::memory_order_relaxed);
+}
+
+void ThreadPool::WorkDeque::Array::Put(int64_t i, Task* task)
+{
+    slots[static_cast<size_t>(i & (capacity - 1))].store(task, std::memory_order_relaxed);
+}
+
+ThreadPool::WorkDeque::WorkDeque()
 {
-    const size_t hwThreadCount = std::max<size_t>(1, std::thread::hardware_concurrency());
-    for (size_t n = 0; n < hwThreadCount; ++n)
+    arrays_.push_back(std::make_unique<Array>(InitialDequeCapacity));
+    array_.store(arrays_.back().get(), std::memory_order_relaxed);
+}
+
+ThreadPool::WorkDeque::~WorkDeque()
+{
+}
+
+void ThreadPool::WorkDeque::Push(Task* task)
+{
+    const int64_t bottom = bottom_.load(std::memory_order_relaxed);
+    const int64_t top = top_.load(std::memory_order_acquire);
+    Array* array = array_.load(std::memory_order_relaxed);
+    if (bottom - top > array->capacity - 1)
+        array = Grow(array, top, bottom);
+    array->Put(bottom, task);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom_.store(bottom + 1, std::memory_order_relaxed);
+}
+
+Task* ThreadPool::WorkDeque::Pop()
+{
+    const int64_t bottom = bottom_.load(std::memory_order_relaxed) - 1;
+    Array* array = array_.load(std::memory_order_relaxed);
+    bottom_.store(bottom, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t top = top_.load(std::memory_order_relaxed);
+
+    Task* task = nullptr;
+    if (top <= bottom)
+    {
+        task = array->Get(bottom);
+        if (top == bottom)
+        {
+            // Last task; race against thieves
+            if (!top_.compare_exchange_strong(top, top + 1,
+                    std::memory_order_seq_cst, std::memory_order_relaxed))
+                task = nullptr;
+            bottom_.store(bottom + 1, std::memory_order_relaxed);
+        }
+    }
+    else
     {
-        auto thread = std::make_unique<std::thread>(&ThreadPool::ThreadFunc, this);
-        threads_.push_back(std::move(thread));
+        bottom_.store(bottom + 1, std::memory_order_relaxed);
     }
+    return task;
+}
+
+Task* ThreadPool::WorkDeque::Steal()
+{
+    int64_t top = top_.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const int64_t bottom = bottom_.load(std::memory_order_acquire);
+    if (top >= bottom)
+        return nullptr;
+
+    Array* array = array_.load(std::memory_order_acquire);
+    Task* task = array->Get(top);
+    if (!top_.compare_exchange_strong(top, top + 1,
+            std::memory_order_seq_cst, std::memory_order_relaxed))
+        return nullptr; // Lost to the owner or another thief
+    return task;
+}
+
+ThreadPool::WorkDeque::Array* ThreadPool::WorkDeque::Grow(Array* array, int64_t top, int64_t bottom)
+{
+    auto grown = std::make_unique<Array>(2 * array->capacity);
+    for (int64_t i = top; i < bottom; ++i)
+        grown->Put(i, array->Get(i));
+    arrays_.push_back(std::move(grown));
+    Array* result = arrays_.back().get();
+    array_.store(result, std::memory_order_release);
+    return result;
+}
+
+ThreadPool::ThreadPool(size_t threadCount)
+{
+    if (threadCount == 0)
+        threadCount = std::max<size_t>(1, std::thread::hardware_concurrency());
+    // All deques must exist before any thread starts stealing
+    for (size_t n = 0; n < threadCount; ++n)
+        workers_.push_back(std::make_unique<Worker>());
+    for (size_t n = 0; n < threadCount; ++n)
+        workers_[n]->thread = std::thread(&ThreadPool::ThreadFunc, this, n);
 }
 
 ThreadPool::~ThreadPool()
@@ -49,58 +162,226 @@ ThreadPool::~ThreadPool()
     }
     cv_.notify_all();
 
-    for (const auto& thread : threads_)
-        thread->join();
+    for (const auto& worker : workers_)
+        worker->thread.join();
 }
 
 size_t ThreadPool::GetSize() const
 {
-    return threads_.size();
+    return workers_.size();
 }
 
-void ThreadPool::Execute(Task* task)
+bool ThreadPool::SetAffinity(const std::vector<unsigned>& cpus)
 {
-    assert(task);
+    std::lock_guard<std::mutex> lock(affinityMx_);
+    if (!ApplyAffinity(cpus))
+        return false;
+    affinity_ = cpus;
+    pinnedCpus_.clear();
+    return true;
+}
+
+std::vector<unsigned> ThreadPool::GetAffinity() const
+{
+    std::lock_guard<std::mutex> lock(affinityMx_);
+    return affinity_;
+}
+
+bool ThreadPool::PinTo(const std::vector<unsigned>& cpus)
+{
+    std::lock_guard<std::mutex> lock(affinityMx_);
+    if (!affinity_.empty())
+        return false;
+    if (cpus == pinnedCpus_)
+        return true;
+    if (!ApplyAffinity(cpus))
+        return false;
+    pinnedCpus_ = cpus;
+    return true;
+}
+
+bool ThreadPool::ApplyAffinity(const std::vector<unsigned>& cpus)
+{
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (cpus.empty())
     {
-        std::lock_guard<std::mutex> lock(mx_);
-        if (abortFlag_)
-            return;
-        queue_.push_back(task);
+        if (sched_getaffinity(0, sizeof(set), &set) != 0)
+            return false;
+    }
+    for (unsigned cpu : cpus)
+    {
+        if (cpu < CPU_SETSIZE)
+            CPU_SET(cpu, &set);
     }
-    cv_.notify_one();
+
+    bool ok = true;
+    for (const auto& worker : workers_)
+    {
+        if (pthread_setaffinity_np(worker->thread.native_handle(), sizeof(set), &set) != 0)
+            ok = false;
+    }
+    return ok;
+#else
+    (void)cpus;
+    return false;
+#endif
+}
+
+void ThreadPool::Execute(Task* task)
+{
+    assert(task);
+    Push(task);
+    queuedCount_.fetch_add(1);
+    Notify(1);
 }
 
 void ThreadPool::Execute(const std::vector<Task*>& tasks)
 {
     assert(!tasks.empty());
 
+    if (currentPool == this)
     {
-        std::lock_guard<std::mutex> lock(mx_);
-        if (abortFlag_)
-            return;
+        for (Task* task : tasks)
+        {
+            assert(task);
+            workers_[currentWorker]->deque.Push(task);
+        }
+    }
+    else
+    {
+        std::lock_guard<std::mutex> lock(queueMx_);
         for (Task* task : tasks)
         {
             assert(task);
             queue_.push_back(task);
         }
     }
-    cv_.notify_all();
+    queuedCount_.fetch_add(static_cast<int64_t>(tasks.size()));
+    Notify(tasks.size());
 }
 
-void ThreadPool::ThreadFunc()
+bool ThreadPool::RunPendingTask()
 {
-    for (;;)
+    Task* task = (currentPool == this) ? FindTask(currentWorker) : TakeQueued(0);
+    if (!task)
+        return false;
+    Run(task);
+    return true;
+}
+
+bool ThreadPool::IsPoolThread() const
+{
+    return currentPool == this;
+}
+
+void ThreadPool::Push(Task* task)
+{
+    if (currentPool == this)
+    {
+        workers_[currentWorker]->deque.Push(task);
+        return;
+    }
+    std::lock_guard<std::mutex> lock(queueMx_);
+    queue_.push_back(task);
+}
+
+void ThreadPool::Notify(size_t count)
+{
+    // Pairs with the increment of sleepingCount_ in ThreadFunc(): either we
+    // see the sleeping thread, or it sees the queued task
+    const size_t sleeping = sleepingCount_.load();
+    if (sleeping == 0)
+        return;
+
+    // Taking the lock ensures that a thread about to wait is either waiting
+    // or has already seen the queued task
     {
-        Task* task = nullptr;
+        std::lock_guard<std::mutex> lock(mx_);
+    }
+    if (count >= sleeping)
+        cv_.notify_all();
+    else
+        for (size_t n = 0; n < count; ++n)
+            cv_.notify_one();
+}
+
+Task* ThreadPool::FindTask(size_t index)
+{
+    Task* task = workers_[index]->deque.Pop();
+    if (task)
+    {
+        queuedCount_.fetch_sub(1);
+        return task;
+    }
+    return TakeQueued(index + 1);
+}
+
+Task* ThreadPool::TakeQueued(size_t stealStart)
+{
+    if (queuedCount_.load(std::memory_order_relaxed) <= 0)
+        return nullptr;
+
+    Task* task = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(queueMx_);
+        if (!queue_.empty())
         {
-            std::unique_lock<std::mutex> lock(mx_);
-            cv_.wait(lock, [&]() { return abortFlag_ || !queue_.empty(); });
-            if (abortFlag_)
-                break;
             task = queue_.front();
             queue_.pop_front();
         }
-        task->Execute();
-        task->Done();
+    }
+    if (!task)
+        task = Steal(stealStart);
+    if (task)
+        queuedCount_.fetch_sub(1);
+    return task;
+}
+
+Task* ThreadPool::Steal(size_t start)
+{
+    const size_t count = workers_.size();
+    for (size_t n = 0; n < count; ++n)
+    {
+        Task* task = workers_[(start + n) % count]->deque.Steal();
+        if (task)
+            return task;
+    }
+    return nullptr;
+}
+
+void ThreadPool::Run(Task* task)
+{
+    task->Execute();
+    task->Done();
+}
+
+void ThreadPool::ThreadFunc(size_t index)
+{
+    currentPool = this;
+    currentWorker = index;
+
+    for (;;)
+    {
+        Task* task = FindTask(index);
+        for (int spin = 0; !task && spin < SpinCount && !abortFlag_; ++spin)
+        {
+            std::this_thread::yield();
+            if (queuedCount_.load(std::memory_order_relaxed) > 0)
+                task = FindTask(index);
+        }
+        if (task)
+        {
+            Run(task);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(mx_);
+        sleepingCount_.fetch_add(1);
+        cv_.wait(lock, [&]() { return abortFlag_ || queuedCount_.load() > 0; });
+        sleepingCount_.fetch_sub(1);
+        if (abortFlag_ && queuedCount_.load() <= 0)
+            break;
     }
 }
@@ -24,33 +24,158 @@
 
 #pragma once
 
+#include "Task.h"
+
+#include <atomic>
 #include <condition_variable>
+#include <cstdint>
 #include <deque>
+#include <future>
 #include <memory>
 #include <mutex>
 #include <thread>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
-class Task;
-
+// Work-stealing thread pool.
+//
+// Each thread owns a deque of tasks. Tasks submitted from one of the pool's
+// own threads go to that thread's deque, which it pops from the back while
+// idle threads steal from the front; tasks submitted from elsewhere go to a
+// shared queue. Only as many sleeping threads are woken as there are new
+// tasks, and threads keep looking for work briefly before going to sleep.
+//
+// A task waiting for other tasks should call RunPendingTask() while waiting
+// (TaskSet::Wait() does) rather than just block, so that it cannot deadlock
+// the pool by occupying all its threads.
 class ThreadPool final
 {
 public:
-    explicit ThreadPool();
+    // Creates one thread per hardware thread if threadCount is 0
+    explicit ThreadPool(size_t threadCount = 0);
+    // Runs the tasks still queued before the threads exit
     ~ThreadPool();
 
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
     size_t GetSize() const;
 
+    // Restricts all threads to the given logical CPUs or, if cpus is empty,
+    // to those the calling thread may run on. Returns false if not supported
+    // on this platform or if none of the CPUs are available to the process.
+    // A non-empty affinity stays in place until changed by SetAffinity();
+    // PinTo() has no effect while it is set.
+    bool SetAffinity(const std::vector<unsigned>& cpus);
+    std::vector<unsigned> GetAffinity() const;
+
+    // Moves all threads to the given logical CPUs unless an affinity has been
+    // set. Does nothing if they are already there. Returns false if the
+    // threads were not moved.
+    bool PinTo(const std::vector<unsigned>& cpus);
+
     void Execute(Task* task);
     void Execute(const std::vector<Task*>& tasks);
 
+    // Runs f on the pool and returns a future for its result (or exception)
+    template <typename F>
+    std::future<typename std::result_of<typename std::decay<F>::type()>::type>
+    Submit(F&& f)
+    {
+        using R = typename std::result_of<typename std::decay<F>::type()>::type;
+        auto* task = new FunctionTask<R>(std::forward<F>(f));
+        std::future<R> future = task->GetFuture();
+        Execute(task);
+        return future;
+    }
+
+    // Runs one queued task, if any, on the calling thread. Returns false if
+    // there was none.
+    bool RunPendingTask();
+
+    // Whether the calling thread is one of this pool's threads
+    bool IsPoolThread() const;
+
 private:
-    void ThreadFunc();
+    // Chase-Lev deque. Only the owning thread may Push() and Pop(); any
+    // thread may Steal().
+    class WorkDeque final
+    {
+    public:
+        WorkDeque();
+        ~WorkDeque();
+
+        void Push(Task* task);
+        Task* Pop();
+        Task* Steal();
+
+    private:
+        struct Array
+        {
+            explicit Array(int64_t capacity);
+
+            Task* Get(int64_t i) const;
+            void Put(int64_t i, Task* task);
+
+            const int64_t capacity;
+            std::unique_ptr<std::atomic<Task*>[]> slots;
+        };
+
+        Array* Grow(Array* array, int64_t top, int64_t bottom);
+
+        alignas(64) std::atomic<int64_t> top_{ 0 };
+        alignas(64) std::atomic<int64_t> bottom_{ 0 };
+        std::atomic<Array*> array_;
+        // Replaced arrays, which thieves may still be reading
+        std::vector<std::unique_ptr<Array>> arrays_{};
+    };
+
+    template <typename R>
+    class FunctionTask final : public Task
+    {
+    public:
+        template <typename F>
+        explicit FunctionTask(F&& f) : task_(std::forward<F>(f)) {}
+
+        std::future<R> GetFuture() { return task_.get_future(); }
+
+        virtual void Execute() override { task_(); }
+        virtual void Done() override { delete this; }
+
+    private:
+        std::packaged_task<R()> task_;
+    };
+
+    struct Worker
+    {
+        WorkDeque deque{};
+        std::thread thread{};
+    };
+
+    void ThreadFunc(size_t index);
+    Task* FindTask(size_t index);
+    Task* TakeQueued(size_t stealStart);
+    Task* Steal(size_t start);
+    void Run(Task* task);
+    void Push(Task* task);
+    void Notify(size_t count);
+    bool ApplyAffinity(const std::vector<unsigned>& cpus);
 
 private:
-    std::vector<std::unique_ptr<std::thread>> threads_{};
-    bool abortFlag_{ false };
+    std::vector<std::unique_ptr<Worker>> workers_{};
+
+    std::mutex queueMx_{};
+    std::deque<Task*> queue_{}; // Tasks submitted from outside the pool
+
+    // Tasks in queue_ and in the workers' deques
+    std::atomic<int64_t> queuedCount_{ 0 };
+    std::atomic<size_t> sleepingCount_{ 0 };
+    std::atomic<bool> abortFlag_{ false };
     std::mutex mx_{};
     std::condition_variable cv_{};
-    std::deque<Task*> queue_{};
+
+    mutable std::mutex affinityMx_{};
+    std::vector<unsigned> affinity_{};
+    std::vector<unsigned> pinnedCpus_{};
 };
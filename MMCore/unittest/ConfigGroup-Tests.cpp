@@ -0,0 +1,154 @@
+#include <gtest/gtest.h>
+
+#include "ConfigGroup.h"
+
+#include <string>
+#include <vector>
+
+
+TEST(ConfigGroupTests, GroupsIncludingProperty)
+{
+   ConfigGroupCollection groups;
+   groups.Define("Channel", "DAPI", "Wheel", "State", "0");
+   groups.Define("Channel", "DAPI", "Shutter", "State", "1");
+   groups.Define("Channel", "FITC", "Wheel", "State", "1");
+   groups.Define("Objective", "10x", "Nosepiece", "State", "0");
+   groups.Define("Filter", "Open", "Wheel", "State", "0");
+
+   EXPECT_EQ(std::vector<std::string>({ "Channel", "Filter" }),
+         groups.GetGroupsIncluding("Wheel", "State", 1));
+   // Only Channel has a preset with more than 1 property
+   EXPECT_EQ(std::vector<std::string>({ "Channel" }),
+         groups.GetGroupsIncluding("Wheel", "State", 2));
+   EXPECT_EQ(std::vector<std::string>({ "Objective" }),
+         groups.GetGroupsIncluding("Nosepiece", "State", 1));
+   EXPECT_TRUE(groups.GetGroupsIncluding("Nosepiece", "State", 2).empty());
+   EXPECT_TRUE(groups.GetGroupsIncluding("Wheel", "Label", 1).empty());
+}
+
+TEST(ConfigGroupTests, IndexFollowsChanges)
+{
+   ConfigGroupCollection groups;
+   groups.Define("Channel", "DAPI", "Wheel", "State", "0");
+   EXPECT_TRUE(groups.GetGroupsIncluding("Wheel", "State", 2).empty());
+
+   groups.Define("Channel", "DAPI", "Shutter", "State", "1");
+   EXPECT_EQ(std::vector<std::string>({ "Channel" }),
+         groups.GetGroupsIncluding("Wheel", "State", 2));
+
+   groups.Delete("Channel", "DAPI", "Shutter", "State");
+   EXPECT_TRUE(groups.GetGroupsIncluding("Shutter", "State", 1).empty());
+   EXPECT_TRUE(groups.GetGroupsIncluding("Wheel", "State", 2).empty());
+
+   groups.RenameGroup("Channel", "Color");
+   EXPECT_EQ(std::vector<std::string>({ "Color" }),
+         groups.GetGroupsIncluding("Wheel", "State", 1));
+
+   groups.Delete("Color", "DAPI");
+   EXPECT_TRUE(groups.GetGroupsIncluding("Wheel", "State", 1).empty());
+
+   groups.Define("Color", "DAPI", "Wheel", "State", "0");
+   groups.Delete("Color");
+   EXPECT_TRUE(groups.GetGroupsIncluding("Wheel", "State", 1).empty());
+}
+
+TEST(ConfigGroupTests, PixelSizePresetsIncludingProperty)
+{
+   PixelSizeConfigGroup pixelSizes;
+   EXPECT_EQ(0u, pixelSizes.LargestPresetIncluding("Nosepiece", "State"));
+
+   pixelSizes.Define("10x", "Nosepiece", "State", "0");
+   pixelSizes.Define("20x", "Nosepiece", "State", "1");
+   pixelSizes.Define("20x", "Optovar", "State", "1");
+   EXPECT_EQ(2u, pixelSizes.LargestPresetIncluding("Nosepiece", "State"));
+
+   pixelSizes.Delete("20x");
+   EXPECT_EQ(1u, pixelSizes.LargestPresetIncluding("Nosepiece", "State"));
+   EXPECT_EQ(0u, pixelSizes.LargestPresetIncluding("Optovar", "State"));
+}
+
+TEST(ConfigGroupTests, TracksCurrentPreset)
+{
+   ConfigGroupCollection groups;
+   groups.Define("Channel", "DAPI", "Wheel", "State", "0");
+   groups.Define("Channel", "DAPI", "Shutter", "State", "1");
+   groups.Define("Channel", "FITC", "Wheel", "State", "1");
+   groups.Define("Channel", "FITC", "Shutter", "State", "1");
+
+   Configuration state;
+   state.addSetting(PropertySetting("Wheel", "State", "1"));
+   state.addSetting(PropertySetting("Shutter", "State", "1"));
+   groups.SyncState(state);
+
+   std::string current;
+   EXPECT_TRUE(groups.GetCurrentPreset("Channel", state, current));
+   EXPECT_EQ("FITC", current);
+
+   const long version = groups.GetVersion();
+   groups.UpdateState(PropertySetting("Wheel", "State", "0"));
+   EXPECT_TRUE(groups.GetCurrentPreset("Channel", state, current));
+   EXPECT_EQ("DAPI", current);
+   EXPECT_EQ(std::vector<std::string>({ "Channel" }),
+         groups.GetGroupsChangedSince(version));
+
+   const long version2 = groups.GetVersion();
+   groups.UpdateState(PropertySetting("Wheel", "State", "0")); // Unchanged
+   groups.UpdateState(PropertySetting("Camera", "Binning", "2")); // Unrelated
+   EXPECT_TRUE(groups.GetGroupsChangedSince(version2).empty());
+
+   groups.UpdateState(PropertySetting("Shutter", "State", "0"));
+   EXPECT_TRUE(groups.GetCurrentPreset("Channel", state, current));
+   EXPECT_EQ("", current);
+   EXPECT_EQ(std::vector<std::string>({ "Channel" }),
+         groups.GetGroupsChangedSince(version2));
+}
+
+TEST(ConfigGroupTests, TrackingFollowsPresetChanges)
+{
+   ConfigGroupCollection groups;
+   groups.Define("Channel", "DAPI", "Wheel", "State", "0");
+   groups.Define("Objective", "10x", "Nosepiece", "State", "0");
+
+   Configuration state;
+   state.addSetting(PropertySetting("Wheel", "State", "1"));
+   state.addSetting(PropertySetting("Nosepiece", "State", "0"));
+   groups.SyncState(state);
+
+   const long version = groups.GetVersion();
+   groups.Define("Channel", "FITC", "Wheel", "State", "1");
+   EXPECT_EQ(std::vector<std::string>({ "Channel" }),
+         groups.GetGroupsChangedSince(version));
+
+   // The edited group is matched again when next asked
+   std::string current;
+   EXPECT_TRUE(groups.GetCurrentPreset("Channel", state, current));
+   EXPECT_EQ("FITC", current);
+   EXPECT_TRUE(groups.GetCurrentPreset("Objective", state, current));
+   EXPECT_EQ("10x", current);
+}
+
+TEST(ConfigGroupTests, TrackingReportsMissingProperties)
+{
+   ConfigGroupCollection groups;
+   groups.Define("Channel", "DAPI", "Wheel", "State", "0");
+   groups.Define("Channel", "DAPI", "Shutter", "State", "1");
+   groups.Define("Channel", "Open", "Shutter", "State", "1");
+
+   Configuration state;
+   state.addSetting(PropertySetting("Shutter", "State", "1"));
+   groups.SyncState(state);
+
+   std::string current;
+   EXPECT_FALSE(groups.GetCurrentPreset("Channel", state, current));
+   EXPECT_EQ("Open", current);
+
+   groups.UpdateState(PropertySetting("Wheel", "State", "0"));
+   EXPECT_TRUE(groups.GetCurrentPreset("Channel", state, current));
+   EXPECT_EQ("DAPI", current);
+}
+
+int main(int argc, char **argv)
+{
+   ::testing::InitGoogleTest(&argc, argv);
+   return RUN_ALL_TESTS();
+}
@@ -0,0 +1,84 @@
+// Bandwidth benchmark for the parallel copy used by the sequence buffers.
+//
+// Sweeps frame sizes and thread pool sizes and reports the bandwidth of
+// TaskSet_CopyMemory (with its automatically chosen task count) next to a
+// plain single-threaded memcpy.
+//
+// Usage: CopyMemory-Bench [maxFrameMB]
+
+#include "TaskSet_CopyMemory.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+
+
+namespace {
+
+// Best of several runs, in GB/s
+template <typename F>
+double MeasureBandwidth(size_t bytes, F copy)
+{
+   using namespace std::chrono;
+   const int reps = static_cast<int>(std::max<size_t>(3, (256u << 20) / bytes));
+   double best = 0.0;
+   for (int i = 0; i < reps; ++i)
+   {
+      auto start = steady_clock::now();
+      copy();
+      double s = duration<double>(steady_clock::now() - start).count();
+      best = std::max(best, bytes / s / 1e9);
+   }
+   return best;
+}
+
+} // anonymous namespace
+
+
+int main(int argc, char** argv)
+{
+   const size_t maxFrameBytes = (argc > 1 ? std::atol(argv[1]) : 256) << 20;
+   const size_t hwThreads = std::max(1u, std::thread::hardware_concurrency());
+
+   const TaskSet_CopyMemory::Profile profile = TaskSet_CopyMemory::GetMeasuredProfile();
+   std::printf("Profile: max %zu tasks, min chunk %zu kB, streaming from %zu kB,"
+         " %.1f GB/s\n\n", profile.maxTaskCount, profile.minChunkBytes >> 10,
+         profile.streamingThreshold >> 10, profile.bandwidth);
+
+   std::vector<size_t> threadCounts;
+   for (size_t n = 1; n < hwThreads; n *= 2)
+      threadCounts.push_back(n);
+   threadCounts.push_back(hwThreads);
+
+   std::printf("%10s %9s", "frame kB", "memcpy");
+   for (size_t n : threadCounts)
+      std::printf("  %4zu thr", n);
+   std::printf("   (GB/s)\n");
+
+   std::vector<char> src(maxFrameBytes, 1);
+   std::vector<char> dst(maxFrameBytes, 0);
+   std::vector<std::unique_ptr<TaskSet_CopyMemory>> copiers;
+   for (size_t n : threadCounts)
+      copiers.emplace_back(new TaskSet_CopyMemory(std::make_shared<ThreadPool>(n)));
+
+   for (size_t bytes = 256 << 10; bytes <= maxFrameBytes; bytes *= 4)
+   {
+      std::printf("%10zu %9.2f", bytes >> 10, MeasureBandwidth(bytes, [&]() {
+         std::memcpy(&dst[0], &src[0], bytes);
+      }));
+      for (auto& copier : copiers)
+      {
+         std::printf("  %8.2f", MeasureBandwidth(bytes, [&]() {
+            copier->MemCopy(&dst[0], &src[0], bytes);
+         }));
+      }
+      std::printf("\n");
+   }
+   return 0;
+}
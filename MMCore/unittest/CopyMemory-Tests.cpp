@@ -0,0 +1,82 @@
+#include <gtest/gtest.h>
+
+#include "TaskSet_CopyMemory.h"
+#include "ThreadPool.h"
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+
+namespace {
+
+void CheckCopy(TaskSet_CopyMemory& copier, size_t bytes, size_t offset)
+{
+   std::vector<unsigned char> src(bytes + offset);
+   for (size_t i = 0; i < src.size(); ++i)
+      src[i] = static_cast<unsigned char>(i * 7 + i / 251);
+   // Guard bytes after the destination must be left alone
+   std::vector<unsigned char> dst(bytes + offset + 64, 0xee);
+
+   copier.MemCopy(&dst[offset], &src[offset], bytes);
+
+   for (size_t i = 0; i < bytes; ++i)
+      ASSERT_EQ(src[offset + i], dst[offset + i]) << "at byte " << i;
+   for (size_t i = offset + bytes; i < dst.size(); ++i)
+      ASSERT_EQ(0xee, dst[i]) << "past end at byte " << i;
+}
+
+} // anonymous namespace
+
+
+// Runs first, before any copy has started the measurement
+TEST(CopyMemoryTests, DefaultProfileIsNotMeasured)
+{
+   TaskSet_CopyMemory copier(std::make_shared<ThreadPool>(2));
+   const TaskSet_CopyMemory::Profile profile = TaskSet_CopyMemory::GetProfile();
+   EXPECT_GE(profile.maxTaskCount, 1u);
+   EXPECT_GT(profile.minChunkBytes, 0u);
+   EXPECT_GT(profile.streamingThreshold, 0u);
+   EXPECT_EQ(0.0, profile.bandwidth);
+}
+
+TEST(CopyMemoryTests, ProfileIsSane)
+{
+   const TaskSet_CopyMemory::Profile profile = TaskSet_CopyMemory::GetMeasuredProfile();
+   EXPECT_GE(profile.maxTaskCount, 1u);
+   EXPECT_GT(profile.minChunkBytes, 0u);
+   EXPECT_GT(profile.streamingThreshold, 0u);
+   EXPECT_GT(profile.bandwidth, 0.0);
+}
+
+TEST(CopyMemoryTests, CopiesAllSizes)
+{
+   TaskSet_CopyMemory copier(std::make_shared<ThreadPool>(4));
+   const TaskSet_CopyMemory::Profile profile = TaskSet_CopyMemory::GetProfile();
+   std::vector<size_t> sizes = { 1, 63, 64, 4097, profile.minChunkBytes * 3 + 13 };
+   // Non-temporal copy, unless the cache is unusually large
+   if (profile.streamingThreshold <= (64 << 20))
+      sizes.push_back(profile.streamingThreshold + 1001);
+   for (size_t bytes : sizes)
+   {
+      for (size_t offset : { 0, 3 })
+      {
+         SCOPED_TRACE(bytes);
+         CheckCopy(copier, bytes, offset);
+      }
+   }
+}
+
+TEST(CopyMemoryTests, SingleThreadPool)
+{
+   TaskSet_CopyMemory copier(std::make_shared<ThreadPool>(1));
+   CheckCopy(copier, TaskSet_CopyMemory::GetProfile().minChunkBytes * 4 + 1, 1);
+   EXPECT_EQ(1u, copier.GetUsedTaskCount());
+}
+
+
+int main(int argc, char **argv)
+{
+   ::testing::InitGoogleTest(&argc, argv);
+   return RUN_ALL_TESTS();
+}
@@ -0,0 +1,131 @@
+#include <gtest/gtest.h>
+
+#include "DeviceIdleWaiter.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+
+namespace {
+
+// Busy until told otherwise; counts how often it was asked
+struct FakeDevice
+{
+   FakeDevice() : busy(false), checks(0) {}
+
+   DeviceIdleWaiter::Device Get()
+   {
+      DeviceIdleWaiter::Device device;
+      device.id = this;
+      device.busy = [this] { ++checks; return busy.load(); };
+      return device;
+   }
+
+   std::atomic<bool> busy;
+   std::atomic<int> checks;
+};
+
+std::chrono::steady_clock::time_point In(std::chrono::milliseconds ms)
+{
+   return std::chrono::steady_clock::now() + ms;
+}
+
+} // anonymous namespace
+
+
+TEST(DeviceIdleWaiterTests, ReturnsAtOnceWhenIdle)
+{
+   DeviceIdleWaiter waiter;
+   FakeDevice a, b;
+   size_t stillBusy = 99;
+   EXPECT_TRUE(waiter.Wait({ a.Get(), b.Get() }, In(std::chrono::milliseconds(1000)),
+            std::chrono::milliseconds(100), stillBusy));
+   EXPECT_EQ(1, a.checks.load());
+   EXPECT_EQ(1, b.checks.load());
+   EXPECT_EQ(99u, stillBusy);
+}
+
+TEST(DeviceIdleWaiterTests, TimesOutWithFirstBusyDevice)
+{
+   DeviceIdleWaiter waiter;
+   FakeDevice a, b, c;
+   b.busy = true;
+   c.busy = true;
+   size_t stillBusy = 99;
+   EXPECT_FALSE(waiter.Wait({ a.Get(), b.Get(), c.Get() },
+            In(std::chrono::milliseconds(20)), std::chrono::milliseconds(5),
+            stillBusy));
+   EXPECT_EQ(1u, stillBusy);
+   EXPECT_EQ(1, a.checks.load()); // Not asked again once idle
+}
+
+TEST(DeviceIdleWaiterTests, PollsWithBackoff)
+{
+   DeviceIdleWaiter waiter;
+   FakeDevice a;
+   a.busy = true;
+   std::thread mover([&] {
+      std::this_thread::sleep_for(std::chrono::milliseconds(30));
+      a.busy = false;
+   });
+   size_t stillBusy;
+   EXPECT_TRUE(waiter.Wait({ a.Get() }, In(std::chrono::milliseconds(5000)),
+            std::chrono::milliseconds(10), stillBusy));
+   mover.join();
+   // Fixed 10 ms polling would check 4 times; the first few polls are
+   // shorter, but doubling keeps the count low
+   EXPECT_GE(a.checks.load(), 4);
+   EXPECT_LE(a.checks.load(), 20);
+}
+
+TEST(DeviceIdleWaiterTests, NotificationEndsWaitWithoutPolling)
+{
+   DeviceIdleWaiter waiter;
+   FakeDevice a, b;
+   waiter.NotifyIdle(&a); // Now known to notify
+   waiter.NotifyIdle(&b);
+   a.busy = true;
+   b.busy = true;
+   std::thread mover([&] {
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      a.busy = false;
+      waiter.NotifyIdle(&a);
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      b.busy = false;
+      waiter.NotifyIdle(&b);
+   });
+   const auto start = std::chrono::steady_clock::now();
+   size_t stillBusy;
+   EXPECT_TRUE(waiter.Wait({ a.Get(), b.Get() }, In(std::chrono::milliseconds(10000)),
+            std::chrono::milliseconds(5000), stillBusy));
+   const auto elapsed = std::chrono::steady_clock::now() - start;
+   mover.join();
+   EXPECT_LT(elapsed, std::chrono::milliseconds(2000));
+   EXPECT_EQ(2, a.checks.load());
+   EXPECT_EQ(3, b.checks.load());
+}
+
+TEST(DeviceIdleWaiterTests, ForgottenDeviceIsPolled)
+{
+   DeviceIdleWaiter waiter;
+   FakeDevice a;
+   waiter.NotifyIdle(&a);
+   waiter.Forget(&a);
+   a.busy = true;
+   std::thread mover([&] {
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      a.busy = false; // Without notifying
+   });
+   size_t stillBusy;
+   EXPECT_TRUE(waiter.Wait({ a.Get() }, In(std::chrono::milliseconds(10000)),
+            std::chrono::milliseconds(10), stillBusy));
+   mover.join();
+}
+
+int main(int argc, char **argv)
+{
+   ::testing::InitGoogleTest(&argc, argv);
+   return RUN_ALL_TESTS();
+}
@@ -0,0 +1,84 @@
+// Microbenchmark for property get/set through the Core with many devices.
+//
+// Loads deviceCount instances of the DemoCamera state device and times
+// getProperty() and setProperty() on the first and the last of them. Every
+// such call looks up the device by label (and setProperty() looks up the
+// device again when it reports the change back through the CoreCallback),
+// so with a linear search the last device is markedly slower to reach than
+// the first; with the indexed lookup both should cost the same.
+//
+// The DemoCamera adapter (libmmgr_dal_DemoCamera) must be in adapterDir.
+//
+// Usage: DeviceManager-Bench [iterations] [deviceCount] [adapterDir]
+
+#include "MMCore.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <string>
+#include <vector>
+
+
+namespace {
+
+const char* const Property = "State";
+
+template <typename F>
+double MicrosecondsPerCall(long iterations, F f)
+{
+   const auto start = std::chrono::steady_clock::now();
+   for (long i = 0; i < iterations; ++i)
+      f(i);
+   const std::chrono::duration<double, std::micro> elapsed =
+      std::chrono::steady_clock::now() - start;
+   return elapsed.count() / iterations;
+}
+
+void Report(CMMCore& core, const std::string& label, long iterations)
+{
+   const double get = MicrosecondsPerCall(iterations, [&](long) {
+      core.getProperty(label.c_str(), Property);
+   });
+   const double set = MicrosecondsPerCall(iterations, [&](long i) {
+      core.setProperty(label.c_str(), Property, i % 2 ? "1" : "0");
+   });
+   std::printf("%-12s %12.3f %12.3f\n", label.c_str(), get, set);
+}
+
+} // anonymous namespace
+
+
+int main(int argc, char** argv)
+{
+   long iterations = argc > 1 ? std::atol(argv[1]) : 200000;
+   long deviceCount = argc > 2 ? std::atol(argv[2]) : 150;
+   const std::string adapterDir = argc > 3 ? argv[3] : ".";
+
+   try
+   {
+      CMMCore core;
+      core.enableStderrLog(false);
+      core.setDeviceAdapterSearchPaths(std::vector<std::string>(1, adapterDir));
+
+      std::vector<std::string> labels;
+      for (long i = 0; i < deviceCount; ++i)
+      {
+         labels.push_back("State" + std::to_string(i + 1));
+         core.loadDevice(labels.back().c_str(), "DemoCamera", "DStateDevice");
+      }
+      core.initializeAllDevices();
+
+      std::printf("%ld devices, %ld iterations\n", deviceCount, iterations);
+      std::printf("%-12s %12s %12s\n", "device", "get (us)", "set (us)");
+      Report(core, labels.front(), iterations);
+      Report(core, labels.back(), iterations);
+   }
+   catch (const std::exception& e)
+   {
+      std::fprintf(stderr, "%s\n", e.what());
+      return 1;
+   }
+   return 0;
+}
@@ -0,0 +1,240 @@
+#include <gtest/gtest.h>
+
+#include "CircularBuffer.h"
+#include "DiskStreamWriter.h"
+
+#include "../../MMDevice/MMDevice.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+namespace {
+
+const unsigned width = 100; // Frames are not a multiple of the alignment
+const unsigned height = 30;
+const unsigned depth = 2;
+const unsigned frameBytes = width * height * depth;
+
+std::string ScratchPrefix(const char* name)
+{
+#ifdef _WIN32
+   const char* dir = std::getenv("TEMP");
+   return std::string(dir ? dir : ".") + "\\" + name;
+#else
+   const char* dir = std::getenv("TMPDIR");
+   return std::string(dir ? dir : "/tmp") + "/" + name;
+#endif
+}
+
+std::vector<char> ReadFile(const std::string& path)
+{
+   std::ifstream file(path.c_str(), std::ios::binary);
+   return std::vector<char>(std::istreambuf_iterator<char>(file),
+         std::istreambuf_iterator<char>());
+}
+
+template <typename T>
+T ReadValue(const std::vector<char>& data, std::size_t& pos)
+{
+   T value;
+   std::memcpy(&value, &data[pos], sizeof(value));
+   pos += sizeof(value);
+   return value;
+}
+
+void InsertFrames(CircularBuffer& buf, long first, long count)
+{
+   std::vector<unsigned char> pixels(frameBytes);
+   Metadata md;
+   md.put("Camera", "Cam");
+   for (long i = first; i < first + count; ++i)
+   {
+      for (unsigned j = 0; j < frameBytes; ++j)
+         pixels[j] = static_cast<unsigned char>(i + j);
+      ASSERT_TRUE(buf.InsertImage(&pixels[0], width, height, depth, &md));
+   }
+}
+
+} // anonymous namespace
+
+
+TEST(DiskStreamWriterTests, WritesAllImagesWithIndex)
+{
+   CircularBuffer buf(4);
+   ASSERT_TRUE(buf.Initialize(1, width, height, depth));
+   const std::string prefix = ScratchPrefix("DiskStreamWriter-Tests");
+
+   const long count = 3000; // Spans several chunks
+   InsertFrames(buf, 0, 10);
+   {
+      DiskStreamWriter writer(&buf, prefix, nullptr);
+      EXPECT_TRUE(writer.IsRunning());
+      for (long i = 10; i < count; i += 10)
+      {
+         // Keep a slot free: the one the writer is copying from is the
+         // next to be reused, as with any popped image
+         while (buf.GetFreeSize() < 11)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+         InsertFrames(buf, i, 10);
+      }
+      writer.Stop();
+      EXPECT_FALSE(writer.IsRunning());
+      EXPECT_EQ(static_cast<unsigned long long>(count), writer.GetImageCount());
+      EXPECT_EQ(static_cast<unsigned long long>(count) * frameBytes,
+            writer.GetBytesWritten());
+      EXPECT_GE(writer.GetMaxBacklog(), 10u);
+   }
+   EXPECT_EQ(0u, buf.GetRemainingImageCount());
+
+   const std::vector<char> raw = ReadFile(prefix + ".raw");
+   ASSERT_EQ(static_cast<std::size_t>(count) * frameBytes, raw.size());
+   for (long i = 0; i < count; ++i)
+   {
+      ASSERT_EQ(static_cast<char>(i), raw[i * frameBytes]);
+      ASSERT_EQ(static_cast<char>(i + frameBytes - 1), raw[(i + 1) * frameBytes - 1]);
+   }
+
+   const std::vector<char> index = ReadFile(prefix + ".idx");
+   ASSERT_GE(index.size(), 12u);
+   EXPECT_EQ(0, std::memcmp(&index[0], "MMSTRIDX", 8));
+   std::size_t pos = 8;
+   EXPECT_EQ(2u, ReadValue<std::uint32_t>(index, pos));
+   EXPECT_EQ(static_cast<std::uint32_t>(DEVICE_INTERFACE_VERSION),
+         ReadValue<std::uint32_t>(index, pos));
+   for (long i = 0; i < count; ++i)
+   {
+      ASSERT_EQ(static_cast<std::uint64_t>(i) * frameBytes,
+            ReadValue<std::uint64_t>(index, pos));
+      EXPECT_EQ(width, ReadValue<std::uint32_t>(index, pos));
+      EXPECT_EQ(height, ReadValue<std::uint32_t>(index, pos));
+      EXPECT_EQ(depth, ReadValue<std::uint32_t>(index, pos));
+      EXPECT_EQ(0u, ReadValue<std::uint32_t>(index, pos));
+      const std::uint32_t mdSize = ReadValue<std::uint32_t>(index, pos);
+      ASSERT_LE(pos + mdSize, index.size());
+      BinaryMetadata md;
+      ASSERT_TRUE(md.AssignRecords(
+               reinterpret_cast<const unsigned char*>(&index[pos]), mdSize));
+      BinaryMetadata::Tag tag;
+      ASSERT_TRUE(md.FindTag(MM::g_Keyword_Metadata_ImageNumber, tag));
+      EXPECT_EQ(i, tag.GetInteger());
+      EXPECT_STREQ("Cam", md.FindString("Camera"));
+      pos += mdSize;
+   }
+   EXPECT_EQ(index.size(), pos);
+
+   std::remove((prefix + ".raw").c_str());
+   std::remove((prefix + ".idx").c_str());
+}
+
+TEST(DiskStreamWriterTests, WritesAllChannelsOfFramesLargerThanChunks)
+{
+   CircularBuffer buf(128);
+   ASSERT_TRUE(buf.Initialize(1, width, height, depth));
+   const std::string prefix = ScratchPrefix("DiskStreamWriter-Tests-3");
+
+   // Two channels of 12 MB make frames larger than the chunks the writer
+   // started with
+   const unsigned bigWidth = 3072;
+   const unsigned bigHeight = 2048;
+   const std::size_t channelBytes = std::size_t(bigWidth) * bigHeight * depth;
+   const long bigCount = 5;
+   {
+      DiskStreamWriter writer(&buf, prefix, nullptr);
+      InsertFrames(buf, 0, 3);
+      while (writer.GetImageCount() < 3)
+         std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+      ASSERT_TRUE(buf.Initialize(2, bigWidth, bigHeight, depth));
+      std::vector<unsigned char> pixels(2 * channelBytes);
+      Metadata md;
+      md.put("Camera", "Cam");
+      for (long i = 0; i < bigCount; ++i)
+      {
+         pixels[0] = static_cast<unsigned char>(i);
+         pixels[channelBytes - 1] = static_cast<unsigned char>(i + 1);
+         pixels[channelBytes] = static_cast<unsigned char>(i + 2);
+         pixels[2 * channelBytes - 1] = static_cast<unsigned char>(i + 3);
+         while (buf.GetFreeSize() < 2)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+         ASSERT_TRUE(buf.InsertMultiChannel(&pixels[0], 2, bigWidth,
+                  bigHeight, depth, &md));
+      }
+      writer.Stop();
+      EXPECT_EQ(3u + 2 * bigCount, writer.GetImageCount());
+   }
+
+   const std::size_t start = 3 * frameBytes;
+   const std::vector<char> raw = ReadFile(prefix + ".raw");
+   ASSERT_EQ(start + bigCount * 2 * channelBytes, raw.size());
+   for (long i = 0; i < bigCount; ++i)
+   {
+      const std::size_t frame = start + i * 2 * channelBytes;
+      EXPECT_EQ(static_cast<char>(i), raw[frame]);
+      EXPECT_EQ(static_cast<char>(i + 1), raw[frame + channelBytes - 1]);
+      EXPECT_EQ(static_cast<char>(i + 2), raw[frame + channelBytes]);
+      EXPECT_EQ(static_cast<char>(i + 3), raw[frame + 2 * channelBytes - 1]);
+   }
+
+   const std::vector<char> index = ReadFile(prefix + ".idx");
+   std::size_t pos = 16;
+   for (long i = 0; i < 3 + 2 * bigCount; ++i)
+   {
+      const std::uint64_t offset = ReadValue<std::uint64_t>(index, pos);
+      const std::uint32_t w = ReadValue<std::uint32_t>(index, pos);
+      pos += 2 * sizeof(std::uint32_t);
+      const std::uint32_t channel = ReadValue<std::uint32_t>(index, pos);
+      if (i < 3)
+      {
+         EXPECT_EQ(static_cast<std::uint64_t>(i) * frameBytes, offset);
+         EXPECT_EQ(width, w);
+         EXPECT_EQ(0u, channel);
+      }
+      else
+      {
+         EXPECT_EQ(start + (i - 3) * channelBytes, offset);
+         EXPECT_EQ(bigWidth, w);
+         EXPECT_EQ(static_cast<std::uint32_t>((i - 3) % 2), channel);
+      }
+      pos += ReadValue<std::uint32_t>(index, pos);
+   }
+   EXPECT_EQ(index.size(), pos);
+
+   std::remove((prefix + ".raw").c_str());
+   std::remove((prefix + ".idx").c_str());
+}
+
+TEST(DiskStreamWriterTests, DestroyWithoutStopping)
+{
+   CircularBuffer buf(4);
+   ASSERT_TRUE(buf.Initialize(1, width, height, depth));
+   const std::string prefix = ScratchPrefix("DiskStreamWriter-Tests-2");
+   {
+      DiskStreamWriter writer(&buf, prefix, nullptr);
+      InsertFrames(buf, 0, 100);
+   }
+   std::remove((prefix + ".raw").c_str());
+   std::remove((prefix + ".idx").c_str());
+}
+
+TEST(DiskStreamWriterTests, FailsForMissingDirectory)
+{
+   CircularBuffer buf(1);
+   EXPECT_THROW(DiskStreamWriter(&buf,
+            ScratchPrefix("no-such-directory/x"), nullptr), CMMError);
+}
+
+
+int main(int argc, char **argv)
+{
+   ::testing::InitGoogleTest(&argc, argv);
+   return RUN_ALL_TESTS();
+}
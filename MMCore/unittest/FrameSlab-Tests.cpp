@@ -0,0 +1,64 @@
+#include <gtest/gtest.h>
+
+#include "FrameSlab.h"
+
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+
+TEST(FrameSlabTests, MapsZeroedMemoryOnDemand)
+{
+   const std::size_t bytes = 32 << 20;
+   FrameSlab slab(bytes, false);
+   ASSERT_NE(nullptr, slab.GetData());
+   EXPECT_GE(slab.GetSize(), bytes);
+   EXPECT_FALSE(slab.UsesHugePages());
+
+   EXPECT_EQ(0, slab.GetData()[0]);
+   EXPECT_EQ(0, slab.GetData()[bytes - 1]);
+#if defined(__linux__) || defined(__APPLE__)
+   EXPECT_LT(slab.GetResidentBytes(), bytes / 2);
+   std::memset(slab.GetData(), 1, 1 << 20);
+   EXPECT_GE(slab.GetResidentBytes(), std::size_t(1 << 20));
+#endif
+}
+
+TEST(FrameSlabTests, PrefaultKeepsContents)
+{
+   const std::size_t bytes = 16 << 20;
+   FrameSlab slab(bytes, false);
+   slab.GetData()[12345] = 42;
+   slab.StartPrefault();
+   slab.GetData()[bytes - 1] = 7;
+   while (slab.IsPrefaulting())
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+   EXPECT_EQ(42, slab.GetData()[12345]);
+   EXPECT_EQ(7, slab.GetData()[bytes - 1]);
+   EXPECT_EQ(0, slab.GetData()[bytes / 2]);
+   EXPECT_GE(slab.GetResidentBytes(), bytes);
+}
+
+TEST(FrameSlabTests, FallsBackToNormalPages)
+{
+   // Huge pages are usually not reserved; either way the slab is usable
+   FrameSlab slab(3 << 20, true);
+   ASSERT_NE(nullptr, slab.GetData());
+   EXPECT_GE(slab.GetSize(), std::size_t(3 << 20));
+   EXPECT_EQ(0, slab.GetSize() % slab.GetPageSize());
+   slab.GetData()[slab.GetSize() - 1] = 1;
+}
+
+TEST(FrameSlabTests, DestroyWhilePrefaulting)
+{
+   FrameSlab slab(256 << 20, false);
+   slab.StartPrefault();
+}
+
+
+int main(int argc, char **argv)
+{
+   ::testing::InitGoogleTest(&argc, argv);
+   return RUN_ALL_TESTS();
+}
@@ -0,0 +1,180 @@
+#include <gtest/gtest.h>
+
+#include "ImageInsertQueue.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+namespace {
+
+// Stands in for the sequence buffer: records inserted images and can be
+// held up to simulate a slow copy.
+class FakeBuffer
+{
+public:
+   FakeBuffer() : blocked_(false), result_(DEVICE_OK) {}
+
+   int Insert(const unsigned char* buf, BinaryMetadata& md)
+   {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, [&] { return !blocked_; });
+      inserted_.push_back(buf[0]);
+      EXPECT_STREQ("Cam", md.FindString("Camera"));
+      return result_;
+   }
+
+   void Block()
+   {
+      std::lock_guard<std::mutex> lock(mutex_);
+      blocked_ = true;
+   }
+
+   void Unblock()
+   {
+      {
+         std::lock_guard<std::mutex> lock(mutex_);
+         blocked_ = false;
+      }
+      cv_.notify_all();
+   }
+
+   void SetResult(int result)
+   {
+      std::lock_guard<std::mutex> lock(mutex_);
+      result_ = result;
+   }
+
+   std::vector<unsigned char> Inserted()
+   {
+      std::lock_guard<std::mutex> lock(mutex_);
+      return inserted_;
+   }
+
+private:
+   std::mutex mutex_;
+   std::condition_variable cv_;
+   bool blocked_;
+   int result_;
+   std::vector<unsigned char> inserted_;
+};
+
+ImageInsertQueue::InsertFunction InsertInto(FakeBuffer& buffer)
+{
+   return [&buffer](const MM::Device*, const unsigned char* buf, unsigned,
+         unsigned, unsigned, unsigned, BinaryMetadata& md) {
+      return buffer.Insert(buf, md);
+   };
+}
+
+std::atomic<int> releasedCount(0);
+
+void CountRelease(void* context, const unsigned char* buf)
+{
+   EXPECT_EQ(context, buf);
+   ++releasedCount;
+}
+
+const MM::Device* const camera1 = reinterpret_cast<const MM::Device*>(1);
+const MM::Device* const camera2 = reinterpret_cast<const MM::Device*>(2);
+
+int Enqueue(ImageInsertQueue& queue, const MM::Device* caller,
+      unsigned char* frame)
+{
+   BinaryMetadata md;
+   md.PutImageTag("Camera", "Cam");
+   return queue.Enqueue(caller, frame, 1, 1, 1, 1, md.GetRecords(),
+         static_cast<unsigned>(md.GetRecordsSize()), CountRelease, frame);
+}
+
+} // anonymous namespace
+
+
+TEST(ImageInsertQueueTests, InsertsInOrderAndReleases)
+{
+   releasedCount = 0;
+   FakeBuffer buffer;
+   std::vector<unsigned char> frames(100);
+   {
+      ImageInsertQueue queue(4, InsertInto(buffer));
+      EXPECT_EQ(4u, queue.GetDepth());
+      for (size_t i = 0; i < frames.size(); ++i)
+      {
+         frames[i] = static_cast<unsigned char>(i);
+         ASSERT_EQ(DEVICE_OK, Enqueue(queue, camera1, &frames[i]));
+      }
+      EXPECT_EQ(DEVICE_OK, queue.Flush(camera1));
+      EXPECT_EQ(100, releasedCount.load());
+   }
+   EXPECT_EQ(frames, buffer.Inserted());
+}
+
+TEST(ImageInsertQueueTests, BlocksWhenFull)
+{
+   releasedCount = 0;
+   FakeBuffer buffer;
+   buffer.Block();
+   std::vector<unsigned char> frames(3);
+   ImageInsertQueue queue(2, InsertInto(buffer));
+   ASSERT_EQ(DEVICE_OK, Enqueue(queue, camera1, &frames[0]));
+   ASSERT_EQ(DEVICE_OK, Enqueue(queue, camera1, &frames[1]));
+
+   std::atomic<bool> queued(false);
+   std::thread producer([&] {
+      EXPECT_EQ(DEVICE_OK, Enqueue(queue, camera1, &frames[2]));
+      queued = true;
+   });
+   std::this_thread::sleep_for(std::chrono::milliseconds(50));
+   EXPECT_FALSE(queued.load());
+   EXPECT_EQ(0, releasedCount.load());
+
+   buffer.Unblock();
+   producer.join();
+   EXPECT_TRUE(queued.load());
+   EXPECT_EQ(DEVICE_OK, queue.Flush(camera1));
+   EXPECT_EQ(3, releasedCount.load());
+}
+
+TEST(ImageInsertQueueTests, ReportsErrorsToTheCallerOnce)
+{
+   releasedCount = 0;
+   FakeBuffer buffer;
+   buffer.SetResult(DEVICE_BUFFER_OVERFLOW);
+   std::vector<unsigned char> frames(3);
+   ImageInsertQueue queue(2, InsertInto(buffer));
+   ASSERT_EQ(DEVICE_OK, Enqueue(queue, camera1, &frames[0]));
+   queue.Flush(camera2);
+   EXPECT_EQ(1, releasedCount.load()); // The failed image is dropped
+
+   buffer.SetResult(DEVICE_OK);
+   EXPECT_EQ(DEVICE_OK, Enqueue(queue, camera2, &frames[1]));
+   EXPECT_EQ(DEVICE_BUFFER_OVERFLOW, Enqueue(queue, camera1, &frames[2]));
+   EXPECT_EQ(DEVICE_OK, Enqueue(queue, camera1, &frames[2]));
+   EXPECT_EQ(DEVICE_OK, queue.Flush(camera1));
+   EXPECT_EQ(3, releasedCount.load());
+}
+
+TEST(ImageInsertQueueTests, RejectsMalformedMetadata)
+{
+   releasedCount = 0;
+   FakeBuffer buffer;
+   ImageInsertQueue queue(2, InsertInto(buffer));
+   unsigned char frame = 0;
+   const unsigned char garbage[4] = { 1, 2, 3, 4 };
+   EXPECT_EQ(DEVICE_INVALID_INPUT_PARAM, queue.Enqueue(camera1, &frame,
+            1, 1, 1, 1, garbage, sizeof(garbage), CountRelease, &frame));
+   EXPECT_EQ(DEVICE_OK, queue.Flush(camera1));
+   EXPECT_EQ(0, releasedCount.load());
+   EXPECT_TRUE(buffer.Inserted().empty());
+}
+
+
+int main(int argc, char **argv)
+{
+   ::testing::InitGoogleTest(&argc, argv);
+   return RUN_ALL_TESTS();
+}
@@ -0,0 +1,156 @@
+// Microbenchmark for the cost of log statements to the logging threads.
+//
+// First, logs to stderr at info level, as the Core does by default, and
+// times LOG_DEBUG statements, which are not written anywhere. The
+// "Unchecked" variant uses the logging macro as it was before it checked the
+// level, so that each statement formats its entry and hands it to the logging
+// core, only for the sink to discard it; the "Checked" variant uses the
+// current macro, which skips the statement after comparing the level with the
+// minimum level of the sinks. No entries are written by either variant.
+//
+// Then, times enabled statements logged from 1 to maxThreads threads at once
+// into an asynchronous sink that only counts the lines, once with the
+// default queue (which makes logging threads wait when it is full) and once
+// with a small queue dropping the oldest entries, reporting the time per
+// statement seen by each logging thread and the number of entries dropped.
+//
+// Usage: Logger-Bench [iterations] [maxThreads]
+
+#include "LogManager.h"
+#include "Logging/Logging.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+// The LOG_WITH_LEVEL macro without the level check
+#define UNCHECKED_LOG_DEBUG(logger) \
+   for (::mm::logging::LogStream strm((logger), \
+            ::mm::logging::LogLevelDebug); \
+         !strm.Used(); strm.MarkUsed()) \
+      strm
+
+
+namespace {
+
+template <typename F>
+double NanosecondsPerCall(long iterations, F f)
+{
+   const auto start = std::chrono::steady_clock::now();
+   for (long i = 0; i < iterations; ++i)
+      f(i);
+   const std::chrono::duration<double, std::nano> elapsed =
+      std::chrono::steady_clock::now() - start;
+   return elapsed.count() / iterations;
+}
+
+class CountingSink : public mm::logging::LogSink
+{
+public:
+   std::atomic<long long> lineCount{ 0 };
+
+   virtual void Consume(const PacketArrayType& packets)
+   {
+      long long n = 0;
+      for (PacketArrayType::ConstIteratorType it = packets.Begin(),
+            end = packets.End(); it != end; ++it)
+         ++n;
+      lineCount.fetch_add(n, std::memory_order_relaxed);
+   }
+};
+
+// Returns the mean time per statement on each thread
+double NanosecondsPerConcurrentCall(mm::logging::LoggingCore& core,
+      long iterations, int threadCount)
+{
+   std::vector<double> perThread(threadCount);
+   std::vector<std::thread> threads;
+   for (int t = 0; t < threadCount; ++t)
+   {
+      threads.emplace_back([&core, &perThread, iterations, t] {
+         mm::logging::Logger logger =
+            core.NewLogger("Thread" + std::to_string(t));
+         perThread[t] = NanosecondsPerCall(iterations, [&](long i) {
+            LOG_INFO(logger) << "Sent 12 bytes to port COM" << t <<
+               " (request " << i << ")";
+         });
+      });
+   }
+   double sum = 0.0;
+   for (int t = 0; t < threadCount; ++t)
+   {
+      threads[t].join();
+      sum += perThread[t];
+   }
+   return sum / threadCount;
+}
+
+void ReportConcurrent(const char* name, long iterations, int maxThreads,
+      bool dropOldest)
+{
+   for (int threadCount = 1; threadCount <= maxThreads; threadCount *= 2)
+   {
+      std::shared_ptr<mm::logging::LoggingCore> core =
+         std::make_shared<mm::logging::LoggingCore>();
+      if (dropOldest)
+      {
+         core->SetAsyncQueueCapacity(256);
+         core->SetAsyncQueueOverflowPolicy(
+               mm::logging::OverflowPolicyDropOldest);
+      }
+      std::shared_ptr<CountingSink> sink = std::make_shared<CountingSink>();
+      core->AddSink(sink, mm::logging::SinkModeAsynchronous);
+
+      const double ns =
+         NanosecondsPerConcurrentCall(*core, iterations, threadCount);
+      core->RemoveSink(sink, mm::logging::SinkModeAsynchronous);
+
+      std::printf("%-12s %8d %12.1f %12llu\n", name, threadCount, ns,
+            core->GetDroppedEntryCount());
+   }
+}
+
+} // anonymous namespace
+
+
+int main(int argc, char** argv)
+{
+   long iterations = argc > 1 ? std::atol(argv[1]) : 1000000;
+   int maxThreads = argc > 2 ? std::atoi(argv[2]) : 8;
+
+   mm::LogManager logManager;
+   logManager.SetPrimaryLogLevel(mm::logging::LogLevelInfo);
+   logManager.SetUseStdErr(true);
+   mm::logging::Logger logger = logManager.NewLogger("Bench");
+   const std::string label = "Camera";
+
+   const double unchecked = NanosecondsPerCall(iterations, [&](long i) {
+      UNCHECKED_LOG_DEBUG(logger) << "Waiting for device " << label <<
+         " (attempt " << i << ")";
+   });
+   const double checked = NanosecondsPerCall(iterations, [&](long i) {
+      LOG_DEBUG(logger) << "Waiting for device " << label <<
+         " (attempt " << i << ")";
+   });
+
+   logManager.SetUseStdErr(false);
+
+   std::printf("%ld disabled statements\n", iterations);
+   std::printf("%-12s %12s\n", "variant", "ns/stmt");
+   std::printf("%-12s %12.1f\n", "Unchecked", unchecked);
+   std::printf("%-12s %12.1f\n", "Checked", checked);
+
+   const long enabledIterations = iterations / 10;
+   std::printf("\n%ld enabled statements per thread\n", enabledIterations);
+   std::printf("%-12s %8s %12s %12s\n", "queue", "threads", "ns/stmt",
+         "dropped");
+   ReportConcurrent("Block", enabledIterations, maxThreads, false);
+   ReportConcurrent("DropOldest", enabledIterations, maxThreads, true);
+   return 0;
+}
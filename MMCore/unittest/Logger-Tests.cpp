@@ -2,8 +2,10 @@
 
 #include "Logging/Logging.h"
 
+#include <condition_variable>
 #include <functional>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <thread>
 #include <vector>
@@ -11,6 +13,64 @@
 using namespace mm::logging;
 
 
+namespace {
+
+// Collects entry first lines; can be made to hold up the receive thread
+class CollectingSink : public LogSink
+{
+   std::mutex mutex_;
+   std::condition_variable condVar_;
+   bool holding_;
+   bool held_;
+   std::vector<std::string> lines_;
+
+public:
+   CollectingSink() : holding_(false), held_(false) {}
+
+   virtual void Consume(const PacketArrayType& packets)
+   {
+      std::unique_lock<std::mutex> lock(mutex_);
+      for (PacketArrayType::ConstIteratorType it = packets.Begin(),
+            end = packets.End(); it != end; ++it)
+      {
+         lines_.push_back(it->GetText());
+      }
+      held_ = holding_;
+      condVar_.notify_all();
+      condVar_.wait(lock, [this] { return !holding_; });
+   }
+
+   // Hold up the receive thread the next time it passes entries
+   void Hold()
+   {
+      std::lock_guard<std::mutex> lock(mutex_);
+      holding_ = true;
+   }
+
+   void WaitUntilHeld()
+   {
+      std::unique_lock<std::mutex> lock(mutex_);
+      condVar_.wait(lock, [this] { return held_; });
+   }
+
+   void Release()
+   {
+      std::lock_guard<std::mutex> lock(mutex_);
+      holding_ = false;
+      held_ = false;
+      condVar_.notify_all();
+   }
+
+   std::vector<std::string> GetLines()
+   {
+      std::lock_guard<std::mutex> lock(mutex_);
+      return lines_;
+   }
+};
+
+} // anonymous namespace
+
+
 TEST(LoggerTests, BasicSynchronous)
 {
    std::shared_ptr<LoggingCore> c =
@@ -54,6 +114,128 @@ TEST(LoggerTests, BasicLogStream)
 }
 
 
+TEST(LoggerTests, MinimumLevelSkipsFormatting)
+{
+   std::shared_ptr<LoggingCore> c =
+      std::make_shared<LoggingCore>();
+
+   c->AddSink(std::make_shared<StdErrLogSink>(), SinkModeSynchronous);
+
+   Logger lgr = c->NewLogger("mylabel");
+   int formatted = 0;
+   auto operand = [&formatted] { return ++formatted; };
+
+   EXPECT_TRUE(lgr.IsEnabled(LogLevelTrace));
+   LOG_TRACE(lgr) << operand();
+   EXPECT_EQ(1, formatted);
+
+   c->SetMinimumLevel(LogLevelInfo);
+   EXPECT_FALSE(lgr.IsEnabled(LogLevelDebug));
+   EXPECT_TRUE(lgr.IsEnabled(LogLevelInfo));
+   LOG_DEBUG(lgr) << operand();
+   EXPECT_EQ(1, formatted);
+   LOG_INFO(lgr) << operand();
+   EXPECT_EQ(2, formatted);
+
+   // Must not capture a following else
+   bool elseTaken = false;
+   if (formatted == 0)
+      LOG_DEBUG(lgr) << operand();
+   else
+      elseTaken = true;
+   EXPECT_TRUE(elseTaken);
+}
+
+
+TEST(LoggerTests, QueueDropsOldestWhenFull)
+{
+   std::shared_ptr<LoggingCore> c =
+      std::make_shared<LoggingCore>();
+   c->SetAsyncQueueCapacity(4);
+   c->SetAsyncQueueOverflowPolicy(OverflowPolicyDropOldest);
+   std::shared_ptr<CollectingSink> sink = std::make_shared<CollectingSink>();
+   c->AddSink(sink, SinkModeAsynchronous);
+
+   Logger lgr = c->NewLogger("mylabel");
+   sink->Hold();
+   LOG_INFO(lgr) << "first";
+   sink->WaitUntilHeld();
+   for (int i = 0; i < 10; ++i)
+      LOG_INFO(lgr) << i;
+   EXPECT_EQ(6u, c->GetDroppedEntryCount());
+   sink->Release();
+   c->RemoveSink(sink, SinkModeAsynchronous);
+
+   EXPECT_EQ(std::vector<std::string>({ "first", "6", "7", "8", "9" }),
+         sink->GetLines());
+}
+
+
+TEST(LoggerTests, QueueDropsOnlyDroppableWhenFull)
+{
+   std::shared_ptr<LoggingCore> c =
+      std::make_shared<LoggingCore>();
+   c->SetAsyncQueueCapacity(2);
+   c->SetAsyncQueueOverflowPolicy(OverflowPolicyDropDebug, LogLevelInfo);
+   std::shared_ptr<CollectingSink> sink = std::make_shared<CollectingSink>();
+   c->AddSink(sink, SinkModeAsynchronous);
+
+   Logger lgr = c->NewLogger("mylabel");
+   sink->Hold();
+   LOG_INFO(lgr) << "first";
+   sink->WaitUntilHeld();
+   LOG_INFO(lgr) << "a";
+   LOG_DEBUG(lgr) << "b";
+   LOG_DEBUG(lgr) << "c"; // Dropped
+   EXPECT_EQ(1u, c->GetDroppedEntryCount());
+
+   // Waits for room
+   std::thread t([&] { LOG_INFO(lgr) << "d"; });
+   sink->Release();
+   t.join();
+   c->RemoveSink(sink, SinkModeAsynchronous);
+
+   EXPECT_EQ(std::vector<std::string>({ "first", "a", "b", "d" }),
+         sink->GetLines());
+   EXPECT_EQ(1u, c->GetDroppedEntryCount());
+}
+
+
+TEST(LoggerTests, QueueKeepsEntriesWholeWhenBlocking)
+{
+   std::shared_ptr<LoggingCore> c =
+      std::make_shared<LoggingCore>();
+   c->SetAsyncQueueCapacity(16);
+   c->SetAsyncQueueFlushInterval(std::chrono::milliseconds(1));
+   std::shared_ptr<CollectingSink> sink = std::make_shared<CollectingSink>();
+   c->AddSink(sink, SinkModeAsynchronous);
+
+   const int threadCount = 4;
+   const int entryCount = 1000;
+   std::vector<std::thread> threads;
+   for (int i = 0; i < threadCount; ++i)
+   {
+      threads.emplace_back([&c, i] {
+         Logger lgr = c->NewLogger("thread" + std::to_string(i));
+         for (int j = 0; j < entryCount; ++j)
+            LOG_INFO(lgr) << i << '\n' << i << '\n' << i;
+      });
+   }
+   for (std::thread& t : threads)
+      t.join();
+   c->RemoveSink(sink, SinkModeAsynchronous);
+
+   const std::vector<std::string> lines = sink->GetLines();
+   ASSERT_EQ(size_t(3 * threadCount * entryCount), lines.size());
+   for (size_t k = 0; k < lines.size(); k += 3)
+   {
+      EXPECT_EQ(lines[k], lines[k + 1]);
+      EXPECT_EQ(lines[k], lines[k + 2]);
+   }
+   EXPECT_EQ(0u, c->GetDroppedEntryCount());
+}
+
+
 class LoggerTestThreadFunc
 {
    unsigned n_;
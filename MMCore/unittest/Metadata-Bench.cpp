@@ -0,0 +1,199 @@
+// Microbenchmark for the per-frame metadata cost of inserting an image.
+//
+// Replays the metadata handling that happens between a camera calling
+// InsertImage() with serialized metadata and the frame being stored in the
+// sequence buffer: parse the camera's metadata, merge in the camera's own
+// tags, add the Core's image tags and store the result with the frame. The
+// "Metadata" variant does this the way the Core did before BinaryMetadata was
+// introduced; the "BinaryMetadata" variant the way it does now. The "Typed"
+// variant also builds the camera's metadata as a BinaryMetadata and passes
+// it in binary form, as CCameraBase does. Reports the time and the number
+// of heap allocations per frame.
+//
+// Usage: Metadata-Bench [frameCount]
+
+#include "../../MMDevice/BinaryMetadata.h"
+#include "../../MMDevice/ImageMetadata.h"
+#include "../../MMDevice/MMDeviceConstants.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+
+
+namespace {
+
+std::atomic<long long> allocationCount(0);
+
+} // anonymous namespace
+
+void* operator new(std::size_t size)
+{
+   allocationCount.fetch_add(1, std::memory_order_relaxed);
+   void* p = std::malloc(size ? size : 1);
+   if (!p)
+      throw std::bad_alloc();
+   return p;
+}
+
+void operator delete(void* p) noexcept
+{
+   std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+   std::free(p);
+}
+
+
+namespace {
+
+// What a typical camera adapter sends with each frame (CCameraBase adds
+// the ROI tags; many adapters add a few of their own).
+std::string FrameMetadata()
+{
+   Metadata md;
+   md.PutImageTag(MM::g_Keyword_Binning, 1);
+   md.PutImageTag("ROI-X-start", 0);
+   md.PutImageTag("ROI-Y-start", 0);
+   md.PutImageTag("Sensor temperature", -20.0);
+   md.PutImageTag("Frame timestamp", 123456789);
+   return md.Serialize();
+}
+
+// Tags returned by the camera's GetTags().
+std::string CameraTags()
+{
+   Metadata md;
+   md.PutTag("Gain", "BenchCam", 2);
+   md.PutTag("Readout mode", "BenchCam", "Fast");
+   return md.Serialize();
+}
+
+long long MetadataFrame(const std::string& serialized,
+      const std::string& cameraTags, long imageNumber)
+{
+   // CoreCallback::InsertImage()
+   Metadata origMd;
+   origMd.Restore(serialized.c_str());
+
+   // CoreCallback::AddCameraMetadata()
+   Metadata newMd;
+   newMd.PutImageTag("Camera", "BenchCam");
+   Metadata devMd;
+   devMd.Restore(cameraTags.c_str());
+   newMd.Merge(devMd);
+   newMd.Merge(origMd);
+
+   // CircularBuffer::InsertMultiChannel()
+   Metadata md = newMd;
+   md.PutImageTag(MM::g_Keyword_Metadata_ImageNumber, imageNumber);
+   md.PutImageTag(MM::g_Keyword_Elapsed_Time_ms, imageNumber * 10);
+   md.PutImageTag(MM::g_Keyword_Metadata_TimeInCore, "2024-01-01 12:00:00.000000");
+   md.PutImageTag("Width", 512);
+   md.PutImageTag("Height", 512);
+   md.PutImageTag(MM::g_Keyword_PixelType, "GRAY16");
+
+   // ImgBuffer::SetMetadata()
+   Metadata stored;
+   stored.Restore(md.Serialize().c_str());
+   return static_cast<long long>(stored.GetKeys().size());
+}
+
+void StoreFrame(const BinaryMetadata& md, long imageNumber,
+      BinaryMetadata& stored)
+{
+   // CircularBuffer::InsertMultiChannel(), into the slot's own metadata
+   stored = md;
+   stored.PutImageTag(MM::g_Keyword_Metadata_ImageNumber, imageNumber);
+   stored.PutImageTag(MM::g_Keyword_Elapsed_Time_ms, imageNumber * 10);
+   stored.PutImageTag(MM::g_Keyword_Metadata_TimeInCore, "2024-01-01 12:00:00.000000");
+   stored.PutImageTag("Width", 512);
+   stored.PutImageTag("Height", 512);
+   stored.PutImageTag(MM::g_Keyword_PixelType, "GRAY16");
+}
+
+long long BinaryMetadataFrame(const std::string& serialized,
+      const std::string& cameraTags, long imageNumber,
+      BinaryMetadata& md, BinaryMetadata& stored)
+{
+   // CoreCallback::InsertImage() and AddCameraMetadata()
+   md.Restore(serialized.c_str());
+   md.PutImageTag("Camera", "BenchCam");
+   md.MergeSerialized(cameraTags.c_str());
+
+   StoreFrame(md, imageNumber, stored);
+   return static_cast<long long>(stored.GetTagCount());
+}
+
+long long TypedFrame(const std::string& cameraTags, long imageNumber,
+      BinaryMetadata& camMd, BinaryMetadata& md, BinaryMetadata& stored)
+{
+   // The camera adapter
+   camMd.Clear();
+   camMd.PutImageTag(MM::g_Keyword_Binning, 1);
+   camMd.PutImageTag("ROI-X-start", 0);
+   camMd.PutImageTag("ROI-Y-start", 0);
+   camMd.PutImageTag("Sensor temperature", -20.0);
+   camMd.PutImageTag("Frame timestamp", 123456789);
+
+   // CoreCallback::InsertImage() and AddCameraMetadata()
+   md.AssignRecords(camMd.GetRecords(), camMd.GetRecordsSize());
+   md.PutImageTag("Camera", "BenchCam");
+   md.MergeSerialized(cameraTags.c_str());
+
+   StoreFrame(md, imageNumber, stored);
+   return static_cast<long long>(stored.GetTagCount());
+}
+
+template <typename F>
+void Report(const char* name, long frameCount, F frame)
+{
+   long long sink = 0;
+   for (long i = 0; i < frameCount / 10; ++i) // Warm up
+      sink += frame(i);
+
+   using namespace std::chrono;
+   long long allocsBefore = allocationCount.load();
+   auto start = steady_clock::now();
+   for (long i = 0; i < frameCount; ++i)
+      sink += frame(i);
+   auto elapsed = duration<double, std::nano>(steady_clock::now() - start);
+   long long allocs = allocationCount.load() - allocsBefore;
+
+   std::printf("%-16s %10.0f ns/frame   %8.1f allocations/frame   (%lld)\n",
+         name, elapsed.count() / frameCount,
+         static_cast<double>(allocs) / frameCount, sink);
+}
+
+} // anonymous namespace
+
+
+int main(int argc, char** argv)
+{
+   long frameCount = argc > 1 ? std::atol(argv[1]) : 200000;
+   const std::string serialized = FrameMetadata();
+   const std::string cameraTags = CameraTags();
+
+   std::printf("%ld frames\n", frameCount);
+
+   Report("Metadata", frameCount, [&](long i) {
+      return MetadataFrame(serialized, cameraTags, i);
+   });
+
+   BinaryMetadata md;
+   BinaryMetadata stored;
+   Report("BinaryMetadata", frameCount, [&](long i) {
+      return BinaryMetadataFrame(serialized, cameraTags, i, md, stored);
+   });
+
+   BinaryMetadata camMd;
+   Report("Typed", frameCount, [&](long i) {
+      return TypedFrame(cameraTags, i, camMd, md, stored);
+   });
+   return 0;
+}
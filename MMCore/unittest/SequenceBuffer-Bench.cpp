@@ -0,0 +1,130 @@
+// Stress benchmark for the sequence buffer implementations.
+//
+// A producer thread inserts frames as fast as possible while consumer
+// threads pop them (as the Java popNextImage() loop does) and a display
+// thread peeks at the most recent frame. Reports throughput and insert
+// latency percentiles for each implementation.
+//
+// Usage: SequenceBuffer-Bench [width height frameCount consumerCount]
+
+#include "CircularBuffer.h"
+#include "LockFreeSequenceBuffer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+namespace {
+
+struct BenchParams
+{
+   unsigned width;
+   unsigned height;
+   long frameCount;
+   unsigned consumerCount;
+};
+
+void RunBench(const std::string& name, SequenceBuffer& buf,
+      const BenchParams& p)
+{
+   const unsigned depth = 2;
+   if (!buf.Initialize(1, p.width, p.height, depth))
+   {
+      std::printf("%s: failed to initialize\n", name.c_str());
+      return;
+   }
+
+   std::atomic<long> popped(0);
+   std::atomic<bool> done(false);
+
+   std::vector<std::thread> consumers;
+   for (unsigned i = 0; i < p.consumerCount; ++i)
+   {
+      consumers.emplace_back([&]() {
+         while (popped.load(std::memory_order_relaxed) < p.frameCount)
+         {
+            if (buf.GetNextImage())
+               popped.fetch_add(1, std::memory_order_relaxed);
+         }
+      });
+   }
+   std::thread display([&]() {
+      while (!done.load(std::memory_order_relaxed))
+      {
+         buf.GetTopImage();
+         buf.Width();
+         buf.Height();
+         buf.GetRemainingImageCount();
+      }
+   });
+
+   std::vector<unsigned char> pixels(p.width * p.height * depth);
+   Metadata md;
+   md.put("Camera", "BenchCam");
+
+   std::vector<double> latenciesUs;
+   latenciesUs.reserve(p.frameCount);
+   long overflows = 0;
+
+   using namespace std::chrono;
+   auto start = steady_clock::now();
+   for (long i = 0; i < p.frameCount; )
+   {
+      auto t0 = steady_clock::now();
+      bool ok = buf.InsertImage(&pixels[0], p.width, p.height, depth, &md);
+      auto t1 = steady_clock::now();
+      if (!ok)
+      {
+         ++overflows;
+         continue;
+      }
+      latenciesUs.push_back(duration<double, std::micro>(t1 - t0).count());
+      ++i;
+   }
+   for (auto& t : consumers)
+      t.join();
+   auto elapsed = duration<double>(steady_clock::now() - start).count();
+   done.store(true);
+   display.join();
+
+   std::sort(latenciesUs.begin(), latenciesUs.end());
+   auto percentile = [&](double q) {
+      return latenciesUs[static_cast<size_t>(q * (latenciesUs.size() - 1))];
+   };
+   std::printf("%-12s %10.0f frames/s   insert p50 %8.2f us   p99 %8.2f us"
+         "   max %9.2f us   overflow retries %ld\n",
+         name.c_str(), p.frameCount / elapsed, percentile(0.50),
+         percentile(0.99), latenciesUs.back(), overflows);
+}
+
+} // anonymous namespace
+
+
+int main(int argc, char** argv)
+{
+   BenchParams p;
+   p.width = argc > 1 ? std::atoi(argv[1]) : 128;
+   p.height = argc > 2 ? std::atoi(argv[2]) : 128;
+   p.frameCount = argc > 3 ? std::atol(argv[3]) : 200000;
+   p.consumerCount = argc > 4 ? std::atoi(argv[4]) : 1;
+
+   std::printf("%ux%u 16-bit, %ld frames, %u consumer(s)\n",
+         p.width, p.height, p.frameCount, p.consumerCount);
+
+   {
+      CircularBuffer buf(250);
+      RunBench("Circular", buf, p);
+   }
+   {
+      LockFreeSequenceBuffer buf(250);
+      RunBench("LockFree", buf, p);
+   }
+   return 0;
+}
@@ -0,0 +1,426 @@
+#include <gtest/gtest.h>
+
+#include "CircularBuffer.h"
+#include "LockFreeSequenceBuffer.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+namespace {
+
+const unsigned width = 64;
+const unsigned height = 32;
+const unsigned depth = 2;
+const unsigned frameBytes = width * height * depth;
+
+Metadata CameraMetadata()
+{
+   Metadata md;
+   md.put("Camera", "Cam");
+   return md;
+}
+
+long ImageNumber(const mm::ImgBuffer* img)
+{
+   return std::atol(img->GetMetadata().GetSingleTag(
+            MM::g_Keyword_Metadata_ImageNumber).GetValue().c_str());
+}
+
+std::string ScratchDirectory()
+{
+#ifdef _WIN32
+   const char* dir = std::getenv("TEMP");
+   return dir ? dir : ".";
+#else
+   const char* dir = std::getenv("TMPDIR");
+   return dir ? dir : "/tmp";
+#endif
+}
+
+} // anonymous namespace
+
+
+template <typename T>
+class SequenceBufferTest : public ::testing::Test
+{
+protected:
+   // 1 MB holds somewhat fewer than 256 frames of 4 kB, because each slot
+   // also costs its bookkeeping
+   SequenceBufferTest() : buf_(new T(1)) {}
+
+   std::unique_ptr<SequenceBuffer> buf_;
+};
+
+typedef ::testing::Types<CircularBuffer, LockFreeSequenceBuffer>
+   SequenceBufferTypes;
+TYPED_TEST_CASE(SequenceBufferTest, SequenceBufferTypes);
+
+
+TYPED_TEST(SequenceBufferTest, InsertAndPopInOrder)
+{
+   ASSERT_TRUE(this->buf_->Initialize(1, width, height, depth));
+   const unsigned capacity = this->buf_->GetSize();
+   EXPECT_LT(200u, capacity);
+   EXPECT_GT(256u, capacity);
+   EXPECT_EQ(0u, this->buf_->GetRemainingImageCount());
+   EXPECT_EQ(nullptr, this->buf_->GetNextImage());
+   EXPECT_EQ(nullptr, this->buf_->GetTopImage());
+
+   std::vector<unsigned char> pixels(frameBytes);
+   Metadata md = CameraMetadata();
+   for (unsigned i = 0; i < 10; ++i)
+   {
+      pixels[0] = static_cast<unsigned char>(i);
+      ASSERT_TRUE(this->buf_->InsertImage(&pixels[0], width, height, depth, &md));
+   }
+   EXPECT_EQ(10u, this->buf_->GetRemainingImageCount());
+   EXPECT_EQ(capacity - 10, this->buf_->GetFreeSize());
+
+   EXPECT_EQ(9, this->buf_->GetTopImage()[0]);
+   EXPECT_EQ(7, this->buf_->GetNthFromTopImageBuffer(2)->GetPixels()[0]);
+   EXPECT_EQ(nullptr, this->buf_->GetNthFromTopImageBuffer(10));
+
+   for (unsigned i = 0; i < 10; ++i)
+   {
+      const mm::ImgBuffer* img = this->buf_->GetNextImageBuffer(0);
+      ASSERT_NE(nullptr, img);
+      EXPECT_EQ(i, img->GetPixels()[0]);
+      EXPECT_EQ(static_cast<long>(i), ImageNumber(img));
+   }
+   EXPECT_EQ(nullptr, this->buf_->GetNextImageBuffer(0));
+   EXPECT_FALSE(this->buf_->Overflow());
+}
+
+TYPED_TEST(SequenceBufferTest, OverflowAndClear)
+{
+   ASSERT_TRUE(this->buf_->Initialize(1, width, height, depth));
+   std::vector<unsigned char> pixels(frameBytes);
+   Metadata md = CameraMetadata();
+   for (unsigned i = 0; i < this->buf_->GetSize(); ++i)
+      ASSERT_TRUE(this->buf_->InsertImage(&pixels[0], width, height, depth, &md));
+   EXPECT_EQ(0u, this->buf_->GetFreeSize());
+   EXPECT_FALSE(this->buf_->InsertImage(&pixels[0], width, height, depth, &md));
+   EXPECT_TRUE(this->buf_->Overflow());
+
+   this->buf_->Clear();
+   EXPECT_FALSE(this->buf_->Overflow());
+   EXPECT_EQ(0u, this->buf_->GetRemainingImageCount());
+   EXPECT_TRUE(this->buf_->InsertImage(&pixels[0], width, height, depth, &md));
+   EXPECT_EQ(0, ImageNumber(this->buf_->GetNextImageBuffer(0)));
+}
+
+TYPED_TEST(SequenceBufferTest, RejectsIncompatibleImage)
+{
+   ASSERT_TRUE(this->buf_->Initialize(1, width, height, depth));
+   std::vector<unsigned char> pixels(frameBytes);
+   EXPECT_THROW(this->buf_->InsertImage(&pixels[0], width / 2, height, depth, 0),
+         CMMError);
+}
+
+TYPED_TEST(SequenceBufferTest, WriteSlotCommitAndAbandon)
+{
+   ASSERT_TRUE(this->buf_->Initialize(1, width, height, depth));
+   Metadata md = CameraMetadata();
+
+   EXPECT_FALSE(this->buf_->CommitWriteSlot(1, &md));
+   EXPECT_FALSE(this->buf_->AbandonWriteSlot());
+
+   unsigned char* pixels = this->buf_->AcquireWriteSlot(width, height, depth);
+   ASSERT_NE(nullptr, pixels);
+   EXPECT_EQ(0u, this->buf_->GetRemainingImageCount());
+   pixels[0] = 42;
+   EXPECT_TRUE(this->buf_->CommitWriteSlot(1, &md));
+   EXPECT_FALSE(this->buf_->CommitWriteSlot(1, &md));
+   EXPECT_EQ(1u, this->buf_->GetRemainingImageCount());
+
+   pixels = this->buf_->AcquireWriteSlot(width, height, depth);
+   ASSERT_NE(nullptr, pixels);
+   EXPECT_TRUE(this->buf_->AbandonWriteSlot());
+   EXPECT_EQ(1u, this->buf_->GetRemainingImageCount());
+
+   // Regular inserts are not blocked after the slot has been released
+   std::vector<unsigned char> frame(frameBytes, 7);
+   ASSERT_TRUE(this->buf_->InsertImage(&frame[0], width, height, depth, &md));
+
+   const mm::ImgBuffer* img = this->buf_->GetNextImageBuffer(0);
+   ASSERT_NE(nullptr, img);
+   EXPECT_EQ(42, img->GetPixels()[0]);
+   EXPECT_EQ(0, ImageNumber(img));
+   EXPECT_EQ("Cam", img->GetMetadata().GetSingleTag("Camera").GetValue());
+   img = this->buf_->GetNextImageBuffer(0);
+   ASSERT_NE(nullptr, img);
+   EXPECT_EQ(7, img->GetPixels()[0]);
+   EXPECT_EQ(1, ImageNumber(img));
+}
+
+TYPED_TEST(SequenceBufferTest, WriteSlotOverflowAndIncompatibleImage)
+{
+   ASSERT_TRUE(this->buf_->Initialize(1, width, height, depth));
+   EXPECT_THROW(this->buf_->AcquireWriteSlot(width, height / 2, depth),
+         CMMError);
+
+   Metadata md = CameraMetadata();
+   for (unsigned i = 0; i < this->buf_->GetSize(); ++i)
+   {
+      ASSERT_NE(nullptr, this->buf_->AcquireWriteSlot(width, height, depth));
+      ASSERT_TRUE(this->buf_->CommitWriteSlot(1, &md));
+   }
+   EXPECT_EQ(nullptr, this->buf_->AcquireWriteSlot(width, height, depth));
+   EXPECT_TRUE(this->buf_->Overflow());
+   EXPECT_FALSE(this->buf_->AbandonWriteSlot());
+
+   // Neither failure leaves the producer lock held
+   this->buf_->Clear();
+   std::vector<unsigned char> frame(frameBytes);
+   EXPECT_TRUE(this->buf_->InsertImage(&frame[0], width, height, depth, &md));
+}
+
+TYPED_TEST(SequenceBufferTest, WriteSlotRequiresSingleChannel)
+{
+   ASSERT_TRUE(this->buf_->Initialize(2, width, height, depth));
+   EXPECT_THROW(this->buf_->AcquireWriteSlot(width, height, depth), CMMError);
+
+   // The producer lock is not left held
+   std::vector<unsigned char> frame(2 * frameBytes);
+   Metadata md = CameraMetadata();
+   EXPECT_TRUE(this->buf_->InsertMultiChannel(&frame[0], 2, width, height,
+            depth, &md));
+}
+
+TYPED_TEST(SequenceBufferTest, GetNextFrameTakesAllChannels)
+{
+   ASSERT_TRUE(this->buf_->Initialize(2, width, height, depth));
+   EXPECT_EQ(2u, this->buf_->GetNumberOfChannels());
+   std::vector<const mm::ImgBuffer*> images;
+   EXPECT_FALSE(this->buf_->GetNextFrame(images));
+   EXPECT_TRUE(images.empty());
+
+   std::vector<unsigned char> frame(2 * frameBytes);
+   Metadata md = CameraMetadata();
+   for (unsigned i = 0; i < 2; ++i)
+   {
+      frame[0] = static_cast<unsigned char>(i);
+      frame[frameBytes] = static_cast<unsigned char>(i + 10);
+      ASSERT_TRUE(this->buf_->InsertMultiChannel(&frame[0], 2, width, height,
+               depth, &md));
+   }
+   for (unsigned i = 0; i < 2; ++i)
+   {
+      ASSERT_TRUE(this->buf_->GetNextFrame(images));
+      ASSERT_EQ(2u, images.size());
+      EXPECT_EQ(i, images[0]->GetPixels()[0]);
+      EXPECT_EQ(i + 10, images[1]->GetPixels()[0]);
+   }
+   EXPECT_FALSE(this->buf_->GetNextFrame(images));
+   EXPECT_EQ(0u, this->buf_->GetRemainingImageCount());
+}
+
+TYPED_TEST(SequenceBufferTest, WaitForImagesWakesOnInsertOrStop)
+{
+   ASSERT_TRUE(this->buf_->Initialize(1, width, height, depth));
+   std::vector<unsigned char> pixels(frameBytes);
+   Metadata md = CameraMetadata();
+
+   std::atomic<bool> stop(false);
+   std::thread waiter([&] {
+      this->buf_->WaitForImages([&] { return stop.load(); });
+   });
+   ASSERT_TRUE(this->buf_->InsertImage(&pixels[0], width, height, depth, &md));
+   waiter.join();
+
+   // With an image available, no waiting
+   this->buf_->WaitForImages([] { return false; });
+   ASSERT_NE(nullptr, this->buf_->GetNextImageBuffer(0));
+
+   std::thread stopped([&] {
+      this->buf_->WaitForImages([&] { return stop.load(); });
+   });
+   stop = true;
+   this->buf_->WakeImageWaiters();
+   stopped.join();
+}
+
+TYPED_TEST(SequenceBufferTest, ReinitializeForNewGeometry)
+{
+   ASSERT_TRUE(this->buf_->Initialize(1, width, height, depth));
+   const unsigned singleChannelCapacity = this->buf_->GetSize();
+   std::vector<unsigned char> pixels(frameBytes, 1);
+   Metadata md = CameraMetadata();
+   for (unsigned i = 0; i < this->buf_->GetSize(); ++i)
+      ASSERT_TRUE(this->buf_->InsertImage(&pixels[0], width, height, depth, &md));
+
+   // Two channels of a quarter of the size: more frames, though not twice
+   // as many since there are twice as many images to keep track of
+   ASSERT_TRUE(this->buf_->Initialize(2, width / 2, height / 2, depth));
+   EXPECT_LT(singleChannelCapacity, this->buf_->GetSize());
+   EXPECT_GT(2 * singleChannelCapacity, this->buf_->GetSize());
+   EXPECT_EQ(0u, this->buf_->GetRemainingImageCount());
+   EXPECT_EQ(nullptr, this->buf_->GetTopImage());
+
+   std::vector<unsigned char> frame(2 * frameBytes / 4);
+   for (unsigned i = 0; i < this->buf_->GetSize(); ++i)
+   {
+      frame[0] = static_cast<unsigned char>(i);
+      frame[frameBytes / 4] = static_cast<unsigned char>(i + 1);
+      ASSERT_TRUE(this->buf_->InsertMultiChannel(&frame[0], 2, width / 2,
+               height / 2, depth, &md));
+   }
+   for (unsigned i = 0; i < this->buf_->GetSize(); ++i)
+   {
+      const mm::ImgBuffer* img0 = this->buf_->GetNthFromTopImageBuffer(
+            this->buf_->GetSize() - 1 - i, 0);
+      const mm::ImgBuffer* img1 = this->buf_->GetNthFromTopImageBuffer(
+            this->buf_->GetSize() - 1 - i, 1);
+      ASSERT_NE(nullptr, img0);
+      ASSERT_NE(nullptr, img1);
+      EXPECT_EQ(width / 2, img0->Width());
+      EXPECT_EQ(static_cast<unsigned char>(i), img0->GetPixels()[0]);
+      EXPECT_EQ(static_cast<unsigned char>(i + 1), img1->GetPixels()[0]);
+   }
+
+   // Tiny frames: the per-image overhead, not the pixels, bounds the count
+   ASSERT_TRUE(this->buf_->Initialize(1, 1, 1, 1));
+   EXPECT_LT(0u, this->buf_->GetSize());
+   EXPECT_GE(1u << 20, this->buf_->GetSize() *
+         (1 + mm::ImgBuffer::GetOverheadBytes()));
+}
+
+TYPED_TEST(SequenceBufferTest, ConcurrentProducerAndConsumers)
+{
+   ASSERT_TRUE(this->buf_->Initialize(1, width, height, depth));
+   const long frameCount = 20000;
+   std::atomic<long> popped(0);
+   std::atomic<bool> outOfOrder(false);
+
+   // Frames carry their index in the pixel data. (Metadata is not read
+   // here because a popped slot may be reused by the producer.)
+   auto consumer = [&]() {
+      long last = -1;
+      while (popped.load() < frameCount)
+      {
+         const unsigned char* pix = this->buf_->GetNextImage();
+         if (!pix)
+         {
+            std::this_thread::yield();
+            continue;
+         }
+         // Each consumer must see increasing frame indices
+         long num;
+         std::memcpy(&num, pix, sizeof(num));
+         if (num <= last)
+            outOfOrder.store(true);
+         last = num;
+         ++popped;
+      }
+   };
+   std::thread c1(consumer);
+   std::thread c2(consumer);
+
+   std::vector<unsigned char> pixels(frameBytes);
+   Metadata md = CameraMetadata();
+   for (long i = 0; i < frameCount; )
+   {
+      // Stay well behind the consumers so that popped slots are not reused
+      // while they are being read
+      if (this->buf_->GetRemainingImageCount() > 16)
+      {
+         std::this_thread::yield();
+         continue;
+      }
+      std::memcpy(&pixels[0], &i, sizeof(i));
+      EXPECT_TRUE(this->buf_->InsertImage(&pixels[0], width, height, depth, &md));
+      ++i;
+      this->buf_->GetTopImage();
+   }
+
+   c1.join();
+   c2.join();
+   EXPECT_EQ(frameCount, popped.load());
+   EXPECT_FALSE(outOfOrder.load());
+   EXPECT_EQ(0u, this->buf_->GetRemainingImageCount());
+}
+
+TEST(CircularBufferSpillTest, SpillsOldestFramesAndReadsThemBackInOrder)
+{
+   // Somewhat fewer than 256 frames in memory and 256 in the spill file
+   CircularBuffer buf(1, nullptr, false, false, ScratchDirectory(), 1);
+   ASSERT_TRUE(buf.Initialize(1, width, height, depth));
+   EXPECT_EQ(256u, buf.GetSpillCapacity());
+   const long inMemory = static_cast<long>(buf.GetSize()) - 256;
+   const long total = static_cast<long>(buf.GetSize());
+   ASSERT_LT(100, inMemory);
+
+   std::vector<unsigned char> pixels(frameBytes);
+   Metadata md = CameraMetadata();
+   auto insert = [&](long i) {
+      std::memcpy(&pixels[0], &i, sizeof(i));
+      return buf.InsertImage(&pixels[0], width, height, depth, &md);
+   };
+   auto frameIndex = [](const mm::ImgBuffer* img) {
+      long i;
+      std::memcpy(&i, img->GetPixels(), sizeof(i));
+      return i;
+   };
+
+   for (long i = 0; i < inMemory + 44; ++i)
+      ASSERT_TRUE(insert(i));
+   EXPECT_EQ(44u, buf.GetSpilledImageCount());
+   EXPECT_EQ(44u, buf.GetTotalSpilledImageCount());
+   EXPECT_EQ(inMemory + 44, buf.GetRemainingImageCount());
+   EXPECT_EQ(212u, buf.GetFreeSize());
+   EXPECT_FALSE(buf.Overflow());
+
+   // Frames on disk and in memory can be looked at
+   EXPECT_EQ(0, frameIndex(buf.GetNthFromTopImageBuffer(inMemory + 43)));
+   EXPECT_EQ(43, frameIndex(buf.GetNthFromTopImageBuffer(inMemory)));
+   EXPECT_EQ(44, frameIndex(buf.GetNthFromTopImageBuffer(inMemory - 1)));
+
+   // Reading some frames makes room on disk again
+   for (long i = 0; i < 100; ++i)
+   {
+      const mm::ImgBuffer* img = buf.GetNextImageBuffer(0);
+      ASSERT_NE(nullptr, img);
+      EXPECT_EQ(i, frameIndex(img));
+      EXPECT_EQ(i, ImageNumber(img));
+   }
+   EXPECT_EQ(0u, buf.GetSpilledImageCount());
+   for (long i = inMemory + 44; i < total + 100; ++i)
+      ASSERT_TRUE(insert(i));
+   EXPECT_EQ(0u, buf.GetFreeSize());
+   EXPECT_EQ(256u, buf.GetSpilledImageCount());
+   EXPECT_FALSE(insert(total + 100));
+   EXPECT_TRUE(buf.Overflow());
+   EXPECT_GT(buf.GetSpillBandwidthMBps(), 0.0);
+
+   for (long i = 100; i < total + 100; ++i)
+   {
+      const mm::ImgBuffer* img = buf.GetNextImageBuffer(0);
+      ASSERT_NE(nullptr, img);
+      EXPECT_EQ(i, frameIndex(img));
+      EXPECT_EQ(i, ImageNumber(img));
+   }
+   EXPECT_EQ(nullptr, buf.GetNextImageBuffer(0));
+
+   buf.Clear();
+   EXPECT_EQ(0u, buf.GetTotalSpilledImageCount());
+   EXPECT_EQ(0.0, buf.GetSpillBandwidthMBps());
+}
+
+TEST(CircularBufferSpillTest, FailsForMissingDirectory)
+{
+   EXPECT_THROW(CircularBuffer(1, nullptr, false, false,
+            ScratchDirectory() + "/no-such-directory/x", 1), CMMError);
+}
+
+
+int main(int argc, char **argv)
+{
+   ::testing::InitGoogleTest(&argc, argv);
+   return RUN_ALL_TESTS();
+}
@@ -0,0 +1,173 @@
+// Task dispatch latency benchmark for the Core's thread pool.
+//
+// Measures the round trip of submitting a set of empty tasks and waiting for
+// them to finish, as TaskSet_CopyMemory does for every frame, with
+// ThreadPool and with a copy of the single-queue pool it replaced (one
+// mutex-protected deque, all threads woken for every batch). Also measures
+// the round trip of ThreadPool::Submit() for a single function. Reports the
+// median and 99th percentile in microseconds.
+//
+// Usage: ThreadPool-Bench [iterations]
+
+#include "Semaphore.h"
+#include "Task.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+namespace {
+
+// The pool before work stealing
+class SingleQueuePool
+{
+public:
+   explicit SingleQueuePool(size_t threadCount)
+   {
+      for (size_t n = 0; n < threadCount; ++n)
+         threads_.emplace_back(&SingleQueuePool::ThreadFunc, this);
+   }
+
+   ~SingleQueuePool()
+   {
+      {
+         std::lock_guard<std::mutex> lock(mx_);
+         abortFlag_ = true;
+      }
+      cv_.notify_all();
+      for (auto& thread : threads_)
+         thread.join();
+   }
+
+   void Execute(const std::vector<Task*>& tasks)
+   {
+      {
+         std::lock_guard<std::mutex> lock(mx_);
+         for (Task* task : tasks)
+            queue_.push_back(task);
+      }
+      cv_.notify_all();
+   }
+
+private:
+   void ThreadFunc()
+   {
+      for (;;)
+      {
+         Task* task = nullptr;
+         {
+            std::unique_lock<std::mutex> lock(mx_);
+            cv_.wait(lock, [&]() { return abortFlag_ || !queue_.empty(); });
+            if (abortFlag_)
+               break;
+            task = queue_.front();
+            queue_.pop_front();
+         }
+         task->Execute();
+         task->Done();
+      }
+   }
+
+   std::vector<std::thread> threads_;
+   bool abortFlag_ = false;
+   std::mutex mx_;
+   std::condition_variable cv_;
+   std::deque<Task*> queue_;
+};
+
+class EmptyTask : public Task
+{
+public:
+   EmptyTask(std::shared_ptr<Semaphore> semaphore, size_t taskIndex,
+         size_t totalTaskCount) :
+      Task(semaphore, taskIndex, totalTaskCount)
+   {}
+
+   virtual void Execute() override {}
+};
+
+struct Latency
+{
+   double median;
+   double p99;
+};
+
+template <typename F>
+Latency Measure(int iterations, F roundTrip)
+{
+   using namespace std::chrono;
+   for (int i = 0; i < iterations / 10; ++i) // Warm up
+      roundTrip();
+
+   std::vector<double> us;
+   us.reserve(iterations);
+   for (int i = 0; i < iterations; ++i)
+   {
+      auto start = steady_clock::now();
+      roundTrip();
+      us.push_back(duration<double, std::micro>(steady_clock::now() - start).count());
+   }
+   std::sort(us.begin(), us.end());
+   Latency result;
+   result.median = us[us.size() / 2];
+   result.p99 = us[std::min(us.size() - 1, us.size() * 99 / 100)];
+   return result;
+}
+
+template <typename Pool>
+Latency MeasureBatches(Pool& pool, size_t taskCount, int iterations)
+{
+   auto semaphore = std::make_shared<Semaphore>();
+   std::vector<std::unique_ptr<Task>> owned;
+   std::vector<Task*> tasks;
+   for (size_t n = 0; n < taskCount; ++n)
+   {
+      owned.emplace_back(new EmptyTask(semaphore, n, taskCount));
+      tasks.push_back(owned.back().get());
+   }
+   return Measure(iterations, [&] {
+      pool.Execute(tasks);
+      semaphore->Wait(taskCount);
+   });
+}
+
+} // anonymous namespace
+
+
+int main(int argc, char** argv)
+{
+   const int iterations = argc > 1 ? std::atoi(argv[1]) : 20000;
+   const size_t threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+   std::printf("%zu threads, %d iterations, latency in us (median / p99)\n",
+         threadCount, iterations);
+   std::printf("%-6s %22s %22s\n", "tasks", "SingleQueuePool", "ThreadPool");
+
+   SingleQueuePool singleQueue(threadCount);
+   ThreadPool pool(threadCount);
+   for (size_t taskCount = 1; ; taskCount = std::min(2 * taskCount, threadCount))
+   {
+      const Latency before = MeasureBatches(singleQueue, taskCount, iterations);
+      const Latency after = MeasureBatches(pool, taskCount, iterations);
+      std::printf("%-6zu %10.1f / %9.1f %10.1f / %9.1f\n", taskCount,
+            before.median, before.p99, after.median, after.p99);
+      if (taskCount == threadCount)
+         break;
+   }
+
+   const Latency submit = Measure(iterations, [&] {
+      pool.Submit([] {}).wait();
+   });
+   std::printf("%-6s %22s %10.1f / %9.1f\n", "Submit", "",
+         submit.median, submit.p99);
+   return 0;
+}
@@ -0,0 +1,175 @@
+#include <gtest/gtest.h>
+
+#include "Semaphore.h"
+#include "Task.h"
+#include "TaskSet.h"
+#include "ThreadPool.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+
+namespace {
+
+class CountingTask : public Task
+{
+public:
+   CountingTask(std::shared_ptr<Semaphore> semaphore, size_t taskIndex,
+         size_t totalTaskCount) :
+      Task(semaphore, taskIndex, totalTaskCount)
+   {}
+
+   virtual void Execute() override { ++count; }
+
+   static std::atomic<int> count;
+};
+
+std::atomic<int> CountingTask::count(0);
+
+class CountingTaskSet : public TaskSet
+{
+public:
+   explicit CountingTaskSet(std::shared_ptr<ThreadPool> pool) : TaskSet(pool)
+   {
+      CreateTasks<CountingTask>();
+   }
+};
+
+} // anonymous namespace
+
+
+TEST(ThreadPoolTests, ExecutesTaskSets)
+{
+   auto pool = std::make_shared<ThreadPool>(3);
+   EXPECT_EQ(3u, pool->GetSize());
+   CountingTaskSet tasks(pool);
+   ASSERT_EQ(3u, tasks.GetUsedTaskCount());
+
+   CountingTask::count = 0;
+   for (int i = 0; i < 1000; ++i)
+   {
+      tasks.Execute();
+      tasks.Wait();
+   }
+   EXPECT_EQ(3000, CountingTask::count.load());
+}
+
+TEST(ThreadPoolTests, SubmitReturnsResultOrException)
+{
+   ThreadPool pool(2);
+   std::future<int> result = pool.Submit([] { return 42; });
+   std::future<void> failure = pool.Submit([] { throw std::runtime_error("x"); });
+   EXPECT_EQ(42, result.get());
+   EXPECT_THROW(failure.get(), std::runtime_error);
+}
+
+TEST(ThreadPoolTests, TasksSubmittedFromAThreadAreStolen)
+{
+   ThreadPool pool(2);
+   std::mutex mx;
+   std::condition_variable cv;
+   int done = 0;
+   const int count = 200; // More than the initial deque capacity
+
+   // The first thread queues tasks on its own deque and then waits without
+   // running them, so that only the other thread can run them
+   std::future<void> outer = pool.Submit([&] {
+      const std::thread::id self = std::this_thread::get_id();
+      for (int i = 0; i < count; ++i)
+      {
+         pool.Submit([&, self] {
+            EXPECT_NE(self, std::this_thread::get_id());
+            std::lock_guard<std::mutex> lock(mx);
+            ++done;
+            cv.notify_all();
+         });
+      }
+      std::unique_lock<std::mutex> lock(mx);
+      cv.wait(lock, [&] { return done == count; });
+   });
+   EXPECT_EQ(std::future_status::ready,
+         outer.wait_for(std::chrono::seconds(30)));
+   EXPECT_EQ(count, done);
+}
+
+TEST(ThreadPoolTests, WaitingWithinATaskDoesNotDeadlock)
+{
+   auto pool = std::make_shared<ThreadPool>(1);
+   CountingTask::count = 0;
+   std::future<void> outer = pool->Submit([&] {
+      CountingTaskSet tasks(pool);
+      tasks.Execute();
+      tasks.Wait();
+
+      std::future<int> inner = pool->Submit([] { return 1; });
+      while (inner.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+         pool->RunPendingTask();
+      EXPECT_EQ(1, inner.get());
+   });
+   EXPECT_EQ(std::future_status::ready,
+         outer.wait_for(std::chrono::seconds(30)));
+   EXPECT_EQ(1, CountingTask::count.load());
+}
+
+TEST(ThreadPoolTests, DestructorRunsQueuedTasks)
+{
+   std::atomic<int> count(0);
+   std::vector<std::future<void>> futures;
+   {
+      ThreadPool pool(2);
+      for (int i = 0; i < 100; ++i)
+         futures.push_back(pool.Submit([&] {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+            ++count;
+         }));
+   }
+   EXPECT_EQ(100, count.load());
+   for (auto& future : futures)
+      EXPECT_NO_THROW(future.get());
+}
+
+TEST(ThreadPoolTests, FixedAffinityDisablesPinning)
+{
+   ThreadPool pool(2);
+   EXPECT_TRUE(pool.GetAffinity().empty());
+#ifdef __linux__
+   std::vector<unsigned> cpus;
+   {
+      cpu_set_t set;
+      ASSERT_EQ(0, sched_getaffinity(0, sizeof(set), &set));
+      for (unsigned cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+      {
+         if (CPU_ISSET(cpu, &set))
+         {
+            cpus.push_back(cpu);
+            break;
+         }
+      }
+   }
+   EXPECT_TRUE(pool.PinTo(cpus));
+   ASSERT_TRUE(pool.SetAffinity(cpus));
+   EXPECT_EQ(cpus, pool.GetAffinity());
+   EXPECT_FALSE(pool.PinTo(cpus));
+   ASSERT_TRUE(pool.SetAffinity(std::vector<unsigned>()));
+   EXPECT_TRUE(pool.GetAffinity().empty());
+   EXPECT_TRUE(pool.PinTo(cpus));
+#endif
+}
+
+
+int main(int argc, char **argv)
+{
+   ::testing::InitGoogleTest(&argc, argv);
+   return RUN_ALL_TESTS();
+}
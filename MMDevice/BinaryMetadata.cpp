@@ -0,0 +1,665 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          BinaryMetadata.cpp
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMDevice - Device adapter kit
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Compact image metadata container for the image insertion
+//                path
+// LICENSE:       This file is distributed under the BSD license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#include "BinaryMetadata.h"
+
+#include "ImageMetadata.h"
+#include "MMDeviceConstants.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+
+// Record layout: header, then the name (null-terminated; omitted if the key
+// is interned), then the device label (null-terminated; omitted for image
+// tags), then valueLen bytes of value. String values are null-terminated;
+// string arrays are a sequence of null-terminated strings. Records are not
+// aligned, so all fields are accessed with memcpy.
+namespace {
+
+struct RecordHeader
+{
+   std::uint32_t size; // Whole record, including the header
+   std::uint32_t valueLen;
+   std::uint16_t nameLen; // 0 if interned
+   std::uint16_t deviceLen; // 0 for image tags
+   std::uint8_t keyId; // 0 if not interned
+   std::uint8_t type;
+   std::uint8_t flags;
+   std::uint8_t reserved;
+};
+
+const std::uint8_t FlagReadOnly = 1;
+const std::uint8_t FlagImageTag = 2;
+
+// Keys attached to (nearly) every image. Ids are indices into this table,
+// which is compiled into every module: only ever append to it.
+const char* const internedKeys[] = {
+   0,
+   "Camera",
+   MM::g_Keyword_Metadata_ImageNumber,
+   MM::g_Keyword_Elapsed_Time_ms,
+   MM::g_Keyword_Metadata_TimeInCore,
+   "Width",
+   "Height",
+   "PixelType",
+   MM::g_Keyword_Binning,
+   MM::g_Keyword_Metadata_ROI_X,
+   MM::g_Keyword_Metadata_ROI_Y,
+   MM::g_Keyword_Exposure,
+};
+const int internedKeyCount = sizeof(internedKeys) / sizeof(internedKeys[0]);
+
+int InternKey(const char* name, std::size_t len)
+{
+   for (int i = 1; i < internedKeyCount; ++i)
+   {
+      const char* key = internedKeys[i];
+      if (key[0] == name[0] && std::strncmp(key, name, len) == 0 &&
+            key[len] == '\0')
+         return i;
+   }
+   return 0;
+}
+
+bool IsImageDevice(const char* device, std::size_t len)
+{
+   return len == 1 && device[0] == '_';
+}
+
+RecordHeader ReadHeader(const unsigned char* record)
+{
+   RecordHeader h;
+   std::memcpy(&h, record, sizeof(h));
+   return h;
+}
+
+// Checks that the record at the start of [record, end) is well formed.
+bool IsValidRecord(const unsigned char* record, const unsigned char* end)
+{
+   if (end - record < static_cast<std::ptrdiff_t>(sizeof(RecordHeader)))
+      return false;
+   RecordHeader h = ReadHeader(record);
+   if (h.size > static_cast<std::size_t>(end - record) ||
+         h.keyId >= internedKeyCount ||
+         h.type < BinaryMetadata::TypeInteger ||
+         h.type > BinaryMetadata::TypeStringArray)
+      return false;
+
+   const bool imageTag = (h.flags & FlagImageTag) != 0;
+   const std::size_t nameSize = h.keyId ? 0 : h.nameLen + 1;
+   const std::size_t deviceSize = imageTag ? 0 : h.deviceLen + 1;
+   if ((h.keyId == 0 && h.nameLen == 0) || (imageTag && h.deviceLen != 0) ||
+         sizeof(h) + nameSize + deviceSize + h.valueLen != h.size)
+      return false;
+
+   const unsigned char* p = record + sizeof(h);
+   if (nameSize && p[nameSize - 1] != '\0')
+      return false;
+   p += nameSize;
+   if (deviceSize && p[deviceSize - 1] != '\0')
+      return false;
+   p += deviceSize;
+
+   switch (h.type)
+   {
+      case BinaryMetadata::TypeInteger:
+         return h.valueLen == sizeof(long long);
+      case BinaryMetadata::TypeDouble:
+         return h.valueLen == sizeof(double);
+      case BinaryMetadata::TypeString:
+         return h.valueLen > 0 && p[h.valueLen - 1] == '\0';
+      default: // String array; may be empty
+         return h.valueLen == 0 || p[h.valueLen - 1] == '\0';
+   }
+}
+
+const unsigned char* ValueOf(const unsigned char* record)
+{
+   RecordHeader h = ReadHeader(record);
+   return record + h.size - h.valueLen;
+}
+
+// Returns the end of the current line and advances p past the newline.
+const char* NextLine(const char*& p)
+{
+   while (*p != '\0' && *p != '\n')
+      ++p;
+   const char* end = p;
+   if (*p == '\n')
+      ++p;
+   return end;
+}
+
+} // anonymous namespace
+
+
+const char* BinaryMetadata::Tag::GetName() const
+{
+   RecordHeader h = ReadHeader(record_);
+   if (h.keyId != 0)
+      return internedKeys[h.keyId];
+   return reinterpret_cast<const char*>(record_ + sizeof(RecordHeader));
+}
+
+const char* BinaryMetadata::Tag::GetDevice() const
+{
+   RecordHeader h = ReadHeader(record_);
+   if (h.flags & FlagImageTag)
+      return "_";
+   std::size_t offset = sizeof(RecordHeader);
+   if (h.keyId == 0)
+      offset += h.nameLen + 1;
+   return reinterpret_cast<const char*>(record_ + offset);
+}
+
+bool BinaryMetadata::Tag::IsReadOnly() const
+{
+   return (ReadHeader(record_).flags & FlagReadOnly) != 0;
+}
+
+BinaryMetadata::ValueType BinaryMetadata::Tag::GetType() const
+{
+   return static_cast<ValueType>(ReadHeader(record_).type);
+}
+
+long long BinaryMetadata::Tag::GetInteger() const
+{
+   if (GetType() != TypeInteger)
+      return 0;
+   long long v;
+   std::memcpy(&v, ValueOf(record_), sizeof(v));
+   return v;
+}
+
+double BinaryMetadata::Tag::GetDouble() const
+{
+   if (GetType() != TypeDouble)
+      return 0.0;
+   double v;
+   std::memcpy(&v, ValueOf(record_), sizeof(v));
+   return v;
+}
+
+const char* BinaryMetadata::Tag::GetString() const
+{
+   if (GetType() != TypeString)
+      return "";
+   return reinterpret_cast<const char*>(ValueOf(record_));
+}
+
+std::size_t BinaryMetadata::Tag::GetArraySize() const
+{
+   if (GetType() != TypeStringArray)
+      return 0;
+   const unsigned char* value = ValueOf(record_);
+   std::size_t valueLen = ReadHeader(record_).valueLen;
+   return std::count(value, value + valueLen, '\0');
+}
+
+const char* BinaryMetadata::Tag::GetArrayValue(std::size_t index) const
+{
+   if (GetType() != TypeStringArray)
+      return "";
+   const char* value = reinterpret_cast<const char*>(ValueOf(record_));
+   const char* end = value + ReadHeader(record_).valueLen;
+   for (; value < end; value += std::strlen(value) + 1)
+   {
+      if (index-- == 0)
+         return value;
+   }
+   return "";
+}
+
+std::string BinaryMetadata::Tag::GetValueAsString() const
+{
+   // As std::ostream (used by Metadata::PutTag()), but without rounding
+   // doubles to 6 significant digits, which would mangle e.g. long elapsed
+   // times
+   char buf[32];
+   switch (GetType())
+   {
+      case TypeInteger:
+         std::snprintf(buf, sizeof(buf), "%lld", GetInteger());
+         return buf;
+      case TypeDouble:
+         std::snprintf(buf, sizeof(buf), "%.15g", GetDouble());
+         return buf;
+      case TypeString:
+         return GetString();
+      default:
+         return std::string();
+   }
+}
+
+
+BinaryMetadata::BinaryMetadata() :
+   size_(0),
+   count_(0),
+   capacity_(EmbeddedCapacity),
+   data_(embedded_)
+{
+}
+
+BinaryMetadata::BinaryMetadata(const Metadata& md) :
+   size_(0),
+   count_(0),
+   capacity_(EmbeddedCapacity),
+   data_(embedded_)
+{
+   for (Metadata::TagConstIter it = md.tags_.begin(), end = md.tags_.end();
+         it != end; ++it)
+   {
+      const MetadataTag* tag = it->second;
+      const std::string& name = tag->GetName();
+      const std::string& device = tag->GetDevice();
+      if (const MetadataArrayTag* atag = tag->ToArrayTag())
+      {
+         std::size_t valueLen = 0;
+         for (std::size_t i = 0; i < atag->GetSize(); ++i)
+            valueLen += atag->GetValue(i).size() + 1;
+         unsigned char* value = AppendRecord(name.c_str(), name.size(),
+               device.c_str(), device.size(), tag->IsReadOnly(),
+               TypeStringArray, valueLen);
+         for (std::size_t i = 0; i < atag->GetSize(); ++i)
+         {
+            const std::string& v = atag->GetValue(i);
+            std::memcpy(value, v.c_str(), v.size() + 1);
+            value += v.size() + 1;
+         }
+      }
+      else if (const MetadataSingleTag* stag = tag->ToSingleTag())
+      {
+         const std::string& v = stag->GetValue();
+         unsigned char* value = AppendRecord(name.c_str(), name.size(),
+               device.c_str(), device.size(), tag->IsReadOnly(),
+               TypeString, v.size() + 1);
+         std::memcpy(value, v.c_str(), v.size() + 1);
+      }
+   }
+}
+
+BinaryMetadata::BinaryMetadata(const BinaryMetadata& other) :
+   size_(0),
+   count_(0),
+   capacity_(EmbeddedCapacity),
+   data_(embedded_)
+{
+   *this = other;
+}
+
+BinaryMetadata& BinaryMetadata::operator=(const BinaryMetadata& other)
+{
+   if (this != &other)
+   {
+      Reserve(other.size_);
+      std::memcpy(data_, other.data_, other.size_);
+      size_ = other.size_;
+      count_ = other.count_;
+   }
+   return *this;
+}
+
+BinaryMetadata::~BinaryMetadata()
+{
+}
+
+void BinaryMetadata::Reserve(std::size_t capacity)
+{
+   if (capacity <= capacity_)
+      return;
+   std::size_t newCapacity = std::max(capacity, 2 * capacity_);
+   std::unique_ptr<unsigned char[]> heap(new unsigned char[newCapacity]);
+   std::memcpy(heap.get(), data_, size_);
+   heap_.swap(heap);
+   data_ = heap_.get();
+   capacity_ = newCapacity;
+}
+
+const unsigned char* BinaryMetadata::FindRecord(const char* name,
+      std::size_t nameLen, const char* device, std::size_t deviceLen) const
+{
+   const bool imageTag = IsImageDevice(device, deviceLen);
+   const int keyId = InternKey(name, nameLen);
+   for (const unsigned char* rec = data_; rec < data_ + size_; )
+   {
+      RecordHeader h = ReadHeader(rec);
+      if (h.keyId == keyId && ((h.flags & FlagImageTag) != 0) == imageTag)
+      {
+         const char* p = reinterpret_cast<const char*>(rec + sizeof(h));
+         bool match = true;
+         if (keyId == 0)
+         {
+            match = h.nameLen == nameLen &&
+               std::memcmp(p, name, nameLen) == 0;
+            p += h.nameLen + 1;
+         }
+         if (match && !imageTag)
+         {
+            match = h.deviceLen == deviceLen &&
+               std::memcmp(p, device, deviceLen) == 0;
+         }
+         if (match)
+            return rec;
+      }
+      rec += h.size;
+   }
+   return 0;
+}
+
+const unsigned char* BinaryMetadata::FindQualified(const char* key) const
+{
+   const std::size_t keyLen = std::strlen(key);
+   const int keyId = InternKey(key, keyLen);
+   for (const unsigned char* rec = data_; rec < data_ + size_; )
+   {
+      RecordHeader h = ReadHeader(rec);
+      const char* p = reinterpret_cast<const char*>(rec + sizeof(h));
+      const char* name = h.keyId ? internedKeys[h.keyId] : p;
+      if (h.keyId == 0)
+         p += h.nameLen + 1;
+
+      if (h.flags & FlagImageTag)
+      {
+         if (keyId != 0 ? h.keyId == keyId :
+               (h.keyId == 0 && std::strcmp(name, key) == 0))
+            return rec;
+      }
+      else
+      {
+         // "<device>-<name>"
+         if (keyLen > h.deviceLen && key[h.deviceLen] == '-' &&
+               std::memcmp(key, p, h.deviceLen) == 0 &&
+               std::strcmp(key + h.deviceLen + 1, name) == 0)
+            return rec;
+      }
+      rec += h.size;
+   }
+   return 0;
+}
+
+void BinaryMetadata::EraseRecord(const unsigned char* record)
+{
+   unsigned char* rec = data_ + (record - data_);
+   std::size_t recSize = ReadHeader(rec).size;
+   std::memmove(rec, rec + recSize, data_ + size_ - (rec + recSize));
+   size_ -= recSize;
+   --count_;
+}
+
+unsigned char* BinaryMetadata::AppendRecord(const char* name,
+      std::size_t nameLen, const char* device, std::size_t deviceLen,
+      bool readOnly, ValueType type, std::size_t valueLen)
+{
+   if (const unsigned char* existing = FindRecord(name, nameLen, device, deviceLen))
+      EraseRecord(existing);
+
+   RecordHeader h;
+   h.keyId = static_cast<std::uint8_t>(InternKey(name, nameLen));
+   h.type = static_cast<std::uint8_t>(type);
+   h.flags = readOnly ? FlagReadOnly : 0;
+   h.reserved = 0;
+   h.nameLen = h.keyId ? 0 : static_cast<std::uint16_t>(nameLen);
+   if (IsImageDevice(device, deviceLen))
+   {
+      h.flags |= FlagImageTag;
+      h.deviceLen = 0;
+   }
+   else
+   {
+      h.deviceLen = static_cast<std::uint16_t>(deviceLen);
+   }
+   h.valueLen = static_cast<std::uint32_t>(valueLen);
+   h.size = static_cast<std::uint32_t>(sizeof(h) +
+      (h.keyId ? 0 : nameLen + 1) +
+      ((h.flags & FlagImageTag) ? 0 : deviceLen + 1) +
+      valueLen);
+
+   Reserve(size_ + h.size);
+   unsigned char* rec = data_ + size_;
+   std::memcpy(rec, &h, sizeof(h));
+   unsigned char* p = rec + sizeof(h);
+   if (h.keyId == 0)
+   {
+      std::memcpy(p, name, nameLen);
+      p[nameLen] = '\0';
+      p += nameLen + 1;
+   }
+   if (!(h.flags & FlagImageTag))
+   {
+      std::memcpy(p, device, deviceLen);
+      p[deviceLen] = '\0';
+      p += deviceLen + 1;
+   }
+   size_ += h.size;
+   ++count_;
+   return p;
+}
+
+bool BinaryMetadata::HasTag(const char* key) const
+{
+   return FindQualified(key) != 0;
+}
+
+bool BinaryMetadata::FindTag(const char* key, Tag& tag) const
+{
+   const unsigned char* rec = FindQualified(key);
+   if (!rec)
+      return false;
+   tag = Tag(rec);
+   return true;
+}
+
+const char* BinaryMetadata::FindString(const char* key) const
+{
+   const unsigned char* rec = FindQualified(key);
+   if (!rec || ReadHeader(rec).type != TypeString)
+      return 0;
+   return reinterpret_cast<const char*>(ValueOf(rec));
+}
+
+void BinaryMetadata::RemoveTag(const char* key)
+{
+   if (const unsigned char* rec = FindQualified(key))
+      EraseRecord(rec);
+}
+
+void BinaryMetadata::PutTag(const char* key, const char* device,
+      const char* value)
+{
+   std::size_t len = std::strlen(value) + 1;
+   unsigned char* p = AppendRecord(key, std::strlen(key), device,
+         std::strlen(device), true, TypeString, len);
+   std::memcpy(p, value, len);
+}
+
+void BinaryMetadata::PutTag(const char* key, const char* device,
+      double value)
+{
+   unsigned char* p = AppendRecord(key, std::strlen(key), device,
+         std::strlen(device), true, TypeDouble, sizeof(value));
+   std::memcpy(p, &value, sizeof(value));
+}
+
+void BinaryMetadata::PutTag(const char* key, const char* device,
+      long long value)
+{
+   unsigned char* p = AppendRecord(key, std::strlen(key), device,
+         std::strlen(device), true, TypeInteger, sizeof(value));
+   std::memcpy(p, &value, sizeof(value));
+}
+
+void BinaryMetadata::Merge(const BinaryMetadata& newTags)
+{
+   if (&newTags == this)
+      return;
+   for (const unsigned char* rec = newTags.data_;
+         rec < newTags.data_ + newTags.size_; )
+   {
+      RecordHeader h = ReadHeader(rec);
+      Tag tag(rec);
+      const char* name = tag.GetName();
+      const char* device = tag.GetDevice();
+      unsigned char* value = AppendRecord(name, std::strlen(name),
+            device, std::strlen(device), tag.IsReadOnly(),
+            tag.GetType(), h.valueLen);
+      std::memcpy(value, ValueOf(rec), h.valueLen);
+      rec += h.size;
+   }
+}
+
+std::string BinaryMetadata::Serialize() const
+{
+   std::string str;
+   str.reserve(2 * size_);
+   str.append(std::to_string(count_)).append("\n");
+   for (const unsigned char* rec = data_; rec < data_ + size_; )
+   {
+      Tag tag(rec);
+      const bool isArray = tag.GetType() == TypeStringArray;
+      str.append(isArray ? "a" : "s").append("\n");
+      str.append(tag.GetName()).append("\n");
+      str.append(tag.GetDevice()).append("\n");
+      str.append(tag.IsReadOnly() ? "1" : "0").append("\n");
+      if (isArray)
+      {
+         std::size_t n = tag.GetArraySize();
+         str.append(std::to_string(n)).append("\n");
+         for (std::size_t i = 0; i < n; ++i)
+            str.append(tag.GetArrayValue(i)).append("\n");
+      }
+      else
+      {
+         str.append(tag.GetValueAsString()).append("\n");
+      }
+      rec += ReadHeader(rec).size;
+   }
+   return str;
+}
+
+bool BinaryMetadata::Restore(const char* stream)
+{
+   Clear();
+   return MergeSerialized(stream);
+}
+
+bool BinaryMetadata::MergeSerialized(const char* stream)
+{
+   const char* p = stream;
+   NextLine(p);
+   const long count = std::atol(stream);
+
+   for (long i = 0; i < count; ++i)
+   {
+      const char* id = p;
+      const char* idEnd = NextLine(p);
+      const bool isArray = idEnd - id == 1 && *id == 'a';
+      if (!isArray && !(idEnd - id == 1 && *id == 's'))
+         return false;
+
+      const char* name = p;
+      const std::size_t nameLen = NextLine(p) - name;
+      const char* device = p;
+      const std::size_t deviceLen = NextLine(p) - device;
+      const bool readOnly = std::atoi(p) != 0;
+      NextLine(p);
+
+      if (isArray)
+      {
+         const long size = std::atol(p);
+         NextLine(p);
+         // Values are the following lines
+         const char* values = p;
+         std::size_t valueLen = 0;
+         for (long j = 0; j < size; ++j)
+         {
+            const char* v = p;
+            valueLen += NextLine(p) - v + 1;
+         }
+         unsigned char* value = AppendRecord(name, nameLen, device,
+               deviceLen, readOnly, TypeStringArray, valueLen);
+         p = values;
+         for (long j = 0; j < size; ++j)
+         {
+            const char* v = p;
+            const std::size_t vLen = NextLine(p) - v;
+            std::memcpy(value, v, vLen);
+            value[vLen] = '\0';
+            value += vLen + 1;
+         }
+      }
+      else
+      {
+         const char* v = p;
+         const std::size_t vLen = NextLine(p) - v;
+         unsigned char* value = AppendRecord(name, nameLen, device,
+               deviceLen, readOnly, TypeString, vLen + 1);
+         std::memcpy(value, v, vLen);
+         value[vLen] = '\0';
+      }
+   }
+   return true;
+}
+
+void BinaryMetadata::ToMetadata(Metadata& md) const
+{
+   md.Clear();
+   for (const unsigned char* rec = data_; rec < data_ + size_; )
+   {
+      Tag tag(rec);
+      if (tag.GetType() == TypeStringArray)
+      {
+         MetadataArrayTag atag(tag.GetName(), tag.GetDevice(),
+               tag.IsReadOnly());
+         for (std::size_t i = 0, n = tag.GetArraySize(); i < n; ++i)
+            atag.AddValue(tag.GetArrayValue(i));
+         md.SetTag(atag);
+      }
+      else
+      {
+         MetadataSingleTag stag(tag.GetName(), tag.GetDevice(),
+               tag.IsReadOnly());
+         stag.SetValue(tag.GetValueAsString().c_str());
+         md.SetTag(stag);
+      }
+      rec += ReadHeader(rec).size;
+   }
+}
+
+bool BinaryMetadata::AssignRecords(const unsigned char* records,
+      std::size_t size)
+{
+   Clear();
+   std::size_t count = 0;
+   for (const unsigned char* rec = records; rec < records + size; )
+   {
+      if (!IsValidRecord(rec, records + size))
+         return false;
+      rec += ReadHeader(rec).size;
+      ++count;
+   }
+
+   Reserve(size);
+   if (size > 0)
+      std::memcpy(data_, records, size);
+   size_ = size;
+   count_ = count;
+   return true;
+}
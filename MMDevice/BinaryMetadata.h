@@ -0,0 +1,163 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          BinaryMetadata.h
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMDevice - Device adapter kit
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Compact image metadata container for the image insertion
+//                path
+// LICENSE:       This file is distributed under the BSD license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <type_traits>
+
+class Metadata;
+
+
+/**
+ * Image metadata stored as a flat sequence of typed records.
+ *
+ * Unlike Metadata, which keeps a map of heap-allocated, string-valued tags,
+ * all tags live in a single byte arena: integer and floating point values are
+ * stored in binary and only formatted when converted to Metadata. The keys
+ * that the Core and most cameras attach to every image are interned as small
+ * integers (the table is compiled into every module, so the ids are the same
+ * on both sides of the device interface). Small tag sets fit in storage
+ * embedded in the object, and Clear() and assignment reuse the existing
+ * storage, so building, copying and merging metadata for a frame does not
+ * allocate in the steady state.
+ *
+ * Tags are identified, as in Metadata, by their qualified name: the tag name
+ * for image tags (device "_"), or "<device>-<name>" for device tags. Putting
+ * a tag replaces any tag with the same qualified name.
+ *
+ * Metadata remains the public representation; use the converting constructor
+ * and ToMetadata() at the boundaries.
+ */
+class BinaryMetadata
+{
+public:
+   enum ValueType
+   {
+      TypeInteger = 1,
+      TypeDouble,
+      TypeString,
+      TypeStringArray,
+   };
+
+   /**
+    * View of a single tag. Valid until the container is modified.
+    */
+   class Tag
+   {
+   public:
+      Tag() : record_(0) {} // Must be assigned by FindTag() before use
+
+      const char* GetName() const;
+      const char* GetDevice() const; // "_" for image tags
+      bool IsReadOnly() const;
+      ValueType GetType() const;
+
+      // The value accessors below return 0 or "" if the tag has a different
+      // type.
+      long long GetInteger() const;
+      double GetDouble() const;
+      const char* GetString() const;
+      std::size_t GetArraySize() const;
+      const char* GetArrayValue(std::size_t index) const;
+
+      // Formatted as Metadata::PutTag() would have stored it, except that
+      // doubles keep up to 15 significant digits.
+      std::string GetValueAsString() const;
+
+   private:
+      friend class BinaryMetadata;
+      explicit Tag(const unsigned char* record) : record_(record) {}
+      const unsigned char* record_;
+   };
+
+   BinaryMetadata();
+   explicit BinaryMetadata(const Metadata& md);
+   BinaryMetadata(const BinaryMetadata& other);
+   BinaryMetadata& operator=(const BinaryMetadata& other);
+   ~BinaryMetadata();
+
+   void Clear() { size_ = 0; count_ = 0; }
+   bool IsEmpty() const { return count_ == 0; }
+   std::size_t GetTagCount() const { return count_; }
+
+   bool HasTag(const char* key) const;
+   // Returns false, leaving tag unchanged, if there is no such tag.
+   bool FindTag(const char* key, Tag& tag) const;
+   // Value of a string tag, or 0 if there is no such string tag.
+   const char* FindString(const char* key) const;
+   void RemoveTag(const char* key);
+
+   void PutTag(const char* key, const char* device, const char* value);
+   void PutTag(const char* key, const char* device, const std::string& value)
+   { PutTag(key, device, value.c_str()); }
+   void PutTag(const char* key, const char* device, double value);
+   void PutTag(const char* key, const char* device, long long value);
+   template <typename T>
+   typename std::enable_if<std::is_integral<T>::value>::type
+   PutTag(const char* key, const char* device, T value)
+   { PutTag(key, device, static_cast<long long>(value)); }
+
+   // Add a tag not associated with any device.
+   template <typename T>
+   void PutImageTag(const char* key, T value)
+   { PutTag(key, "_", value); }
+
+   void Merge(const BinaryMetadata& newTags);
+
+   // Metadata::Serialize() format.
+   std::string Serialize() const;
+   bool Restore(const char* stream);
+   // Like Restore(), but keeps existing tags that are not in stream.
+   bool MergeSerialized(const char* stream);
+
+   void ToMetadata(Metadata& md) const;
+
+   // The encoded tags, for passing through the device interface (see
+   // MM::Core::InsertImage()). The encoding is internal to this class and
+   // is covered by the device interface version.
+   const unsigned char* GetRecords() const { return data_; }
+   std::size_t GetRecordsSize() const { return size_; }
+   // Replaces the contents with records obtained from GetRecords(). Returns
+   // false, leaving the container empty, if the records are malformed.
+   bool AssignRecords(const unsigned char* records, std::size_t size);
+
+private:
+   void Reserve(std::size_t capacity);
+   const unsigned char* FindRecord(const char* name, std::size_t nameLen,
+         const char* device, std::size_t deviceLen) const;
+   const unsigned char* FindQualified(const char* key) const;
+   void EraseRecord(const unsigned char* record);
+   // Adds a record, replacing any tag with the same name and device, and
+   // returns its value area of valueLen bytes for the caller to fill in.
+   unsigned char* AppendRecord(const char* name, std::size_t nameLen,
+         const char* device, std::size_t deviceLen, bool readOnly,
+         ValueType type, std::size_t valueLen);
+
+   static const std::size_t EmbeddedCapacity = 512;
+
+   std::size_t size_;
+   std::size_t count_;
+   std::size_t capacity_;
+   unsigned char* data_; // embedded_ or heap_
+   std::unique_ptr<unsigned char[]> heap_;
+   unsigned char embedded_[EmbeddedCapacity];
+};
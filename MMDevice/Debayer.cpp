@@ -24,10 +24,275 @@
 ///////////////////////////////////////////////////////////////////////////////
 
 #include "Debayer.h"
+#include "DebayerKernels.h"
+
 #include <math.h>
 #include <assert.h>
+#include <system_error>
+#include <thread>
+
+#if defined(MM_DEBAYER_AVX2) && defined(_MSC_VER)
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
 using namespace std;
 
+///////////////////////////////////////////////////////////////////////////////
+// Row kernels for the instruction sets available without runtime checks
+///////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+using DebayerKernels::Job;
+using DebayerKernels::Workspace;
+
+// Reference implementation; also used on other architectures
+struct ScalarOps
+{
+   typedef unsigned V16;
+   typedef bool M16;
+   typedef int V32;
+   typedef bool M32;
+   enum { N16 = 1, N32 = 1 };
+
+   static V16 Load16(const unsigned short* p) { return *p; }
+   static void Store16(unsigned short* p, V16 v) { *p = static_cast<unsigned short>(v); }
+   static V16 Avg16(V16 a, V16 b) { return (a + b + 1) >> 1; }
+   static M16 PhaseMask16(int x, int phase) { return (x & 1) == phase; }
+   static V16 Select16(M16 m, V16 a, V16 b) { return m ? b : a; }
+
+   static V32 Widen(const unsigned short* p) { return *p; }
+   static V32 Load32(const int* p) { return *p; }
+   static void Store32(int* p, V32 v) { *p = v; }
+   static V32 Set32(int v) { return v; }
+   static V32 Add32(V32 a, V32 b) { return a + b; }
+   static V32 Sub32(V32 a, V32 b) { return a - b; }
+   static V32 Half32(V32 v) { return v >> 1; }
+   static V32 Quarter32(V32 v) { return v >> 2; }
+   static V32 Abs32(V32 v) { return v < 0 ? -v : v; }
+   static V32 Min32(V32 a, V32 b) { return b < a ? b : a; }
+   static V32 Max32(V32 a, V32 b) { return a < b ? b : a; }
+   static M32 Lt32(V32 a, V32 b) { return a < b; }
+   static V32 Select32(M32 m, V32 a, V32 b) { return m ? b : a; }
+   static M32 PhaseMask32(int x, int phase) { return (x & 1) == phase; }
+   static void StoreClamped16(unsigned short* p, V32 v, V32 zero, V32 maxValue)
+   { *p = static_cast<unsigned short>(Min32(Max32(v, zero), maxValue)); }
+
+   static void PackRGB32(unsigned char* dst, const unsigned short* r,
+         const unsigned short* g, const unsigned short* b, int n, int shift)
+   { DebayerKernels::PackRGB32Scalar(dst, r, g, b, 0, n, shift); }
+   static void PackRGB64(unsigned short* dst, const unsigned short* r,
+         const unsigned short* g, const unsigned short* b, int n)
+   { DebayerKernels::PackRGB64Scalar(dst, r, g, b, 0, n); }
+};
+
+void ProcessRowsScalar(const Job& job, const Workspace& workspace, int y0, int y1)
+{
+   DebayerKernels::Rows<ScalarOps>(job, workspace).Run(y0, y1);
+}
+
+#ifdef MM_DEBAYER_SSE2
+struct SSE2Ops
+{
+   typedef __m128i V16;
+   typedef __m128i M16;
+   typedef __m128i V32;
+   typedef __m128i M32;
+   enum { N16 = 8, N32 = 4 };
+
+   static V16 Load16(const unsigned short* p)
+   { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); }
+   static void Store16(unsigned short* p, V16 v)
+   { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), v); }
+   static V16 Avg16(V16 a, V16 b) { return _mm_avg_epu16(a, b); }
+   static M16 PhaseMask16(int, int phase)
+   { return _mm_set1_epi32(phase ? static_cast<int>(0xFFFF0000) : 0x0000FFFF); }
+   static V16 Select16(M16 m, V16 a, V16 b)
+   { return _mm_or_si128(_mm_and_si128(m, b), _mm_andnot_si128(m, a)); }
+
+   static V32 Widen(const unsigned short* p)
+   {
+      return _mm_unpacklo_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)),
+            _mm_setzero_si128());
+   }
+   static V32 Load32(const int* p)
+   { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); }
+   static void Store32(int* p, V32 v)
+   { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), v); }
+   static V32 Set32(int v) { return _mm_set1_epi32(v); }
+   static V32 Add32(V32 a, V32 b) { return _mm_add_epi32(a, b); }
+   static V32 Sub32(V32 a, V32 b) { return _mm_sub_epi32(a, b); }
+   static V32 Half32(V32 v) { return _mm_srai_epi32(v, 1); }
+   static V32 Quarter32(V32 v) { return _mm_srai_epi32(v, 2); }
+   static V32 Abs32(V32 v)
+   {
+      __m128i sign = _mm_srai_epi32(v, 31);
+      return _mm_sub_epi32(_mm_xor_si128(v, sign), sign);
+   }
+   static V32 Min32(V32 a, V32 b) { return Select16(_mm_cmplt_epi32(b, a), a, b); }
+   static V32 Max32(V32 a, V32 b) { return Select16(_mm_cmplt_epi32(a, b), a, b); }
+   static M32 Lt32(V32 a, V32 b) { return _mm_cmplt_epi32(a, b); }
+   static V32 Select32(M32 m, V32 a, V32 b) { return Select16(m, a, b); }
+   static M32 PhaseMask32(int, int phase)
+   { return phase ? _mm_set_epi32(-1, 0, -1, 0) : _mm_set_epi32(0, -1, 0, -1); }
+   static void StoreClamped16(unsigned short* p, V32 v, V32 zero, V32 maxValue)
+   {
+      // No unsigned saturating pack before SSE4.1: bias into the signed
+      // range, pack, and remove the bias
+      v = Min32(Max32(v, zero), maxValue);
+      v = _mm_packs_epi32(_mm_sub_epi32(v, _mm_set1_epi32(32768)), zero);
+      v = _mm_xor_si128(v, _mm_set1_epi16(static_cast<short>(0x8000)));
+      _mm_storel_epi64(reinterpret_cast<__m128i*>(p), v);
+   }
+
+   static void PackRGB32(unsigned char* dst, const unsigned short* r,
+         const unsigned short* g, const unsigned short* b, int n, int shift)
+   { DebayerKernels::PackRGB32SSE2(dst, r, g, b, n, shift); }
+   static void PackRGB64(unsigned short* dst, const unsigned short* r,
+         const unsigned short* g, const unsigned short* b, int n)
+   { DebayerKernels::PackRGB64SSE2(dst, r, g, b, n); }
+};
+
+void ProcessRowsSSE2(const Job& job, const Workspace& workspace, int y0, int y1)
+{
+   DebayerKernels::Rows<SSE2Ops>(job, workspace).Run(y0, y1);
+}
+#endif // MM_DEBAYER_SSE2
+
+#ifdef MM_DEBAYER_NEON
+struct NEONOps
+{
+   typedef uint16x8_t V16;
+   typedef uint16x8_t M16;
+   typedef int32x4_t V32;
+   typedef uint32x4_t M32;
+   enum { N16 = 8, N32 = 4 };
+
+   static V16 Load16(const unsigned short* p) { return vld1q_u16(p); }
+   static void Store16(unsigned short* p, V16 v) { vst1q_u16(p, v); }
+   static V16 Avg16(V16 a, V16 b) { return vrhaddq_u16(a, b); }
+   static M16 PhaseMask16(int, int phase)
+   { return vreinterpretq_u16_u32(vdupq_n_u32(phase ? 0xFFFF0000u : 0x0000FFFFu)); }
+   static V16 Select16(M16 m, V16 a, V16 b) { return vbslq_u16(m, b, a); }
+
+   static V32 Widen(const unsigned short* p)
+   { return vreinterpretq_s32_u32(vmovl_u16(vld1_u16(p))); }
+   static V32 Load32(const int* p) { return vld1q_s32(p); }
+   static void Store32(int* p, V32 v) { vst1q_s32(p, v); }
+   static V32 Set32(int v) { return vdupq_n_s32(v); }
+   static V32 Add32(V32 a, V32 b) { return vaddq_s32(a, b); }
+   static V32 Sub32(V32 a, V32 b) { return vsubq_s32(a, b); }
+   static V32 Half32(V32 v) { return vshrq_n_s32(v, 1); }
+   static V32 Quarter32(V32 v) { return vshrq_n_s32(v, 2); }
+   static V32 Abs32(V32 v) { return vabsq_s32(v); }
+   static V32 Min32(V32 a, V32 b) { return vminq_s32(a, b); }
+   static V32 Max32(V32 a, V32 b) { return vmaxq_s32(a, b); }
+   static M32 Lt32(V32 a, V32 b) { return vcltq_s32(a, b); }
+   static V32 Select32(M32 m, V32 a, V32 b) { return vbslq_s32(m, b, a); }
+   static M32 PhaseMask32(int, int phase)
+   {
+      return vreinterpretq_u32_u64(vdupq_n_u64(phase ?
+               0xFFFFFFFF00000000ull : 0x00000000FFFFFFFFull));
+   }
+   static void StoreClamped16(unsigned short* p, V32 v, V32 zero, V32 maxValue)
+   { vst1_u16(p, vqmovun_s32(vminq_s32(vmaxq_s32(v, zero), maxValue))); }
+
+   static void PackRGB32(unsigned char* dst, const unsigned short* r,
+         const unsigned short* g, const unsigned short* b, int n, int shift)
+   {
+      const int16x8_t count = vdupq_n_s16(static_cast<short>(-shift));
+      int x = 0;
+      for (; x + 8 <= n; x += 8)
+      {
+         uint8x8x4_t px;
+         px.val[0] = vqmovn_u16(vshlq_u16(vld1q_u16(b + x), count));
+         px.val[1] = vqmovn_u16(vshlq_u16(vld1q_u16(g + x), count));
+         px.val[2] = vqmovn_u16(vshlq_u16(vld1q_u16(r + x), count));
+         px.val[3] = vdup_n_u8(0);
+         vst4_u8(dst + 4 * x, px);
+      }
+      DebayerKernels::PackRGB32Scalar(dst, r, g, b, x, n, shift);
+   }
+   static void PackRGB64(unsigned short* dst, const unsigned short* r,
+         const unsigned short* g, const unsigned short* b, int n)
+   {
+      int x = 0;
+      for (; x + 8 <= n; x += 8)
+      {
+         uint16x8x4_t px;
+         px.val[0] = vld1q_u16(b + x);
+         px.val[1] = vld1q_u16(g + x);
+         px.val[2] = vld1q_u16(r + x);
+         px.val[3] = vdupq_n_u16(0);
+         vst4q_u16(dst + 4 * x, px);
+      }
+      DebayerKernels::PackRGB64Scalar(dst, r, g, b, x, n);
+   }
+};
+
+void ProcessRowsNEON(const Job& job, const Workspace& workspace, int y0, int y1)
+{
+   DebayerKernels::Rows<NEONOps>(job, workspace).Run(y0, y1);
+}
+#endif // MM_DEBAYER_NEON
+
+#ifdef MM_DEBAYER_AVX2
+bool CPUHasAVX2()
+{
+#ifdef _MSC_VER
+   int info[4];
+   __cpuid(info, 0);
+   if (info[0] < 7)
+      return false;
+   __cpuid(info, 1);
+   const bool osxsave = (info[2] & (1 << 27)) != 0;
+   const bool avx = (info[2] & (1 << 28)) != 0;
+   if (!osxsave || !avx || (_xgetbv(0) & 6) != 6) // OS must save YMM state
+      return false;
+   __cpuidex(info, 7, 0);
+   return (info[1] & (1 << 5)) != 0;
+#else
+   return __builtin_cpu_supports("avx2") != 0;
+#endif
+}
+#endif
+
+struct RowsImplementation
+{
+   DebayerKernels::RowsFunction function;
+   const char* name;
+};
+
+RowsImplementation SelectRowsImplementation()
+{
+   RowsImplementation impl = { ProcessRowsScalar, "Scalar" };
+#ifdef MM_DEBAYER_AVX2
+   if (CPUHasAVX2())
+   {
+      impl.function = DebayerKernels::ProcessRowsAVX2;
+      impl.name = "AVX2";
+      return impl;
+   }
+#endif
+#if defined(MM_DEBAYER_SSE2)
+   impl.function = ProcessRowsSSE2;
+   impl.name = "SSE2";
+#elif defined(MM_DEBAYER_NEON)
+   impl.function = ProcessRowsNEON;
+   impl.name = "NEON";
+#endif
+   return impl;
+}
+
+const RowsImplementation& BestRowsImplementation()
+{
+   static const RowsImplementation impl = SelectRowsImplementation();
+   return impl;
+}
+
+} // anonymous namespace
+
 ///////////////////////////////////////////////////////////////////////////////
 // Debayer class implementation
 ///////////////////////////////////////////////////////////////////////////////
@@ -48,12 +313,30 @@ Debayer::Debayer()
    // default settings
    orderIndex = 0; // RGRG ordering
    algoIndex = 0;  // replication - faster
+   outputDepth = 4; // RGB32
+   threadCount = std::thread::hardware_concurrency();
+   if (threadCount == 0)
+      threadCount = 1;
+   simdEnabled = true;
 }
 
 Debayer::~Debayer()
 {
 }
 
+int Debayer::SetOutputDepth(int bytesPerPixel)
+{
+   if (bytesPerPixel != 4 && bytesPerPixel != 8)
+      return DEVICE_INVALID_INPUT_PARAM;
+   outputDepth = bytesPerPixel;
+   return DEVICE_OK;
+}
+
+const char* Debayer::GetInstructionSet() const
+{
+   return simdEnabled ? BestRowsImplementation().name : "Scalar";
+}
+
 int Debayer::Process(ImgBuffer& out, const ImgBuffer& input, int bitDepth)
 {
    assert(sizeof(int) == 4);
@@ -65,7 +348,6 @@ int Debayer::Process(ImgBuffer& out, const ImgBuffer& input, int bitDepth)
       return DEVICE_INVALID_INPUT_PARAM;
    }
 
-   out.Resize(input.Width(), input.Height(), 4);
    if (input.Depth() == 1)
    {
       const unsigned char* inBuf = input.GetPixels();
@@ -91,26 +373,97 @@ template <typename T>
 int Debayer::ProcessT(ImgBuffer& out, const T* in, int width, int height, int bitDepth)
 {
    assert(sizeof(int) == 4);
-   out.Resize(width, height, 4);
-   int* outBuf = reinterpret_cast<int*>(out.GetPixelsRW());
-   return Convert(in, outBuf, width, height, bitDepth, orderIndex, algoIndex);
-}
-
-template<typename T>
-int Debayer::Convert(const T* input, int* output, int width, int height, int bitDepth, int rowOrder, int algorithm)
-{				
-	if (algorithm == 0)
-      ReplicateDecode(input, output, width, height, bitDepth, rowOrder);
-	else if (algorithm == 1)
-      return DEVICE_NOT_SUPPORTED;
-	else if (algorithm == 2)
-      SmoothDecode(input, output, width, height, bitDepth, rowOrder);
-	else if (algorithm == 3)
-      return DEVICE_NOT_SUPPORTED;
-   else
+   if (algoIndex == 2)
+   {
+      // Smooth-Hue keeps its original implementation
+      if (outputDepth != 4)
+         return DEVICE_NOT_SUPPORTED;
+      out.Resize(width, height, 4);
+      int* outBuf = reinterpret_cast<int*>(out.GetPixelsRW());
+      SmoothDecode(in, outBuf, width, height, bitDepth, orderIndex);
+      return DEVICE_OK;
+   }
+   if (algoIndex != DebayerKernels::Replication &&
+         algoIndex != DebayerKernels::Bilinear &&
+         algoIndex != DebayerKernels::EdgeAware)
       return DEVICE_NOT_SUPPORTED;
 
+   out.Resize(width, height, outputDepth);
+   return Demosaic(out, in, sizeof(T), width, height, bitDepth);
+}
+
+// Writes directly into out, in bands of rows processed in parallel
+int Debayer::Demosaic(ImgBuffer& out, const void* in, int inputDepth, int width, int height, int bitDepth)
+{
+   using namespace DebayerKernels;
+
+   // Position of the red site for each order. G-R-G-R and G-B-G-B are
+   // swapped relative to their names; this matches the original
+   // implementation, which existing configurations depend on.
+   static const int redX[] = { 0, 1, 0, 1 };
+   static const int redY[] = { 0, 1, 1, 0 };
+   if (orderIndex < 0 || orderIndex > 3 || bitDepth < 1 || bitDepth > 16)
+      return DEVICE_INVALID_INPUT_PARAM;
+   if (width <= 0 || height <= 0)
+      return DEVICE_OK;
+
+   Job job;
+   job.input8 = inputDepth == 1 ? static_cast<const unsigned char*>(in) : 0;
+   job.input16 = inputDepth == 1 ? 0 : static_cast<const unsigned short*>(in);
+   job.width = width;
+   job.height = height;
+   job.redX = redX[orderIndex];
+   job.redY = redY[orderIndex];
+   job.algorithm = algoIndex;
+   job.maxValue = (1 << bitDepth) - 1;
+   job.shift = bitDepth > 8 ? bitDepth - 8 : 0;
+   job.output = out.GetPixelsRW();
+   job.outputDepth = outputDepth;
+
+   // Starting a thread is only worth it for bands of a reasonable size
+   const long long minBandPixels = 256 * 1024;
+   unsigned bands = threadCount;
+   if (bands > (long long)width * height / minBandPixels)
+      bands = (unsigned)((long long)width * height / minBandPixels);
+   if (bands > (unsigned)height / 16)
+      bands = (unsigned)height / 16;
+   if (bands < 1)
+      bands = 1;
+
+   const size_t stride = LineStride(width);
+   const size_t lineSetSize = (RawLines + 3) * stride; // Raw, then R, G, B
+   if (lineBuffers.size() < bands * lineSetSize)
+      lineBuffers.resize(bands * lineSetSize);
+   if (algoIndex == EdgeAware && greenBuffers.size() < bands * GreenLines * stride)
+      greenBuffers.resize(bands * GreenLines * stride);
+
+   vector<Workspace> workspaces(bands);
+   for (unsigned i = 0; i < bands; ++i)
+   {
+      workspaces[i].raw = &lineBuffers[i * lineSetSize];
+      workspaces[i].rgb = workspaces[i].raw + RawLines * stride;
+      workspaces[i].green = algoIndex == EdgeAware ?
+         &greenBuffers[i * GreenLines * stride] : 0;
+   }
 
+   RowsFunction rows = simdEnabled ? BestRowsImplementation().function : ProcessRowsScalar;
+   vector<thread> workers;
+   for (unsigned i = 1; i < bands; ++i)
+   {
+      const int y0 = (int)((long long)height * i / bands);
+      const int y1 = (int)((long long)height * (i + 1) / bands);
+      try
+      {
+         workers.push_back(thread(rows, std::cref(job), std::cref(workspaces[i]), y0, y1));
+      }
+      catch (const system_error&)
+      {
+         rows(job, workspaces[i], y0, y1);
+      }
+   }
+   rows(job, workspaces[0], 0, (int)((long long)height / bands));
+   for (size_t i = 0; i < workers.size(); ++i)
+      workers[i].join();
    return DEVICE_OK;
 }
 
@@ -136,155 +489,6 @@ unsigned short Debayer::GetPixel(const unsigned char* v, int x, int y, int width
       return v[y*width + x];
 }
 
-// Replication algorithm
-template <typename T>
-void Debayer::ReplicateDecode(const T* input, int* output, int width, int height, int bitDepth, int rowOrder)
-{
-   unsigned numPixels(width*height);
-   if (r.size() != numPixels)
-   {
-      r.resize(numPixels);
-      g.resize(numPixels);
-      b.resize(numPixels);
-   }
-
-   int bitShift = bitDepth - 8;
-	
-	if (rowOrder == 0 || rowOrder == 1) {
-		for (int y=0; y<height; y+=2) {
-			for (int x=0; x<width; x+=2) {
-				unsigned short one = GetPixel(input, x, y, width, height);
-				SetPixel(b, one, x, y, width, height);
-				SetPixel(b, one, x+1, y, width, height);
-				SetPixel(b, one, x, y+1, width, height); 
-				SetPixel(b, one, x+1, y+1, width, height);
-			}
-		}
-		
-		for (int y=1; y<height; y+=2) {
-			for (int x=1; x<width; x+=2) {
-            unsigned short one = GetPixel(input, x, y, width, height);
-				SetPixel(r, one, x, y, width, height);
-				SetPixel(r, one, x+1, y, width, height);
-				SetPixel(r, one, x, y+1, width, height); 
-				SetPixel(r, one, x+1, y+1, width, height);
-			}
-		}
-		
-		for (int y=0; y<height; y+=2) {
-			for (int x=1; x<width; x+=2) {
-				unsigned short one = GetPixel(input, x, y, width, height);
-            SetPixel(g, one, x, y, width, height);
-            SetPixel(g, one, x+1, y, width, height);
-			}
-		}	
-			
-		for (int y=1; y<height; y+=2) {
-			for (int x=0; x<width; x+=2) {
-            unsigned short one = GetPixel(input, x, y, width, height);
-            SetPixel(g, one, x, y, width, height);
-            SetPixel(g, one, x+1, y, width, height);
-			}
-		}	
-		
-		if (rowOrder == 0) {
-         for (int i=0; i<height*width; i++)
-         {
-            output[i] = 0;
-            unsigned char* bytePix = (unsigned char*)(output+i);
-            *bytePix = (unsigned char)(r[i] >> bitShift);
-            *(bytePix+1) = (unsigned char)(g[i] >> bitShift);
-            *(bytePix+2) = (unsigned char)(b[i] >> bitShift);
-
-			   //rgb.addSlice("red",b);	
-			   //rgb.addSlice("green",g);
-			   //rgb.addSlice("blue",r);
-         }
-		}
-		else if (rowOrder == 1) {
-         for (int i=0; i<height*width; i++)
-         {
-            output[i] = 0;
-            unsigned char* bytePix = (unsigned char*)(output+i);
-            *bytePix = (unsigned char)(b[i] >> bitShift);
-            *(bytePix+1) = (unsigned char)(g[i] >> bitShift);
-            *(bytePix+2) = (unsigned char)(r[i] >> bitShift);
-
-			   //rgb.addSlice("red",r);	
-			   //rgb.addSlice("green",g);
-			   //rgb.addSlice("blue",b);			
-		   }
-      }
-	}
-
-	else if (rowOrder == 2 || rowOrder == 3) {
-		for (int y=1; y<height; y+=2) {
-			for (int x=0; x<width; x+=2) {
-				unsigned short one = GetPixel(input, x, y, width, height);
-				SetPixel(b, one, x, y, width, height);
-				SetPixel(b, one, x+1, y, width, height);
-				SetPixel(b, one, x, y+1, width, height); 
-				SetPixel(b, one, x+1, y+1, width, height);
-			}
-		}
-		
-		for (int y=0; y<height; y+=2) {
-			for (int x=1; x<width; x+=2) {
-            unsigned short one = GetPixel(input, x, y, width, height);
-				SetPixel(r, one, x, y, width, height);
-				SetPixel(r, one, x+1, y, width, height);
-				SetPixel(r, one, x, y+1, width, height); 
-				SetPixel(r, one, x+1, y+1, width, height);
-			}
-		}
-		
-		for (int y=0; y<height; y+=2) {
-			for (int x=0; x<width; x+=2) {
-				unsigned short one = GetPixel(input, x, y, width, height);
-            SetPixel(g, one, x, y, width, height);
-            SetPixel(g, one, x+1, y, width, height);
-			}
-		}	
-			
-		for (int y=1; y<height; y+=2) {
-			for (int x=1; x<width; x+=2) {
-            unsigned short one = GetPixel(input, x, y, width, height);
-            SetPixel(g, one, x, y, width, height);
-            SetPixel(g, one, x+1, y, width, height);
-			}
-		}	
-		
-		if (rowOrder == 2) {
-         for (int i=0; i<height*width; i++)
-         {
-            output[i] = 0;
-            unsigned char* bytePix = (unsigned char*)(output+i);
-            *bytePix = (unsigned char)(r[i] >> bitShift);
-            *(bytePix+1) = (unsigned char)(g[i] >> bitShift);
-            *(bytePix+2) = (unsigned char)(b[i] >> bitShift);
-
-            //rgb.addSlice("red",b);	
-			   //rgb.addSlice("green",g);
-			   //rgb.addSlice("blue",r);
-         }
-		}
-		else if (rowOrder == 3) {
-         for (int i=0; i<height*width; i++)
-         {
-            output[i] = 0;
-            unsigned char* bytePix = (unsigned char*)(output+i);
-            *bytePix = (unsigned char)(b[i] >> bitShift);
-            *(bytePix+1) = (unsigned char)(g[i] >> bitShift);
-            *(bytePix+2) = (unsigned char)(r[i] >> bitShift);
-
-            //rgb.addSlice("red",r);	
-			   //rgb.addSlice("green",g);
-			   //rgb.addSlice("blue",b);
-         }
-		}
-	}
-}
-
 // Smooth Hue algorithm
 template <typename T>
 void Debayer::SmoothDecode(const T* input, int* output, int width, int height, int bitDepth, int rowOrder)
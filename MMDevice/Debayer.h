@@ -48,15 +48,28 @@ public:
    void SetOrderIndex(int idx) {orderIndex = idx;}
    void SetAlgorithmIndex(int idx) {algoIndex = idx;}
 
+   // Bytes per output pixel: 4 (RGB32, the default) or 8 (RGB64, 16 bits
+   // per channel, not shifted). Smooth-Hue supports only RGB32.
+   int SetOutputDepth(int bytesPerPixel);
+   int GetOutputDepth() const {return outputDepth;}
+
+   // Maximum number of threads used for large images; defaults to the
+   // number of processor cores
+   void SetThreadCount(unsigned count) {threadCount = count > 0 ? count : 1;}
+   unsigned GetThreadCount() const {return threadCount;}
+
+   // Use of AVX2, SSE2 or NEON, when available. The results are identical
+   // either way; disabling is only useful for testing.
+   void SetSIMDEnabled(bool enable) {simdEnabled = enable;}
+   // "AVX2", "SSE2", "NEON" or "Scalar"
+   const char* GetInstructionSet() const;
+
 private:
    template <typename T>
    int ProcessT(ImgBuffer& out, const T* in, int width, int height, int bitDepth);
-   template<typename T>
-   void ReplicateDecode(const T* input, int* out, int width, int height, int bitDepth, int rowOrder);
+   int Demosaic(ImgBuffer& out, const void* in, int inputDepth, int width, int height, int bitDepth);
    template <typename T>
    void SmoothDecode(const T* input, int* output, int width, int height, int bitDepth, int rowOrder);
-   template<typename T>
-   int Convert(const T* input, int* output, int width, int height, int bitDepth, int rowOrder, int algorithm);
    unsigned short GetPixel(const unsigned short* v, int x, int y, int width, int height);
    void SetPixel(std::vector<unsigned short>& v, unsigned short val, int x, int y, int width, int height);
    unsigned short GetPixel(const unsigned char* v, int x, int y, int width, int height);
@@ -70,6 +83,12 @@ private:
 
    int orderIndex;
    int algoIndex;
+   int outputDepth;
+   unsigned threadCount;
+   bool simdEnabled;
+
+   std::vector<unsigned short> lineBuffers; // Per-thread, for Demosaic()
+   std::vector<int> greenBuffers;
 };
 
 #endif // !defined(_DEBAYER_)
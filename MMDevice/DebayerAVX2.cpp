@@ -0,0 +1,116 @@
+///////////////////////////////////////////////////////////////////////////////
+// MODULE:        DebayerAVX2.cpp
+// SYSTEM:        ImageBase subsystem
+//
+// DESCRIPTION:   AVX2 instantiation of the Debayer row kernels. This file is
+//                compiled for AVX2 without special compiler flags; Debayer.cpp
+//                only calls into it after checking the CPU.
+//
+// LICENSE:       This file is free for use, modification and distribution and
+//                is distributed under terms specified in the BSD license
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <cstddef>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#include <immintrin.h>
+
+// Enable AVX2 code generation for the rest of this file only. All system
+// headers must be included above this point.
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx2"))), apply_to = function)
+#define MM_DEBAYER_AVX2_POP
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#define MM_DEBAYER_AVX2_POP
+#endif
+#endif
+
+#include "DebayerKernels.h"
+
+#ifdef MM_DEBAYER_AVX2
+
+namespace {
+
+struct AVX2Ops
+{
+   typedef __m256i V16;
+   typedef __m256i M16;
+   typedef __m256i V32;
+   typedef __m256i M32;
+   enum { N16 = 16, N32 = 8 };
+
+   static V16 Load16(const unsigned short* p)
+   { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+   static void Store16(unsigned short* p, V16 v)
+   { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v); }
+   static V16 Avg16(V16 a, V16 b) { return _mm256_avg_epu16(a, b); }
+   static M16 PhaseMask16(int, int phase)
+   { return _mm256_set1_epi32(phase ? static_cast<int>(0xFFFF0000) : 0x0000FFFF); }
+   static V16 Select16(M16 m, V16 a, V16 b) { return _mm256_blendv_epi8(a, b, m); }
+
+   static V32 Widen(const unsigned short* p)
+   { return _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p))); }
+   static V32 Load32(const int* p)
+   { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+   static void Store32(int* p, V32 v)
+   { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v); }
+   static V32 Set32(int v) { return _mm256_set1_epi32(v); }
+   static V32 Add32(V32 a, V32 b) { return _mm256_add_epi32(a, b); }
+   static V32 Sub32(V32 a, V32 b) { return _mm256_sub_epi32(a, b); }
+   static V32 Half32(V32 v) { return _mm256_srai_epi32(v, 1); }
+   static V32 Quarter32(V32 v) { return _mm256_srai_epi32(v, 2); }
+   static V32 Abs32(V32 v) { return _mm256_abs_epi32(v); }
+   static V32 Min32(V32 a, V32 b) { return _mm256_min_epi32(a, b); }
+   static V32 Max32(V32 a, V32 b) { return _mm256_max_epi32(a, b); }
+   static M32 Lt32(V32 a, V32 b) { return _mm256_cmpgt_epi32(b, a); }
+   static V32 Select32(M32 m, V32 a, V32 b) { return _mm256_blendv_epi8(a, b, m); }
+   static M32 PhaseMask32(int, int phase)
+   {
+      return phase ? _mm256_set_epi32(-1, 0, -1, 0, -1, 0, -1, 0) :
+         _mm256_set_epi32(0, -1, 0, -1, 0, -1, 0, -1);
+   }
+   static void StoreClamped16(unsigned short* p, V32 v, V32 zero, V32 maxValue)
+   {
+      v = _mm256_min_epi32(_mm256_max_epi32(v, zero), maxValue);
+      // packus works within 128-bit lanes; gather the two halves
+      __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(v, v), 0x08);
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(p), _mm256_castsi256_si128(packed));
+   }
+
+   static void PackRGB32(unsigned char* dst, const unsigned short* r,
+         const unsigned short* g, const unsigned short* b, int n, int shift)
+   { DebayerKernels::PackRGB32SSE2(dst, r, g, b, n, shift); }
+   static void PackRGB64(unsigned short* dst, const unsigned short* r,
+         const unsigned short* g, const unsigned short* b, int n)
+   { DebayerKernels::PackRGB64SSE2(dst, r, g, b, n); }
+};
+
+} // anonymous namespace
+
+void DebayerKernels::ProcessRowsAVX2(const Job& job,
+      const Workspace& workspace, int y0, int y1)
+{
+   Rows<AVX2Ops>(job, workspace).Run(y0, y1);
+}
+
+#endif // MM_DEBAYER_AVX2
+
+#ifdef MM_DEBAYER_AVX2_POP
+#if defined(__clang__)
+#pragma clang attribute pop
+#else
+#pragma GCC pop_options
+#endif
+#endif
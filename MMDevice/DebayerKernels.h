@@ -0,0 +1,439 @@
+///////////////////////////////////////////////////////////////////////////////
+// MODULE:        DebayerKernels.h
+// SYSTEM:        ImageBase subsystem
+//
+// DESCRIPTION:   Row kernels for the Debayer class. Private to Debayer.cpp
+//                and DebayerAVX2.cpp; not part of the MMDevice API.
+//
+// LICENSE:       This file is free for use, modification and distribution and
+//                is distributed under terms specified in the BSD license
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+// The kernels are written once, as templates over an "Ops" type that
+// provides the vector operations of one instruction set (scalar, SSE2, AVX2
+// or NEON). Every instruction set computes exactly the same result.
+//
+// This header is also compiled with AVX2 code generation enabled (in
+// DebayerAVX2.cpp), so it must not contain anything that could be shared
+// between translation units: everything here is either a template
+// instantiated with a TU-local Ops type or declared static. It also must not
+// instantiate standard library templates.
+
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MM_DEBAYER_SSE2
+#include <emmintrin.h>
+#if defined(__GNUC__) || defined(_MSC_VER)
+#define MM_DEBAYER_AVX2
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define MM_DEBAYER_NEON
+#include <arm_neon.h>
+#endif
+
+namespace DebayerKernels {
+
+enum Algorithm
+{
+   Replication = 0,
+   Bilinear = 1,
+   EdgeAware = 3 // Listed as "Adaptive-Smooth-Hue"
+};
+
+struct Job
+{
+   const unsigned char* input8; // Exactly one of input8, input16 is set
+   const unsigned short* input16;
+   int width;
+   int height;
+   int redX; // Position of the red site in the 2x2 Bayer cell
+   int redY;
+   int algorithm;
+   int maxValue; // (1 << bitDepth) - 1
+   int shift; // Right shift for 8-bit output
+   unsigned char* output; // B, G, R, 0 per pixel, 8 or 16 bits each
+   int outputDepth; // Bytes per output pixel: 4 or 8
+};
+
+// Line buffers of one thread, allocated by the caller (see LineStride())
+struct Workspace
+{
+   unsigned short* raw; // RawLines lines
+   int* green; // GreenLines lines
+   unsigned short* rgb; // 3 lines
+};
+
+static const int Padding = 2; // Mirrored pixels on each side of a line
+static const int RawLines = 8;
+static const int GreenLines = 4;
+
+// Elements per line buffer: the padded width, plus room for whole vectors
+// past the end of the line
+static inline std::size_t LineStride(int width)
+{
+   return static_cast<std::size_t>(((width + 15) & ~15) + 32);
+}
+
+typedef void (*RowsFunction)(const Job& job, const Workspace& workspace,
+      int y0, int y1);
+
+#ifdef MM_DEBAYER_AVX2
+// Defined in DebayerAVX2.cpp; only call when the CPU supports AVX2
+void ProcessRowsAVX2(const Job& job, const Workspace& workspace,
+      int y0, int y1);
+#endif
+
+// Mirror index i into [0, n) without repeating the edge pixel, which
+// preserves the Bayer phase of rows and columns
+static inline int Reflect(int i, int n)
+{
+   if (n == 1)
+      return 0;
+   while (i < 0 || i >= n)
+   {
+      if (i < 0)
+         i = -i;
+      if (i >= n)
+         i = 2 * (n - 1) - i;
+   }
+   return i;
+}
+
+static inline void PackRGB32Scalar(unsigned char* dst,
+      const unsigned short* r, const unsigned short* g,
+      const unsigned short* b, int x, int n, int shift)
+{
+   for (; x < n; ++x)
+   {
+      unsigned bv = b[x] >> shift;
+      unsigned gv = g[x] >> shift;
+      unsigned rv = r[x] >> shift;
+      dst[4 * x] = static_cast<unsigned char>(bv > 255 ? 255 : bv);
+      dst[4 * x + 1] = static_cast<unsigned char>(gv > 255 ? 255 : gv);
+      dst[4 * x + 2] = static_cast<unsigned char>(rv > 255 ? 255 : rv);
+      dst[4 * x + 3] = 0;
+   }
+}
+
+static inline void PackRGB64Scalar(unsigned short* dst,
+      const unsigned short* r, const unsigned short* g,
+      const unsigned short* b, int x, int n)
+{
+   for (; x < n; ++x)
+   {
+      dst[4 * x] = b[x];
+      dst[4 * x + 1] = g[x];
+      dst[4 * x + 2] = r[x];
+      dst[4 * x + 3] = 0;
+   }
+}
+
+#ifdef MM_DEBAYER_SSE2
+// Also used by the AVX2 kernels: the interleave is limited by stores
+static inline void PackRGB32SSE2(unsigned char* dst,
+      const unsigned short* r, const unsigned short* g,
+      const unsigned short* b, int n, int shift)
+{
+   const __m128i zero = _mm_setzero_si128();
+   const __m128i count = _mm_cvtsi32_si128(shift);
+   int x = 0;
+   for (; x + 8 <= n; x += 8)
+   {
+      __m128i bv = _mm_srl_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(b + x)), count);
+      __m128i gv = _mm_srl_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(g + x)), count);
+      __m128i rv = _mm_srl_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(r + x)), count);
+      __m128i bg = _mm_unpacklo_epi8(_mm_packus_epi16(bv, zero), _mm_packus_epi16(gv, zero));
+      __m128i r0 = _mm_unpacklo_epi8(_mm_packus_epi16(rv, zero), zero);
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 4 * x), _mm_unpacklo_epi16(bg, r0));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 4 * x + 16), _mm_unpackhi_epi16(bg, r0));
+   }
+   PackRGB32Scalar(dst, r, g, b, x, n, shift);
+}
+
+static inline void PackRGB64SSE2(unsigned short* dst,
+      const unsigned short* r, const unsigned short* g,
+      const unsigned short* b, int n)
+{
+   const __m128i zero = _mm_setzero_si128();
+   int x = 0;
+   for (; x + 8 <= n; x += 8)
+   {
+      __m128i bv = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + x));
+      __m128i gv = _mm_loadu_si128(reinterpret_cast<const __m128i*>(g + x));
+      __m128i rv = _mm_loadu_si128(reinterpret_cast<const __m128i*>(r + x));
+      __m128i bgLo = _mm_unpacklo_epi16(bv, gv);
+      __m128i bgHi = _mm_unpackhi_epi16(bv, gv);
+      __m128i r0Lo = _mm_unpacklo_epi16(rv, zero);
+      __m128i r0Hi = _mm_unpackhi_epi16(rv, zero);
+      __m128i* out = reinterpret_cast<__m128i*>(dst + 4 * x);
+      _mm_storeu_si128(out, _mm_unpacklo_epi32(bgLo, r0Lo));
+      _mm_storeu_si128(out + 1, _mm_unpackhi_epi32(bgLo, r0Lo));
+      _mm_storeu_si128(out + 2, _mm_unpacklo_epi32(bgHi, r0Hi));
+      _mm_storeu_si128(out + 3, _mm_unpackhi_epi32(bgHi, r0Hi));
+   }
+   PackRGB64Scalar(dst, r, g, b, x, n);
+}
+#endif // MM_DEBAYER_SSE2
+
+
+/**
+ * Demosaics a band of rows.
+ *
+ * Input rows are converted to 16 bits and mirrored at the edges as they are
+ * needed, so that the kernels can read two pixels past either end of a line
+ * without bounds checks. Each row is computed into red, green and blue
+ * lines, which are then interleaved into the output.
+ *
+ * Ops provides 16-bit vectors (V16, with masks M16, N16 lanes) and 32-bit
+ * signed vectors (V32, M32, N32 lanes). Vector code processes whole vectors
+ * past the end of the line; the line buffers leave room for that.
+ */
+template <typename Ops>
+class Rows
+{
+public:
+   Rows(const Job& job, const Workspace& workspace) :
+      job_(job),
+      ws_(workspace),
+      stride_(LineStride(job.width))
+   {
+      for (int i = 0; i < RawLines; ++i)
+         rawTag_[i] = -1;
+      for (int i = 0; i < GreenLines; ++i)
+         greenTag_[i] = -1;
+   }
+
+   void Run(int y0, int y1)
+   {
+      unsigned short* r = ws_.rgb;
+      unsigned short* g = r + stride_;
+      unsigned short* b = g + stride_;
+      const std::size_t rowBytes =
+         static_cast<std::size_t>(job_.width) * job_.outputDepth;
+      for (int y = y0; y < y1; ++y)
+      {
+         if (job_.algorithm == Bilinear)
+            BilinearRow(y, r, g, b);
+         else if (job_.algorithm == EdgeAware)
+            EdgeAwareRow(y, r, g, b);
+         else
+            ReplicationRow(y, r, g, b);
+
+         unsigned char* dst = job_.output + y * rowBytes;
+         if (job_.outputDepth == 8)
+            Ops::PackRGB64(reinterpret_cast<unsigned short*>(dst),
+                  r, g, b, job_.width);
+         else
+            Ops::PackRGB32(dst, r, g, b, job_.width, job_.shift);
+      }
+   }
+
+private:
+   // Whether row y contains red (rather than blue) sites
+   bool IsRedRow(int y) const { return ((y - job_.redY) & 1) == 0; }
+
+   // Column parity of the red or blue sites in row y
+   int ColorPhase(int y) const
+   { return IsRedRow(y) ? job_.redX : 1 - job_.redX; }
+
+   const unsigned short* RawLine(int y)
+   {
+      const int w = job_.width;
+      const int row = Reflect(y, job_.height);
+      const int slot = row & (RawLines - 1);
+      unsigned short* line = ws_.raw + slot * stride_ + Padding;
+      if (rawTag_[slot] != row)
+      {
+         rawTag_[slot] = row;
+         const std::size_t offset = static_cast<std::size_t>(row) * w;
+         if (job_.input8)
+         {
+            const unsigned char* src = job_.input8 + offset;
+            for (int x = 0; x < w; ++x)
+               line[x] = src[x];
+         }
+         else
+            std::memcpy(line, job_.input16 + offset, w * sizeof(unsigned short));
+         for (int k = 1; k <= Padding; ++k)
+         {
+            line[-k] = line[Reflect(-k, w)];
+            line[w - 1 + k] = line[Reflect(w - 1 + k, w)];
+         }
+      }
+      return line;
+   }
+
+   // Pixels whose column parity differs from phase take the site to their
+   // left (same as the original implementation)
+   static typename Ops::V16 Replicate(const unsigned short* line, int x,
+         int phase)
+   {
+      return Ops::Select16(Ops::PhaseMask16(x, 1 - phase),
+            Ops::Load16(line + x), Ops::Load16(line + x - 1));
+   }
+
+   void ReplicationRow(int y, unsigned short* r, unsigned short* g,
+         unsigned short* b)
+   {
+      // Rows without a color take it from the row above
+      const unsigned short* cur = RawLine(y);
+      const unsigned short* red = IsRedRow(y) ? cur : RawLine(y - 1);
+      const unsigned short* blue = IsRedRow(y) ? RawLine(y - 1) : cur;
+      const int redPhase = job_.redX;
+      const int bluePhase = 1 - job_.redX;
+      const int greenPhase = 1 - ColorPhase(y);
+      for (int x = 0; x < job_.width; x += Ops::N16)
+      {
+         Ops::Store16(r + x, Replicate(red, x, redPhase));
+         Ops::Store16(g + x, Replicate(cur, x, greenPhase));
+         Ops::Store16(b + x, Replicate(blue, x, bluePhase));
+      }
+   }
+
+   void BilinearRow(int y, unsigned short* r, unsigned short* g,
+         unsigned short* b)
+   {
+      const unsigned short* n = RawLine(y - 1);
+      const unsigned short* c = RawLine(y);
+      const unsigned short* s = RawLine(y + 1);
+      // A is the color sampled in this row, C the one in the rows above
+      // and below
+      unsigned short* a = IsRedRow(y) ? r : b;
+      unsigned short* o = IsRedRow(y) ? b : r;
+      const int phase = ColorPhase(y);
+      for (int x = 0; x < job_.width; x += Ops::N16)
+      {
+         typename Ops::M16 atColor = Ops::PhaseMask16(x, phase);
+         typename Ops::V16 center = Ops::Load16(c + x);
+         typename Ops::V16 horz = Ops::Avg16(Ops::Load16(c + x - 1),
+               Ops::Load16(c + x + 1));
+         typename Ops::V16 vert = Ops::Avg16(Ops::Load16(n + x),
+               Ops::Load16(s + x));
+         typename Ops::V16 diag = Ops::Avg16(
+               Ops::Avg16(Ops::Load16(n + x - 1), Ops::Load16(n + x + 1)),
+               Ops::Avg16(Ops::Load16(s + x - 1), Ops::Load16(s + x + 1)));
+         Ops::Store16(a + x, Ops::Select16(atColor, horz, center));
+         Ops::Store16(g + x, Ops::Select16(atColor, center,
+                  Ops::Avg16(horz, vert)));
+         Ops::Store16(o + x, Ops::Select16(atColor, vert, diag));
+      }
+   }
+
+   // Green for every pixel of row y, by Hamilton-Adams interpolation along
+   // the direction with the smaller gradient
+   const int* GreenLine(int y)
+   {
+      const int w = job_.width;
+      const int row = Reflect(y, job_.height);
+      const int slot = row & (GreenLines - 1);
+      int* line = ws_.green + slot * stride_ + Padding;
+      if (greenTag_[slot] == row)
+         return line;
+      greenTag_[slot] = row;
+
+      const unsigned short* nn = RawLine(row - 2);
+      const unsigned short* n = RawLine(row - 1);
+      const unsigned short* c = RawLine(row);
+      const unsigned short* s = RawLine(row + 1);
+      const unsigned short* ss = RawLine(row + 2);
+      const typename Ops::V32 zero = Ops::Set32(0);
+      const typename Ops::V32 maxValue = Ops::Set32(job_.maxValue);
+      const int phase = ColorPhase(row);
+      for (int x = 0; x < w; x += Ops::N32)
+      {
+         typename Ops::V32 center = Ops::Widen(c + x);
+         typename Ops::V32 west = Ops::Widen(c + x - 1);
+         typename Ops::V32 east = Ops::Widen(c + x + 1);
+         typename Ops::V32 north = Ops::Widen(n + x);
+         typename Ops::V32 south = Ops::Widen(s + x);
+         typename Ops::V32 center2 = Ops::Add32(center, center);
+         typename Ops::V32 lapH = Ops::Sub32(Ops::Sub32(center2,
+                  Ops::Widen(c + x - 2)), Ops::Widen(c + x + 2));
+         typename Ops::V32 lapV = Ops::Sub32(Ops::Sub32(center2,
+                  Ops::Widen(nn + x)), Ops::Widen(ss + x));
+         typename Ops::V32 gradH = Ops::Add32(
+               Ops::Abs32(Ops::Sub32(west, east)), Ops::Abs32(lapH));
+         typename Ops::V32 gradV = Ops::Add32(
+               Ops::Abs32(Ops::Sub32(north, south)), Ops::Abs32(lapV));
+         typename Ops::V32 sumH = Ops::Add32(west, east);
+         typename Ops::V32 sumV = Ops::Add32(north, south);
+         typename Ops::V32 estH =
+            Ops::Quarter32(Ops::Add32(Ops::Add32(sumH, sumH), lapH));
+         typename Ops::V32 estV =
+            Ops::Quarter32(Ops::Add32(Ops::Add32(sumV, sumV), lapV));
+         typename Ops::V32 est = Ops::Half32(Ops::Add32(estH, estV));
+         est = Ops::Select32(Ops::Lt32(gradH, gradV), est, estH);
+         est = Ops::Select32(Ops::Lt32(gradV, gradH), est, estV);
+         est = Ops::Min32(Ops::Max32(est, zero), maxValue);
+         Ops::Store32(line + x,
+               Ops::Select32(Ops::PhaseMask32(x, phase), est, center));
+      }
+      for (int k = 1; k <= Padding; ++k)
+      {
+         line[-k] = line[Reflect(-k, w)];
+         line[w - 1 + k] = line[Reflect(w - 1 + k, w)];
+      }
+      return line;
+   }
+
+   // Red and blue by interpolating the color differences to green
+   void EdgeAwareRow(int y, unsigned short* r, unsigned short* g,
+         unsigned short* b)
+   {
+      // Green lines first: computing them may replace cached raw lines
+      const int* gn = GreenLine(y - 1);
+      const int* gc = GreenLine(y);
+      const int* gs = GreenLine(y + 1);
+      const unsigned short* n = RawLine(y - 1);
+      const unsigned short* c = RawLine(y);
+      const unsigned short* s = RawLine(y + 1);
+      unsigned short* a = IsRedRow(y) ? r : b;
+      unsigned short* o = IsRedRow(y) ? b : r;
+      const typename Ops::V32 zero = Ops::Set32(0);
+      const typename Ops::V32 maxValue = Ops::Set32(job_.maxValue);
+      const int phase = ColorPhase(y);
+      for (int x = 0; x < job_.width; x += Ops::N32)
+      {
+         typename Ops::M32 atColor = Ops::PhaseMask32(x, phase);
+         typename Ops::V32 green = Ops::Load32(gc + x);
+         typename Ops::V32 dW = Ops::Sub32(Ops::Widen(c + x - 1), Ops::Load32(gc + x - 1));
+         typename Ops::V32 dE = Ops::Sub32(Ops::Widen(c + x + 1), Ops::Load32(gc + x + 1));
+         typename Ops::V32 dN = Ops::Sub32(Ops::Widen(n + x), Ops::Load32(gn + x));
+         typename Ops::V32 dS = Ops::Sub32(Ops::Widen(s + x), Ops::Load32(gs + x));
+         typename Ops::V32 dDiag = Ops::Add32(
+               Ops::Add32(Ops::Sub32(Ops::Widen(n + x - 1), Ops::Load32(gn + x - 1)),
+                  Ops::Sub32(Ops::Widen(n + x + 1), Ops::Load32(gn + x + 1))),
+               Ops::Add32(Ops::Sub32(Ops::Widen(s + x - 1), Ops::Load32(gs + x - 1)),
+                  Ops::Sub32(Ops::Widen(s + x + 1), Ops::Load32(gs + x + 1))));
+         typename Ops::V32 sampled = Ops::Select32(atColor,
+               Ops::Add32(green, Ops::Half32(Ops::Add32(dW, dE))),
+               Ops::Widen(c + x));
+         typename Ops::V32 other = Ops::Select32(atColor,
+               Ops::Add32(green, Ops::Half32(Ops::Add32(dN, dS))),
+               Ops::Add32(green, Ops::Quarter32(dDiag)));
+         Ops::StoreClamped16(a + x, sampled, zero, maxValue);
+         Ops::StoreClamped16(g + x, green, zero, maxValue);
+         Ops::StoreClamped16(o + x, other, zero, maxValue);
+      }
+   }
+
+   const Job& job_;
+   const Workspace& ws_;
+   const std::size_t stride_;
+   int rawTag_[RawLines]; // Source row held by each raw line, or -1
+   int greenTag_[GreenLines];
+};
+
+} // namespace DebayerKernels
@@ -29,6 +29,7 @@
 
 #include "MMDevice.h"
 #include "MMDeviceConstants.h"
+#include "BinaryMetadata.h"
 #include "Property.h"
 #include "DeviceUtils.h"
 #include "ModuleInterface.h"
@@ -1031,6 +1032,39 @@ protected:
       return DEVICE_NO_CALLBACK_REGISTERED;
    }
 
+   /**
+   * Sends several commands back-to-back and receives their answers in order,
+   * for controllers that accept a new command before answering the previous
+   * one.
+   * @param portName
+   * @param commands - command strings
+   * @param commandTerm - terminating string sent after each command
+   * @param answerTerm - terminating string of each answer
+   * @param answers - answer strings without the terminating characters
+   */
+   int SendSerialCommands(const char* portName, const std::vector<std::string>& commands,
+         const char* commandTerm, const char* answerTerm, std::vector<std::string>& answers)
+   {
+      if (!callback_)
+         return DEVICE_NO_CALLBACK_REGISTERED;
+
+      const unsigned long MAX_BUFLEN = 2000;
+      std::vector<const char*> commandPtrs;
+      for (size_t i = 0; i < commands.size(); ++i)
+         commandPtrs.push_back(commands[i].c_str());
+      std::vector<char> buf(commands.size() * MAX_BUFLEN + 1);
+      int ret = callback_->SetSerialCommands(this, portName,
+            static_cast<unsigned>(commands.size()),
+            commandPtrs.empty() ? 0 : &commandPtrs[0], commandTerm,
+            MAX_BUFLEN, &buf[0], answerTerm);
+      if (ret != DEVICE_OK)
+         return ret;
+      answers.clear();
+      for (size_t i = 0; i < commands.size(); ++i)
+         answers.push_back(&buf[i * MAX_BUFLEN]);
+      return DEVICE_OK;
+   }
+
    /**
    * Reads the current contents of Rx serial buffer.
    */
@@ -1131,6 +1165,17 @@ protected:
       return DEVICE_NO_CALLBACK_REGISTERED;
    }
 
+   /**
+   * Signals to the core that the device is no longer busy, so that waiting
+   * for it ends without polling. Call once Busy() returns false.
+   */
+   int OnBecameIdle()
+   {
+      if (callback_)
+         return callback_->OnBecameIdle(this);
+      return DEVICE_NO_CALLBACK_REGISTERED;
+   }
+
    /**
    * Gets the system ticks in microseconds.
    * OBSOLETE, use GetCurrentTime()
@@ -1304,7 +1349,11 @@ public:
    virtual unsigned GetImageBytesPerPixel() const = 0;
    virtual int SnapImage() = 0;
 
-   CCameraBase() : busy_(false), stopWhenCBOverflows_(false), thd_(0)
+   CCameraBase() :
+      busy_(false),
+      stopWhenCBOverflows_(false),
+      serializedTags_(metadata_.Serialize()),
+      thd_(0)
    {
       // create and initialize common transpose properties
       std::vector<std::string> allowedValues;
@@ -1414,8 +1463,8 @@ public:
     */
    virtual void GetTags(char* serializedMetadata)
    {
-      std::string data = metadata_.Serialize();
-      data.copy(serializedMetadata, data.size(), 0);
+      // Called by the Core only after the tags change
+      serializedTags_.copy(serializedMetadata, serializedTags_.size(), 0);
    }
 
    // temporary debug methods
@@ -1472,12 +1521,18 @@ public:
    virtual void AddTag(const char* key, const char* deviceLabel, const char* value)
    {
       metadata_.PutTag(key, deviceLabel, value);
+      serializedTags_ = metadata_.Serialize();
+      if (GetCoreCallback())
+         GetCoreCallback()->OnCameraTagsChanged(this);
    }
 
 
    virtual void RemoveTag(const char* key)
    {
       metadata_.RemoveTag(key);
+      serializedTags_ = metadata_.Serialize();
+      if (GetCoreCallback())
+         GetCoreCallback()->OnCameraTagsChanged(this);
    }
 
    virtual bool SupportsMultiROI()
@@ -1545,18 +1600,18 @@ protected:
    {
       char label[MM::MaxStrLength];
       this->GetLabel(label);
-      Metadata md;
-      md.put("Camera", label);
+      BinaryMetadata md;
+      md.PutImageTag("Camera", label);
       int ret = GetCoreCallback()->InsertImage(this, GetImageBuffer(), GetImageWidth(),
-         GetImageHeight(), GetImageBytesPerPixel(),
-         md.Serialize().c_str());
+         GetImageHeight(), GetImageBytesPerPixel(), 1,
+         md.GetRecords(), static_cast<unsigned>(md.GetRecordsSize()));
       if (!stopWhenCBOverflows_ && ret == DEVICE_BUFFER_OVERFLOW)
       {
          // do not stop on overflow - just reset the buffer
          GetCoreCallback()->ClearImageBuffer(this);
          return GetCoreCallback()->InsertImage(this, GetImageBuffer(), GetImageWidth(),
-            GetImageHeight(), GetImageBytesPerPixel(),
-            md.Serialize().c_str());
+            GetImageHeight(), GetImageBytesPerPixel(), 1,
+            md.GetRecords(), static_cast<unsigned>(md.GetRecordsSize()));
       } else
          return ret;
    }
@@ -1713,6 +1768,7 @@ private:
    bool busy_;
    bool stopWhenCBOverflows_;
    Metadata metadata_;
+   std::string serializedTags_; // metadata_, as returned by GetTags()
 
    BaseSequenceThread * thd_;
    friend class BaseSequenceThread;
@@ -79,6 +79,7 @@ public:
 
 class MetadataSingleTag;
 class MetadataArrayTag;
+class BinaryMetadata;
 
 /**
  * Image information tags - metadata.
@@ -482,6 +483,8 @@ public:
    }
 
 private:
+   friend class BinaryMetadata; // Converts directly from tags_
+
    MetadataTag* FindTag(const char* key) const
    {
       TagConstIter it = tags_.find(key);
@@ -27,7 +27,7 @@
 // Header version
 // If any of the class definitions changes, the interface version
 // must be incremented
-#define DEVICE_INTERFACE_VERSION 71
+#define DEVICE_INTERFACE_VERSION 78
 ///////////////////////////////////////////////////////////////////////////////
 
 
@@ -526,7 +526,8 @@ namespace MM {
       /**
        * Get the metadata tags stored in this device.
        * These tags will automatically be add to the metadata of an image inserted
-       * into the circular buffer
+       * into the circular buffer. The Core keeps its own parsed copy and only
+       * calls this again after Core::OnCameraTagsChanged().
        *
        */
       virtual void GetTags(char* serializedMetadata) = 0;
@@ -537,6 +538,7 @@ namespace MM {
        * Use this mechanism for tags that do not change often.  For metadata that
        * change often, create an instance of metadata yourself and add to one of
        * the versions of the InsertImage function
+       * Implementations must call Core::OnCameraTagsChanged() afterwards.
        */
       virtual void AddTag(const char* key, const char* deviceLabel, const char* value) = 0;
 
@@ -544,6 +546,7 @@ namespace MM {
        * Removes an existing tag from the metadata associated with this device
        * These tags will automatically be add to the metadata of an image inserted
        * into the circular buffer
+       * Implementations must call Core::OnCameraTagsChanged() afterwards.
        */
       virtual void RemoveTag(const char* key) = 0;
 
@@ -1231,6 +1234,12 @@ namespace MM {
       virtual Device* GetInstalledDevice(int devIdx) = 0;
    };
 
+   /**
+    * Called by the Core when it has finished reading an image buffer passed
+    * to Core::InsertImageAsync().
+    */
+   typedef void (*ImageReleaseCallback)(void* context, const unsigned char* buf);
+
    /**
     * Callback API to the core control module.
     * Devices use this abstract interface to use Core services
@@ -1270,6 +1279,20 @@ namespace MM {
       virtual int ReadFromSerial(const Device* caller, const char* port, unsigned char* buf, unsigned long length, unsigned long& read) = 0;
       virtual int PurgeSerial(const Device* caller, const char* portName) = 0;
       virtual MM::PortType GetSerialPortType(const char* portName) const = 0;
+      /// Send several commands and collect their answers in one exchange.
+      /**
+       * Writes all commands back-to-back, each followed by commandTerm,
+       * without waiting for answers in between; then receives one answer
+       * per command, in order, each terminated by answerTerm. Only for
+       * controllers that accept a new command before answering the previous
+       * one; the round trip then costs about as much as a single query.
+       *
+       * Answer i (without the terminator, null-terminated) is written to
+       * answers + i * ansLength, so answers must hold numCommands * ansLength
+       * characters. If any answer fails, an error is returned and the port
+       * is purged of the remaining answers.
+       */
+      virtual int SetSerialCommands(const Device* caller, const char* portName, unsigned numCommands, const char* const* commands, const char* commandTerm, unsigned long ansLength, char* answers, const char* answerTerm) = 0;
 
       virtual int OnPropertiesChanged(const Device* caller) = 0;
       /**
@@ -1300,6 +1323,18 @@ namespace MM {
        * Magnifiers can use this to signal changes in magnification
        */
       virtual int OnMagnifierChanged(const Device* caller) = 0;
+      /**
+       * Devices that learn when they stop being busy (e.g. from a
+       * move-finished message) can call this once Busy() returns false, so
+       * that the Core stops waiting for them right away instead of at its
+       * next poll. Optional: devices that never call it are polled.
+       */
+      virtual int OnBecameIdle(const Device* caller) = 0;
+      /**
+       * Cameras call this after their tags (see Camera::AddTag()) change,
+       * so that the Core reads them again before the next image.
+       */
+      virtual int OnCameraTagsChanged(const Device* caller) = 0;
 
       // Deprecated: Return value overflows in ~72 minutes on Windows.
       // Prefer std::chrono::steady_clock for time delta measurements.
@@ -1316,6 +1351,49 @@ namespace MM {
       virtual int InsertImage(const Device* caller, const ImgBuffer& buf) = 0;
       virtual int InsertImage(const Device* caller, const unsigned char* buf, unsigned width, unsigned height, unsigned byteDepth, unsigned nComponents, const char* serializedMetadata, const bool doProcess = true) = 0;
       virtual int InsertImage(const Device* caller, const unsigned char* buf, unsigned width, unsigned height, unsigned byteDepth, const Metadata* md = 0, const bool doProcess = true) = 0;
+      /// Insert an image with metadata in binary form.
+      /**
+       * metadataRecords and metadataSize are the values returned by
+       * GetRecords() and GetRecordsSize() of a BinaryMetadata. Unlike the
+       * serialized forms, this does not format or parse the metadata as
+       * text. Returns DEVICE_INVALID_INPUT_PARAM if the records are
+       * malformed.
+       */
+      virtual int InsertImage(const Device* caller, const unsigned char* buf, unsigned width, unsigned height, unsigned byteDepth, unsigned nComponents, const unsigned char* metadataRecords, unsigned metadataSize, const bool doProcess = true) = 0;
+      /// Insert an image without waiting for it to be copied.
+      /**
+       * Like InsertImage() with binary metadata, but when the Core's insert
+       * queue is enabled, only queues the image and returns, so that the
+       * camera can go on reading out the next frame. Images are inserted in
+       * the order they were queued; if the queue is full, waits until there
+       * is room.
+       *
+       * If DEVICE_OK is returned, the Core calls release(releaseContext, buf)
+       * exactly once, from any thread, when it no longer needs buf; until
+       * then, the camera must not modify or free it. (Without the queue, this
+       * happens before returning.) If an error is returned, the image was not
+       * inserted and release is not called.
+       *
+       * A failure to insert a queued image is returned by the camera's next
+       * call to this function or to FlushImageInserts() (and that image is
+       * dropped), so DEVICE_BUFFER_OVERFLOW can be handled as with
+       * InsertImage().
+       */
+      virtual int InsertImageAsync(const Device* caller, const unsigned char* buf, unsigned width, unsigned height, unsigned byteDepth, unsigned nComponents, const unsigned char* metadataRecords, unsigned metadataSize, ImageReleaseCallback release, void* releaseContext) = 0;
+      /// Wait until all images queued by InsertImageAsync() have been inserted.
+      /**
+       * Returns the first error in inserting the camera's queued images, if
+       * any. The Core also does this when the camera calls AcqFinished().
+       */
+      virtual int FlushImageInserts(const Device* caller) = 0;
+      /// Whether InsertImageAsync() queues images rather than inserting them before returning.
+      /**
+       * Does not change while a sequence acquisition is running. Without the
+       * queue, an image that failed to be inserted (e.g. with
+       * DEVICE_BUFFER_OVERFLOW) has already been through the image
+       * processor, so a retry should use InsertImage() with doProcess false.
+       */
+      virtual bool IsImageInsertQueueEnabled() = 0;
       /// \deprecated Use the other forms instead.
       virtual int InsertImage(const Device* caller, const unsigned char* buf, unsigned width, unsigned height, unsigned byteDepth, const char* serializedMetadata, const bool doProcess = true) = 0;
       virtual void ClearImageBuffer(const Device* caller) = 0;
@@ -1323,6 +1401,34 @@ namespace MM {
       /// \deprecated Use the other forms instead.
       virtual int InsertMultiChannel(const Device* caller, const unsigned char* buf, unsigned numChannels, unsigned width, unsigned height, unsigned byteDepth, Metadata* md = 0) = 0;
 
+      /// Reserve the next sequence buffer slot for in-place writing.
+      /**
+       * Allows a camera to decode or DMA an image directly into the Core's
+       * sequence buffer, avoiding the copy made by InsertImage(). On success,
+       * pixels is set to width * height * byteDepth bytes of writable
+       * storage for a single-channel image.
+       *
+       * Returns DEVICE_BUFFER_OVERFLOW if the buffer is full and
+       * DEVICE_INCOMPATIBLE_IMAGE if the dimensions do not match those the
+       * buffer was initialized with.
+       *
+       * A successful call must be followed, on the same thread, by
+       * CommitImageWriteSlot() or AbandonImageWriteSlot(). Other inserts
+       * into the sequence buffer wait until then, so the camera should
+       * only write the image while holding the slot.
+       */
+      virtual int AcquireImageWriteSlot(const Device* caller, unsigned width, unsigned height, unsigned byteDepth, unsigned char** pixels) = 0;
+      /// Make the image written into the reserved slot available.
+      /**
+       * pixels must be the pointer returned by AcquireImageWriteSlot(). The
+       * metadata and image processing are handled as in InsertImage().
+       */
+      virtual int CommitImageWriteSlot(const Device* caller, unsigned char* pixels, unsigned nComponents, const char* serializedMetadata, const bool doProcess = true) = 0;
+      /// As above, with metadata in binary form (see InsertImage()).
+      virtual int CommitImageWriteSlot(const Device* caller, unsigned char* pixels, unsigned nComponents, const unsigned char* metadataRecords, unsigned metadataSize, const bool doProcess = true) = 0;
+      /// Release the reserved slot without inserting an image.
+      virtual int AbandonImageWriteSlot(const Device* caller) = 0;
+
       // autofocus
       // TODO This interface needs improvement: the caller pointer should be
       // passed, and it should be clarified whether the use of these methods is
@@ -0,0 +1,175 @@
+// Debayer throughput benchmark.
+//
+// Demosaics 12-bit and 8-bit mosaics at 5 MP (2592 x 1944) and 20 MP
+// (5472 x 3648) into RGB32 with a copy of the replication code that Debayer
+// used before (three full-size color planes, then a packing pass), and with
+// each current algorithm: scalar single-threaded, SIMD single-threaded, and
+// SIMD on all cores. Reports the median time per frame in milliseconds and
+// the throughput in megapixels per second.
+//
+// Usage: Debayer-Bench [iterations]
+
+#include "Debayer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <random>
+#include <thread>
+#include <vector>
+
+
+namespace {
+
+// The replication algorithm before vectorization (orders 0 and 1)
+template <typename T>
+void LegacyReplicate(const T* input, int* output, int width, int height,
+      int bitDepth, std::vector<unsigned short>& r,
+      std::vector<unsigned short>& g, std::vector<unsigned short>& b)
+{
+   const unsigned numPixels(width * height);
+   if (r.size() != numPixels)
+   {
+      r.resize(numPixels);
+      g.resize(numPixels);
+      b.resize(numPixels);
+   }
+   auto get = [&](int x, int y) -> unsigned short {
+      if (x >= width || x < 0 || y >= height || y < 0)
+         return 0;
+      return input[y * width + x];
+   };
+   auto set = [&](std::vector<unsigned short>& v, unsigned short val, int x, int y) {
+      if (x < width && x >= 0 && y < height && y >= 0)
+         v[y * width + x] = val;
+   };
+   const int bitShift = bitDepth - 8;
+   for (int y = 0; y < height; y += 2)
+      for (int x = 0; x < width; x += 2)
+      {
+         unsigned short one = get(x, y);
+         set(b, one, x, y); set(b, one, x + 1, y);
+         set(b, one, x, y + 1); set(b, one, x + 1, y + 1);
+      }
+   for (int y = 1; y < height; y += 2)
+      for (int x = 1; x < width; x += 2)
+      {
+         unsigned short one = get(x, y);
+         set(r, one, x, y); set(r, one, x + 1, y);
+         set(r, one, x, y + 1); set(r, one, x + 1, y + 1);
+      }
+   for (int y = 0; y < height; y += 2)
+      for (int x = 1; x < width; x += 2)
+      {
+         unsigned short one = get(x, y);
+         set(g, one, x, y); set(g, one, x + 1, y);
+      }
+   for (int y = 1; y < height; y += 2)
+      for (int x = 0; x < width; x += 2)
+      {
+         unsigned short one = get(x, y);
+         set(g, one, x, y); set(g, one, x + 1, y);
+      }
+   for (int i = 0; i < height * width; i++)
+   {
+      output[i] = 0;
+      unsigned char* bytePix = (unsigned char*)(output + i);
+      *bytePix = (unsigned char)(r[i] >> bitShift);
+      *(bytePix + 1) = (unsigned char)(g[i] >> bitShift);
+      *(bytePix + 2) = (unsigned char)(b[i] >> bitShift);
+   }
+}
+
+double MedianMs(int iterations, const std::function<void()>& f)
+{
+   f(); // Warm up (allocation, page faults)
+   std::vector<double> times;
+   for (int i = 0; i < iterations; ++i)
+   {
+      auto start = std::chrono::steady_clock::now();
+      f();
+      auto end = std::chrono::steady_clock::now();
+      times.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+   }
+   std::sort(times.begin(), times.end());
+   return times[times.size() / 2];
+}
+
+void Report(const char* label, double ms, double megapixels)
+{
+   std::printf("  %-40s %9.2f ms %9.1f MP/s\n", label, ms, megapixels * 1000.0 / ms);
+}
+
+template <typename T>
+void RunSize(int width, int height, int bitDepth, int iterations)
+{
+   std::mt19937 rng(42);
+   std::uniform_int_distribution<int> dist(0, (1 << bitDepth) - 1);
+   std::vector<T> in(static_cast<size_t>(width) * height);
+   for (auto& p : in)
+      p = static_cast<T>(dist(rng));
+   const double megapixels = width * static_cast<double>(height) / 1e6;
+
+   std::printf("%d x %d, %d-bit:\n", width, height, bitDepth);
+
+   std::vector<int> legacyOut(in.size());
+   std::vector<unsigned short> r, g, b;
+   Report("Replication (original)", MedianMs(iterations, [&] {
+      LegacyReplicate(in.data(), legacyOut.data(), width, height, bitDepth, r, g, b);
+   }), megapixels);
+
+   const unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+   const char* names[] = { "Replication", "Bilinear", "", "Adaptive-Smooth-Hue" };
+   for (int algorithm : { 0, 1, 3 })
+   {
+      Debayer debayer;
+      debayer.SetAlgorithmIndex(algorithm);
+      ImgBuffer out;
+      char label[64];
+
+      debayer.SetSIMDEnabled(false);
+      debayer.SetThreadCount(1);
+      std::snprintf(label, sizeof(label), "%s (scalar, 1 thread)", names[algorithm]);
+      Report(label, MedianMs(iterations, [&] {
+         debayer.Process(out, in.data(), width, height, bitDepth);
+      }), megapixels);
+
+      debayer.SetSIMDEnabled(true);
+      std::snprintf(label, sizeof(label), "%s (%s, 1 thread)", names[algorithm],
+            debayer.GetInstructionSet());
+      Report(label, MedianMs(iterations, [&] {
+         debayer.Process(out, in.data(), width, height, bitDepth);
+      }), megapixels);
+
+      if (cores > 1)
+      {
+         debayer.SetThreadCount(cores);
+         std::snprintf(label, sizeof(label), "%s (%s, %u threads)", names[algorithm],
+               debayer.GetInstructionSet(), cores);
+         Report(label, MedianMs(iterations, [&] {
+            debayer.Process(out, in.data(), width, height, bitDepth);
+         }), megapixels);
+      }
+   }
+}
+
+} // anonymous namespace
+
+
+int main(int argc, char** argv)
+{
+   const int iterations = argc > 1 ? std::atoi(argv[1]) : 10;
+   if (iterations < 1)
+   {
+      std::fprintf(stderr, "Usage: Debayer-Bench [iterations]\n");
+      return 1;
+   }
+
+   RunSize<unsigned short>(2592, 1944, 12, iterations);
+   RunSize<unsigned char>(2592, 1944, 8, iterations);
+   RunSize<unsigned short>(5472, 3648, 12, iterations);
+   RunSize<unsigned char>(5472, 3648, 8, iterations);
+   return 0;
+}
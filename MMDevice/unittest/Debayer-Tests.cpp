@@ -0,0 +1,244 @@
+#include <gtest/gtest.h>
+
+#include "Debayer.h"
+
+#include <cstring>
+#include <random>
+#include <vector>
+
+
+namespace {
+
+// The replication algorithm as originally implemented (with the r, g, b
+// planes zero-initialized), for comparison
+template <typename T>
+std::vector<unsigned> LegacyReplicate(const T* input, int width, int height,
+      int bitDepth, int rowOrder)
+{
+   std::vector<unsigned short> r(width * height), g(width * height), b(width * height);
+   auto get = [&](int x, int y) -> unsigned short {
+      if (x >= width || x < 0 || y >= height || y < 0)
+         return 0;
+      return input[y * width + x];
+   };
+   auto set = [&](std::vector<unsigned short>& v, unsigned short val, int x, int y) {
+      if (x < width && x >= 0 && y < height && y >= 0)
+         v[y * width + x] = val;
+   };
+   auto fill4 = [&](std::vector<unsigned short>& v, int x0, int y0) {
+      for (int y = y0; y < height; y += 2)
+         for (int x = x0; x < width; x += 2)
+         {
+            unsigned short one = get(x, y);
+            set(v, one, x, y); set(v, one, x + 1, y);
+            set(v, one, x, y + 1); set(v, one, x + 1, y + 1);
+         }
+   };
+   auto fill2 = [&](std::vector<unsigned short>& v, int x0, int y0) {
+      for (int y = y0; y < height; y += 2)
+         for (int x = x0; x < width; x += 2)
+         {
+            unsigned short one = get(x, y);
+            set(v, one, x, y); set(v, one, x + 1, y);
+         }
+   };
+   if (rowOrder == 0 || rowOrder == 1)
+   {
+      fill4(b, 0, 0);
+      fill4(r, 1, 1);
+      fill2(g, 1, 0);
+      fill2(g, 0, 1);
+   }
+   else
+   {
+      fill4(b, 0, 1);
+      fill4(r, 1, 0);
+      fill2(g, 0, 0);
+      fill2(g, 1, 1);
+   }
+   // Byte 0 comes from r for orders 0 and 2, from b for orders 1 and 3
+   const bool swap = rowOrder == 0 || rowOrder == 2;
+   const int shift = bitDepth - 8;
+   std::vector<unsigned> out(width * height);
+   for (int i = 0; i < width * height; ++i)
+   {
+      unsigned byte0 = (swap ? r[i] : b[i]) >> shift;
+      unsigned byte2 = (swap ? b[i] : r[i]) >> shift;
+      out[i] = (byte0 & 0xff) | ((g[i] >> shift & 0xff) << 8) | ((byte2 & 0xff) << 16);
+   }
+   return out;
+}
+
+template <typename T>
+std::vector<T> RandomMosaic(int width, int height, int bitDepth, unsigned seed)
+{
+   std::mt19937 rng(seed);
+   std::uniform_int_distribution<int> dist(0, (1 << bitDepth) - 1);
+   std::vector<T> pixels(width * height);
+   for (auto& p : pixels)
+      p = static_cast<T>(dist(rng));
+   return pixels;
+}
+
+template <typename T>
+std::vector<unsigned char> Demosaic(Debayer& debayer, const std::vector<T>& in,
+      int width, int height, int bitDepth)
+{
+   ImgBuffer out;
+   EXPECT_EQ(DEVICE_OK, debayer.Process(out, in.data(), width, height, bitDepth));
+   EXPECT_EQ(static_cast<unsigned>(width), out.Width());
+   EXPECT_EQ(static_cast<unsigned>(height), out.Height());
+   EXPECT_EQ(static_cast<unsigned>(debayer.GetOutputDepth()), out.Depth());
+   const unsigned char* p = out.GetPixels();
+   return std::vector<unsigned char>(p, p + width * height * out.Depth());
+}
+
+} // anonymous namespace
+
+
+TEST(DebayerTests, ReplicationMatchesOriginal)
+{
+   const int width = 67, height = 41;
+   const auto in8 = RandomMosaic<unsigned char>(width, height, 8, 1);
+   const auto in16 = RandomMosaic<unsigned short>(width, height, 12, 2);
+   for (int order = 0; order < 4; ++order)
+   {
+      Debayer debayer;
+      debayer.SetOrderIndex(order);
+      const auto out8 = Demosaic(debayer, in8, width, height, 8);
+      const auto out16 = Demosaic(debayer, in16, width, height, 12);
+      const auto legacy8 = LegacyReplicate(in8.data(), width, height, 8, order);
+      const auto legacy16 = LegacyReplicate(in16.data(), width, height, 12, order);
+      // The original left the first row and column partly unset
+      for (int y = 1; y < height; ++y)
+      {
+         for (int x = 1; x < width; ++x)
+         {
+            const int i = y * width + x;
+            unsigned v8, v16;
+            std::memcpy(&v8, &out8[4 * i], 4);
+            std::memcpy(&v16, &out16[4 * i], 4);
+            ASSERT_EQ(legacy8[i], v8) << "order " << order << " at " << x << "," << y;
+            ASSERT_EQ(legacy16[i], v16) << "order " << order << " at " << x << "," << y;
+         }
+      }
+   }
+}
+
+TEST(DebayerTests, SIMDMatchesScalar)
+{
+   const int sizes[][2] = { { 1, 1 }, { 2, 3 }, { 5, 4 }, { 37, 29 }, { 640, 9 } };
+   const int algorithms[] = { 0, 1, 3 };
+   for (const auto& size : sizes)
+   {
+      const int width = size[0], height = size[1];
+      const auto in8 = RandomMosaic<unsigned char>(width, height, 8, 3);
+      const auto in16 = RandomMosaic<unsigned short>(width, height, 14, 4);
+      for (int algorithm : algorithms)
+      {
+         for (int order = 0; order < 4; ++order)
+         {
+            for (int depth : { 4, 8 })
+            {
+               Debayer simd, scalar;
+               scalar.SetSIMDEnabled(false);
+               for (Debayer* d : { &simd, &scalar })
+               {
+                  d->SetOrderIndex(order);
+                  d->SetAlgorithmIndex(algorithm);
+                  ASSERT_EQ(DEVICE_OK, d->SetOutputDepth(depth));
+               }
+               ASSERT_EQ(Demosaic(scalar, in8, width, height, 8), Demosaic(simd, in8, width, height, 8))
+                  << simd.GetInstructionSet() << " algorithm " << algorithm << " order " << order
+                  << " size " << width << "x" << height;
+               ASSERT_EQ(Demosaic(scalar, in16, width, height, 14), Demosaic(simd, in16, width, height, 14))
+                  << simd.GetInstructionSet() << " algorithm " << algorithm << " order " << order
+                  << " size " << width << "x" << height;
+            }
+         }
+      }
+   }
+}
+
+TEST(DebayerTests, ThreadCountDoesNotChangeResult)
+{
+   const int width = 1030, height = 771;
+   const auto in = RandomMosaic<unsigned short>(width, height, 16, 5);
+   for (int algorithm : { 0, 1, 3 })
+   {
+      Debayer single, multi;
+      single.SetThreadCount(1);
+      multi.SetThreadCount(4);
+      single.SetAlgorithmIndex(algorithm);
+      multi.SetAlgorithmIndex(algorithm);
+      ASSERT_EQ(Demosaic(single, in, width, height, 16), Demosaic(multi, in, width, height, 16))
+         << "algorithm " << algorithm;
+   }
+}
+
+TEST(DebayerTests, UniformImageStaysUniform)
+{
+   const int width = 20, height = 14;
+   const std::vector<unsigned short> in(width * height, 1000);
+   for (int algorithm : { 0, 1, 3 })
+   {
+      Debayer debayer;
+      debayer.SetAlgorithmIndex(algorithm);
+      ASSERT_EQ(DEVICE_OK, debayer.SetOutputDepth(8));
+      const auto out = Demosaic(debayer, in, width, height, 12);
+      for (int i = 0; i < width * height; ++i)
+      {
+         unsigned short px[4];
+         std::memcpy(px, &out[8 * i], 8);
+         ASSERT_EQ(1000, px[0]);
+         ASSERT_EQ(1000, px[1]);
+         ASSERT_EQ(1000, px[2]);
+         ASSERT_EQ(0, px[3]);
+      }
+   }
+}
+
+TEST(DebayerTests, RGB64IsUnshiftedRGB32)
+{
+   const int width = 33, height = 18;
+   const auto in = RandomMosaic<unsigned short>(width, height, 12, 6);
+   for (int algorithm : { 0, 1, 3 })
+   {
+      Debayer rgb32, rgb64;
+      rgb32.SetAlgorithmIndex(algorithm);
+      rgb64.SetAlgorithmIndex(algorithm);
+      ASSERT_EQ(DEVICE_OK, rgb64.SetOutputDepth(8));
+      const auto out32 = Demosaic(rgb32, in, width, height, 12);
+      const auto out64 = Demosaic(rgb64, in, width, height, 12);
+      for (int i = 0; i < width * height * 4; ++i)
+      {
+         unsigned short v;
+         std::memcpy(&v, &out64[2 * i], 2);
+         ASSERT_EQ(out32[i], v >> 4);
+      }
+   }
+}
+
+TEST(DebayerTests, InvalidSettings)
+{
+   Debayer debayer;
+   EXPECT_EQ(DEVICE_INVALID_INPUT_PARAM, debayer.SetOutputDepth(6));
+   EXPECT_EQ(4, debayer.GetOutputDepth());
+
+   const std::vector<unsigned char> in(16, 0);
+   ImgBuffer out;
+   debayer.SetAlgorithmIndex(2);
+   ASSERT_EQ(DEVICE_OK, debayer.SetOutputDepth(8));
+   EXPECT_EQ(DEVICE_NOT_SUPPORTED, debayer.Process(out, in.data(), 4, 4, 8));
+   debayer.SetAlgorithmIndex(4);
+   EXPECT_EQ(DEVICE_NOT_SUPPORTED, debayer.Process(out, in.data(), 4, 4, 8));
+   debayer.SetAlgorithmIndex(0);
+   debayer.SetOrderIndex(4);
+   EXPECT_EQ(DEVICE_INVALID_INPUT_PARAM, debayer.Process(out, in.data(), 4, 4, 8));
+}
+
+int main(int argc, char **argv)
+{
+   ::testing::InitGoogleTest(&argc, argv);
+   return RUN_ALL_TESTS();
+}